@@ -0,0 +1,169 @@
+/*
+ * keonOS - drivers/acpi.cpp
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#include <drivers/acpi.h>
+#include <kernel/arch/x86_64/paging.h>
+#include <kernel/constants.h>
+#include <mm/vmm.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * Just enough ACPI to find the processors: RSDP, then the RSDT or XSDT,
+ * then the MADT. Tables are read in place through the direct map when
+ * they sit below its end and through ioremap otherwise.
+ */
+static acpi_cpu_info cpu_info;
+static bool cpu_info_valid = false;
+
+static bool acpi_checksum(const void* data, size_t length)
+{
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; i++) sum += ((const uint8_t*)data)[i];
+    return sum == 0;
+}
+
+static void* acpi_map(uintptr_t phys, size_t size)
+{
+    if (phys + size <= KERNEL_DIRECT_MAP_SIZE) return phys_to_virt(phys);
+    return ioremap(phys, size);
+}
+
+static void acpi_unmap(void* virt, uintptr_t phys, size_t size)
+{
+    if (phys + size > KERNEL_DIRECT_MAP_SIZE) iounmap(virt);
+}
+
+// Maps a whole table once its header has given the length
+static acpi_sdt_header* acpi_map_table(uintptr_t phys)
+{
+    acpi_sdt_header* header = (acpi_sdt_header*)acpi_map(phys, sizeof(acpi_sdt_header));
+    if (!header) return nullptr;
+
+    uint32_t length = header->length;
+    acpi_unmap(header, phys, sizeof(acpi_sdt_header));
+    if (length < sizeof(acpi_sdt_header)) return nullptr;
+
+    header = (acpi_sdt_header*)acpi_map(phys, length);
+    if (header && !acpi_checksum(header, length))
+    {
+        acpi_unmap(header, phys, length);
+        return nullptr;
+    }
+    return header;
+}
+
+static acpi_rsdp* acpi_scan_rsdp(uintptr_t start, size_t length)
+{
+    for (uintptr_t p = start; p + sizeof(acpi_rsdp) <= start + length; p += 16)
+    {
+        acpi_rsdp* rsdp = (acpi_rsdp*)phys_to_virt(p);
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && acpi_checksum(rsdp, 20)) return rsdp;
+    }
+    return nullptr;
+}
+
+// Without a copy from the loader, look in the first KiB of the EBDA and then the BIOS area
+static acpi_rsdp* acpi_find_rsdp()
+{
+    uintptr_t ebda = (uintptr_t)(*(uint16_t*)phys_to_virt(0x40E)) << 4;
+    acpi_rsdp* rsdp = ebda ? acpi_scan_rsdp(ebda, 1024) : nullptr;
+    if (!rsdp) rsdp = acpi_scan_rsdp(0xE0000, 0x20000);
+    return rsdp;
+}
+
+static void acpi_parse_madt(acpi_madt* madt)
+{
+    cpu_info.lapic_phys = madt->lapic_address;
+    cpu_info.cpu_count = 0;
+
+    uint8_t* entry = madt->entries;
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+    while (entry + sizeof(acpi_madt_entry) <= end)
+    {
+        acpi_madt_entry* header = (acpi_madt_entry*)entry;
+        if (header->length < sizeof(acpi_madt_entry)) break;
+
+        if (header->type == ACPI_MADT_LAPIC)
+        {
+            acpi_madt_lapic* lapic = (acpi_madt_lapic*)entry;
+            if ((lapic->flags & 1) && cpu_info.cpu_count < MAX_CPUS)
+                cpu_info.apic_ids[cpu_info.cpu_count++] = lapic->apic_id;
+        }
+        else if (header->type == ACPI_MADT_LAPIC_OVERRIDE)
+            cpu_info.lapic_phys = ((acpi_madt_lapic_override*)entry)->address;
+
+        entry += header->length;
+    }
+}
+
+// 'rsdp_copy' is the loader's copy of the RSDP, or nullptr to search for it
+bool acpi_init(void* rsdp_copy)
+{
+    acpi_rsdp* rsdp = rsdp_copy ? (acpi_rsdp*)rsdp_copy : acpi_find_rsdp();
+    if (!rsdp || memcmp(rsdp->signature, "RSD PTR ", 8) != 0)
+    {
+        printf("[ACPI] No RSDP found\n");
+        return false;
+    }
+
+    // ACPI 2.0 and later list 64-bit table addresses in the XSDT
+    bool xsdt = rsdp->revision >= 2 && rsdp->xsdt_address;
+    uintptr_t root_phys = xsdt ? rsdp->xsdt_address : rsdp->rsdt_address;
+    acpi_sdt_header* root = acpi_map_table(root_phys);
+    if (!root)
+    {
+        printf("[ACPI] Bad %s at 0x%lx\n", xsdt ? "XSDT" : "RSDT", root_phys);
+        return false;
+    }
+
+    size_t width = xsdt ? 8 : 4;
+    size_t count = (root->length - sizeof(acpi_sdt_header)) / width;
+    uint8_t* pointers = (uint8_t*)root + sizeof(acpi_sdt_header);
+    for (size_t i = 0; i < count && !cpu_info_valid; i++)
+    {
+        uintptr_t phys = 0;
+        memcpy(&phys, pointers + i * width, width);
+
+        acpi_sdt_header* table = acpi_map_table(phys);
+        if (!table) continue;
+        if (memcmp(table->signature, "APIC", 4) == 0)
+        {
+            acpi_parse_madt((acpi_madt*)table);
+            cpu_info_valid = cpu_info.cpu_count > 0;
+        }
+        acpi_unmap(table, phys, table->length);
+    }
+    acpi_unmap(root, root_phys, root->length);
+
+    if (!cpu_info_valid)
+    {
+        printf("[ACPI] No MADT\n");
+        return false;
+    }
+
+    printf("[ACPI] MADT lists %u CPU(s), local APIC at 0x%lx\n", cpu_info.cpu_count, cpu_info.lapic_phys);
+    return true;
+}
+
+const acpi_cpu_info* acpi_get_cpus()
+{
+    return cpu_info_valid ? &cpu_info : nullptr;
+}
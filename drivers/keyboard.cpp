@@ -19,6 +19,7 @@
  */
 
 #include <kernel/arch/x86_64/thread.h>
+#include <kernel/wait_queue.h>
 #include <drivers/keyboard.h>
 #include <stdint.h>
 
@@ -45,6 +46,8 @@ static const char scancode_to_ascii[] =
 static char keyboard_buffer[KEYBOARD_BUFFER_SIZE];
 static volatile int buffer_read_pos = 0;
 static volatile int buffer_write_pos = 0;
+static spinlock_t keyboard_lock = {0, 0};   // Guards the ring against other CPUs and the IRQ
+static wait_queue_t keyboard_wait;
 
 
 bool keyboard_init() 
@@ -95,25 +98,42 @@ bool keyboard_has_input()
 }
 
 
+static bool keyboard_input_ready(void*)
+{
+    return keyboard_has_input();
+}
+
+wait_queue_t* keyboard_wait_queue()
+{
+    return &keyboard_wait;
+}
+
+
 char keyboard_peek() 
 {
-    if (!keyboard_has_input()) return 0;
-    return keyboard_buffer[buffer_read_pos];
+    spin_lock_irqsave(&keyboard_lock);
+    char c = keyboard_has_input() ? keyboard_buffer[buffer_read_pos] : 0;
+    spin_unlock_irqrestore(&keyboard_lock);
+    return c;
 }
 
 
 char keyboard_getchar() 
 {    
-    while (!keyboard_has_input())
+    // Another CPU may take the key first, so check again under the lock
+    for (;;)
     {
-        thread_get_current()->state = THREAD_BLOCKED;
-        yield();
+        spin_lock_irqsave(&keyboard_lock);
+        if (keyboard_has_input())
+        {
+            char c = keyboard_buffer[buffer_read_pos];
+            buffer_read_pos = (buffer_read_pos + 1) % KEYBOARD_BUFFER_SIZE;
+            spin_unlock_irqrestore(&keyboard_lock);
+            return c;
+        }
+        spin_unlock_irqrestore(&keyboard_lock);
+        wait_queue_wait(&keyboard_wait, keyboard_input_ready, nullptr, WAIT_FOREVER);
     }
-    asm volatile("cli");
-    char c = keyboard_buffer[buffer_read_pos];
-    buffer_read_pos = (buffer_read_pos + 1) % KEYBOARD_BUFFER_SIZE;
-    asm volatile("sti");
-    return c;
 }
 
 
@@ -178,8 +198,10 @@ extern "C" void keyboard_handler()
 
     if (ascii != 0)
     {
+        spin_lock_irqsave(&keyboard_lock);
         keyboard_buffer[buffer_write_pos] = ascii;
         buffer_write_pos = (buffer_write_pos + 1) % KEYBOARD_BUFFER_SIZE;
-        thread_wakeup_blocked();
+        spin_unlock_irqrestore(&keyboard_lock);
+        wait_queue_wake_one(&keyboard_wait);
     }
 }
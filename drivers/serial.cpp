@@ -19,11 +19,19 @@
  */
 
 
+#include <kernel/arch/x86_64/thread.h>
 #include <kernel/arch/x86_64/idt.h>
 #include <kernel/constants.h>
 #include <drivers/serial.h>
+#include <kernel/wait_queue.h>
 
 
+static char serial_buffer[SERIAL_BUFFER_SIZE];
+static volatile int serial_read_pos = 0;
+static volatile int serial_write_pos = 0;
+static spinlock_t serial_lock = {0, 0};     // Guards the ring against other CPUs and the IRQ
+static wait_queue_t serial_wait;
+
 void serial_install() 
 {
     outb(COM1 + 1, 0x00);
@@ -33,6 +41,7 @@ void serial_install()
     outb(COM1 + 3, 0x03);
     outb(COM1 + 2, 0xC7);
     outb(COM1 + 4, 0x0B);
+    outb(COM1 + 1, 0x01);   // IRQ 4 when data arrives
 }
 
 int is_transmit_empty() 
@@ -40,9 +49,10 @@ int is_transmit_empty()
     return inb(COM1 + 5) & 0x20;
 }
 
+// Received bytes are buffered by the IRQ; the UART itself is checked in case it hasn't run yet
 int serial_received() 
 {
-   return inb(COM1 + 5) & 1;
+   return serial_read_pos != serial_write_pos || (inb(COM1 + 5) & 1);
 }
 
 char read_serial() 
@@ -53,8 +63,40 @@ char read_serial()
 
 char serial_getc()
 {
-    if (serial_received()) return inb(COM1);
-    return 0;
+    char c = 0;
+    spin_lock_irqsave(&serial_lock);
+    if (serial_read_pos != serial_write_pos)
+    {
+        c = serial_buffer[serial_read_pos];
+        serial_read_pos = (serial_read_pos + 1) % SERIAL_BUFFER_SIZE;
+    }
+    else if (inb(COM1 + 5) & 1)
+        c = inb(COM1);
+    spin_unlock_irqrestore(&serial_lock);
+    return c;
+}
+
+wait_queue_t* serial_wait_queue()
+{
+    return &serial_wait;
+}
+
+extern "C" void serial_handler()
+{
+    bool received = false;
+    spin_lock_irqsave(&serial_lock);
+    while (inb(COM1 + 5) & 1)
+    {
+        char c = inb(COM1);
+        int next = (serial_write_pos + 1) % SERIAL_BUFFER_SIZE;
+        if (next == serial_read_pos) continue;  // Full: drop the byte
+
+        serial_buffer[serial_write_pos] = c;
+        serial_write_pos = next;
+        received = true;
+    }
+    spin_unlock_irqrestore(&serial_lock);
+    if (received) wait_queue_wake_one(&serial_wait);
 }
 
 void write_serial(char a) 
@@ -20,13 +20,127 @@
 
 
 #include <kernel/arch/x86_64/thread.h>
+#include <kernel/arch/x86_64/cpu.h>
 #include <kernel/arch/x86_64/idt.h>
 #include <drivers/timer.h>
 #include <stdio.h>
 
-static volatile uint32_t timer_ticks = 0;
+static volatile uint64_t timer_ticks = 0;
 static volatile uint32_t timer_hz = 0;
 
+/*
+ * Hierarchical timer wheel. The root level has one slot per tick for the
+ * next 2^TIMER_WHEEL_ROOT_BITS ticks; each outer level has slots that span
+ * a whole turn of the level below. Adding and cancelling a timer is O(1).
+ * Each tick empties one root slot, and whenever the root wraps the next
+ * slot of the level above is cascaded down, so a timer is moved at most
+ * once per level before it fires.
+ */
+#define WHEEL_ROOT_SIZE   (1U << TIMER_WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE  (1U << TIMER_WHEEL_LEVEL_BITS)
+#define WHEEL_ROOT_MASK   (WHEEL_ROOT_SIZE - 1)
+#define WHEEL_LEVEL_MASK  (WHEEL_LEVEL_SIZE - 1)
+#define WHEEL_SPAN        (1ULL << (TIMER_WHEEL_ROOT_BITS + TIMER_WHEEL_LEVELS * TIMER_WHEEL_LEVEL_BITS))
+
+static ktimer* wheel_root[WHEEL_ROOT_SIZE];
+static ktimer* wheel_levels[TIMER_WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+static uint64_t wheel_clock = 0;            // Next tick whose root slot has not been run
+static spinlock_t wheel_lock = {0, 0};
+
+/*
+ * Due timers wait on wheel_expired and their callbacks run one at a time
+ * with wheel_lock dropped. wheel_running is the timer whose callback is
+ * running, so timer_cancel() can wait for it to finish before the caller
+ * frees or reuses the timer, which may live on a stack another CPU is
+ * about to leave.
+ */
+static ktimer* wheel_expired = nullptr;
+static ktimer* volatile wheel_running = nullptr;
+static volatile uint32_t wheel_running_cpu = 0;
+
+
+static inline uint32_t level_shift(int level)
+{
+    return TIMER_WHEEL_ROOT_BITS + level * TIMER_WHEEL_LEVEL_BITS;
+}
+
+// Called with wheel_lock held
+static void wheel_link(ktimer** slot, ktimer* timer)
+{
+    timer->next = *slot;
+    if (timer->next) timer->next->link = &timer->next;
+    timer->link = slot;
+    *slot = timer;
+}
+
+// Called with wheel_lock held
+static void wheel_insert(ktimer* timer)
+{
+    uint64_t expires = timer->expires;
+    uint64_t delta = expires - wheel_clock;
+    ktimer** slot;
+
+    if ((int64_t)delta < 0) slot = &wheel_root[wheel_clock & WHEEL_ROOT_MASK];
+    else if (delta < WHEEL_ROOT_SIZE) slot = &wheel_root[expires & WHEEL_ROOT_MASK];
+    else
+    {
+        // Beyond the wheel's reach the timer is parked in the last slot and re-sorted later
+        if (delta >= WHEEL_SPAN) expires = wheel_clock + WHEEL_SPAN - 1;
+
+        int level = 0;
+        while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << level_shift(level + 1))) level++;
+        slot = &wheel_levels[level][(expires >> level_shift(level)) & WHEEL_LEVEL_MASK];
+    }
+    wheel_link(slot, timer);
+}
+
+// Called with wheel_lock held
+static void wheel_remove(ktimer* timer)
+{
+    *timer->link = timer->next;
+    if (timer->next) timer->next->link = timer->link;
+    timer->next = nullptr;
+    timer->link = nullptr;
+}
+
+// Re-files every timer of one outer slot into the levels below it
+static void wheel_cascade(int level, uint32_t index)
+{
+    ktimer* timer = wheel_levels[level][index];
+    wheel_levels[level][index] = nullptr;
+
+    while (timer)
+    {
+        ktimer* next = timer->next;
+        wheel_insert(timer);
+        timer = next;
+    }
+}
+
+// Advances the wheel to the current tick and moves the timers that came due to wheel_expired
+static void wheel_advance()
+{
+    while (wheel_clock <= timer_ticks)
+    {
+        uint32_t index = wheel_clock & WHEEL_ROOT_MASK;
+        for (int level = 0; index == 0 && level < TIMER_WHEEL_LEVELS; level++)
+        {
+            index = (wheel_clock >> level_shift(level)) & WHEEL_LEVEL_MASK;
+            wheel_cascade(level, index);
+        }
+
+        ktimer** slot = &wheel_root[wheel_clock & WHEEL_ROOT_MASK];
+        while (*slot)
+        {
+            ktimer* timer = *slot;
+            wheel_remove(timer);
+            wheel_link(&wheel_expired, timer);
+        }
+        wheel_clock++;
+    }
+}
+
+
 bool timer_init(uint32_t frequency) 
 {
 	timer_hz = frequency;
@@ -51,46 +165,90 @@ extern "C" void timer_handler()
     outb(PIC1_COMMAND, PIC_EOI);
     timer_ticks++;    
 
-    thread_t* current = thread_get_current();
-
-    if (current)
+    // Only the timers that are due are touched, however many are queued
+    spin_lock(&wheel_lock);
+    wheel_advance();
+    while (wheel_expired)
     {
-        thread_t* t = current;
-        do
-        {
-            if (t->state == THREAD_SLEEPING) 
-            {
-                if (t->sleep_ticks > 0)
-                    t->sleep_ticks--;
-            
-                if (t->sleep_ticks == 0)
-                    t->state = THREAD_READY;
-            }
-            t = t->next;
-        } while (t != current);
+        ktimer* timer = wheel_expired;
+        wheel_remove(timer);
+        wheel_running = timer;
+        wheel_running_cpu = cpu_current_id();
+        spin_unlock(&wheel_lock);
+
+        timer->callback(timer->data);
+
+        spin_lock(&wheel_lock);
+        wheel_running = nullptr;
     }
+    spin_unlock(&wheel_lock);
+    thread_balance_tick();
     yield();
 }
 
 
-uint32_t timer_get_ticks() 
+uint64_t timer_get_ticks() 
 {
     return timer_ticks;
 }
 
+uint64_t timer_ms_to_ticks(uint32_t milliseconds)
+{
+    uint64_t ticks = ((uint64_t)milliseconds * timer_hz) / 1000;
+    if (ticks == 0 && milliseconds > 0) ticks = 1;
+    return ticks;
+}
+
+// Arms (or re-arms) a timer to run its callback at the absolute tick 'expires'
+void timer_add(ktimer* timer, uint64_t expires)
+{
+    spin_lock_irqsave(&wheel_lock);
+    if (timer->link) wheel_remove(timer);
+    timer->expires = expires;
+    wheel_insert(timer);
+    spin_unlock_irqrestore(&wheel_lock);
+}
+
+/*
+ * Returns true if the timer was still queued; its callback will not run
+ * then. Either way the callback is not running once this returns, unless
+ * the caller is that callback, so the timer may be freed straight after.
+ */
+bool timer_cancel(ktimer* timer)
+{
+    spin_lock_irqsave(&wheel_lock);
+    bool pending = timer->link != nullptr;
+    if (pending) wheel_remove(timer);
+
+    // Callbacks run from the timer interrupt with interrupts off, so on
+    // the CPU running one the caller can only be that callback
+    uint32_t self = cpu_current_id();
+    while (wheel_running == timer && wheel_running_cpu != self)
+    {
+        spin_unlock_irqrestore(&wheel_lock);
+        asm volatile("pause");
+        spin_lock_irqsave(&wheel_lock);
+    }
+    spin_unlock_irqrestore(&wheel_lock);
+    return pending;
+}
+
+
+static void timer_wake(void* data)
+{
+    thread_make_ready((thread_t*)data);
+}
 
 void timer_sleep(uint32_t milliseconds) 
 {
-    uint32_t ticks_to_wait = (milliseconds * timer_hz) / 1000;
-    
-    if (ticks_to_wait == 0 && milliseconds > 0) ticks_to_wait = 1;
+    uint64_t ticks_to_wait = timer_ms_to_ticks(milliseconds);
     if (ticks_to_wait == 0) return;
 
     thread_t* current = thread_get_current();
     
     if (!current) 
     {
-        uint32_t start = timer_ticks;
+        uint64_t start = timer_ticks;
         while ((timer_ticks - start) < ticks_to_wait)
             asm volatile("pause");
         return;
@@ -98,9 +256,11 @@ void timer_sleep(uint32_t milliseconds)
 
     asm volatile("cli");
 
-    current->sleep_ticks = ticks_to_wait;
-    current->state = THREAD_SLEEPING;
+    current->sleep_timer.callback = timer_wake;
+    current->sleep_timer.data = current;
+    thread_park(THREAD_SLEEPING);
+    timer_add(&current->sleep_timer, timer_ticks + ticks_to_wait);
 
     asm volatile("sti");
     yield(); 
-}
\ No newline at end of file
+}
@@ -86,7 +86,7 @@ void JBD2::log_block(uint64_t fs_block, uint8_t* data)
     }
     
     // Copy data to buffer
-    uint8_t* copy = (uint8_t*)kmalloc(block_size);
+    uint8_t* copy = fs->alloc_block_buffer();
     memcpy(copy, data, block_size);
     
     current_trans[trans_count].fs_block = fs_block;
@@ -99,7 +99,7 @@ void JBD2::commit_transaction()
     if (trans_count == 0) return;
     
     // 1. Write Descriptor Block
-    uint8_t* desc_buf = (uint8_t*)kmalloc(block_size);
+    uint8_t* desc_buf = fs->alloc_block_buffer();
     memset(desc_buf, 0, block_size);
     
     journal_header_t* header = (journal_header_t*)desc_buf;
@@ -126,7 +126,7 @@ void JBD2::commit_transaction()
     }
     
     // 3. Write Commit Block
-    uint8_t* commit_buf = (uint8_t*)kmalloc(block_size);
+    uint8_t* commit_buf = fs->alloc_block_buffer();
     memset(commit_buf, 0, block_size);
     
     header = (journal_header_t*)commit_buf;
@@ -21,6 +21,8 @@
 #include <fs/ext4_vfs.h>
 #include <drivers/ata.h>
 #include <mm/heap.h>
+#include <mm/page_cache.h>
+#include <mm/slab.h>
 #include <kernel/panic.h>
 #include <stdio.h>
 #include <string.h>
@@ -42,6 +44,7 @@ void Ext4Manager::init(uint32_t lba)
         panic(KernelError::K_ERR_GENERAL_PROTECTION, "Invalid EXT4 magic signature");
     
     block_size = 1024 << sb.s_log_block_size;
+    block_cache = kmem_cache_create("ext4_block", block_size);
     inodes_per_group = sb.s_inodes_per_group;
     blocks_per_group = sb.s_blocks_per_group;
     
@@ -109,6 +112,13 @@ uint32_t Ext4Manager::find_ext4_partition()
 }
 
 
+// Block-sized scratch buffer; the slab owner lets callers free it with kfree
+uint8_t* Ext4Manager::alloc_block_buffer()
+{
+    if (block_cache) return (uint8_t*)kmem_cache_alloc(block_cache);
+    return (uint8_t*)kmalloc(block_size);
+}
+
 void Ext4Manager::read_block(uint64_t block_num, uint8_t* buffer) 
 {
     uint32_t sectors_per_block = block_size / 512;
@@ -143,7 +153,7 @@ void Ext4Manager::read_group_desc(uint32_t group, Ext4GroupDesc* desc)
     uint32_t block_offset = group / desc_per_block;
     uint32_t offset_in_block = (group % desc_per_block) * group_desc_size;
     
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = alloc_block_buffer();
     read_block(first_desc_block + block_offset, buffer);
     
     memcpy(desc, buffer + offset_in_block, sizeof(Ext4GroupDesc)); // Copy base size
@@ -202,7 +212,7 @@ void Ext4Manager::read_inode(uint32_t inode_num, Ext4Inode* inode)
     uint32_t block_offset = index / inodes_per_block;
     uint32_t offset_in_block = (index % inodes_per_block) * inode_size;
     
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = alloc_block_buffer();
     read_block(table_block + block_offset, buffer);
     
     memcpy(inode, buffer + offset_in_block, sizeof(Ext4Inode));
@@ -224,7 +234,7 @@ void Ext4Manager::write_inode(uint32_t inode_num, Ext4Inode* inode)
     uint32_t block_offset = index / inodes_per_block;
     uint32_t offset_in_block = (index % inodes_per_block) * inode_size;
     
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = alloc_block_buffer();
     read_block(table_block + block_offset, buffer);
     
     memcpy(buffer + offset_in_block, inode, sizeof(Ext4Inode));
@@ -398,7 +408,7 @@ uint64_t Ext4Manager::extent_get_block(Ext4Inode* inode, uint32_t logical_block)
                     
                     // Read the next block in the tree
                     if (current_block_data) kfree(current_block_data);
-                    current_block_data = (uint8_t*)kmalloc(block_size);
+                    current_block_data = alloc_block_buffer();
                     read_block(next_block_phys, current_block_data);
                     
                     current_header = (Ext4ExtentHeader*)current_block_data;
@@ -441,6 +451,7 @@ Ext4File::Ext4File(const char* n, uint32_t ino, Ext4Superblock* s)
 }
 
 void Ext4File::open() { ref_count++; }
+uint64_t Ext4File::cache_id() { return page_cache_id(PC_FS_EXT4, inode_num); }
 void Ext4File::close() 
 {
     if (ref_count > 0) ref_count--; 
@@ -474,7 +485,7 @@ uint32_t Ext4File::read(uint32_t offset, uint32_t size, uint8_t* buffer)
         else 
         {
             // Read actual data
-            uint8_t* temp_buf = (uint8_t*)kmalloc(block_size);
+            uint8_t* temp_buf = ext4_inst.alloc_block_buffer();
             ext4_inst.read_block(physical_block, temp_buf);
             memcpy(buffer + bytes_read, temp_buf + offset_in_block, to_read);
             kfree(temp_buf);
@@ -520,7 +531,7 @@ uint32_t Ext4File::write(uint32_t offset, uint32_t size, uint8_t* buffer)
         if (to_write > (size - bytes_written)) to_write = size - bytes_written;
 
         // Read-Modify-Write if partial block
-        uint8_t* temp_buf = (uint8_t*)kmalloc(block_size);
+        uint8_t* temp_buf = ext4_inst.alloc_block_buffer();
         
         if (to_write < block_size) 
             ext4_inst.read_block(physical_block, temp_buf);
@@ -532,10 +543,11 @@ uint32_t Ext4File::write(uint32_t offset, uint32_t size, uint8_t* buffer)
         bytes_written += to_write;
     }
     
-    if (offset + bytes_written > this->size) 
+    // The page cache may already have moved this->size on; the inode is what is on disk
+    if (offset + bytes_written > ext4_get_inode_size(&this->inode)) 
     {
-        this->size = offset + bytes_written;
-        this->inode.i_size_lo = this->size;
+        if (offset + bytes_written > this->size) this->size = offset + bytes_written;
+        this->inode.i_size_lo = offset + bytes_written;
         ext4_inst.write_inode(inode_num, &this->inode);
     }
     else 
@@ -577,7 +589,7 @@ vfs_dirent* Ext4Directory::readdir(uint32_t index)
     uint32_t current_idx = 0;
     uint32_t offset = 0;
     uint32_t block_size = ext4_inst.block_size;
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = ext4_inst.alloc_block_buffer();
     
     while (offset < this->size) 
     {
@@ -641,7 +653,7 @@ VFSNode* Ext4Directory::finddir(const char* name)
 {
     uint32_t offset = 0;
     uint32_t block_size = ext4_inst.block_size;
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = ext4_inst.alloc_block_buffer();
     
     while (offset < this->size) 
     {
@@ -731,7 +743,7 @@ int Ext4Directory::mkdir(const char* name, [[maybe_unused]] uint32_t mode)
 
     // 4. Init Directory Block with . and ..
     uint32_t block_size = ext4_inst.block_size;
-    uint8_t* buf = (uint8_t*)kmalloc(block_size);
+    uint8_t* buf = ext4_inst.alloc_block_buffer();
     memset(buf, 0, block_size);
     
     // Entry 1: "."
@@ -767,7 +779,7 @@ int Ext4Directory::mkdir(const char* name, [[maybe_unused]] uint32_t mode)
     if (space_found != 0) 
     {
         // Read block again
-        uint8_t* pbuf = (uint8_t*)kmalloc(block_size);
+        uint8_t* pbuf = ext4_inst.alloc_block_buffer();
         ext4_inst.read_block(phys_block, pbuf);
         
         Ext4DirEntry2* existing_entry = (Ext4DirEntry2*)(pbuf + entry_block_offset);
@@ -810,7 +822,7 @@ bool Ext4Directory::unlink(const char* name)
     // Find entry logic (needs block ptr to write back)
     uint32_t offset = 0;
     uint32_t block_size = ext4_inst.block_size;
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = ext4_inst.alloc_block_buffer();
     
     bool found = false;
     uint32_t found_inode_num = 0;
@@ -890,7 +902,12 @@ cleanup:
     }
     
     // TODO: If links==0, call free_inode/free_blocks
-    if (target_inode.i_links_count == 0) printf("[EXT4] Unlinked inode %d (fully deleted)\n", found_inode_num);
+    if (target_inode.i_links_count == 0) 
+    {
+        // Cached pages must not outlive the inode, its number may be reused
+        page_cache_invalidate(page_cache_id(PC_FS_EXT4, found_inode_num), 0, UINT32_MAX);
+        printf("[EXT4] Unlinked inode %d (fully deleted)\n", found_inode_num);
+    }
     else printf("[EXT4] Unlinked inode %d (links remaining: %d)\n", found_inode_num, target_inode.i_links_count);
     
 
@@ -911,7 +928,7 @@ bool Ext4Manager::test_block_bitmap(uint32_t group, uint32_t block_in_group)
     read_group_desc(group, &gd);
     uint64_t bitmap_block = get_block_bitmap(&gd);
     
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = alloc_block_buffer();
     read_block(bitmap_block, buffer);
     
     uint32_t byte_idx = block_in_group / 8;
@@ -929,7 +946,7 @@ void Ext4Manager::set_block_bitmap(uint32_t group, uint32_t block_in_group, bool
     read_group_desc(group, &gd);
     uint64_t bitmap_block = get_block_bitmap(&gd);
     
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = alloc_block_buffer();
     read_block(bitmap_block, buffer);
     
     uint32_t byte_idx = block_in_group / 8;
@@ -953,7 +970,7 @@ bool Ext4Manager::test_inode_bitmap(uint32_t group, uint32_t inode_in_group)
     read_group_desc(group, &gd);
     uint64_t bitmap_block = get_inode_bitmap(&gd);
     
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = alloc_block_buffer();
     read_block(bitmap_block, buffer);
     
     uint32_t byte_idx = inode_in_group / 8;
@@ -971,7 +988,7 @@ void Ext4Manager::set_inode_bitmap(uint32_t group, uint32_t inode_in_group, bool
     read_group_desc(group, &gd);
     uint64_t bitmap_block = get_inode_bitmap(&gd);
     
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = alloc_block_buffer();
     read_block(bitmap_block, buffer);
     
     uint32_t byte_idx = inode_in_group / 8;
@@ -998,7 +1015,7 @@ uint64_t Ext4Manager::allocate_block()
         {
             // Found a group with free blocks. Find the exact bit.
             uint64_t bitmap_block = get_block_bitmap(&gd);
-            uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+            uint8_t* buffer = alloc_block_buffer();
             read_block(bitmap_block, buffer);
             
             for (uint32_t i = 0; i < blocks_per_group; i++) 
@@ -1043,7 +1060,7 @@ uint32_t Ext4Manager::allocate_inode(bool is_directory)
         if (gd.bg_free_inodes_count_lo > 0) 
         {
             uint64_t bitmap_block = get_inode_bitmap(&gd);
-            uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+            uint8_t* buffer = alloc_block_buffer();
             read_block(bitmap_block, buffer);
             
             for (uint32_t i = 0; i < inodes_per_group; i++) 
@@ -1103,7 +1120,7 @@ void Ext4Manager::write_group_desc(uint32_t group, Ext4GroupDesc* desc)
     uint32_t block_offset = group / desc_per_block;
     uint32_t offset_in_block = (group % desc_per_block) * group_desc_size;
     
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = alloc_block_buffer();
     read_block(first_desc_block + block_offset, buffer);
     
     memcpy(buffer + offset_in_block, desc, sizeof(Ext4GroupDesc));
@@ -1146,7 +1163,7 @@ uint32_t Ext4Directory::find_free_entry_space(uint32_t required_size, uint64_t*
     
     uint32_t offset = 0;
     uint32_t block_size = ext4_inst.block_size;
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = ext4_inst.alloc_block_buffer();
     
     while (offset < this->size) 
     {
@@ -1244,8 +1261,7 @@ VFSNode* Ext4Directory::create(const char* name, [[maybe_unused]] uint32_t flags
     // We need to read the block again, modify the existing entry to shrink it, 
     // and append the new one.
     
-    uint32_t block_size = ext4_inst.block_size;
-    uint8_t* buffer = (uint8_t*)kmalloc(block_size);
+    uint8_t* buffer = ext4_inst.alloc_block_buffer();
     ext4_inst.read_block(phys_block, buffer);
     
     Ext4DirEntry2* existing_entry = (Ext4DirEntry2*)(buffer + entry_block_offset);
@@ -22,6 +22,7 @@
 #include <fs/fat32_vfs.h>
 #include <drivers/ata.h>
 #include <mm/heap.h>
+#include <mm/page_cache.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -117,6 +118,7 @@ FAT32_File::FAT32_File(const char* n, uint32_t cluster, uint32_t sz, FAT32_BPB*
     strncpy(this->name, n, 127);
     this->first_cluster = cluster;
     this->size = sz;
+    this->disk_size = sz;
     this->bpb = b;
     this->dir_entry_lba = entry_lba;
     this->dir_entry_offset = entry_off;
@@ -195,14 +197,21 @@ uint32_t FAT32_File::write(uint32_t offset, uint32_t size, uint8_t* buffer)
         bytes_written += to_write;
     }
 
-    if (offset + size > this->size) 
+    if (offset + size > this->disk_size) 
 	{
-        this->size = offset + size;
+        this->disk_size = offset + size;
+        if (this->disk_size > this->size) this->size = this->disk_size;
         update_metadata();
     }
     return bytes_written;
 }
 
+// An empty file has no cluster yet, and nothing worth caching
+uint64_t FAT32_File::cache_id()
+{
+    return (first_cluster >= 2) ? page_cache_id(PC_FS_FAT32, first_cluster) : 0;
+}
+
 
 FAT32_Directory::FAT32_Directory(const char* n, uint32_t c, FAT32_BPB* b) 
 {
@@ -540,6 +549,7 @@ void FAT32_File::update_metadata()
 void FAT32Manager::free_cluster_chain(uint32_t cluster)
 {
     if (cluster < 2) return;
+    page_cache_invalidate(page_cache_id(PC_FS_FAT32, cluster), 0, UINT32_MAX);
 
     while (cluster < 0x0FFFFFF8 && cluster != 0) 
 	{
@@ -23,6 +23,7 @@
 #include <drivers/ata.h>
 #include <fs/vfs.h>
 #include <mm/heap.h>
+#include <mm/page_cache.h>
 #include <stdio.h>
 
 static uint8_t rootfs_buffer[sizeof(RootFS)]; 
@@ -114,14 +115,19 @@ VFSNode* vfs_open(const char* path)
     return current;
 }
 
+// Cacheable files go through the page cache; node->read/write are then its backend
 uint32_t vfs_read(VFSNode* node, uint32_t offset, uint32_t size, uint8_t* buffer) 
 {
-    return (node) ? node->read(offset, size, buffer) : 0;
+    if (!node) return 0;
+    if (node->cache_id()) return page_cache_read(node, offset, size, buffer);
+    return node->read(offset, size, buffer);
 }
 
 uint32_t vfs_write(VFSNode* node, uint32_t offset, uint32_t size, uint8_t* buffer) 
 {
-    return (node) ? node->write(offset, size, buffer) : 0;
+    if (!node) return 0;
+    if (node->cache_id()) return page_cache_write(node, offset, size, buffer);
+    return node->write(offset, size, buffer);
 }
 
 vfs_dirent* vfs_readdir(VFSNode* node, uint32_t index) 
@@ -129,9 +135,12 @@ vfs_dirent* vfs_readdir(VFSNode* node, uint32_t index)
     return (node) ? node->readdir(index) : nullptr;
 }
 
+// Dirty cached pages are written back through the node before it can go away
 void vfs_close(VFSNode* node) 
 {
-    if (node) node->close();
+    if (!node) return;
+    page_cache_flush(node);
+    node->close();
 }
 
 void VFSNode::open() { ref_count++; }
@@ -0,0 +1,99 @@
+/*
+ * keonOS - include/drivers/acpi.h
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <kernel/constants.h>
+#include <stdint.h>
+
+struct acpi_rsdp
+{
+    char     signature[8];      // "RSD PTR "
+    uint8_t  checksum;          // Covers the first 20 bytes
+    char     oem_id[6];
+    uint8_t  revision;          // 0 for ACPI 1.0, 2 when the fields below exist
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t  extended_checksum;
+    uint8_t  reserved[3];
+} __attribute__((packed));
+
+struct acpi_sdt_header
+{
+    char     signature[4];
+    uint32_t length;            // Whole table, header included
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct acpi_madt
+{
+    acpi_sdt_header header;     // "APIC"
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint8_t  entries[];
+} __attribute__((packed));
+
+enum ACPI_MADT_TYPE
+{
+    ACPI_MADT_LAPIC          = 0,
+    ACPI_MADT_LAPIC_OVERRIDE = 5,
+};
+
+struct acpi_madt_entry
+{
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+struct acpi_madt_lapic
+{
+    acpi_madt_entry header;
+    uint8_t  processor_id;
+    uint8_t  apic_id;
+    uint32_t flags;             // Bit 0: enabled, bit 1: may be brought online
+} __attribute__((packed));
+
+struct acpi_madt_lapic_override
+{
+    acpi_madt_entry header;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed));
+
+// What the kernel keeps of the MADT
+struct acpi_cpu_info
+{
+    uintptr_t lapic_phys;
+    uint32_t  cpu_count;        // Enabled processors, at most MAX_CPUS
+    uint8_t   apic_ids[MAX_CPUS];
+};
+
+bool acpi_init(void* rsdp);
+const acpi_cpu_info* acpi_get_cpus();
+
+#endif		// ACPI_H
@@ -24,10 +24,13 @@
 #include <stdint.h>
 #include <kernel/constants.h>
 
+struct wait_queue_t;
+
 bool keyboard_init();
 char keyboard_getchar();
 bool keyboard_has_input();
 char keyboard_peek(); 
+wait_queue_t* keyboard_wait_queue();
 
 
 extern "C" void irq1_handler();
@@ -23,12 +23,16 @@
 
 #include <stdint.h>
 
+struct wait_queue_t;
+
 void serial_install();
 int is_transmit_empty();
 void write_serial(char a);
 void serial_putc(char c);
 int serial_received();
 char serial_getc();
+wait_queue_t* serial_wait_queue();
+extern "C" void serial_handler();
 void serial_move_cursor(int dx);
 
 #endif		// SERIAL_H
\ No newline at end of file
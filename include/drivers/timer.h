@@ -26,9 +26,25 @@
 #include <stdint.h>
 
 
+/*
+ * Kernel timers. Once the tick count reaches 'expires' the callback runs
+ * from the timer interrupt, so it must be short and must never sleep.
+ */
+struct ktimer
+{
+    uint64_t expires;
+    void (*callback)(void* data);
+    void* data;
+    ktimer* next;
+    ktimer** link;          // What points at this timer while it is queued, else null
+};
+
 bool timer_init(uint32_t frequency);
 extern "C" void timer_handler();  
-uint32_t timer_get_ticks();
+uint64_t timer_get_ticks();
+uint64_t timer_ms_to_ticks(uint32_t milliseconds);
+void timer_add(ktimer* timer, uint64_t expires);
+bool timer_cancel(ktimer* timer);
 void timer_sleep(uint32_t milliseconds);
 
 #endif		// TIMER_H
\ No newline at end of file
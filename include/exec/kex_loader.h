@@ -32,4 +32,16 @@
 int kex_load(const char* path, int argc, char** argv);
 uintptr_t kdl_load(const char* path, thread_t* t);
 
+// Frames mapped for program segments: private copies vs shared page cache frames
+struct kex_load_stats
+{
+    uint64_t loads;
+    uint64_t private_frames;
+    uint64_t shared_frames;
+};
+
+// Sharing is on by default; benchmarks turn it off to measure the copying path
+void kex_set_segment_sharing(bool enabled);
+void kex_get_load_stats(kex_load_stats* stats);
+
 #endif // KEX_LOADER_H
@@ -24,6 +24,7 @@
 #include <fs/ext4_structs.h>
 #include <fs/vfs_node.h>
 #include <fs/ext4_journal.h>
+#include <mm/slab.h>
 #include <stdint.h>
 
 // Forward declarations
@@ -46,12 +47,14 @@ public:
     uint32_t blocks_per_group;
     uint32_t group_desc_size;
     uint32_t groups_count;
+    kmem_cache* block_cache;        // Slab cache of block_size buffers (release with kfree)
     
     // Initialization
     void init(uint32_t lba);
     uint32_t find_ext4_partition();
     
     // Block operations
+    uint8_t* alloc_block_buffer();
     void read_block(uint64_t block_num, uint8_t* buffer);
     void write_block(uint64_t block_num, uint8_t* buffer);
     void journal_write_block(uint64_t block_num, uint8_t* buffer); // Journal-aware write
@@ -113,6 +116,7 @@ public:
     uint32_t write(uint32_t offset, uint32_t size, uint8_t* buffer) override;
     void open() override;
     void close() override;
+    uint64_t cache_id() override;
     
     uint32_t get_inode_num() { return inode_num; }
     Ext4Inode* get_inode() { return &inode; }
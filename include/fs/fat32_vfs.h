@@ -49,6 +49,7 @@ class FAT32_File : public VFSNode
     FAT32_BPB* bpb;
     uint32_t dir_entry_lba;
     uint32_t dir_entry_offset;
+    uint32_t disk_size;         // Size recorded on disk; 'size' may run ahead in the page cache
     
     public:
     FAT32_File(const char* n, uint32_t cluster, uint32_t sz, FAT32_BPB* b, uint32_t entry_lba, uint32_t entry_off);
@@ -56,6 +57,7 @@ class FAT32_File : public VFSNode
     void close() override {}
     uint32_t read(uint32_t offset, uint32_t size, uint8_t* buffer) override;
     uint32_t write(uint32_t offset, uint32_t size, uint8_t* buffer) override;
+    uint64_t cache_id() override;
     void update_metadata();
 };
 
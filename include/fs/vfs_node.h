@@ -58,6 +58,10 @@ public:
     virtual VFSNode* finddir([[maybe_unused]] const char* name) { return nullptr; }
     virtual VFSNode* create([[maybe_unused]] const char* name, [[maybe_unused]] uint32_t flags) { return nullptr; }
     virtual int mkdir([[maybe_unused]] const char* name, [[maybe_unused]] uint32_t mode) { return -1; }
+
+    // Identity of the data in the page cache, the same for every open of
+    // one file; 0 keeps read() and write() uncached (see mm/page_cache.h)
+    virtual uint64_t cache_id() { return 0; }
 };
 
 class RootFS : public VFSNode 
@@ -0,0 +1,58 @@
+/*
+ * keonOS - include/kernel/arch/x86_64/apic.h
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#ifndef _KERNEL_APIC_H
+#define _KERNEL_APIC_H
+
+#include <stdint.h>
+
+// Register offsets into the local APIC page
+enum LAPIC_REG
+{
+    LAPIC_ID          = 0x020,
+    LAPIC_TPR         = 0x080,
+    LAPIC_EOI         = 0x0B0,
+    LAPIC_SVR         = 0x0F0,
+    LAPIC_ICR_LOW     = 0x300,
+    LAPIC_ICR_HIGH    = 0x310,
+    LAPIC_LVT_TIMER   = 0x320,
+    LAPIC_LVT_LINT0   = 0x350,
+    LAPIC_LVT_LINT1   = 0x360,
+    LAPIC_LVT_ERROR   = 0x370,
+    LAPIC_TIMER_INIT  = 0x380,
+    LAPIC_TIMER_COUNT = 0x390,
+    LAPIC_TIMER_DIV   = 0x3E0,
+};
+
+bool lapic_init(uintptr_t phys);
+void lapic_init_cpu(bool bsp);
+bool lapic_present();
+uint32_t lapic_id();
+void lapic_eoi();
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_startup(uint32_t apic_id, uintptr_t page);
+
+void lapic_timer_calibrate();
+void lapic_timer_start(uint32_t hz);
+void lapic_timer_handler();
+
+#endif      // _KERNEL_APIC_H
@@ -0,0 +1,143 @@
+/*
+ * keonOS - include/kernel/arch/x86_64/cpu.h
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#ifndef _KERNEL_CPU_H
+#define _KERNEL_CPU_H
+
+#include <kernel/constants.h>
+#include <stdint.h>
+
+// Offsets into struct cpu_local (see smp.h), read through GS in kernel mode
+#define CPU_LOCAL_SELF      16
+#define CPU_LOCAL_ID        24
+#define CPU_LOCAL_CURRENT   32
+
+// Index of the executing CPU. A single GS-relative load, so it cannot be
+// torn by a migration; the answer can of course be stale once IF is set.
+static inline uint32_t cpu_current_id()
+{
+    uint32_t id;
+    asm volatile("movl %%gs:%c1, %0" : "=r"(id) : "i"(CPU_LOCAL_ID));
+    return id;
+}
+
+// Disables interrupts on the local CPU and returns the previous RFLAGS
+static inline uint64_t local_irq_save()
+{
+    uint64_t rflags;
+    asm volatile("pushfq; popq %0; cli" : "=rm"(rflags) : : "memory");
+    return rflags;
+}
+
+static inline void local_irq_restore(uint64_t rflags)
+{
+    asm volatile("pushq %0; popfq" : : "rm"(rflags) : "memory", "cc");
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d)
+{
+    asm volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+// Whether the CPU can map 1 GiB pages with a PDPT leaf (CPUID 0x80000001 EDX.26)
+static inline bool cpu_has_pdpe1gb()
+{
+    uint32_t a, b, c, d;
+    cpuid(0x80000000, &a, &b, &c, &d);
+    if (a < 0x80000001) return false;
+    cpuid(0x80000001, &a, &b, &c, &d);
+    return (d >> 26) & 1;
+}
+
+#define CR0_WP      (1ULL << 16)
+#define CR4_PGE     (1ULL << 7)
+#define CR4_PCIDE   (1ULL << 17)
+#define CR3_NOFLUSH (1ULL << 63)     // With CR4.PCIDE, keep the new PCID's cached translations
+
+// Global pages survive CR3 loads (CPUID 1 EDX.13)
+static inline bool cpu_has_pge()
+{
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    return (d >> 13) & 1;
+}
+
+// Process-context identifiers in CR3 (CPUID 1 ECX.17)
+static inline bool cpu_has_pcid()
+{
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    return (c >> 17) & 1;
+}
+
+// INVPCID instruction (CPUID 7 EBX.10)
+static inline bool cpu_has_invpcid()
+{
+    uint32_t a, b, c, d;
+    cpuid(0, &a, &b, &c, &d);
+    if (a < 7) return false;
+    cpuid(7, &a, &b, &c, &d);
+    return (b >> 10) & 1;
+}
+
+static inline uint64_t read_cr4()
+{
+    uint64_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static inline void write_cr4(uint64_t cr4)
+{
+    asm volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+// Type 0 drops one address of one PCID, type 1 every non-global entry of it
+static inline void invpcid(uint64_t type, uint64_t pcid, uintptr_t addr)
+{
+    struct { uint64_t pcid; uint64_t addr; } desc = { pcid, addr };
+    asm volatile("invpcid %0, %1" : : "m"(desc), "r"(type) : "memory");
+}
+
+#define MSR_APIC_BASE       0x1B
+#define MSR_EFER            0xC0000080
+#define MSR_GS_BASE         0xC0000101
+#define MSR_KERNEL_GS_BASE  0xC0000102
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    asm volatile("wrmsr" : : "a"((uint32_t)value), "d"((uint32_t)(value >> 32)), "c"(msr));
+}
+
+static inline uint64_t rdtsc()
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#endif      // _KERNEL_CPU_H
@@ -23,6 +23,11 @@
 
 #include <stdint.h>
 
+#define IST_DOUBLE_FAULT 1      // TSS ist[] slot (1-based) the double-fault gate switches to
+#define GDT_ENTRIES      7      // Null, kernel code/data, user data/code, then the 16-byte TSS descriptor
+
+struct cpu_local;
+
 extern "C" 
 {
     struct gdt_entry
@@ -67,8 +72,9 @@ extern "C"
     } __attribute__((packed));
 
     void gdt_init();
-    void gdt_set_gate(int32_t num, uint64_t base, uint32_t limit, uint8_t access, uint8_t gran);
-    void gdt_set_tss(int32_t num, uint64_t base, uint32_t limit);
+    void gdt_init_cpu(cpu_local* cpu);
+    void gdt_set_gate(gdt_entry* table, int32_t num, uint64_t base, uint32_t limit, uint8_t access, uint8_t gran);
+    void gdt_set_tss(gdt_entry* table, int32_t num, uint64_t base, uint32_t limit);
     
     extern void gdt_flush(uintptr_t);
     extern void tss_load();
@@ -49,6 +49,15 @@ struct registers_t
     uint64_t rip, cs, rflags, rsp, ss;
 };
 
+// Page fault error code bits
+enum PF_ERROR
+{
+    PF_PRESENT = 0x01,      // Protection violation on a present page
+    PF_WRITE   = 0x02,
+    PF_USER    = 0x04,      // Raised while in ring 3
+    PF_FETCH   = 0x10,
+};
+
 
 extern "C" void outb(uint16_t port, uint8_t value);
 extern "C" uint8_t inb(uint16_t port);
@@ -57,11 +66,13 @@ extern "C" uint16_t inw(uint16_t port);
 extern "C" void idt_flush(uintptr_t addr);
 
 bool idt_init();
+void idt_load();
 void idt_set_gate(uint8_t num, uint64_t base, uint16_t selector, uint8_t flags);
 
 
 extern "C" void timer_handler();
 extern "C" void keyboard_handler();
+extern "C" void serial_handler();
 
 extern "C" void isr0();
 extern "C" void isr1();
@@ -95,6 +106,10 @@ extern "C" void isr28();
 extern "C" void isr29();
 extern "C" void isr30();
 extern "C" void isr31();
+extern "C" void isr48();
+extern "C" void isr49();
+extern "C" void isr50();
+extern "C" void isr255();
 
 extern "C" void irq0();
 extern "C" void irq1();
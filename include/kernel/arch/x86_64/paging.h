@@ -21,6 +21,7 @@
 #ifndef PAGING_H
 #define PAGING_H
 
+#include <kernel/arch/x86_64/thread.h>
 #include <kernel/constants.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -34,34 +35,113 @@ enum PAGE_FLAGS
     PTE_PCD      = 0x010,
     PTE_ACCESSED = 0x020,
     PTE_DIRTY    = 0x040,
+    PTE_HUGE     = 0x080,       // PS: the PDPT/PD entry maps a 1 GiB/2 MiB page
     PTE_GLOBAL   = 0x100,
+    PTE_COW      = 0x200,       // Software bit: read-only share, copy on the first write
     PTE_NX       = (1ULL << 63)
 };
 
+enum PFA_FLAGS
+{
+    PFA_NO_ZERO  = 0x01,    // Caller overwrites the whole frame, skip zeroing
+    PFA_NO_RECLAIM = 0x02   // Fail at once instead of shrinking caches first
+};
+
+// Physical memory zones, lowest first; a request for a zone may be served from any zone below it
+enum PFA_ZONE
+{
+    PFA_ZONE_DMA,           // Below PFA_ZONE_DMA_END
+    PFA_ZONE_DMA32,         // Below PFA_ZONE_DMA32_END
+    PFA_ZONE_NORMAL,        // Everything else
+    PFA_ZONE_COUNT
+};
+
 typedef uint64_t pt_entry;
 
+#define PTE_ADDR_MASK   0x000FFFFFFFFFF000ULL
+#define PAGE_SIZE_2M    (2ULL * 1024 * 1024)
+#define PAGE_SIZE_1G    (1024ULL * 1024 * 1024)
+
 struct paging_stats 
 {
     uint64_t total_frames;
     uint64_t used_frames;
     uint64_t free_frames;
     uint64_t mapped_pages;
+    uint64_t free_blocks[PFA_MAX_ORDER + 1];   // Free buddy blocks per order
+    uint64_t zone_present[PFA_ZONE_COUNT];     // Usable RAM frames in each zone
+    uint64_t zone_free[PFA_ZONE_COUNT];        // Frames on each zone's buddy lists
+    uint64_t pcp_cached;                       // Frames sitting in per-CPU magazines
+    uint64_t pcp_hits;                         // Single-frame requests served lock-free
+    uint64_t pcp_misses;                       // Requests that had to refill/drain under pfa_lock
+    uint64_t zero_pool_frames;                 // Pre-zeroed frames ready to hand out
+    uint64_t zero_pool_hits;                   // Zeroed requests served from the pool
+    uint64_t zero_pool_misses;                 // Zeroed requests that had to clear inline
+    uint64_t huge_2m;                          // 2 MiB leaves in the kernel page tables
+    uint64_t huge_1g;                          // 1 GiB leaves in the kernel page tables
+    uint64_t thp_mapped;                       // 2 MiB leaves backing user memory
+    uint64_t thp_splits;                       // User 2 MiB leaves broken into 4 KiB pages
+    uint64_t pcid_used;                        // Tags held by live address spaces
+    bool     pcid_enabled;                     // CR3 loads keep other spaces' TLB entries
 };
 
 void pfa_init_from_multiboot2(void* mb2_structure);
-void* pfa_alloc_frame();
+void* pfa_alloc_frame(uint32_t flags = 0);
 void pfa_free_frame(void* frame);
+void* pfa_alloc_frames(uint32_t order, uint32_t flags = 0);
+void* pfa_alloc_frame_zone(PFA_ZONE zone, uint32_t flags = 0);
+void* pfa_alloc_frames_zone(uint32_t order, PFA_ZONE zone, uint32_t flags = 0);
+void pfa_free_frames(void* frame, uint32_t order);
+void pfa_ref_frame(void* frame);
+void pfa_put_frame(void* frame);
+uint32_t pfa_frame_shares(void* frame);
+uint64_t pfa_free_frame_count();
+uint32_t pfa_zero_pool_refill(uint32_t max_frames);
+void pfa_set_owner(void* frame, uint32_t order, void* owner);
+void* pfa_get_owner(void* frame);
 void pfa_mark_used(uintptr_t frame_start, uint64_t frame_count);
 
+/*
+ * An address space is one PML4. The kernel half (entries 256-511) is shared
+ * by every space; the user half belongs to the process. Mappings of kernel
+ * addresses always go to the shared kernel tables whatever space is passed.
+ */
+struct address_space
+{
+    pt_entry* pml4;             // Direct-map pointer to the top-level table
+    uintptr_t pml4_phys;        // Value loaded into CR3
+    uint16_t pcid;              // TLB tag while CR4.PCIDE is set
+    uint32_t flush_pending;     // CPUs whose next load must drop what their TLB holds for the tag
+    struct vm_area* vmas;       // User-half areas, see mm/vma.h
+    spinlock_t vma_lock;        // Guards 'vmas' and faults against them
+};
+
 void paging_init();
-void paging_map_page(void* virt, void* phys, uint64_t flags);
-void paging_unmap_page(void* virt);
-void* paging_get_physical_address(void* virt);
+void paging_init_cpu();
+address_space* paging_kernel_space();
+address_space* paging_create_address_space();
+address_space* paging_fork_address_space(address_space* parent);
+void paging_destroy_address_space(address_space* as);
+void paging_switch_address_space(address_space* as);
+void paging_flush_address_space(address_space* as);
+
+bool paging_map_page(address_space* as, void* virt, void* phys, uint64_t flags);
+bool paging_unmap_page(address_space* as, void* virt);
+bool paging_can_map_huge(address_space* as, void* virt);
+bool paging_map_huge_page(address_space* as, void* virt, void* phys, uint64_t flags);
+void* paging_unmap_huge_page(address_space* as, void* virt);
+void* paging_get_physical_address(address_space* as, void* virt);
+bool paging_is_user_accessible(address_space* as, void* virt, bool write = false);
+bool paging_handle_cow(address_space* as, void* virt, bool* out_of_memory = nullptr);
+void paging_protect_page(address_space* as, void* virt, bool user, bool writable);
+void paging_protect_range(address_space* as, uintptr_t start, uintptr_t end, bool user, bool writable);
+size_t paging_copy_to(address_space* as, uintptr_t virt, const void* src, size_t size);
+size_t paging_copy_from(address_space* as, void* dst, uintptr_t virt, size_t size);
+uint64_t paging_resident_pages(address_space* as);
+
 void paging_identity_map(uintptr_t start, uintptr_t size, uint64_t flags);
 void paging_get_stats(struct paging_stats* stats);
-void* paging_create_address_space();
 void paging_make_kernel_user_accessible();
-bool paging_is_user_accessible(void* virt);
 
 inline void* phys_to_virt(uintptr_t phys) 
 { 
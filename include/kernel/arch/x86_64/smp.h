@@ -0,0 +1,72 @@
+/*
+ * keonOS - include/kernel/arch/x86_64/smp.h
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#ifndef _KERNEL_SMP_H
+#define _KERNEL_SMP_H
+
+#include <kernel/arch/x86_64/gdt.h>
+#include <kernel/arch/x86_64/cpu.h>
+#include <kernel/constants.h>
+#include <stdint.h>
+
+struct thread_t;
+struct address_space;
+
+/*
+ * Per-CPU data. In kernel mode GS points at the running CPU's entry;
+ * syscall_entry reads the first two fields and cpu.h the CPU_LOCAL_*
+ * offsets, so their layout is fixed.
+ */
+struct cpu_local
+{
+    uint64_t kernel_stack;          // [gs:0], loaded by syscall_entry
+    uint64_t user_stack_tmp;        // [gs:8], user RSP while syscall_entry switches
+    cpu_local* self;
+    uint32_t id;                    // Index into the CPU table, 0 is the bootstrap CPU
+    uint32_t apic_id;
+    thread_t* current;
+    thread_t* idle;
+    address_space* as;              // Space loaded in CR3
+    uint64_t ticks;                 // Local APIC timer interrupts taken
+    volatile bool online;
+
+    alignas(16) gdt_entry gdt[GDT_ENTRIES];
+    tss_entry tss;
+};
+
+static inline cpu_local* cpu_this()
+{
+    cpu_local* cpu;
+    asm volatile("movq %%gs:%c1, %0" : "=r"(cpu) : "i"(CPU_LOCAL_SELF));
+    return cpu;
+}
+
+cpu_local* smp_cpu(uint32_t id);
+uint32_t smp_cpu_count();
+uint32_t smp_online_mask();
+void smp_init();
+extern "C" void ap_main(cpu_local* cpu);
+
+void smp_flush_tlb(address_space* as, uintptr_t virt);
+void smp_tlb_poll();
+void smp_tlb_interrupt();
+void smp_send_reschedule(uint32_t id);
+
+#endif      // _KERNEL_SMP_H
@@ -22,6 +22,7 @@
 #define THREAD_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 enum thread_state_t
 {
@@ -33,6 +34,11 @@ enum thread_state_t
 };
 
 #include <fs/vfs_node.h>
+#include <drivers/timer.h>
+
+struct address_space;
+struct thread_queue;
+struct wait_waiter;
 
 struct thread_t 
 {
@@ -44,14 +50,27 @@ struct thread_t
     bool      is_user;
     thread_t* next;
     thread_state_t state;
-    uint32_t sleep_ticks;
+    int      priority;      // 0 (highest) to THREAD_PRIORITIES - 1
+    thread_t* rq_next;      // Links on a ready queue
+    thread_t* rq_prev;
+    thread_queue* rq;       // Ready queue the thread is on, if any
+    ktimer   sleep_timer;   // Armed while the thread sleeps
+    wait_waiter* waiting;   // Set while the thread is on wait queues
     int      exit_code;
+    int      joiners;       // Threads in thread_join(); the zombie is kept until they leave
+    bool     running;       // Some CPU's current thread (lock of its CPU's run queue)
+    volatile bool on_cpu;   // Registers still live on a CPU; cleared once switch_context saved them
+    volatile bool kill_pending; // Killed while running elsewhere; exits on its way back to ring 3
+    bool     is_idle;       // One of the per-CPU idle threads, never queued
+    uint32_t cpu;           // CPU whose run queue it belongs to; changes only under that queue's lock
+    uint32_t affinity;      // CPUs it may run on, one bit each; inherited by threads it creates
     
     // Virtual Memory Layout
     uintptr_t user_image_start;
     uintptr_t user_image_end;
     uintptr_t user_heap_break;
     uintptr_t dyn_lib_break; // Base address for next dynamic library load
+    address_space* as;       // Page tables in use while this thread runs
     
     VFSNode* fd_table[16];
     uint32_t fd_offset[16];
@@ -64,29 +83,39 @@ typedef struct
 } spinlock_t;
 
 
-extern "C" void switch_context(uint64_t** old_rsp, uint64_t* new_rsp);
+extern "C" void switch_context(uint64_t** old_rsp, uint64_t* new_rsp, volatile bool* old_on_cpu);
 
 void thread_init();
 void idle_task();
 extern "C" void yield();
 void thread_exit(int code);
 thread_t* thread_create(void (*entry_point)(), const char* name);
-thread_t* thread_add(void(*entry_point)(), const char* name, bool is_user = false);
+thread_t* thread_add(void(*entry_point)(), const char* name, bool is_user = false, size_t user_stack_size = 0, bool held = false);
 bool      thread_kill(uint32_t id);
 void      thread_sleep(uint32_t ms);
-void      thread_wakeup_blocked();
+void      thread_make_ready(thread_t* t);
+void      thread_park(thread_state_t state);
+void      thread_hold(thread_t* t);
+int       thread_join(uint32_t id, int* exit_code, uint32_t timeout_ms);
+bool      thread_set_priority(uint32_t id, int priority);
+bool      thread_set_affinity(uint32_t id, uint32_t mask);
+void      thread_balance_tick();
 thread_t* thread_get_current();
 thread_t* get_idle_thread_ptr();
+thread_t* thread_create_idle(uint32_t cpu);
 void      thread_print_list();
 uint32_t  thread_get_id_by_name(const char* name);
 void spin_lock(spinlock_t* lock);
 void spin_unlock(spinlock_t* lock);
 void spin_lock_irqsave(spinlock_t* lock);
+bool spin_trylock_irqsave(spinlock_t* lock);
 void spin_unlock_irqrestore(spinlock_t* lock);
 void cleanup_zombies();
 int64_t thread_kill_by_string(const char* input);
 thread_t* thread_get_by_id(uint32_t id);
+void      thread_for_each(void (*fn)(thread_t* t, void* arg), void* arg);
 void user_test_thread();
-thread_t* thread_create_user(void (*entry_point)(), const char* name);
+thread_t* thread_create_user(void (*entry_point)(), const char* name, size_t stack_size = 0);
+thread_t* thread_fork(thread_t* parent);
 
 #endif      // THREAD_H
\ No newline at end of file
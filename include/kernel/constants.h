@@ -37,6 +37,40 @@
 
 #define KERNEL_VIRT_OFFSET 0xFFFFFFFF80000000
 
+// Size of the higher-half direct map of physical memory (phys_to_virt window)
+#define KERNEL_DIRECT_MAP_SIZE  (1024ULL * 1024 * 1024)
+
+// Start of the kernel dynamic region (heap, VMM allocations, device mappings).
+// Kept outside the direct map so these mappings never alias physical frames.
+#define KERNEL_DYNAMIC_BASE     0xFFFFFF8000000000
+
+// The dynamic region starts with the VMM::sbrk heap area, followed by the
+// vmalloc/ioremap range allocator's window.
+#define KERNEL_HEAP_AREA_SIZE   (64ULL * 1024 * 1024 * 1024)
+#define KERNEL_VMALLOC_BASE     (KERNEL_DYNAMIC_BASE + KERNEL_HEAP_AREA_SIZE)
+#define KERNEL_VMALLOC_END      0xFFFFFFD000000000
+
+// Kernel thread stacks live in fixed slots right above the vmalloc window
+#define KERNEL_KSTACK_BASE      KERNEL_VMALLOC_END
+#define KERNEL_KSTACK_END       (KERNEL_KSTACK_BASE + KSTACK_SLOTS * KSTACK_SLOT_SIZE)
+
+
+
+// SMP CONSTANTS
+
+#define MAX_CPUS 8
+
+#define AP_TRAMPOLINE_BASE 0x8000		// Real-mode page the application processors start in
+#define AP_STARTUP_TIMEOUT_MS 200		// How long an AP gets to report in after its SIPIs
+
+#define LAPIC_TIMER_VECTOR 48			// Local APIC vectors, above the remapped PIC range
+#define IPI_TLB_VECTOR     49
+#define IPI_RESCHED_VECTOR 50			// Wakes an idle CPU that was handed a thread
+#define LAPIC_SPURIOUS_VECTOR 255
+
+#define LAPIC_TIMER_HZ 100				// Scheduler tick on the application processors
+#define LAPIC_CALIBRATE_MS 100			// PIT time the local APIC timer is measured against
+
 
 
 // C - CPP CONSTANTS
@@ -73,6 +107,59 @@
 #define PD_IDX(addr)   (((uintptr_t)(addr) >> 21) & 0x1FF)
 #define PT_IDX(addr)   (((uintptr_t)(addr) >> 12) & 0x1FF)
 
+#define PFA_MAX_ORDER 10				// Largest buddy block: 2^10 frames (4 MiB)
+#define PFA_MAGAZINE_SIZE 64			// Frames cached per CPU in front of the buddy allocator
+#define PFA_MAGAZINE_BATCH 32			// Frames moved per refill/drain of a magazine
+#define PFA_ZERO_POOL_SIZE 256			// Pre-zeroed frames kept ready for allocation
+#define PFA_ZERO_POOL_BATCH 16			// Frames zeroed by the idle task per wakeup
+#define PFA_ZONE_DMA_END (16ULL * 1024 * 1024)			// ISA-style DMA reaches below 16 MiB
+#define PFA_ZONE_DMA32_END (4ULL * 1024 * 1024 * 1024)	// 32-bit bus masters reach below 4 GiB
+
+#define PAGE_CACHE_HASH_BITS 10			// 1024 buckets keyed by (file, page index)
+#define PAGE_CACHE_DIRTY_MAX 256		// Dirty pages that force a write-back on the next write
+#define PAGE_CACHE_LOOKUP_MAX 64		// Larger invalidations walk the LRU list instead
+
+#define RECLAIM_WMARK_LOW 512			// Free frames below which kswapd starts reclaiming
+#define RECLAIM_WMARK_HIGH 1024			// ...and the level it reclaims back up to
+#define RECLAIM_BATCH 32				// Frames asked of the shrinkers per pass
+#define KSWAPD_INTERVAL_MS 100			// How often kswapd checks the watermarks
+#define OOM_KILL_WAIT_MS 1000			// How long a fault waits for its OOM victim to exit
+
+#define PCID_COUNT 4096					// CR3 tags address spaces with a 12-bit PCID
+#define PCID_KERNEL 0					// The kernel space keeps the tag it booted with
+#define PCID_OVERFLOW 4095				// Shared once every tag is taken; always flushed on load
+
+
+
+// USER ADDRESS SPACE LAYOUT
+
+#define USER_HEAP_MIN   0x40000000ULL		// The heap never starts below 1 GiB
+#define USER_MMAP_BASE  0x500000000000ULL	// mmap places mappings without a usable hint here
+#define USER_MMAP_END   USER_LIB_BASE
+#define USER_LIB_BASE   0x600000000000ULL	// First dynamic library load address
+#define USER_STACK_TOP  0x700000000000ULL	// The main thread stack grows down from here
+#define USER_STACK_DEFAULT (1024ULL * 1024)	// Used when KexHeader.stack_size is 0
+#define USER_STACK_MAX  (256ULL * 1024 * 1024)
+#define USER_SPACE_END  0x800000000000ULL	// First non-canonical address above the user half
+
+
+
+// SLAB CONSTANTS
+
+#define KMEM_CACHE_NAME_LEN 24
+#define KMEM_MIN_ALIGN 16				// Default object alignment
+#define KMEM_MAX_SLAB_ORDER 3			// Largest slab: 2^3 frames (32 KiB)
+#define KMEM_KMALLOC_MAX 4096			// Larger kmalloc requests go to the list allocator
+#define KMEM_MAX_CACHES 32				// Caches reported by kheap_get_stats
+
+
+
+// HEAP CONSTANTS
+
+#define HEAP_SL_BITS 4					// 16 second-level lists per power of two
+#define HEAP_FL_COUNT 32				// First-level classes (blocks up to 2^38 bytes)
+#define HEAP_GROW_MIN (64 * 1024)		// Smallest arena requested from VMM::sbrk
+
 
 // IDT CONSTANTS
 
@@ -104,6 +191,7 @@
 // SERIAL CONSTANTS
 
 #define COM1 0x3F8
+#define SERIAL_BUFFER_SIZE 256
 
 
 
@@ -115,6 +203,10 @@
 #define PIT_COMMAND       0x43
 #define PIT_FREQUENCY 1193182
 
+#define TIMER_WHEEL_ROOT_BITS 8			// One slot per tick for the next 256 ticks
+#define TIMER_WHEEL_LEVEL_BITS 6		// 64 slots in each outer level
+#define TIMER_WHEEL_LEVELS 3			// Outer levels: deadlines up to 2^26 ticks ahead
+
 #define PIC1_COMMAND 0x20
 #define PIC_EOI      0x20
 
@@ -124,6 +216,18 @@
 
 #define THREAD_NOT_FOUND (uint32_t)-1
 #define THREAD_AMBIGUOUS (uint32_t)-2
+#define THREAD_KERNEL_STACK_SIZE 16384
+#define KSTACK_SLOT_SIZE (2 * THREAD_KERNEL_STACK_SIZE)	// Unmapped guard below each stack
+#define KSTACK_SLOTS 4096              // Kernel stacks that can exist at once
+#define KSTACK_CACHE_SIZE 16           // Freed stacks kept mapped for the next thread
+#define IST_STACK_SIZE 16384           // Double-fault stack, used when a kernel stack overflows
+#define SYSCALL_FRAME_QWORDS 15        // User registers syscall_entry saves at the stack top
+#define THREAD_PRIORITIES 32           // Run queue levels, 0 is picked first
+#define THREAD_PRIORITY_DEFAULT 16
+#define SCHED_BALANCE_MS 20            // How often each CPU compares its load with the busiest one
+#define SCHED_IMBALANCE 2              // Load gap worth pulling a thread across for
+#define WAIT_FOREVER (uint32_t)-1      // Timeout for waits that only end when woken
+#define WAIT_QUEUE_MAX_ANY 4           // Queues one wait_queue_wait_any() can sleep on
 
 
 
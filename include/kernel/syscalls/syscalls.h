@@ -27,25 +27,17 @@
 #include <stdint.h>
 #include <stddef.h>
 
-struct kernel_gs_data 
-{
-    uint64_t kernel_stack;      // Offset 0
-	uint64_t user_stack_tmp;	// Offset 8
-    uint64_t reserved;		    // Offset 16
-} __attribute__((packed));
-
-
 typedef uint64_t (*syscall_fn)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
 
 extern "C" void jump_to_user(uintptr_t entry_point, uintptr_t stack_ptr);
 extern "C" void syscall_entry();
-extern "C" tss_entry kernel_tss;
 
 extern "C" uint64_t syscall_handler(uint64_t num, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
 bool copy_from_user(void* dst, const void* src, size_t size);
 bool copy_to_user(void* dst, const void* src, size_t size);
 
 void syscall_init();
+void syscall_init_cpu();
 void syscall_table_init();
 void syscall_set_kernel_stack(uint64_t stack);
 
@@ -72,7 +64,12 @@ uint64_t sys_ps(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5,
 uint64_t sys_kill(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
 uint64_t sys_sleep(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
 uint64_t sys_sbrk(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+uint64_t sys_mmap(uint64_t addr, uint64_t length, uint64_t prot, uint64_t flags, uint64_t fd, uint64_t offset);
+uint64_t sys_munmap(uint64_t addr, uint64_t length, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
+uint64_t sys_mprotect(uint64_t addr, uint64_t length, uint64_t prot, uint64_t a4, uint64_t a5, uint64_t a6);
+uint64_t sys_meminfo(uint64_t info, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
 uint64_t sys_load_library(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+uint64_t sys_fork(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
 
 // process
 uint64_t sys_reboot(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
@@ -82,6 +79,8 @@ uint64_t sys_stat(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a
 uint64_t sys_fstat(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
 uint64_t sys_getpid(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
 uint64_t sys_sleep(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
+uint64_t sys_setpriority(uint64_t id, uint64_t priority, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
+uint64_t sys_setaffinity(uint64_t id, uint64_t mask, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
 
 
 #endif		// SYSCALLS_H
\ No newline at end of file
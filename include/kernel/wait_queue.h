@@ -0,0 +1,65 @@
+/*
+ * keonOS - include/kernel/wait_queue.h
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+
+#ifndef WAIT_QUEUE_H
+#define WAIT_QUEUE_H
+
+#include <kernel/arch/x86_64/thread.h>
+#include <kernel/constants.h>
+#include <stdint.h>
+
+
+/*
+ * Wait queues. A thread waiting for an event sits on the queue of that
+ * event only, so a wakeup touches the threads that asked for it and no
+ * others. A zeroed wait_queue_t is empty and ready to use.
+ */
+struct wait_waiter;
+
+struct wait_entry
+{
+    wait_entry* next;
+    wait_entry* prev;
+    wait_waiter* waiter;
+    bool queued;
+};
+
+struct wait_queue_t
+{
+    spinlock_t lock;
+    wait_entry* head;
+    wait_entry* tail;
+};
+
+void wait_queue_init(wait_queue_t* queue);
+
+// Sleeps until cond(arg) holds, or once until woken if cond is null.
+// Returns false if timeout_ms (or WAIT_FOREVER) ran out first.
+bool wait_queue_wait(wait_queue_t* queue, bool (*cond)(void*), void* arg, uint32_t timeout_ms);
+bool wait_queue_wait_any(wait_queue_t** queues, int count, bool (*cond)(void*), void* arg, uint32_t timeout_ms);
+
+bool wait_queue_wake_one(wait_queue_t* queue);
+int  wait_queue_wake_all(wait_queue_t* queue);
+
+// Pulls a thread that is being killed off every queue it waits on
+void wait_queue_abort(thread_t* t);
+
+#endif		// WAIT_QUEUE_H
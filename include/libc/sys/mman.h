@@ -0,0 +1,47 @@
+/*
+ * keonOS - include/libc/sys/mman.h
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#ifndef _LIBC_SYS_MMAN_H
+#define _LIBC_SYS_MMAN_H
+
+// Shared with user/libc/include/sys/mman.h
+
+#include <stdint.h>
+
+#define PROT_NONE       0x0
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define PROT_EXEC       0x4
+
+#define MAP_SHARED      0x01
+#define MAP_PRIVATE     0x02
+#define MAP_FIXED       0x10
+#define MAP_ANONYMOUS   0x20
+
+// Filled in by SYS_MEMINFO
+struct meminfo
+{
+    uint64_t total_frames;
+    uint64_t free_frames;
+    uint64_t thp_mapped;        // 2 MiB pages backing user memory now
+    uint64_t thp_splits;        // User 2 MiB pages broken up since boot
+};
+
+#endif		// _LIBC_SYS_MMAN_H
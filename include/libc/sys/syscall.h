@@ -56,7 +56,11 @@ static inline uint64_t syscall(uint64_t num, uint64_t a1, uint64_t a2, uint64_t
 #define SYS_GETPID  10
 #define SYS_SLEEP   11
 #define SYS_SBRK    12
+#define SYS_MMAP    13
+#define SYS_MUNMAP  14
+#define SYS_MPROTECT 15
 #define SYS_KILL    37
+#define SYS_FORK    57
 #define SYS_EXIT    60
 #define SYS_VGA     100
 #define SYS_REBOOT  161
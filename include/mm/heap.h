@@ -23,27 +23,41 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <mm/slab.h>
 
+/*
+ * Boundary-tagged heap block. The first 16 bytes are the header; the free
+ * list links overlay the payload and are only valid while the block is
+ * free. A copy of size (with bit 0 set when free) sits in the last word.
+ */
 struct heap_block
 {
-	size_t size;
-	bool free;
-	struct heap_block* next;
+	size_t size;					// Whole block including header and footer
+	uint32_t magic;
+	uint32_t free;
+	struct heap_block* next_free;
+	struct heap_block* prev_free;
 };
 
 struct heap_stats
 {
 	size_t total_size;
-	size_t used_size;
+	size_t used_size;				// Bytes in allocated blocks (arena fenceposts excluded)
 	size_t free_size;
 	size_t block_count;
 	size_t free_block_count;
+
+	size_t slab_size;				// Memory held by slab caches
+	size_t slab_used;				// Bytes handed out from slab caches
+	size_t cache_count;
+	struct kmem_cache_stats caches[KMEM_MAX_CACHES];
 };
 
 bool kheap_init(void* start_addrm, size_t size);
 void* kmalloc(size_t size);
 void kfree(void* ptr);
 void kheap_get_stats(struct heap_stats* stats);
+bool kheap_check();
 
 inline void* operator new(size_t, void* p) throw() {
     return p;
@@ -0,0 +1,44 @@
+/*
+ * keonOS - include/mm/kstack.h
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#ifndef KSTACK_H
+#define KSTACK_H
+
+#include <stdint.h>
+
+/*
+ * Kernel thread stacks. Each stack owns a fixed slot in
+ * [KERNEL_KSTACK_BASE, KERNEL_KSTACK_END): the top THREAD_KERNEL_STACK_SIZE
+ * bytes are mapped and the rest of the slot is left unmapped, so running off
+ * the bottom of a stack faults instead of corrupting a neighbour.
+ */
+struct kstack_stats
+{
+	uint64_t in_use;
+	uint64_t cached;			// Freed stacks still mapped, ready for reuse
+	uint64_t peak;				// Most slots ever handed out
+};
+
+void* kstack_alloc();
+void kstack_free(void* stack);
+bool kstack_is_guard(uintptr_t addr);
+void kstack_get_stats(struct kstack_stats* stats);
+
+#endif		// KSTACK_H
@@ -0,0 +1,65 @@
+/*
+ * keonOS - include/mm/page_cache.h
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class VFSNode;
+
+/*
+ * Page cache for file data. Pages are keyed by a file identity that stays
+ * stable across opens (VFSNode::cache_id) and a page index; a node whose
+ * cache_id is 0 is never cached. Writes only dirty the cached page, which
+ * goes back to disk when the file is closed or too much is dirty. Clean
+ * pages are evicted least recently used first once free memory runs low.
+ */
+enum page_cache_fs
+{
+	PC_FS_EXT4  = 1,		// Object: inode number
+	PC_FS_FAT32 = 2,		// Object: first cluster
+};
+
+inline uint64_t page_cache_id(page_cache_fs fs, uint32_t object)
+{
+	return ((uint64_t)fs << 32) | object;
+}
+
+struct page_cache_stats
+{
+	uint64_t pages;
+	uint64_t dirty;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t writebacks;
+};
+
+uint32_t page_cache_read(VFSNode* node, uint32_t offset, uint32_t size, uint8_t* buffer);
+uint32_t page_cache_write(VFSNode* node, uint32_t offset, uint32_t size, const uint8_t* buffer);
+void* page_cache_get_frame(VFSNode* node, uint32_t index);
+void page_cache_flush(VFSNode* node);
+void page_cache_invalidate(uint64_t file, uint32_t first, uint32_t last);
+uint32_t page_cache_evict(uint32_t max_pages);
+void page_cache_get_stats(struct page_cache_stats* stats);
+
+#endif		// PAGE_CACHE_H
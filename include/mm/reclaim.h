@@ -0,0 +1,62 @@
+/*
+ * keonOS - include/mm/reclaim.h
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <stdint.h>
+
+struct thread_t;
+
+/*
+ * Memory reclaim. Anything that holds frames it could give back registers
+ * a shrinker: count() estimates how many frames it could free right now and
+ * scan(nr) frees up to nr of them, returning how many it did. Shrinkers run
+ * from inside failing allocations too, so they must never sleep and must
+ * skip, not spin on, a lock the allocating code could be holding.
+ *
+ * kswapd keeps free memory between RECLAIM_WMARK_LOW and RECLAIM_WMARK_HIGH
+ * in the background; an allocation that still fails shrinks the caches
+ * itself before giving up.
+ */
+struct shrinker
+{
+	const char* name;
+	uint64_t (*count)();
+	uint64_t (*scan)(uint64_t nr);
+	shrinker* next;
+};
+
+struct reclaim_stats
+{
+	uint64_t kswapd_runs;
+	uint64_t direct_runs;
+	uint64_t reclaimed;			// Frames freed by shrinkers
+	uint64_t oom_kills;
+};
+
+void reclaim_init();
+void register_shrinker(shrinker* s);
+uint64_t reclaim_pages(uint64_t target);
+uint64_t reclaim_direct(uint64_t target);
+bool oom_kill(thread_t* faulting);
+void reclaim_get_stats(struct reclaim_stats* stats);
+
+#endif		// RECLAIM_H
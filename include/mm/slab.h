@@ -0,0 +1,54 @@
+/*
+ * keonOS - include/mm/slab.h
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <kernel/constants.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Slab allocator. Each cache hands out fixed-size objects carved from
+ * buddy blocks reached through the direct map; kmalloc routes small
+ * requests to a set of size-class caches.
+ */
+struct kmem_cache;
+
+struct kmem_cache_stats
+{
+	char name[KMEM_CACHE_NAME_LEN];
+	size_t object_size;
+	size_t active_objects;
+	size_t total_objects;
+	size_t slab_count;
+	size_t slab_bytes;
+};
+
+void kmem_init();
+kmem_cache* kmem_cache_create(const char* name, size_t object_size, size_t align = 0);
+void* kmem_cache_alloc(kmem_cache* cache);
+void kmem_cache_free(kmem_cache* cache, void* obj);
+
+void* kmem_alloc(size_t size);
+bool kmem_free(void* ptr);
+size_t kmem_get_stats(struct kmem_cache_stats* out, size_t max);
+
+#endif		// SLAB_H
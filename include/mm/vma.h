@@ -0,0 +1,79 @@
+/*
+ * keonOS - include/mm/vma.h
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#ifndef VMA_H
+#define VMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct address_space;
+class VFSNode;
+
+/*
+ * Virtual memory areas describe what a process may touch in its user half.
+ * Pages inside an area are only backed by a frame once they are first
+ * accessed; the page fault handler resolves the fault against the areas.
+ */
+enum VMA_FLAGS
+{
+	VMA_READ  = 0x01,
+	VMA_WRITE = 0x02,
+	VMA_EXEC  = 0x04,
+	VMA_SHARED = 0x08,		// File pages may never be written privately
+};
+
+enum vma_kind
+{
+	VMA_IMAGE,			// Program or library segments
+	VMA_HEAP,			// Grown and shrunk by sbrk
+	VMA_STACK,
+	VMA_GUARD,			// Never backed: catches stack overflows
+	VMA_MMAP,			// Anonymous or file mapping made by mmap
+};
+
+struct vm_area
+{
+	uintptr_t start;
+	uintptr_t end;				// Exclusive, page aligned
+	uint32_t flags;				// VMA_FLAGS; guard areas have none
+	vma_kind kind;
+	VFSNode* file;				// Backing file, or null for zero-fill pages
+	uint64_t file_offset;		// File offset that 'start' maps
+	struct vm_area* next;		// Address-sorted
+};
+
+vm_area* vma_create(address_space* as, uintptr_t start, uintptr_t end, uint32_t flags, vma_kind kind);
+vm_area* vma_find(address_space* as, uintptr_t addr);
+vm_area* vma_find_kind(address_space* as, vma_kind kind);
+bool vma_resize(address_space* as, vm_area* vma, uintptr_t new_end);
+bool vma_copy(address_space* dst, address_space* src);
+
+uintptr_t vma_map(address_space* as, uintptr_t addr, size_t length, uint32_t flags, bool fixed,
+				  VFSNode* file, uint64_t offset);
+bool vma_unmap(address_space* as, uintptr_t start, uintptr_t end);
+bool vma_protect(address_space* as, uintptr_t start, uintptr_t end, uint32_t flags);
+void vma_destroy_all(address_space* as);
+
+// *out_of_memory is set when the access was legal but no frame was left for it
+bool vma_handle_fault(address_space* as, uintptr_t addr, bool write, bool* out_of_memory = nullptr);
+uint64_t vma_fault_count();
+
+#endif		// VMA_H
@@ -24,6 +24,12 @@
 #include <stdint.h>
 #include <stddef.h>
 
+enum VM_FLAGS
+{
+	VM_GUARD   = 0x01,		// Leave an unmapped guard page after the area
+	VM_IOREMAP = 0x02,		// Maps memory the area does not own; frames are not freed
+};
+
 class VMM
 {
 public:
@@ -35,5 +41,10 @@ public:
 	static void* map_physical_region(uintptr_t phys_addr, size_t pages, uint32_t flags);
 };
 
+void* vmalloc(size_t size, uint32_t vm_flags = 0);
+void vfree(void* addr);
+void* ioremap(uintptr_t phys_addr, size_t size, uint32_t vm_flags = 0);
+void iounmap(void* addr);
+
 
 #endif		// VMM_H
\ No newline at end of file
@@ -0,0 +1,168 @@
+/*
+ * keonOS - kernel/arch/x86_64/apic.cpp
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#include <kernel/arch/x86_64/apic.h>
+#include <kernel/arch/x86_64/smp.h>
+#include <kernel/arch/x86_64/cpu.h>
+#include <kernel/arch/x86_64/thread.h>
+#include <kernel/constants.h>
+#include <drivers/timer.h>
+#include <mm/vmm.h>
+#include <stdio.h>
+
+#define APIC_BASE_ENABLE    (1ULL << 11)
+#define LAPIC_SVR_ENABLE    (1u << 8)
+#define LAPIC_LVT_MASKED    (1u << 16)
+#define LAPIC_LVT_NMI       (4u << 8)
+#define LAPIC_TIMER_PERIODIC (1u << 17)
+#define LAPIC_TIMER_DIV_16  0x3
+#define LAPIC_ICR_PENDING   (1u << 12)
+#define LAPIC_ICR_INIT      0x4500      // INIT, level assert
+#define LAPIC_ICR_STARTUP   0x4600      // Start-up IPI; the low byte is the start page
+
+/*
+ * Local APIC, one per CPU at the same physical address. Device interrupts
+ * still come from the 8259 PIC through the bootstrap CPU's LINT0 (virtual
+ * wire mode); the local APIC carries the IPIs and each application
+ * processor's scheduler tick.
+ */
+static volatile uint32_t* lapic_regs = nullptr;
+static uint32_t lapic_ticks_per_ms = 0;
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic_regs[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic_regs[reg / 4] = value;
+}
+
+// Maps the register page; done once, since every CPU sees its own APIC there
+bool lapic_init(uintptr_t phys)
+{
+    lapic_regs = (volatile uint32_t*)ioremap(phys, 4096);
+    if (!lapic_regs)
+    {
+        printf("[APIC] Cannot map the local APIC at 0x%lx\n", phys);
+        return false;
+    }
+    return true;
+}
+
+bool lapic_present()
+{
+    return lapic_regs != nullptr;
+}
+
+// Software-enables the calling CPU's APIC. Only the bootstrap CPU keeps the
+// BIOS's LINT0/LINT1 setup, which routes the PIC and NMIs to it.
+void lapic_init_cpu(bool bsp)
+{
+    wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+
+    lapic_write(LAPIC_TPR, 0);
+    if (!bsp)
+    {
+        lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+        lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    }
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_eoi();
+}
+
+uint32_t lapic_id()
+{
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi()
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_send(uint32_t apic_id, uint32_t command)
+{
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) asm volatile("pause");
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+    lapic_send(apic_id, vector);
+}
+
+void lapic_send_init(uint32_t apic_id)
+{
+    lapic_send(apic_id, LAPIC_ICR_INIT);
+}
+
+// 'page' is the physical address the CPU starts at, 4 KiB aligned and below 1 MiB
+void lapic_send_startup(uint32_t apic_id, uintptr_t page)
+{
+    lapic_send(apic_id, LAPIC_ICR_STARTUP | (uint32_t)(page >> 12));
+}
+
+/*
+ * Counts APIC timer ticks across LAPIC_CALIBRATE_MS of PIT time. Runs on the
+ * bootstrap CPU with interrupts on; every CPU's timer runs at the same rate.
+ */
+void lapic_timer_calibrate()
+{
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    // Start on a tick edge so the window is whole ticks long
+    uint64_t start = timer_get_ticks();
+    while (timer_get_ticks() == start) asm volatile("pause");
+
+    uint64_t ticks = timer_ms_to_ticks(LAPIC_CALIBRATE_MS);
+    start = timer_get_ticks();
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    while (timer_get_ticks() - start < ticks) asm volatile("pause");
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_COUNT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    lapic_ticks_per_ms = elapsed / LAPIC_CALIBRATE_MS;
+    printf("[APIC] Timer runs at %u ticks per ms\n", lapic_ticks_per_ms);
+}
+
+// Periodic scheduler tick on the calling CPU
+void lapic_timer_start(uint32_t hz)
+{
+    uint32_t count = (uint32_t)((uint64_t)lapic_ticks_per_ms * 1000 / hz);
+    if (!count) count = 1;
+
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+// The caller has sent the EOI already, as timer_handler does for the PIT
+void lapic_timer_handler()
+{
+    cpu_this()->ticks++;
+    thread_balance_tick();
+    yield();
+}
@@ -0,0 +1,110 @@
+; *****************************************************************************
+; * keonOS - kernel/arch/x86_64/asm/ap_trampoline.asm
+; * Copyright (C) 2025-2026 fmdxp
+; *
+; * This program is free software: you can redistribute it and/or modify
+; * it under the terms of the GNU General Public License as published by
+; * the Free Software Foundation, either version 3 of the License, or
+; * (at your option) any later version.
+; *
+; * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+; * - Original author attributions must be preserved in all copies.
+; * - Modified versions must be marked as different from the original.
+; * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+; *
+; * This program is distributed in the hope that it will be useful,
+; * but WITHOUT ANY WARRANTY; without even the implied warranty of
+; * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+; * See the GNU General Public License for more details.
+; *****************************************************************************
+
+; Application processor start-up code. The bootstrap CPU copies everything
+; between ap_trampoline_start and ap_trampoline_end to TRAMPOLINE_BASE, fills
+; the params block and sends the start-up IPIs; the AP begins here in real
+; mode and climbs to long mode on the kernel's page tables, whose identity
+; map still covers this page. Addresses are taken relative to the copy.
+
+%define TRAMPOLINE_BASE 0x8000          ; AP_TRAMPOLINE_BASE in constants.h
+%define TRAMP(x) ((x) - ap_trampoline_start + TRAMPOLINE_BASE)
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_trampoline_params
+
+section .text
+align 16
+
+[BITS 16]
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    lgdt [TRAMP(tramp_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:TRAMP(ap_protected)
+
+[BITS 32]
+ap_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    mov eax, cr4
+    or eax, 1 << 5                      ; PAE
+    mov cr4, eax
+
+    mov eax, [TRAMP(ap_trampoline_params)]      ; Kernel PML4, below 4 GiB
+    mov cr3, eax
+
+    mov ecx, 0xC0000080
+    rdmsr
+    or eax, 1 << 8                      ; EFER.LME
+    wrmsr
+
+    mov eax, cr0
+    or eax, 1 << 31
+    mov cr0, eax
+    jmp 0x18:TRAMP(ap_long)
+
+[BITS 64]
+ap_long:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    mov rsp, [TRAMP(ap_trampoline_params) + 8]
+    mov rdi, [TRAMP(ap_trampoline_params) + 24]
+    mov rax, [TRAMP(ap_trampoline_params) + 16]
+    call rax                            ; ap_main(cpu), never returns
+
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+align 8
+tramp_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF               ; 0x08: 32-bit code
+    dq 0x00CF92000000FFFF               ; 0x10: data
+    dq 0x00AF9A000000FFFF               ; 0x18: 64-bit code
+tramp_gdt_ptr:
+    dw tramp_gdt_ptr - tramp_gdt - 1
+    dd TRAMP(tramp_gdt)
+
+; struct ap_boot_params in smp.cpp
+align 8
+ap_trampoline_params:
+    dq 0                                ; CR3
+    dq 0                                ; Stack top
+    dq 0                                ; Entry point
+    dq 0                                ; cpu_local*
+ap_trampoline_end:
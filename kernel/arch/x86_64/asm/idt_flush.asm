@@ -104,11 +104,24 @@ IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
 
+; Local APIC: timer (LAPIC_TIMER_VECTOR), TLB shootdown IPI (IPI_TLB_VECTOR)
+; and spurious (LAPIC_SPURIOUS_VECTOR)
+ISR_NOERRCODE 48
+ISR_NOERRCODE 49
+ISR_NOERRCODE 50
+ISR_NOERRCODE 255
+
 extern isr_exception_handler
 
 
 
+; In kernel mode GS always holds the kernel's per-CPU data, so an
+; interrupt from ring 3 swaps it in (CS sits above int_no, err and RIP)
 isr_common_stub:
+    test qword [rsp + 24], 3
+    jz .from_kernel
+    swapgs
+.from_kernel:
     push rax
     push rbx
     push rcx
@@ -150,5 +163,9 @@ isr_common_stub:
     pop rbx
     pop rax
 
+    test qword [rsp + 24], 3
+    jz .to_kernel
+    swapgs
+.to_kernel:
     add rsp, 16
     iretq
\ No newline at end of file
@@ -22,6 +22,8 @@
 global switch_context
 global user_thread_entry
 
+; switch_context(old_rsp, new_rsp, old_on_cpu): once the old thread's
+; registers are saved and its stack is left, another CPU may pick it up
 switch_context:
     pushfq
     push r15
@@ -33,6 +35,7 @@ switch_context:
 
     mov [rdi], rsp
     mov rsp, rsi
+    mov byte [rdx], 0
 
     pop rbp
     pop rbx
@@ -45,6 +48,7 @@ switch_context:
     ret
 
 user_thread_entry:
+    swapgs                  ; Leave the kernel GS base parked for the next entry
     mov ax, 0x1B
     mov ds, ax
     mov es, ax
@@ -20,6 +20,7 @@
 
 [BITS 64]
 global syscall_entry
+global user_fork_return
 extern syscall_handler
 
 syscall_entry:
@@ -53,6 +54,8 @@ syscall_entry:
 
     mov rbp, rsp
     and rsp, -16
+    sub rsp, 8
+    push qword [rbp + 32]   ; Arg 6 U (saved r9) -> Arg 7 C++, on the stack
     call syscall_handler
     mov rsp, rbp
 
@@ -73,5 +76,31 @@ syscall_entry:
     pop r11
     pop rsp
 
+    swapgs
+    o64 sysret
+
+; A forked child starts here on its first switch, with its kernel stack
+; holding a copy of the parent's syscall frame; fork() returns 0 in it
+user_fork_return:
+    cli
+    xor rax, rax
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r9
+    pop r8
+    pop r10
+    pop rdx
+    pop rsi
+    pop rdi
+    pop rbx
+    pop rbp
+
+    pop rcx
+    pop r11
+    pop rsp
+
     swapgs
     o64 sysret
\ No newline at end of file
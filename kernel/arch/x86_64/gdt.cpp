@@ -20,15 +20,19 @@
 
 
 #include <kernel/arch/x86_64/gdt.h>
+#include <kernel/arch/x86_64/smp.h>
+#include <kernel/arch/x86_64/cpu.h>
+#include <kernel/constants.h>
 #include <string.h>
 
-alignas(16) gdt_entry gdt[10]; 
-gdt_ptr gp;
-tss_entry kernel_tss;
+// Every CPU has its own GDT and TSS inside its cpu_local; a double fault
+// gets a known-good stack per CPU, since the usual cause is a thread that
+// ran into the guard below its own stack
+alignas(16) static uint8_t double_fault_stacks[MAX_CPUS][IST_STACK_SIZE];
 
-void gdt_set_tss(int32_t num, uint64_t base, uint32_t limit) 
+void gdt_set_tss(gdt_entry* table, int32_t num, uint64_t base, uint32_t limit) 
 {
-    gdt_tss_descriptor* tss_desc = (gdt_tss_descriptor*)&gdt[num];
+    gdt_tss_descriptor* tss_desc = (gdt_tss_descriptor*)&table[num];
 
     tss_desc->limit_low     = limit & 0xFFFF;
     tss_desc->base_low      = base & 0xFFFF;
@@ -40,43 +44,57 @@ void gdt_set_tss(int32_t num, uint64_t base, uint32_t limit)
     tss_desc->reserved      = 0;
 }
 
-void gdt_set_gate(int32_t num, uint64_t base, uint32_t limit, uint8_t access, uint8_t gran)
+void gdt_set_gate(gdt_entry* table, int32_t num, uint64_t base, uint32_t limit, uint8_t access, uint8_t gran)
 {
-    gdt[num].base_low      = (base & 0xFFFF);
-    gdt[num].base_middle   = (base >> 16) & 0xFF;
-    gdt[num].base_high     = (base >> 24) & 0xFF; 
+    table[num].base_low      = (base & 0xFFFF);
+    table[num].base_middle   = (base >> 16) & 0xFF;
+    table[num].base_high     = (base >> 24) & 0xFF; 
 
-    gdt[num].limit_low     = (limit & 0xFFFF);
-    gdt[num].granularity   = (limit >> 16) & 0x0F;
+    table[num].limit_low     = (limit & 0xFFFF);
+    table[num].granularity   = (limit >> 16) & 0x0F;
 
-    gdt[num].granularity   |= gran & 0xF0;
-    gdt[num].access        = access;
+    table[num].granularity   |= gran & 0xF0;
+    table[num].access        = access;
 }
 
 
+// Stack the running CPU switches to on an interrupt from ring 3
 void tss_set_stack(uintptr_t stack) 
 {
-    kernel_tss.rsp0 = stack & ~0xFULL;
+    cpu_this()->tss.rsp0 = stack & ~0xFULL;
 }
 
 
-void gdt_init()
+// Loads the calling CPU's descriptor tables and points GS at its cpu_local
+void gdt_init_cpu(cpu_local* cpu)
 {
-    memset(gdt, 0, sizeof(gdt));
+    gdt_entry* table = cpu->gdt;
+    memset(table, 0, sizeof(cpu->gdt));
 
-    gdt_set_gate(0, 0, 0, 0, 0);                
-    gdt_set_gate(1, 0, 0, 0x9A, 0x20);          
-    gdt_set_gate(2, 0, 0, 0x92, 0x00);          
-    gdt_set_gate(3, 0, 0, 0xF2, 0x00); // UData (Indice 3)
-    gdt_set_gate(4, 0, 0, 0xFA, 0x20); // UCode (Indice 4)
+    gdt_set_gate(table, 0, 0, 0, 0, 0);                
+    gdt_set_gate(table, 1, 0, 0, 0x9A, 0x20);          
+    gdt_set_gate(table, 2, 0, 0, 0x92, 0x00);          
+    gdt_set_gate(table, 3, 0, 0, 0xF2, 0x00); // UData (Indice 3)
+    gdt_set_gate(table, 4, 0, 0, 0xFA, 0x20); // UCode (Indice 4)
 
-    kernel_tss.iopb_offset = sizeof(tss_entry);
+    memset(&cpu->tss, 0, sizeof(tss_entry));
+    cpu->tss.iopb_offset = sizeof(tss_entry);
+    cpu->tss.ist[IST_DOUBLE_FAULT - 1] = (uintptr_t)double_fault_stacks[cpu->id] + IST_STACK_SIZE;
 
-    gdt_set_tss(5, (uintptr_t)&kernel_tss, sizeof(tss_entry) - 1);
+    gdt_set_tss(table, 5, (uintptr_t)&cpu->tss, sizeof(tss_entry) - 1);
 
-    gp.limit = (8 * 7) - 1; 
-    gp.base  = (uintptr_t)&gdt;
+    gdt_ptr gp;
+    gp.limit = sizeof(cpu->gdt) - 1; 
+    gp.base  = (uintptr_t)table;
 
     gdt_flush((uintptr_t)&gp);
     tss_load();
+
+    // Loading the GS selector in gdt_flush cleared the base
+    wrmsr(MSR_GS_BASE, (uintptr_t)cpu);
+}
+
+void gdt_init()
+{
+    gdt_init_cpu(smp_cpu(0));
 }
\ No newline at end of file
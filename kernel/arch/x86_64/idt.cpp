@@ -19,7 +19,14 @@
  */
 
 #include <kernel/arch/x86_64/idt.h>
+#include <kernel/arch/x86_64/gdt.h>
 #include <kernel/arch/x86_64/paging.h>
+#include <kernel/arch/x86_64/thread.h>
+#include <kernel/arch/x86_64/apic.h>
+#include <kernel/arch/x86_64/smp.h>
+#include <mm/vma.h>
+#include <mm/kstack.h>
+#include <mm/reclaim.h>
 #include <kernel/panic.h>
 #include <drivers/vga.h>
 #include <stdio.h>
@@ -98,24 +105,73 @@ bool idt_init()
     idt_set_gate(42, (uint64_t)irq10, 0x08, 0x8E); idt_set_gate(43, (uint64_t)irq11, 0x08, 0x8E);
     idt_set_gate(44, (uint64_t)irq12, 0x08, 0x8E); idt_set_gate(45, (uint64_t)irq13, 0x08, 0x8E);
     idt_set_gate(46, (uint64_t)irq14, 0x08, 0x8E); idt_set_gate(47, (uint64_t)irq15, 0x08, 0x8E);
+    idt_set_gate(LAPIC_TIMER_VECTOR, (uint64_t)isr48, 0x08, 0x8E);
+    idt_set_gate(IPI_TLB_VECTOR, (uint64_t)isr49, 0x08, 0x8E);
+    idt_set_gate(IPI_RESCHED_VECTOR, (uint64_t)isr50, 0x08, 0x8E);
+    idt_set_gate(LAPIC_SPURIOUS_VECTOR, (uint64_t)isr255, 0x08, 0x8E);
+    idt_entries[8].ist = IST_DOUBLE_FAULT;
     
     outb(0x20, 0x11); outb(0xA0, 0x11); 
     outb(0x21, 0x20); outb(0xA1, 0x28);
     outb(0x21, 0x04); outb(0xA1, 0x02);
     outb(0x21, 0x01); outb(0xA1, 0x01);
     
-    outb(0x21, 0xF8); 
+    outb(0x21, 0xE8);   // Timer, keyboard, cascade and COM1
     outb(0xA1, 0xFF);
 
-    idt_flush((uintptr_t)(&idt_pointer));
+    idt_load();
     return true;
 }
 
+// Every CPU shares the one IDT
+void idt_load()
+{
+    idt_flush((uintptr_t)(&idt_pointer));
+}
+
+// A thread killed while it ran on another CPU leaves on its way back to ring 3
+static void check_kill_pending(registers_t* regs)
+{
+    thread_t* current = thread_get_current();
+    if ((regs->cs & 3) == 3 && current && current->kill_pending) thread_exit(-1);
+}
+
 extern "C" void page_fault_handler(uint64_t error_code) 
 {
     uint64_t faulting_address;
     asm volatile("mov %%cr2, %0" : "=r" (faulting_address));
+
+    // A not-present fault inside one of the process's areas is first touch;
+    // a write to a present page may be a copy-on-write share after fork
+    thread_t* current = thread_get_current();
+    bool resolvable = !(error_code & PF_PRESENT) || (error_code & PF_WRITE);
+    bool out_of_memory = false;
+    if (current && current->is_user && resolvable &&
+        vma_handle_fault(current->as, faulting_address, error_code & PF_WRITE, &out_of_memory))
+        return;
+
+    // A legal access that found no frame: once the OOM killer has made room
+    // the access is retried, unless the faulting process was its pick
+    if (out_of_memory)
+    {
+        if (oom_kill(current)) return;
+        thread_exit(-1);
+    }
+
+    if (current && current->is_user && (error_code & PF_USER))
+    {
+        vm_area* vma = vma_find(current->as, faulting_address);
+        const char* reason = (vma && vma->kind == VMA_GUARD) ? "stack overflow" : "segmentation fault";
+        printf("\n%s: %s at 0x%lx (error 0x%lx)\n", current->name, reason, faulting_address, (unsigned long)error_code);
+        thread_exit(-1);
+    }
     
+    if (kstack_is_guard(faulting_address))
+    {
+        printf("\n%s: kernel stack overflow at 0x%lx\n", current ? current->name : "?", faulting_address);
+        panic(KernelError::K_ERR_STACK_SMASHED, "Kernel stack overflow", (uint32_t)error_code);
+    }
+
     terminal_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_RED));
     printf("\n=== PAGE FAULT (x86_64) ===\n");
     terminal_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
@@ -132,18 +188,59 @@ extern "C" void isr_exception_handler(registers_t* regs)
 	{
         if (regs->int_no == 32) timer_handler();
         else if (regs->int_no == 33) keyboard_handler();
+        else if (regs->int_no == 36) serial_handler();
         
         if (regs->int_no >= 40) outb(0xA0, 0x20);
         outb(0x20, 0x20);
+        check_kill_pending(regs);
+        return;
+    }
+
+    if (regs->int_no == LAPIC_TIMER_VECTOR)
+    {
+        lapic_eoi();
+        lapic_timer_handler();
+        check_kill_pending(regs);
+        return;
+    }
+
+    if (regs->int_no == IPI_TLB_VECTOR)
+    {
+        smp_tlb_interrupt();
+        lapic_eoi();
+        return;
+    }
+
+    if (regs->int_no == IPI_RESCHED_VECTOR)
+    {
+        lapic_eoi();
+        yield();
+        check_kill_pending(regs);
         return;
     }
 
+    // Spurious interrupts must not be acknowledged
+    if (regs->int_no == LAPIC_SPURIOUS_VECTOR) return;
+
     if (regs->int_no == 14) 
 	{
         page_fault_handler(regs->err_code);
         return;
     }
 
+    // Pushing the page-fault frame onto an overflowed stack ends up here
+    if (regs->int_no == 8)
+    {
+        uint64_t cr2;
+        asm volatile("mov %%cr2, %0" : "=r" (cr2));
+        if (kstack_is_guard(cr2) || kstack_is_guard(regs->rsp))
+        {
+            thread_t* current = thread_get_current();
+            printf("\n%s: kernel stack overflow at 0x%lx\n", current ? current->name : "?", cr2);
+            panic(KernelError::K_ERR_STACK_SMASHED, "Kernel stack overflow", 0, regs);
+        }
+    }
+
     printf("\nEXCEPTION: Int %d (Error Code: 0x%lx)\n", (int)regs->int_no, regs->err_code);
     panic(KernelError::K_ERR_UNKNOWN_ERROR, "CPU Exception", (uint32_t)regs->err_code, regs);
 }
\ No newline at end of file
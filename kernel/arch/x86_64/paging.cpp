@@ -21,19 +21,117 @@
 
 #include <kernel/arch/x86_64/thread.h>
 #include <kernel/arch/x86_64/paging.h>
+#include <kernel/arch/x86_64/cpu.h>
+#include <kernel/arch/x86_64/smp.h>
 #include <drivers/multiboot2.h>
 #include <kernel/constants.h>
 #include <kernel/panic.h>
+#include <mm/heap.h>
+#include <mm/reclaim.h>
 #include <stdint.h>
 #include <string.h>
 
 static pt_entry* kernel_pml4 = nullptr;
+static address_space kernel_space = { nullptr, 0, PCID_KERNEL, 0, nullptr, {0, 0} };
 static uint64_t total_frames = 0;
-static uint64_t used_frames = 0;
+static uint64_t free_frames = 0;
 static uint64_t mapped_pages = 0;
+static uint64_t huge_2m_count = 0;
+static uint64_t huge_1g_count = 0;
+static uint64_t thp_mapped = 0;             // 2 MiB leaves in user address spaces
+static uint64_t thp_splits = 0;
 
-static uint32_t* frame_bitmap = nullptr;
-static uint64_t frame_bitmap_size = 0;
+/*
+ * Binary buddy allocator.
+ * Every physical frame has a small descriptor; free blocks of 2^order frames
+ * are kept in per-order doubly linked lists threaded through the descriptor
+ * of the block's first frame, so splitting and coalescing are O(log n).
+ */
+#define PFA_NO_FRAME    0xFFFFFFFF
+#define PFA_FRAME_FREE  0x01        // Frame heads a free block of 'order'
+
+struct pfa_frame
+{
+    uint32_t next;
+    uint32_t prev;
+    uint8_t  order;
+    uint8_t  flags;
+    uint16_t shares;            // Extra mappings of the frame; 0 when it has a single owner
+    uintptr_t owner;            // Opaque tag set by the frame's user (e.g. its slab)
+};
+
+struct pfa_free_area
+{
+    uint32_t head;
+    uint64_t count;
+};
+
+/*
+ * Memory zones. Each zone has its own free lists, and the default allocation
+ * path walks them from the top down so that frames reachable by 32-bit and
+ * ISA DMA engines are only handed out once higher memory is exhausted. Zone
+ * boundaries are multiples of the largest block, so buddies never straddle two.
+ */
+struct pfa_zone
+{
+    uint64_t end;               // One past the zone's last frame
+    uint64_t present;           // Usable RAM frames given to the zone at boot
+    uint64_t free_frames;
+    pfa_free_area free_area[PFA_MAX_ORDER + 1];
+};
+
+static_assert(PFA_ZONE_DMA_END % (PAGE_SIZE << PFA_MAX_ORDER) == 0, "zone splits a buddy block");
+static_assert(PFA_ZONE_DMA32_END % (PAGE_SIZE << PFA_MAX_ORDER) == 0, "zone splits a buddy block");
+
+static pfa_frame* frames = nullptr;
+static pfa_zone zones[PFA_ZONE_COUNT];
+
+static inline pfa_zone* zone_of(uint32_t frame)
+{
+    if (frame < PFA_ZONE_DMA_END / PAGE_SIZE) return &zones[PFA_ZONE_DMA];
+    if (frame < PFA_ZONE_DMA32_END / PAGE_SIZE) return &zones[PFA_ZONE_DMA32];
+    return &zones[PFA_ZONE_NORMAL];
+}
+
+/*
+ * Per-CPU magazines of single free frames. Order-0 requests are served from
+ * the local magazine with only interrupts disabled; pfa_lock is taken once
+ * per PFA_MAGAZINE_BATCH frames to refill an empty magazine or drain a full one.
+ */
+struct pfa_magazine
+{
+    uint32_t count;
+    uint32_t frames[PFA_MAGAZINE_SIZE];
+    uint64_t hits;
+    uint64_t misses;
+};
+
+static pfa_magazine pfa_magazines[MAX_CPUS];
+
+/*
+ * Pool of frames that are already zeroed. It is topped up by the idle task
+ * so that zero-filled allocations (page tables, user heap and stack pages)
+ * normally skip the clearing cost entirely.
+ */
+static uint32_t zero_pool[PFA_ZERO_POOL_SIZE];
+static uint32_t zero_pool_count = 0;
+static uint64_t zero_pool_hits = 0;
+static uint64_t zero_pool_misses = 0;
+static spinlock_t zero_pool_lock = {0, 0};
+
+/*
+ * PCID tags let the TLB hold translations of several address spaces at once,
+ * so a context switch loads CR3 with the no-flush bit instead of dropping
+ * everything. Kernel-half leaves are global, which keeps them valid under
+ * every tag and lets a plain invlpg invalidate them everywhere.
+ */
+static bool pge_enabled = false;
+static bool pcid_enabled = false;
+static bool invpcid_supported = false;
+static uint64_t pcid_bitmap[PCID_COUNT / 64];
+static uint32_t pcid_next = PCID_KERNEL + 1;
+static uint64_t pcid_used = 0;
+static spinlock_t pcid_lock = {0, 0};
 
 static spinlock_t paging_lock = {0, 0};
 static spinlock_t pfa_lock = {0, 0};
@@ -43,61 +141,437 @@ extern "C" uint64_t _kernel_physical_start;
 extern "C" uint64_t _kernel_end;
 
 
+static void free_list_push(uint32_t frame, uint32_t order)
+{
+    pfa_free_area* free_area = zone_of(frame)->free_area;
+    pfa_frame* f = &frames[frame];
+    f->order = order;
+    f->flags |= PFA_FRAME_FREE;
+    f->prev = PFA_NO_FRAME;
+    f->next = free_area[order].head;
+    if (f->next != PFA_NO_FRAME) frames[f->next].prev = frame;
+    free_area[order].head = frame;
+    free_area[order].count++;
+}
+
+static void free_list_remove(uint32_t frame, uint32_t order)
+{
+    pfa_free_area* free_area = zone_of(frame)->free_area;
+    pfa_frame* f = &frames[frame];
+    if (f->prev != PFA_NO_FRAME) frames[f->prev].next = f->next;
+    else free_area[order].head = f->next;
+    if (f->next != PFA_NO_FRAME) frames[f->next].prev = f->prev;
+
+    f->flags &= ~PFA_FRAME_FREE;
+    f->next = PFA_NO_FRAME;
+    f->prev = PFA_NO_FRAME;
+    free_area[order].count--;
+}
+
+// Returns the first frame of the free block containing 'frame', or PFA_NO_FRAME
+static uint32_t buddy_find_free_block(uint32_t frame, uint32_t* order_out)
+{
+    for (uint32_t order = 0; order <= PFA_MAX_ORDER; order++)
+    {
+        uint32_t head = frame & ~((1U << order) - 1);
+        if ((frames[head].flags & PFA_FRAME_FREE) && frames[head].order == order)
+        {
+            if (order_out) *order_out = order;
+            return head;
+        }
+    }
+    return PFA_NO_FRAME;
+}
+
+// Gives a block back to the free lists, merging it with free buddies
+static void buddy_insert(uint32_t frame, uint32_t order)
+{
+    free_frames += (1ULL << order);
+    zone_of(frame)->free_frames += (1ULL << order);
+
+    while (order < PFA_MAX_ORDER)
+    {
+        uint32_t buddy = frame ^ (1U << order);
+        if (buddy + (1ULL << order) > total_frames) break;
+        if (!(frames[buddy].flags & PFA_FRAME_FREE) || frames[buddy].order != order) break;
+
+        free_list_remove(buddy, order);
+        frame &= ~(1U << order);
+        order++;
+    }
+    free_list_push(frame, order);
+}
+
+// Takes a block of exactly 2^order frames from one zone, splitting a larger one if needed
+static uint32_t buddy_take_zone(pfa_zone* zone, uint32_t order)
+{
+    uint32_t found = order;
+    while (found <= PFA_MAX_ORDER && zone->free_area[found].head == PFA_NO_FRAME) found++;
+    if (found > PFA_MAX_ORDER) return PFA_NO_FRAME;
+
+    uint32_t frame = zone->free_area[found].head;
+    free_list_remove(frame, found);
+
+    while (found > order)
+    {
+        found--;
+        free_list_push(frame + (1U << found), found);
+    }
+
+    free_frames -= (1ULL << order);
+    zone->free_frames -= (1ULL << order);
+    return frame;
+}
+
+// Takes a block from 'highest' or, failing that, the zones below it
+static uint32_t buddy_take(uint32_t order, PFA_ZONE highest = PFA_ZONE_NORMAL)
+{
+    for (int z = highest; z >= 0; z--)
+    {
+        uint32_t frame = buddy_take_zone(&zones[z], order);
+        if (frame != PFA_NO_FRAME) return frame;
+    }
+    return PFA_NO_FRAME;
+}
+
+// Removes a single frame from whatever free block currently contains it
+static void buddy_carve(uint32_t frame)
+{
+    uint32_t order;
+    uint32_t head = buddy_find_free_block(frame, &order);
+    if (head == PFA_NO_FRAME) return;
+
+    free_list_remove(head, order);
+    while (order > 0)
+    {
+        order--;
+        uint32_t half = head + (1U << order);
+        if (frame >= half)
+        {
+            free_list_push(head, order);
+            head = half;
+        }
+        else free_list_push(half, order);
+    }
+    free_frames--;
+    zone_of(frame)->free_frames--;
+}
+
+// Seeds [start, end) with the largest naturally aligned blocks that fit
+static void buddy_add_range(uint64_t start, uint64_t end)
+{
+    while (start < end)
+    {
+        uint32_t order = PFA_MAX_ORDER;
+        while (order > 0 && ((start & ((1ULL << order) - 1)) || start + (1ULL << order) > end))
+            order--;
+
+        buddy_insert((uint32_t)start, order);
+        zone_of((uint32_t)start)->present += (1ULL << order);
+        start += (1ULL << order);
+    }
+}
+
+
+static inline void pfa_clear(void* virt, size_t bytes)
+{
+    uint64_t count = bytes / 8;
+    asm volatile("rep stosq" : "+D"(virt), "+c"(count) : "a"(0ULL) : "memory");
+}
+
+
 void pfa_mark_used(uintptr_t frame_start, uint64_t frame_count) 
 {
     spin_lock(&pfa_lock);
     for (uint64_t i = 0; i < frame_count; i++) 
 	{
         uint64_t frame = (frame_start / PAGE_SIZE) + i;
-        if (frame < total_frames) 
-		{
-            if (!(frame_bitmap[frame / 32] & (1 << (frame % 32)))) 
-			{
-                frame_bitmap[frame / 32] |= (1 << (frame % 32));
-                used_frames++;
+        if (frame < total_frames) buddy_carve((uint32_t)frame);
+    }
+    spin_unlock(&pfa_lock);
+}
+
+void pfa_free_frames(void* frame, uint32_t order) 
+{
+    uint64_t f = (uintptr_t)frame / PAGE_SIZE;
+    if (order > PFA_MAX_ORDER || (f & ((1ULL << order) - 1))) return;
+    if (f + (1ULL << order) > total_frames) return;
+
+    if (order == 0)
+    {
+        uint64_t rflags = local_irq_save();
+        pfa_magazine* mag = &pfa_magazines[cpu_current_id()];
+
+        if (mag->count == PFA_MAGAZINE_SIZE)
+        {
+            mag->misses++;
+            spin_lock(&pfa_lock);
+            for (int i = 0; i < PFA_MAGAZINE_BATCH; i++)
+            {
+                uint32_t cached = mag->frames[--mag->count];
+                if (buddy_find_free_block(cached, nullptr) == PFA_NO_FRAME) buddy_insert(cached, 0);
             }
+            spin_unlock(&pfa_lock);
         }
+        else mag->hits++;
+
+        mag->frames[mag->count++] = (uint32_t)f;
+        local_irq_restore(rflags);
+        return;
     }
+
+    spin_lock(&pfa_lock);
+    if (buddy_find_free_block((uint32_t)f, nullptr) == PFA_NO_FRAME)
+        buddy_insert((uint32_t)f, order);
     spin_unlock(&pfa_lock);
 }
 
+void* pfa_alloc_frames(uint32_t order, uint32_t flags) 
+{
+    if (order > PFA_MAX_ORDER) return nullptr;
+
+    uint32_t frame = PFA_NO_FRAME;
+
+    if (order == 0 && !(flags & PFA_NO_ZERO))
+    {
+        spin_lock_irqsave(&zero_pool_lock);
+        if (zero_pool_count > 0)
+        {
+            frame = zero_pool[--zero_pool_count];
+            zero_pool_hits++;
+        }
+        else zero_pool_misses++;
+        spin_unlock_irqrestore(&zero_pool_lock);
+
+        if (frame != PFA_NO_FRAME) return (void*)((uintptr_t)frame * PAGE_SIZE);
+    }
+
+    if (order == 0)
+    {
+        uint64_t rflags = local_irq_save();
+        pfa_magazine* mag = &pfa_magazines[cpu_current_id()];
+
+        if (mag->count == 0)
+        {
+            mag->misses++;
+            spin_lock(&pfa_lock);
+            while (mag->count < PFA_MAGAZINE_BATCH)
+            {
+                uint32_t fresh = buddy_take(0);
+                if (fresh == PFA_NO_FRAME) break;
+                mag->frames[mag->count++] = fresh;
+            }
+            spin_unlock(&pfa_lock);
+        }
+        else mag->hits++;
+
+        if (mag->count > 0) frame = mag->frames[--mag->count];
+        local_irq_restore(rflags);
+    }
+    else
+    {
+        spin_lock(&pfa_lock);
+        frame = buddy_take(order);
+        spin_unlock(&pfa_lock);
+    }
+
+    // A request that skipped the zero pool can still fall back on it
+    if (frame == PFA_NO_FRAME && order == 0 && (flags & PFA_NO_ZERO))
+    {
+        spin_lock_irqsave(&zero_pool_lock);
+        if (zero_pool_count > 0) frame = zero_pool[--zero_pool_count];
+        spin_unlock_irqrestore(&zero_pool_lock);
+        if (frame != PFA_NO_FRAME) return (void*)((uintptr_t)frame * PAGE_SIZE);
+    }
+
+    if (frame == PFA_NO_FRAME)
+    {
+        // Shrink the caches and try once more before reporting failure
+        if (!(flags & PFA_NO_RECLAIM) && reclaim_direct(1ULL << order))
+            return pfa_alloc_frames(order, flags | PFA_NO_RECLAIM);
+        return nullptr;
+    }
+
+    void* phys_ptr = (void*)((uintptr_t)frame * PAGE_SIZE);
+    if (!(flags & PFA_NO_ZERO)) pfa_clear(phys_to_virt((uintptr_t)phys_ptr), PAGE_SIZE << order);
+    return phys_ptr;
+}
+
 void pfa_free_frame(void* frame) 
 {
-    uint64_t f = (uintptr_t)frame / PAGE_SIZE;
+    pfa_free_frames(frame, 0);
+}
+
+void* pfa_alloc_frame(uint32_t flags) 
+{
+    return pfa_alloc_frames(0, flags);
+}
+
+/*
+ * Allocates from 'zone' or a lower one, for devices that cannot address all
+ * of memory. These requests bypass the zero pool and only look at the local
+ * magazine once the buddy lists of the eligible zones are empty.
+ */
+void* pfa_alloc_frames_zone(uint32_t order, PFA_ZONE zone, uint32_t flags)
+{
+    if (zone >= PFA_ZONE_NORMAL) return pfa_alloc_frames(order, flags);
+    if (order > PFA_MAX_ORDER) return nullptr;
+
     spin_lock(&pfa_lock);
-    if (f < total_frames) 
-	{
-        if (frame_bitmap[f / 32] & (1 << (f % 32))) 
-		{
-            frame_bitmap[f / 32] &= ~(1 << (f % 32));
-            used_frames--;
+    uint32_t frame = buddy_take(order, zone);
+    spin_unlock(&pfa_lock);
+
+    if (frame == PFA_NO_FRAME && order == 0)
+    {
+        uint64_t rflags = local_irq_save();
+        pfa_magazine* mag = &pfa_magazines[cpu_current_id()];
+        for (uint32_t i = 0; i < mag->count; i++)
+        {
+            if (mag->frames[i] >= zones[zone].end) continue;
+            frame = mag->frames[i];
+            mag->frames[i] = mag->frames[--mag->count];
+            break;
         }
+        local_irq_restore(rflags);
     }
-    spin_unlock(&pfa_lock);
+
+    if (frame == PFA_NO_FRAME)
+    {
+        if (!(flags & PFA_NO_RECLAIM) && reclaim_direct(1ULL << order))
+            return pfa_alloc_frames_zone(order, zone, flags | PFA_NO_RECLAIM);
+        return nullptr;
+    }
+
+    void* phys_ptr = (void*)((uintptr_t)frame * PAGE_SIZE);
+    if (!(flags & PFA_NO_ZERO)) pfa_clear(phys_to_virt((uintptr_t)phys_ptr), PAGE_SIZE << order);
+    return phys_ptr;
 }
 
-void* pfa_alloc_frame() 
+void* pfa_alloc_frame_zone(PFA_ZONE zone, uint32_t flags)
 {
-    spin_lock(&pfa_lock);
-    for (uint64_t i = 0; i < frame_bitmap_size; i++) 
-	{
-        if (frame_bitmap[i] != 0xFFFFFFFF) 
-		{
-            uint32_t bit = __builtin_ctz(~frame_bitmap[i]);
-            uint64_t frame = i * 32 + bit;
-            if (frame < total_frames)
-			{
-                frame_bitmap[i] |= (1 << bit);
-                used_frames++;
-                spin_unlock(&pfa_lock);
-                void* phys_ptr = (void*)(frame * PAGE_SIZE);
-                memset(phys_to_virt((uintptr_t)phys_ptr), 0, PAGE_SIZE);
-                return phys_ptr;
+    return pfa_alloc_frames_zone(0, zone, flags);
+}
+
+// Tags every frame of an allocated block so the owner can be found from any address in it
+void pfa_set_owner(void* frame, uint32_t order, void* owner)
+{
+    uint64_t f = (uintptr_t)frame / PAGE_SIZE;
+    if (order > PFA_MAX_ORDER || f + (1ULL << order) > total_frames) return;
+
+    for (uint64_t i = 0; i < (1ULL << order); i++)
+        frames[f + i].owner = (uintptr_t)owner;
+}
+
+void* pfa_get_owner(void* frame)
+{
+    uint64_t f = (uintptr_t)frame / PAGE_SIZE;
+    if (f >= total_frames) return nullptr;
+    return (void*)frames[f].owner;
+}
+
+// Adds a mapping to a frame that is being shared (fork, copy-on-write)
+void pfa_ref_frame(void* frame)
+{
+    uint64_t f = (uintptr_t)frame / PAGE_SIZE;
+    if (f < total_frames) __atomic_add_fetch(&frames[f].shares, 1, __ATOMIC_RELAXED);
+}
+
+// Drops one mapping of a frame and frees it once nobody maps it any more
+void pfa_put_frame(void* frame)
+{
+    uint64_t f = (uintptr_t)frame / PAGE_SIZE;
+    if (f >= total_frames) return;
+
+    uint16_t shares = __atomic_load_n(&frames[f].shares, __ATOMIC_RELAXED);
+    while (shares > 0)
+    {
+        if (__atomic_compare_exchange_n(&frames[f].shares, &shares, shares - 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return;
+    }
+    pfa_free_frame(frame);
+}
+
+uint32_t pfa_frame_shares(void* frame)
+{
+    uint64_t f = (uintptr_t)frame / PAGE_SIZE;
+    if (f >= total_frames) return 0;
+    return __atomic_load_n(&frames[f].shares, __ATOMIC_RELAXED);
+}
+
+// Frames that can be handed out right now, wherever they are parked
+uint64_t pfa_free_frame_count()
+{
+    uint64_t count = free_frames + zero_pool_count;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) count += pfa_magazines[cpu].count;
+    return count;
+}
+
+// Zeroes up to max_frames free frames into the pool, returns how many were added
+uint32_t pfa_zero_pool_refill(uint32_t max_frames)
+{
+    uint32_t added = 0;
+
+    while (added < max_frames)
+    {
+        if (zero_pool_count >= PFA_ZERO_POOL_SIZE) break;
+
+        void* phys = pfa_alloc_frame(PFA_NO_ZERO);
+        if (!phys) break;
+        pfa_clear(phys_to_virt((uintptr_t)phys), PAGE_SIZE);
+
+        spin_lock_irqsave(&zero_pool_lock);
+        bool stored = zero_pool_count < PFA_ZERO_POOL_SIZE;
+        if (stored) zero_pool[zero_pool_count++] = (uint32_t)((uintptr_t)phys / PAGE_SIZE);
+        spin_unlock_irqrestore(&zero_pool_lock);
+
+        if (!stored)
+        {
+            pfa_free_frame(phys);
+            break;
+        }
+        added++;
+    }
+    return added;
+}
+
+/*
+ * Picks a physical home for the frame descriptors right after the kernel,
+ * stepping over the multiboot information structure and any boot modules.
+ */
+static uintptr_t pfa_place_metadata(void* mb2_ptr, uintptr_t size)
+{
+    uintptr_t candidate = (virt_to_phys(&_kernel_end) + 0x1000 + 0xFFF) & ~0xFFFULL;
+    uintptr_t mb2_start = virt_to_phys(mb2_ptr) & ~0xFFFULL;
+    uintptr_t mb2_end = mb2_start + 64 * PAGE_SIZE;
+
+    bool moved = true;
+    while (moved)
+    {
+        moved = false;
+        if (candidate < mb2_end && candidate + size > mb2_start)
+        {
+            candidate = mb2_end;
+            moved = true;
+        }
+
+        for (multiboot_tag* tag = (multiboot_tag*)((uint8_t*)mb2_ptr + 8);
+             tag->type != MULTIBOOT_TAG_TYPE_END;
+             tag = (multiboot_tag*)((uint8_t*)tag + ((tag->size + 7) & ~7)))
+        {
+            if (tag->type != MULTIBOOT_TAG_TYPE_MODULE) continue;
+
+            auto mod_tag = (multiboot_tag_module*)tag;
+            uintptr_t m_start = mod_tag->mod_start & ~0xFFFULL;
+            uintptr_t m_end = ((uintptr_t)mod_tag->mod_end + 0xFFF) & ~0xFFFULL;
+            if (candidate < m_end && candidate + size > m_start)
+            {
+                candidate = m_end;
+                moved = true;
             }
         }
     }
-    spin_unlock(&pfa_lock);
-    return nullptr;
+    return candidate;
 }
 
 void pfa_init_from_multiboot2(void* mb2_ptr) 
@@ -125,13 +599,30 @@ void pfa_init_from_multiboot2(void* mb2_ptr)
 			}
     	}
 
+    // Frames are only reachable through the direct map, so never manage more
+    if (mem_upper > KERNEL_DIRECT_MAP_SIZE) mem_upper = KERNEL_DIRECT_MAP_SIZE;
+
     total_frames = mem_upper / PAGE_SIZE;
-    frame_bitmap_size = (total_frames / 32) + 1;
+    free_frames = 0;
 
-    uintptr_t kernel_end_phys = virt_to_phys(&_kernel_end);
-    frame_bitmap = (uint32_t*)phys_to_virt(kernel_end_phys + 0x1000);
-    memset(frame_bitmap, 0xFF, frame_bitmap_size * 4);
-    used_frames = total_frames;
+    uintptr_t frames_size = total_frames * sizeof(pfa_frame);
+    uintptr_t frames_phys = pfa_place_metadata(mb2_ptr, frames_size);
+    frames = (pfa_frame*)phys_to_virt(frames_phys);
+    memset(frames, 0, frames_size);
+
+    zones[PFA_ZONE_DMA].end = PFA_ZONE_DMA_END / PAGE_SIZE;
+    zones[PFA_ZONE_DMA32].end = PFA_ZONE_DMA32_END / PAGE_SIZE;
+    zones[PFA_ZONE_NORMAL].end = ~0ULL;
+    for (int z = 0; z < PFA_ZONE_COUNT; z++)
+    {
+        zones[z].present = 0;
+        zones[z].free_frames = 0;
+        for (int order = 0; order <= PFA_MAX_ORDER; order++)
+        {
+            zones[z].free_area[order].head = PFA_NO_FRAME;
+            zones[z].free_area[order].count = 0;
+        }
+    }
 
     for (tag = (struct multiboot_tag *)((uint8_t*)mb2_ptr + 8);
          tag->type != MULTIBOOT_TAG_TYPE_END;
@@ -148,12 +639,9 @@ void pfa_init_from_multiboot2(void* mb2_ptr)
 						{
 							uintptr_t start = (entry->addr + 4095) & ~4095;
 							uintptr_t end = (entry->addr + entry->len) & ~4095;
-							for (uintptr_t a = start; a < end; a += PAGE_SIZE)
-							{
-								uint64_t frame = a / PAGE_SIZE;
-								frame_bitmap[frame / 32] &= ~(1 << (frame % 32));
-								used_frames--;
-							}
+							if (end > mem_upper) end = mem_upper;
+							if (start < end)
+								buddy_add_range(start / PAGE_SIZE, end / PAGE_SIZE);
 						}
 					}
 			}
@@ -161,11 +649,12 @@ void pfa_init_from_multiboot2(void* mb2_ptr)
 
     pfa_mark_used(0, 256);
 
+    uintptr_t kernel_end_phys = virt_to_phys(&_kernel_end);
     uintptr_t kernel_start_phys = (uintptr_t)&_kernel_physical_start;
     uint64_t kernel_pages = (kernel_end_phys - kernel_start_phys) / PAGE_SIZE + 2;
     pfa_mark_used(kernel_start_phys, kernel_pages);
 
-    pfa_mark_used(virt_to_phys(frame_bitmap), (frame_bitmap_size * 4 / PAGE_SIZE) + 1);
+    pfa_mark_used(frames_phys, (frames_size + PAGE_SIZE - 1) / PAGE_SIZE);
     pfa_mark_used(virt_to_phys(mb2_ptr), 64);
 
     for (tag = (struct multiboot_tag *)((uint8_t*)mb2_ptr + 8);
@@ -184,6 +673,46 @@ void pfa_init_from_multiboot2(void* mb2_ptr)
         }
 }
 
+/*
+ * Replaces a 1 GiB or 2 MiB leaf with a table of 512 entries one level down
+ * mapping the same range with the same attributes, so that a single 4 KiB
+ * page inside it can be changed.
+ */
+static bool split_huge(pt_entry* entry, bool is_1g)
+{
+    void* table_phys = pfa_alloc_frame(PFA_NO_ZERO);
+    if (!table_phys) return false;
+    pt_entry* table = (pt_entry*)phys_to_virt((uintptr_t)table_phys);
+
+    uint64_t span = is_1g ? PAGE_SIZE_1G : PAGE_SIZE_2M;
+    uint64_t step = is_1g ? PAGE_SIZE_2M : PAGE_SIZE;
+    uint64_t base = *entry & PTE_ADDR_MASK & ~(span - 1);
+    uint64_t attrs = *entry & (0xFFFULL | PTE_NX) & ~(PTE_HUGE | PTE_ACCESSED | PTE_DIRTY);
+
+    for (int i = 0; i < 512; i++)
+        table[i] = (base + i * step) | attrs | (is_1g ? (uint64_t)PTE_HUGE : 0ULL);
+
+    *entry = (uintptr_t)table_phys | (attrs & (PTE_PRESENT | PTE_RW | PTE_USER));
+
+    if (is_1g)
+    {
+        huge_1g_count--;
+        huge_2m_count += 512;
+    }
+    else
+    {
+        if (attrs & PTE_USER)
+        {
+            thp_mapped--;
+            thp_splits++;
+        }
+        else huge_2m_count--;
+        mapped_pages += 512;
+    }
+    return true;
+}
+
+// Walks to the 4 KiB PTE for virtual_addr, splitting any huge leaf on the way
 static pt_entry* get_pte(pt_entry* pml4_base, void* virtual_addr, bool create, uint64_t flags = 0)
 {
     pt_entry* table = pml4_base;
@@ -196,102 +725,728 @@ static pt_entry* get_pte(pt_entry* pml4_base, void* virtual_addr, bool create, u
         PT_IDX(addr)
     };
 
+    pt_entry* created[3] = { nullptr, nullptr, nullptr };
+
     for (int i = 0; i < 3; i++) 
 	{
         if (!(table[indices[i]] & PTE_PRESENT)) 
         {
             if (!create) return nullptr;
             void* new_tab_phys = pfa_alloc_frame();
-            if (!new_tab_phys) return nullptr;
+            if (!new_tab_phys)
+            {
+                // Unlink the empty tables this walk added, deepest first
+                while (i-- > 0)
+                {
+                    if (!created[i]) continue;
+                    pfa_free_frame((void*)(*created[i] & PTE_ADDR_MASK));
+                    *created[i] = 0;
+                }
+                return nullptr;
+            }
             
             table[indices[i]] = (uintptr_t)new_tab_phys | PTE_PRESENT | PTE_RW | (flags & PTE_USER);
+            created[i] = &table[indices[i]];
         }
         else
         {
+            if (i > 0 && (table[indices[i]] & PTE_HUGE) && !split_huge(&table[indices[i]], i == 1))
+                return nullptr;
             if (flags & PTE_USER) table[indices[i]] |= PTE_USER;
             if (flags & PTE_RW) table[indices[i]] |= PTE_RW;
         }
-        table = (pt_entry*)phys_to_virt(table[indices[i]] & ~0xFFFULL);
+        table = (pt_entry*)phys_to_virt(table[indices[i]] & PTE_ADDR_MASK);
     }
     return &table[indices[3]];
 }
 
-static pt_entry* get_current_pml4_virt() 
+// Finds the leaf entry mapping virtual_addr at whatever level it sits, without splitting
+static pt_entry* get_leaf(pt_entry* pml4_base, void* virtual_addr, uint64_t* page_size)
 {
+    pt_entry* table = pml4_base;
+    uintptr_t addr = (uintptr_t)virtual_addr;
+    uintptr_t indices[4] = { PML4_IDX(addr), PDPT_IDX(addr), PD_IDX(addr), PT_IDX(addr) };
+    uint64_t sizes[4] = { 0, PAGE_SIZE_1G, PAGE_SIZE_2M, PAGE_SIZE };
+
+    for (int i = 0; i < 4; i++)
+    {
+        pt_entry* entry = &table[indices[i]];
+        if (!(*entry & PTE_PRESENT)) return nullptr;
+        if (i == 3 || (i > 0 && (*entry & PTE_HUGE)))
+        {
+            if (page_size) *page_size = sizes[i];
+            return entry;
+        }
+        table = (pt_entry*)phys_to_virt(*entry & PTE_ADDR_MASK);
+    }
+    return nullptr;
+}
+
+// Installs a 1 GiB (PDPT) or 2 MiB (PD) leaf. Only used while building fresh tables.
+static bool map_huge(pt_entry* pml4_base, uintptr_t virt, uintptr_t phys, bool is_1g, uint64_t flags)
+{
+    pt_entry* table = pml4_base;
+    uintptr_t indices[3] = { PML4_IDX(virt), PDPT_IDX(virt), PD_IDX(virt) };
+    int leaf_level = is_1g ? 1 : 2;
+
+    for (int i = 0; i < leaf_level; i++)
+    {
+        if (!(table[indices[i]] & PTE_PRESENT))
+        {
+            void* new_tab_phys = pfa_alloc_frame();
+            if (!new_tab_phys) return false;
+            table[indices[i]] = (uintptr_t)new_tab_phys | PTE_PRESENT | PTE_RW | (flags & PTE_USER);
+        }
+        else if (table[indices[i]] & PTE_HUGE) return false;
+        table = (pt_entry*)phys_to_virt(table[indices[i]] & PTE_ADDR_MASK);
+    }
+
+    table[indices[leaf_level]] = phys | flags | PTE_PRESENT | PTE_HUGE;
+    if (is_1g) huge_1g_count++;
+    else huge_2m_count++;
+    return true;
+}
+
+static bool is_kernel_half(uintptr_t virt)
+{
+    return virt >= 0xFFFF800000000000ULL;
+}
+
+// Kernel-half addresses always resolve through the shared kernel tables
+static pt_entry* as_root(address_space* as, void* virt)
+{
+    if (!as || is_kernel_half((uintptr_t)virt)) return kernel_pml4;
+    return as->pml4;
+}
+
+static bool as_is_loaded(address_space* as, void* virt)
+{
+    if (!as || is_kernel_half((uintptr_t)virt)) return true;
     uintptr_t cr3;
     asm volatile("mov %%cr3, %0" : "=r"(cr3));
-    return (pt_entry*)phys_to_virt(cr3 & ~0xFFFULL);
+    return (cr3 & PTE_ADDR_MASK) == as->pml4_phys;
+}
+
+/*
+ * Drops any cached translation of virt in 'as'. A space that is not loaded
+ * can still hold entries under its PCID: they are removed with INVPCID when
+ * available, otherwise the space is flushed the next time it is loaded.
+ * Other CPUs are shot down unless the old entry was not present: kernel
+ * mappings that are only being added cannot be cached anywhere.
+ */
+static void flush_page(address_space* as, void* virt, bool was_present = true)
+{
+    bool kernel = !as || is_kernel_half((uintptr_t)virt);
+    if (as_is_loaded(as, virt))
+        asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+    else if (pcid_enabled && as->pcid != PCID_OVERFLOW)
+    {
+        uint32_t self = 1u << cpu_current_id();
+        if (!(__atomic_load_n(&as->flush_pending, __ATOMIC_RELAXED) & self))
+        {
+            if (invpcid_supported) invpcid(0, as->pcid, (uintptr_t)virt);
+            else __atomic_or_fetch(&as->flush_pending, self, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (was_present || !kernel) smp_flush_tlb(kernel ? nullptr : as, (uintptr_t)virt);
+}
+
+// Hands out tags round-robin so a freed one is reused as late as possible
+static uint16_t pcid_alloc()
+{
+    if (!pcid_enabled) return PCID_KERNEL;
+
+    spin_lock(&pcid_lock);
+    uint16_t pcid = PCID_OVERFLOW;
+    for (uint32_t n = 0; n < PCID_OVERFLOW - 1; n++)
+    {
+        uint32_t candidate = pcid_next;
+        pcid_next = (pcid_next + 1 < PCID_OVERFLOW) ? pcid_next + 1 : PCID_KERNEL + 1;
+
+        if (!(pcid_bitmap[candidate / 64] & (1ULL << (candidate % 64))))
+        {
+            pcid_bitmap[candidate / 64] |= 1ULL << (candidate % 64);
+            pcid_used++;
+            pcid = candidate;
+            break;
+        }
+    }
+    spin_unlock(&pcid_lock);
+    return pcid;
 }
 
-void paging_map_page(void* virt, void* phys, uint64_t flags) 
+static void pcid_free(uint16_t pcid)
+{
+    if (pcid == PCID_KERNEL || pcid >= PCID_OVERFLOW) return;
+
+    spin_lock(&pcid_lock);
+    if (pcid_bitmap[pcid / 64] & (1ULL << (pcid % 64)))
+    {
+        pcid_bitmap[pcid / 64] &= ~(1ULL << (pcid % 64));
+        pcid_used--;
+    }
+    spin_unlock(&pcid_lock);
+}
+
+// Returns false when a page table could not be allocated; nothing is mapped then
+bool paging_map_page(address_space* as, void* virt, void* phys, uint64_t flags) 
 {
     spin_lock(&paging_lock);
-    pt_entry* pte = get_pte(get_current_pml4_virt(), virt, true, flags);
+    pt_entry* pte = get_pte(as_root(as, virt), virt, true, flags);
     if (pte) 
     {
+        bool was_present = *pte & PTE_PRESENT;
+        if (pge_enabled && is_kernel_half((uintptr_t)virt)) flags |= PTE_GLOBAL;
         *pte = ((uintptr_t)phys & ~0xFFFULL) | flags | PTE_PRESENT;
-        mapped_pages++;
+        if (!was_present) mapped_pages++;
 
-        // Use invlpg to invalidate the TLB for this specific address
-        // This is much faster than reloading CR3 (which flushes the entire TLB)
-        asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+        // Invalidate just this address (and the upper levels get_pte may
+        // have widened) instead of reloading CR3
+        flush_page(as, virt, was_present);
     }
     spin_unlock(&paging_lock);
+    return pte != nullptr;
 }
 
 
-void paging_unmap_page(void* virt) 
+// Returns false when nothing was unmapped, including when a huge leaf could not be split
+bool paging_unmap_page(address_space* as, void* virt) 
 {
     spin_lock(&paging_lock);
-    pt_entry* pte = get_pte(get_current_pml4_virt(), virt, false);
-    if (pte && (*pte & PTE_PRESENT)) 
+    pt_entry* pte = get_pte(as_root(as, virt), virt, false);
+    bool unmapped = pte && (*pte & PTE_PRESENT);
+    if (unmapped) 
     {
         *pte = 0;
         mapped_pages--;
-        asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+        flush_page(as, virt);
     }
     spin_unlock(&paging_lock);
+    return unmapped;
 }
 
-void* paging_create_address_space() 
+// Finds the PD entry covering a user address, creating the upper tables if asked
+static pt_entry* get_user_pde(address_space* as, uintptr_t virt, bool create)
 {
-    void* new_pml4_phys = pfa_alloc_frame();
+    pt_entry* table = as->pml4;
+    uintptr_t indices[2] = { PML4_IDX(virt), PDPT_IDX(virt) };
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (!(table[indices[i]] & PTE_PRESENT))
+        {
+            if (!create) return nullptr;
+            void* new_tab_phys = pfa_alloc_frame();
+            if (!new_tab_phys) return nullptr;
+            table[indices[i]] = (uintptr_t)new_tab_phys | PTE_PRESENT | PTE_RW | PTE_USER;
+        }
+        else if (table[indices[i]] & PTE_HUGE) return nullptr;
+        table = (pt_entry*)phys_to_virt(table[indices[i]] & PTE_ADDR_MASK);
+    }
+    return &table[PD_IDX(virt)];
+}
+
+// True if the PD entry maps nothing: it is empty or points to a table with no pages left
+static bool pde_is_vacant(pt_entry* pde)
+{
+    if (!(*pde & PTE_PRESENT)) return true;
+    if (*pde & PTE_HUGE) return false;
+
+    pt_entry* table = (pt_entry*)phys_to_virt(*pde & PTE_ADDR_MASK);
+    for (int i = 0; i < 512; i++)
+        if (table[i] & PTE_PRESENT) return false;
+    return true;
+}
+
+// Whether the 2 MiB range at virt (aligned) could take a huge user leaf right now
+bool paging_can_map_huge(address_space* as, void* virt)
+{
+    if (!as || as == &kernel_space || is_kernel_half((uintptr_t)virt)) return false;
+    if ((uintptr_t)virt & (PAGE_SIZE_2M - 1)) return false;
+
+    spin_lock(&paging_lock);
+    pt_entry* pde = get_user_pde(as, (uintptr_t)virt, false);
+    bool vacant = !pde || pde_is_vacant(pde);
+    spin_unlock(&paging_lock);
+    return vacant;
+}
+
+/*
+ * Maps an order-9 block with a single 2 MiB leaf. Fails unless both
+ * addresses are 2 MiB aligned and nothing in the range is mapped yet; an
+ * empty page table left behind by earlier 4 KiB mappings is freed.
+ */
+bool paging_map_huge_page(address_space* as, void* virt, void* phys, uint64_t flags)
+{
+    if (!as || as == &kernel_space || is_kernel_half((uintptr_t)virt)) return false;
+    if (((uintptr_t)virt | (uintptr_t)phys) & (PAGE_SIZE_2M - 1)) return false;
+
+    spin_lock(&paging_lock);
+    pt_entry* pde = get_user_pde(as, (uintptr_t)virt, true);
+    bool ok = pde && pde_is_vacant(pde);
+    if (ok)
+    {
+        void* old_table = (*pde & PTE_PRESENT) ? (void*)(*pde & PTE_ADDR_MASK) : nullptr;
+        *pde = (uintptr_t)phys | flags | PTE_PRESENT | PTE_HUGE;
+        thp_mapped++;
+        flush_page(as, virt);
+        if (old_table) pfa_free_frame(old_table);
+    }
+    spin_unlock(&paging_lock);
+    return ok;
+}
+
+// Removes the 2 MiB user leaf at virt and returns its block, or null if there is none
+void* paging_unmap_huge_page(address_space* as, void* virt)
+{
+    if (!as || as == &kernel_space || ((uintptr_t)virt & (PAGE_SIZE_2M - 1))) return nullptr;
+
+    spin_lock(&paging_lock);
+    pt_entry* pde = get_user_pde(as, (uintptr_t)virt, false);
+    void* phys = nullptr;
+    if (pde && (*pde & PTE_PRESENT) && (*pde & PTE_HUGE))
+    {
+        phys = (void*)(*pde & PTE_ADDR_MASK);
+        *pde = 0;
+        thp_mapped--;
+        flush_page(as, virt);
+    }
+    spin_unlock(&paging_lock);
+    return phys;
+}
+
+address_space* paging_kernel_space()
+{
+    return &kernel_space;
+}
+
+address_space* paging_create_address_space() 
+{
+    address_space* as = (address_space*)kmalloc(sizeof(address_space));
+    if (!as) return nullptr;
+
+    void* new_pml4_phys = pfa_alloc_frame(PFA_NO_ZERO);
+    if (!new_pml4_phys)
+    {
+        kfree(as);
+        return nullptr;
+    }
     pt_entry* new_pml4_virt = (pt_entry*)phys_to_virt((uintptr_t)new_pml4_phys);
     
-    memset(new_pml4_virt, 0, PAGE_SIZE);
+    memset(new_pml4_virt, 0, PAGE_SIZE / 2);
 
+    // Every kernel mapping lives under these entries, so later changes are shared
     for (int i = 256; i < 512; i++)
         new_pml4_virt[i] = kernel_pml4[i];
 
-    return new_pml4_phys;
+    as->pml4 = new_pml4_virt;
+    as->pml4_phys = (uintptr_t)new_pml4_phys;
+
+    // A recycled tag may still have the previous owner's entries in any TLB
+    as->pcid = pcid_alloc();
+    as->flush_pending = ~0u;
+    as->vmas = nullptr;
+    as->vma_lock = {0, 0};
+    return as;
 }
 
-void* paging_get_physical_address(void* virt) 
+// Frees a user-half table and everything it maps; level 1 is a PDPT, 3 a PT
+static void free_user_table(pt_entry* table, int level)
 {
+    for (int i = 0; i < 512; i++)
+    {
+        pt_entry entry = table[i];
+        if (!(entry & PTE_PRESENT)) continue;
+
+        void* phys = (void*)(entry & PTE_ADDR_MASK);
+        if (level == 3)
+        {
+            pfa_put_frame(phys);
+            mapped_pages--;
+        }
+        else if (level == 2 && (entry & PTE_HUGE))
+        {
+            pfa_free_frames(phys, 9);
+            thp_mapped--;
+        }
+        else if (!(entry & PTE_HUGE))
+        {
+            free_user_table((pt_entry*)phys_to_virt((uintptr_t)phys), level + 1);
+            pfa_free_frame(phys);
+        }
+    }
+}
+
+void paging_destroy_address_space(address_space* as)
+{
+    if (!as || as == &kernel_space) return;
+
     spin_lock(&paging_lock);
-    pt_entry* pte = get_pte(get_current_pml4_virt(), virt, false);
+    for (int i = 0; i < 256; i++)
+    {
+        if (!(as->pml4[i] & PTE_PRESENT)) continue;
+        pt_entry* pdpt = (pt_entry*)phys_to_virt(as->pml4[i] & PTE_ADDR_MASK);
+        free_user_table(pdpt, 1);
+        pfa_free_frame((void*)(as->pml4[i] & PTE_ADDR_MASK));
+    }
+    spin_unlock(&paging_lock);
+
+    pcid_free(as->pcid);
+    pfa_free_frame((void*)as->pml4_phys);
+    kfree(as);
+}
+
+/*
+ * Mirrors a user-half table into a fresh one. Leaves are shared rather than
+ * copied: writable ones lose PTE_RW in both spaces and gain PTE_COW, so the
+ * first write from either side takes a fault and gets a private copy.
+ */
+static bool fork_user_table(pt_entry* src, pt_entry* dst, int level)
+{
+    for (int i = 0; i < 512; i++)
+    {
+        if (!(src[i] & PTE_PRESENT)) continue;
+
+        // Share 2 MiB leaves page by page so every frame has its own count
+        if (level == 2 && (src[i] & PTE_HUGE) && !split_huge(&src[i], false)) return false;
+
+        if (level == 3)
+        {
+            if (src[i] & PTE_RW) src[i] = (src[i] & ~(uint64_t)PTE_RW) | PTE_COW;
+            pfa_ref_frame((void*)(src[i] & PTE_ADDR_MASK));
+            dst[i] = src[i];
+            mapped_pages++;
+            continue;
+        }
+
+        void* table_phys = pfa_alloc_frame();
+        if (!table_phys) return false;
+        dst[i] = (uintptr_t)table_phys | (src[i] & ~PTE_ADDR_MASK);
+
+        if (!fork_user_table((pt_entry*)phys_to_virt(src[i] & PTE_ADDR_MASK),
+                             (pt_entry*)phys_to_virt((uintptr_t)table_phys), level + 1))
+            return false;
+    }
+    return true;
+}
+
+address_space* paging_fork_address_space(address_space* parent)
+{
+    if (!parent || parent == &kernel_space) return nullptr;
+
+    address_space* child = paging_create_address_space();
+    if (!child) return nullptr;
+
+    spin_lock(&paging_lock);
+    bool ok = true;
+    for (int i = 0; ok && i < 256; i++)
+    {
+        if (!(parent->pml4[i] & PTE_PRESENT)) continue;
+
+        void* pdpt_phys = pfa_alloc_frame();
+        if (!pdpt_phys)
+        {
+            ok = false;
+            break;
+        }
+        child->pml4[i] = (uintptr_t)pdpt_phys | (parent->pml4[i] & ~PTE_ADDR_MASK);
+        ok = fork_user_table((pt_entry*)phys_to_virt(parent->pml4[i] & PTE_ADDR_MASK),
+                             (pt_entry*)phys_to_virt((uintptr_t)pdpt_phys), 1);
+    }
+    spin_unlock(&paging_lock);
+
+    // The parent's TLB still holds writable translations of what is now shared
+    paging_flush_address_space(parent);
+    if (as_is_loaded(parent, nullptr)) paging_switch_address_space(parent);
+
+    if (!ok)
+    {
+        paging_destroy_address_space(child);
+        return nullptr;
+    }
+    return child;
+}
+
+/*
+ * Resolves a write to a copy-on-write page. The last sharer simply takes
+ * the frame back as writable; others copy it first. Returns false when the
+ * page is not a copy-on-write mapping (a real protection fault), or when no
+ * frame was left for the copy, which sets *out_of_memory.
+ */
+bool paging_handle_cow(address_space* as, void* virt, bool* out_of_memory)
+{
+    spin_lock(&paging_lock);
+    pt_entry* pte = get_pte(as_root(as, virt), virt, false);
+    if (!pte || !(*pte & PTE_PRESENT) || (!(*pte & PTE_COW) && !(*pte & PTE_RW)))
+    {
+        spin_unlock(&paging_lock);
+        return false;
+    }
+
+    if (*pte & PTE_COW)
+    {
+        void* old_frame = (void*)(*pte & PTE_ADDR_MASK);
+        uint64_t attrs = (*pte & ~PTE_ADDR_MASK & ~(uint64_t)PTE_COW) | PTE_RW;
+
+        if (pfa_frame_shares(old_frame) == 0) *pte = (uintptr_t)old_frame | attrs;
+        else
+        {
+            void* new_frame = pfa_alloc_frame(PFA_NO_ZERO);
+            if (!new_frame)
+            {
+                spin_unlock(&paging_lock);
+                if (out_of_memory) *out_of_memory = true;
+                return false;
+            }
+            memcpy(phys_to_virt((uintptr_t)new_frame), phys_to_virt((uintptr_t)old_frame), PAGE_SIZE);
+            *pte = (uintptr_t)new_frame | attrs;
+            pfa_put_frame(old_frame);
+        }
+        flush_page(as, virt);
+    }
+    spin_unlock(&paging_lock);
+    return true;
+}
+
+/*
+ * Re-applies an area's protection to one mapped page. A user bit of 0
+ * keeps the page mapped but out of reach (PROT_NONE); a frame that is
+ * still shared only regains write access through copy-on-write.
+ */
+void paging_protect_page(address_space* as, void* virt, bool user, bool writable)
+{
+    spin_lock(&paging_lock);
+    pt_entry* pte = get_pte(as_root(as, virt), virt, false);
+    if (pte && (*pte & PTE_PRESENT))
+    {
+        uint64_t entry = *pte & ~(uint64_t)(PTE_USER | PTE_RW);
+        if (user) entry |= PTE_USER;
+        if (writable)
+        {
+            bool shared = (entry & PTE_COW) || pfa_frame_shares((void*)(entry & PTE_ADDR_MASK)) > 0;
+            entry |= shared ? (uint64_t)PTE_COW : (uint64_t)PTE_RW;
+        }
+        if (entry != *pte)
+        {
+            *pte = entry;
+            flush_page(as, virt);
+        }
+    }
+    spin_unlock(&paging_lock);
+}
+
+/*
+ * paging_protect_page over [start, end). Huge leaves that lie entirely
+ * inside the range are changed in place; the others are split first.
+ */
+void paging_protect_range(address_space* as, uintptr_t start, uintptr_t end, bool user, bool writable)
+{
+    uintptr_t addr = start;
+    while (addr < end)
+    {
+        spin_lock(&paging_lock);
+        uint64_t size = PAGE_SIZE;
+        pt_entry* leaf = get_leaf(as_root(as, (void*)addr), (void*)addr, &size);
+        bool whole = leaf && size == PAGE_SIZE_2M && !(addr & (size - 1)) && addr + size <= end;
+        if (whole)
+        {
+            uint64_t entry = *leaf & ~(uint64_t)(PTE_USER | PTE_RW);
+            if (user) entry |= PTE_USER;
+            if (writable) entry |= PTE_RW;
+            if (entry != *leaf)
+            {
+                *leaf = entry;
+                flush_page(as, (void*)addr);
+            }
+        }
+        spin_unlock(&paging_lock);
+
+        if (whole) addr += PAGE_SIZE_2M;
+        else
+        {
+            paging_protect_page(as, (void*)addr, user, writable);
+            addr += PAGE_SIZE;
+        }
+    }
+}
+
+// Loads 'as' on the calling CPU, which must not migrate meanwhile (IF clear)
+void paging_switch_address_space(address_space* as)
+{
+    if (!as) as = &kernel_space;
+
+    // Published before the pending bit is read, so a concurrent shootdown
+    // either sees this CPU running the space or leaves the bit set for it
+    cpu_local* cpu = cpu_this();
+    __atomic_store_n(&cpu->as, as, __ATOMIC_SEQ_CST);
+
+    uint64_t cr3 = as->pml4_phys;
+    if (pcid_enabled)
+    {
+        uint32_t self = 1u << cpu->id;
+        bool stale = __atomic_fetch_and(&as->flush_pending, ~self, __ATOMIC_SEQ_CST) & self;
+        cr3 |= as->pcid;
+        if (!stale && as->pcid != PCID_OVERFLOW) cr3 |= CR3_NOFLUSH;
+    }
+    asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+// Makes the next load of 'as' on every CPU start from an empty TLB for its tag
+void paging_flush_address_space(address_space* as)
+{
+    if (as) __atomic_store_n(&as->flush_pending, ~0u, __ATOMIC_SEQ_CST);
+}
+
+void* paging_get_physical_address(address_space* as, void* virt) 
+{
+    spin_lock(&paging_lock);
+    uint64_t size = PAGE_SIZE;
+    pt_entry* leaf = get_leaf(as_root(as, virt), virt, &size);
     void* phys = nullptr;
-    if (pte && (*pte & PTE_PRESENT)) phys = (void*)((*pte & ~0xFFFULL) + ((uintptr_t)virt & 0xFFF));
+    if (leaf) phys = (void*)((*leaf & PTE_ADDR_MASK & ~(size - 1)) + ((uintptr_t)virt & (size - 1)));
     spin_unlock(&paging_lock);
     return phys;
 }
 
+/*
+ * Gives 'virt' a frame of its own if it currently maps one that is shared
+ * (copy-on-write or a page cache frame). The page keeps its protection.
+ */
+static bool unshare_page(address_space* as, void* virt)
+{
+    spin_lock(&paging_lock);
+    uint64_t size = PAGE_SIZE;
+    pt_entry* pte = get_leaf(as_root(as, virt), virt, &size);
+    bool ok = pte != nullptr;
+    if (ok && size == PAGE_SIZE && pfa_frame_shares((void*)(*pte & PTE_ADDR_MASK)) > 0)
+    {
+        void* old_frame = (void*)(*pte & PTE_ADDR_MASK);
+        void* new_frame = pfa_alloc_frame(PFA_NO_ZERO);
+        ok = new_frame != nullptr;
+        if (ok)
+        {
+            memcpy(phys_to_virt((uintptr_t)new_frame), phys_to_virt((uintptr_t)old_frame), PAGE_SIZE);
+            *pte = (uintptr_t)new_frame | (*pte & ~PTE_ADDR_MASK);
+            pfa_put_frame(old_frame);
+            flush_page(as, virt);
+        }
+    }
+    spin_unlock(&paging_lock);
+    return ok;
+}
+
+// Copies into another space's memory through the direct map, page by page.
+// Shared frames are copied first so the write never leaks into other mappings.
+size_t paging_copy_to(address_space* as, uintptr_t virt, const void* src, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        if (!unshare_page(as, (void*)((virt + done) & ~(uintptr_t)(PAGE_SIZE - 1)))) break;
+        void* phys = paging_get_physical_address(as, (void*)(virt + done));
+        if (!phys) break;
+
+        size_t chunk = PAGE_SIZE - ((virt + done) & (PAGE_SIZE - 1));
+        if (chunk > size - done) chunk = size - done;
+        memcpy(phys_to_virt((uintptr_t)phys), (const uint8_t*)src + done, chunk);
+        done += chunk;
+    }
+    return done;
+}
+
+size_t paging_copy_from(address_space* as, void* dst, uintptr_t virt, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        void* phys = paging_get_physical_address(as, (void*)(virt + done));
+        if (!phys) break;
+
+        size_t chunk = PAGE_SIZE - ((virt + done) & (PAGE_SIZE - 1));
+        if (chunk > size - done) chunk = size - done;
+        memcpy((uint8_t*)dst + done, phys_to_virt((uintptr_t)phys), chunk);
+        done += chunk;
+    }
+    return done;
+}
+
+static uint64_t count_user_table(pt_entry* table, int level)
+{
+    uint64_t pages = 0;
+    for (int i = 0; i < 512; i++)
+    {
+        if (!(table[i] & PTE_PRESENT)) continue;
+        if (level == 3) pages++;
+        else if (table[i] & PTE_HUGE) pages += level == 1 ? 512 * 512 : 512;
+        else pages += count_user_table((pt_entry*)phys_to_virt(table[i] & PTE_ADDR_MASK), level + 1);
+    }
+    return pages;
+}
+
+// Pages mapped in the user half, shared ones included
+uint64_t paging_resident_pages(address_space* as)
+{
+    if (!as || as == &kernel_space) return 0;
+
+    uint64_t pages = 0;
+    spin_lock(&paging_lock);
+    for (int i = 0; i < 256; i++)
+        if (as->pml4[i] & PTE_PRESENT)
+            pages += count_user_table((pt_entry*)phys_to_virt(as->pml4[i] & PTE_ADDR_MASK), 1);
+    spin_unlock(&paging_lock);
+    return pages;
+}
+
 void paging_identity_map(uintptr_t start, uintptr_t size, uint64_t flags) 
 {
     uintptr_t addr = start & ~0xFFFULL;
     uintptr_t end = (start + size + 0xFFF) & ~0xFFFULL;
 
     for (; addr < end; addr += PAGE_SIZE)
-        paging_map_page((void*)addr, (void*)addr, flags);
+        paging_map_page(&kernel_space, (void*)addr, (void*)addr, flags);
 }
 
 void paging_get_stats(struct paging_stats* stats) 
 {
     if (!stats) return;
+    stats->pcp_cached = 0;
+    stats->pcp_hits = 0;
+    stats->pcp_misses = 0;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        stats->pcp_cached += pfa_magazines[cpu].count;
+        stats->pcp_hits += pfa_magazines[cpu].hits;
+        stats->pcp_misses += pfa_magazines[cpu].misses;
+    }
+
+    stats->zero_pool_frames = zero_pool_count;
+    stats->zero_pool_hits = zero_pool_hits;
+    stats->zero_pool_misses = zero_pool_misses;
+
+    spin_lock(&pfa_lock);
     stats->total_frames = total_frames;
-    stats->used_frames = used_frames;
-    stats->free_frames = total_frames - used_frames;
+    stats->free_frames = free_frames + stats->pcp_cached + stats->zero_pool_frames;
+    stats->used_frames = total_frames - stats->free_frames;
     stats->mapped_pages = mapped_pages;
+    stats->huge_2m = huge_2m_count;
+    stats->huge_1g = huge_1g_count;
+    stats->thp_mapped = thp_mapped;
+    stats->thp_splits = thp_splits;
+    stats->pcid_used = pcid_used;
+    stats->pcid_enabled = pcid_enabled;
+    for (int order = 0; order <= PFA_MAX_ORDER; order++)
+    {
+        stats->free_blocks[order] = 0;
+        for (int z = 0; z < PFA_ZONE_COUNT; z++)
+            stats->free_blocks[order] += zones[z].free_area[order].count;
+    }
+    for (int z = 0; z < PFA_ZONE_COUNT; z++)
+    {
+        stats->zone_present[z] = zones[z].present;
+        stats->zone_free[z] = zones[z].free_frames;
+    }
+    spin_unlock(&pfa_lock);
 }
 
 void paging_make_kernel_user_accessible() 
@@ -307,14 +1462,14 @@ void paging_make_kernel_user_accessible()
 
     for (uintptr_t p = k_start; p < k_end; p += 4096)
     {
-        paging_map_page((void*)p, (void*)virt_to_phys((void*)p), PTE_PRESENT | PTE_RW | PTE_USER);
+        paging_map_page(&kernel_space, (void*)p, (void*)virt_to_phys((void*)p), PTE_PRESENT | PTE_RW | PTE_USER);
     }
 }
 
 
-bool paging_is_user_accessible(void* virt)
+bool paging_is_user_accessible(address_space* as, void* virt, bool write)
 {
-    pt_entry* table = get_current_pml4_virt();
+    pt_entry* table = as_root(as, virt);
     uintptr_t addr = (uintptr_t)virt;
     uintptr_t indices[4] = { PML4_IDX(addr), PDPT_IDX(addr), PD_IDX(addr), PT_IDX(addr) };
 
@@ -322,36 +1477,70 @@ bool paging_is_user_accessible(void* virt)
     {
         if (!(table[indices[i]] & PTE_PRESENT)) return false;
         if (!(table[indices[i]] & PTE_USER)) return false;
-        if (i < 3) table = (pt_entry*)phys_to_virt(table[indices[i]] & ~0xFFFULL);
+        bool leaf = i == 3 || (i > 0 && (table[indices[i]] & PTE_HUGE));
+        if (leaf) return !write || (table[indices[i]] & PTE_RW);
+        table = (pt_entry*)phys_to_virt(table[indices[i]] & PTE_ADDR_MASK);
     }
     return true;
 }
 
 
+/*
+ * Per-CPU paging state: global pages, PCIDs and write protection. The
+ * application processors come up on the kernel tables already.
+ */
+void paging_init_cpu()
+{
+    // PCIDE may only be set while CR3 carries PCID 0, which the kernel space keeps
+    uint64_t cr4 = read_cr4();
+    if (pge_enabled) cr4 |= CR4_PGE;
+    if (pcid_enabled) cr4 |= CR4_PCIDE;
+    write_cr4(cr4);
+
+    // Kernel writes must honour read-only PTEs too, or they would bypass copy-on-write
+    uint64_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_WP) : "memory");
+
+    cpu_this()->as = &kernel_space;
+}
+
 void paging_init() 
 {
+    uint64_t start_tsc = rdtsc();
     void* new_pml4_phys = pfa_alloc_frame();
     kernel_pml4 = (pt_entry*)phys_to_virt((uintptr_t)new_pml4_phys);
-    memset(kernel_pml4, 0, PAGE_SIZE);
+    kernel_space.pml4 = kernel_pml4;
+    kernel_space.pml4_phys = (uintptr_t)new_pml4_phys;
     
-    for (uintptr_t p = 0; p < 512 * 1024 * 1024; p += PAGE_SIZE)
-    {
-        pt_entry* pte1 = get_pte(kernel_pml4, (void*)p, true, PTE_PRESENT | PTE_RW);
-        *pte1 = p | PTE_PRESENT | PTE_RW;
+    // Kernel-half leaves are global so they survive every address space switch
+    pge_enabled = cpu_has_pge();
+    uint64_t global = pge_enabled ? (uint64_t)PTE_GLOBAL : 0ULL;
 
-        pt_entry* pte2 = get_pte(kernel_pml4, phys_to_virt(p), true, PTE_PRESENT | PTE_RW);
-        *pte2 = p | PTE_PRESENT | PTE_RW;
+    // Identity and higher-half direct maps use the largest leaves available
+    bool use_1g = cpu_has_pdpe1gb();
+    for (uintptr_t p = 0; p < KERNEL_DIRECT_MAP_SIZE;)
+    {
+        bool is_1g = use_1g && !(p & (PAGE_SIZE_1G - 1)) && p + PAGE_SIZE_1G <= KERNEL_DIRECT_MAP_SIZE;
+        map_huge(kernel_pml4, p, p, is_1g, PTE_PRESENT | PTE_RW);
+        map_huge(kernel_pml4, (uintptr_t)phys_to_virt(p), p, is_1g, PTE_PRESENT | PTE_RW | global);
+        p += is_1g ? PAGE_SIZE_1G : PAGE_SIZE_2M;
     }
 
     for (uintptr_t p = 0; p < 1024 * 1024; p += PAGE_SIZE) 
-        paging_map_page((void*)(0xffffffffc0000000 + p), (void*)p, PTE_PRESENT | PTE_RW);
-
-    uintptr_t vga_phys = 0xB8000;
-    uintptr_t vga_virt = 0xffffffff800b8000;
+        paging_map_page(&kernel_space, (void*)(0xffffffffc0000000 + p), (void*)p, PTE_PRESENT | PTE_RW);
 
-    pt_entry* vga_pte = get_pte(kernel_pml4, (void*)vga_virt, true, PTE_PRESENT | PTE_RW);
-    *vga_pte = vga_phys | PTE_PRESENT | PTE_RW;
+    // VGA memory (0xB8000) is reached through the direct map at VGA_MEMORY
     asm volatile("mov %0, %%cr3" : : "r"(new_pml4_phys) : "memory");
 
-    printf("[PAGING] Paging active\n");
+    if (pge_enabled && cpu_has_pcid())
+    {
+        pcid_enabled = true;
+        invpcid_supported = cpu_has_invpcid();
+        pcid_bitmap[PCID_KERNEL / 64] |= 1ULL << (PCID_KERNEL % 64);
+    }
+    paging_init_cpu();
+
+    printf("[PAGING] Paging active (%s pages, PCID %s, %lu cycles)\n", use_1g ? "1G" : "2M",
+           pcid_enabled ? (invpcid_supported ? "on+invpcid" : "on") : "off", rdtsc() - start_tsc);
 }
\ No newline at end of file
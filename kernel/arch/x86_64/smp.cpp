@@ -0,0 +1,241 @@
+/*
+ * keonOS - kernel/arch/x86_64/smp.cpp
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#include <kernel/arch/x86_64/smp.h>
+#include <kernel/arch/x86_64/apic.h>
+#include <kernel/arch/x86_64/gdt.h>
+#include <kernel/arch/x86_64/idt.h>
+#include <kernel/arch/x86_64/paging.h>
+#include <kernel/arch/x86_64/thread.h>
+#include <kernel/syscalls/syscalls.h>
+#include <kernel/constants.h>
+#include <drivers/acpi.h>
+#include <drivers/timer.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+static_assert(offsetof(cpu_local, kernel_stack) == 0, "syscall_entry reads [gs:0]");
+static_assert(offsetof(cpu_local, user_stack_tmp) == 8, "syscall_entry uses [gs:8]");
+static_assert(offsetof(cpu_local, self) == CPU_LOCAL_SELF, "cpu_this() reads CPU_LOCAL_SELF");
+static_assert(offsetof(cpu_local, id) == CPU_LOCAL_ID, "cpu_current_id() reads CPU_LOCAL_ID");
+static_assert(offsetof(cpu_local, current) == CPU_LOCAL_CURRENT, "thread_get_current() reads CPU_LOCAL_CURRENT");
+static_assert(MAX_CPUS <= 32, "CPU masks are 32 bits wide");
+
+static cpu_local cpus[MAX_CPUS];
+static uint32_t cpu_count = 1;
+static volatile uint32_t online_mask = 1;
+
+// Filled in for each AP before its start-up IPIs; matches the block in ap_trampoline.asm
+struct ap_boot_params
+{
+    uint64_t cr3;
+    uint64_t stack;
+    uint64_t entry;
+    uint64_t cpu;
+} __attribute__((packed));
+
+extern "C" uint8_t ap_trampoline_start[];
+extern "C" uint8_t ap_trampoline_end[];
+extern "C" uint8_t ap_trampoline_params[];
+
+cpu_local* smp_cpu(uint32_t id)
+{
+    cpu_local* cpu = &cpus[id];
+    if (!cpu->self)
+    {
+        cpu->self = cpu;
+        cpu->id = id;
+    }
+    return cpu;
+}
+
+uint32_t smp_cpu_count()
+{
+    return cpu_count;
+}
+
+uint32_t smp_online_mask()
+{
+    return online_mask;
+}
+
+/*
+ * TLB shootdown. One request is in flight at a time under tlb_lock; each
+ * target clears its bit in tlb_pending once it has flushed. Targets answer
+ * from the IPI or, when they spin with interrupts off, from spin_lock.
+ */
+static spinlock_t tlb_lock = {0, 0};
+static volatile uint32_t tlb_pending = 0;
+static address_space* volatile tlb_as = nullptr;    // nullptr for a kernel-half address
+static volatile uintptr_t tlb_virt = 0;
+
+void smp_tlb_poll()
+{
+    if (!tlb_pending) return;
+
+    uint32_t self = 1u << cpu_current_id();
+    if (!(__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE) & self)) return;
+
+    if (!tlb_as || cpu_this()->as == tlb_as)
+        asm volatile("invlpg (%0)" : : "r"(tlb_virt) : "memory");
+    __atomic_and_fetch(&tlb_pending, ~self, __ATOMIC_RELEASE);
+}
+
+void smp_tlb_interrupt()
+{
+    smp_tlb_poll();
+}
+
+/*
+ * Drops virt from the other CPUs' TLBs. For a user space only the CPUs
+ * running it are interrupted; the rest flush its tag on their next load.
+ */
+void smp_flush_tlb(address_space* as, uintptr_t virt)
+{
+    if (online_mask == 1) return;
+
+    uint64_t flags = local_irq_save();
+    uint32_t self = 1u << cpu_current_id();
+    uint32_t targets = online_mask & ~self;
+
+    if (as)
+    {
+        __atomic_or_fetch(&as->flush_pending, targets, __ATOMIC_SEQ_CST);
+
+        uint32_t running = 0;
+        for (uint32_t i = 0; i < cpu_count; i++)
+            if ((targets & (1u << i)) && __atomic_load_n(&cpus[i].as, __ATOMIC_SEQ_CST) == as)
+                running |= 1u << i;
+        targets = running;
+    }
+
+    if (targets)
+    {
+        spin_lock(&tlb_lock);
+        tlb_as = as;
+        tlb_virt = virt;
+        __atomic_store_n(&tlb_pending, targets, __ATOMIC_SEQ_CST);
+
+        for (uint32_t i = 0; i < cpu_count; i++)
+            if (targets & (1u << i)) lapic_send_ipi(cpus[i].apic_id, IPI_TLB_VECTOR);
+
+        while (__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE)) asm volatile("pause");
+        spin_unlock(&tlb_lock);
+    }
+    local_irq_restore(flags);
+}
+
+// Makes an idle CPU look at its run queue now rather than on its next tick
+void smp_send_reschedule(uint32_t id)
+{
+    if (id < cpu_count && (online_mask & (1u << id))) lapic_send_ipi(cpus[id].apic_id, IPI_RESCHED_VECTOR);
+}
+
+// First C code on an application processor, on its idle thread's stack
+extern "C" void ap_main(cpu_local* cpu)
+{
+    gdt_init_cpu(cpu);
+    idt_load();
+    paging_init_cpu();
+    syscall_init_cpu();
+    lapic_init_cpu(false);
+
+    thread_t* idle = cpu->idle;
+    idle->running = true;
+    idle->on_cpu = true;
+    cpu->current = idle;
+
+    lapic_timer_start(LAPIC_TIMER_HZ);
+    __atomic_or_fetch(&online_mask, 1u << cpu->id, __ATOMIC_SEQ_CST);
+    cpu->online = true;
+
+    asm volatile("sti");
+    idle_task();
+}
+
+// INIT, then up to two start-up IPIs, as the MP start-up protocol asks
+static bool smp_start_ap(cpu_local* cpu)
+{
+    lapic_send_init(cpu->apic_id);
+    timer_sleep(10);
+
+    for (int sipi = 0; sipi < 2 && !cpu->online; sipi++)
+    {
+        lapic_send_startup(cpu->apic_id, AP_TRAMPOLINE_BASE);
+        timer_sleep(1);
+    }
+
+    for (uint32_t waited = 0; !cpu->online && waited < AP_STARTUP_TIMEOUT_MS; waited += 10)
+        timer_sleep(10);
+    return cpu->online;
+}
+
+/*
+ * Brings up every processor the MADT lists, one at a time. Runs on the
+ * bootstrap CPU once interrupts and the scheduler work; without a MADT the
+ * system simply stays on one CPU.
+ */
+void smp_init()
+{
+    cpu_local* bsp = smp_cpu(0);
+    bsp->online = true;
+
+    const acpi_cpu_info* info = acpi_get_cpus();
+    if (!info || !lapic_init(info->lapic_phys))
+    {
+        printf("[SMP] Running on the bootstrap CPU only\n");
+        return;
+    }
+
+    lapic_init_cpu(true);
+    bsp->apic_id = lapic_id();
+    lapic_timer_calibrate();
+
+    uint8_t* trampoline = (uint8_t*)phys_to_virt(AP_TRAMPOLINE_BASE);
+    memcpy(trampoline, ap_trampoline_start, ap_trampoline_end - ap_trampoline_start);
+    ap_boot_params* params = (ap_boot_params*)(trampoline + (ap_trampoline_params - ap_trampoline_start));
+
+    for (uint32_t i = 0; i < info->cpu_count && cpu_count < MAX_CPUS; i++)
+    {
+        if (info->apic_ids[i] == bsp->apic_id) continue;
+
+        cpu_local* cpu = smp_cpu(cpu_count);
+        cpu->apic_id = info->apic_ids[i];
+        cpu->idle = thread_create_idle(cpu->id);
+        if (!cpu->idle) break;
+
+        params->cr3 = paging_kernel_space()->pml4_phys;
+        params->stack = (uintptr_t)cpu->idle->stack_start + THREAD_KERNEL_STACK_SIZE;
+        params->entry = (uintptr_t)ap_main;
+        params->cpu = (uintptr_t)cpu;
+
+        // A late starter would still run on this slot's stack and params,
+        // so the first CPU that fails to report in ends the bring-up
+        if (!smp_start_ap(cpu))
+        {
+            printf("[SMP] CPU with APIC id %u did not start\n", cpu->apic_id);
+            break;
+        }
+        cpu_count++;
+    }
+
+    printf("[SMP] %u CPU(s) online\n", cpu_count);
+}
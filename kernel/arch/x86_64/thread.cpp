@@ -22,27 +22,32 @@
 #include <kernel/arch/x86_64/thread.h>
 #include <kernel/arch/x86_64/gdt.h>
 #include <kernel/arch/x86_64/paging.h>
+#include <kernel/arch/x86_64/smp.h>
 #include <kernel/constants.h>
 #include <kernel/panic.h>
 #include <kernel/error.h>
 #include <kernel/syscalls/syscalls.h>
+#include <kernel/wait_queue.h>
+#include <fs/vfs.h>
 #include <mm/heap.h>
+#include <mm/kstack.h>
+#include <mm/slab.h>
+#include <mm/vma.h>
 #include <sys/errno.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 
-static thread_t* current_thread = nullptr;
-static thread_t* idle_thread_ptr = nullptr;
+static thread_t* idle_thread_ptr = nullptr;       // The bootstrap CPU's; each CPU has its own in cpu_local
 static uint32_t next_thread_id = 0;
+static kmem_cache* thread_cache = nullptr;
 
 spinlock_t thread_list_lock = {0, 0};
 spinlock_t zombie_lock = {0, 0};
 thread_t* zombie_list_head = nullptr;
 
-extern "C" void switch_context(uint64_t** old_rsp, uint64_t* new_rsp);
 extern "C" void user_thread_entry();
-extern "C" tss_entry kernel_tss;
+extern "C" void user_fork_return();
 
  
 void spin_lock_irqsave(spinlock_t* lock)
@@ -50,12 +55,32 @@ void spin_lock_irqsave(spinlock_t* lock)
     uint64_t rflags;
     asm volatile("pushfq; popq %0; cli" : "=rm"(rflags));
 
+    // Keep answering TLB shootdowns: the holder may be waiting on this CPU
     while (__sync_lock_test_and_set(&lock->locked, 1))
+    {
+        smp_tlb_poll();
         asm volatile("pause");
+    }
     
     lock->rflags = rflags;
 }
 
+// Takes the lock only if it is free; on failure interrupts are left as they were
+bool spin_trylock_irqsave(spinlock_t* lock)
+{
+    uint64_t rflags;
+    asm volatile("pushfq; popq %0; cli" : "=rm"(rflags));
+
+    if (__sync_lock_test_and_set(&lock->locked, 1))
+    {
+        asm volatile("pushq %0; popfq" : : "rm"(rflags));
+        return false;
+    }
+
+    lock->rflags = rflags;
+    return true;
+}
+
 void spin_unlock_irqrestore(spinlock_t* lock) 
 {
     uint64_t rflags = lock->rflags;
@@ -65,7 +90,11 @@ void spin_unlock_irqrestore(spinlock_t* lock)
 
 void spin_lock(spinlock_t* lock) 
 {
-    while (__sync_lock_test_and_set(&lock->locked, 1)) asm volatile("pause");
+    while (__sync_lock_test_and_set(&lock->locked, 1))
+    {
+        smp_tlb_poll();
+        asm volatile("pause");
+    }
 }
 
 void spin_unlock(spinlock_t* lock) 
@@ -73,6 +102,285 @@ void spin_unlock(spinlock_t* lock)
     __sync_lock_release(&lock->locked);
 }
 
+/*
+ * Run queues. Each CPU has its own: every runnable thread other than the
+ * running ones and the idle threads waits on the FIFO of its priority in
+ * the queue of its CPU (t->cpu), and the bitmap has a bit for each level
+ * that is not empty, so picking the next thread is a single bit scan.
+ * Sleeping and blocked threads are on no queue at all; their timer or
+ * wait queue finds them, and they are woken onto the CPU they last ran on.
+ *
+ * A thread's cpu, running flag and queue links are guarded by the lock of
+ * the queue it belongs to. Where two queues are needed they are locked
+ * lowest CPU first. A CPU with nothing to run steals from the busiest peer,
+ * and every CPU pulls work from a much busier one now and then on its tick.
+ */
+struct thread_queue
+{
+    thread_t* head;
+    thread_t* tail;
+};
+
+struct alignas(64) cpu_runqueue
+{
+    spinlock_t lock;
+    thread_queue ready[THREAD_PRIORITIES];
+    uint32_t bitmap;                // One bit per non-empty level
+    volatile uint32_t nr_ready;     // Queued threads; peers read it unlocked to balance
+    uint64_t next_balance;          // Timer tick of this CPU's next balance pass
+};
+
+static_assert(THREAD_PRIORITIES <= 32, "bitmap has one bit per priority");
+
+static cpu_runqueue runqueues[MAX_CPUS];
+static wait_queue_t exit_wait;
+
+static void rq_push(thread_queue* q, thread_t* t)
+{
+    t->rq = q;
+    t->rq_next = nullptr;
+    t->rq_prev = q->tail;
+    if (q->tail) q->tail->rq_next = t;
+    else q->head = t;
+    q->tail = t;
+}
+
+static void rq_remove(thread_t* t)
+{
+    thread_queue* q = t->rq;
+    if (!q) return;
+
+    if (t->rq_prev) t->rq_prev->rq_next = t->rq_next;
+    else q->head = t->rq_next;
+    if (t->rq_next) t->rq_next->rq_prev = t->rq_prev;
+    else q->tail = t->rq_prev;
+
+    t->rq = nullptr;
+    t->rq_next = nullptr;
+    t->rq_prev = nullptr;
+
+    cpu_runqueue* rq = &runqueues[t->cpu];
+    rq->nr_ready--;
+    if (!q->head) rq->bitmap &= ~(1u << (q - rq->ready));
+}
+
+// Queues a thread on its CPU; idle threads are never queued and run only when it is empty
+static void rq_enqueue_ready(thread_t* t)
+{
+    if (t->is_idle) return;
+    cpu_runqueue* rq = &runqueues[t->cpu];
+    rq_push(&rq->ready[t->priority], t);
+    rq->bitmap |= 1u << t->priority;
+    rq->nr_ready++;
+}
+
+/*
+ * A thread queued while another CPU is still switching it out (on_cpu) is
+ * passed over until switch_context has saved it, rather than waited for:
+ * two CPUs each waiting for the other's outgoing thread would never finish.
+ * 'prev' is the caller's own outgoing thread, which it may pick again.
+ * Normally the head of the first level qualifies.
+ */
+static thread_t* rq_pick(cpu_runqueue* rq, thread_t* prev)
+{
+    for (uint32_t levels = rq->bitmap; levels; levels &= levels - 1)
+    {
+        for (thread_t* t = rq->ready[__builtin_ctz(levels)].head; t; t = t->rq_next)
+        {
+            if (t->on_cpu && t != prev) continue;
+            rq_remove(t);
+            return t;
+        }
+    }
+    return nullptr;
+}
+
+// Highest-priority queued thread that may move to 'cpu' and is off every CPU
+static thread_t* rq_find_movable(cpu_runqueue* rq, uint32_t cpu)
+{
+    for (uint32_t levels = rq->bitmap; levels; levels &= levels - 1)
+    {
+        for (thread_t* t = rq->ready[__builtin_ctz(levels)].head; t; t = t->rq_next)
+            if ((t->affinity & (1u << cpu)) && !t->on_cpu) return t;
+    }
+    return nullptr;
+}
+
+static void rq_lock_pair(uint32_t a, uint32_t b)
+{
+    if (a > b)
+    {
+        uint32_t tmp = a;
+        a = b;
+        b = tmp;
+    }
+    spin_lock(&runqueues[a].lock);
+    if (a != b) spin_lock(&runqueues[b].lock);
+}
+
+static void rq_unlock_pair(uint32_t a, uint32_t b)
+{
+    spin_unlock(&runqueues[a].lock);
+    if (a != b) spin_unlock(&runqueues[b].lock);
+}
+
+// Locks the queue a thread belongs to; its cpu may change until the lock is held
+static cpu_runqueue* rq_lock_thread(thread_t* t)
+{
+    while (true)
+    {
+        uint32_t cpu = __atomic_load_n(&t->cpu, __ATOMIC_ACQUIRE);
+        spin_lock(&runqueues[cpu].lock);
+        if (t->cpu == cpu) return &runqueues[cpu];
+        spin_unlock(&runqueues[cpu].lock);
+    }
+}
+
+// Queued threads plus the running one, if that is not the idle thread
+static uint32_t rq_load(uint32_t cpu)
+{
+    cpu_local* c = smp_cpu(cpu);
+    return runqueues[cpu].nr_ready + (c->current != c->idle);
+}
+
+// Least loaded online CPU in 'mask', 'prefer' on a tie or when the mask has none online
+static uint32_t sched_least_loaded(uint32_t mask, uint32_t prefer)
+{
+    uint32_t allowed = mask & smp_online_mask();
+    if (!allowed) return prefer;
+
+    uint32_t best = (allowed & (1u << prefer)) ? prefer : __builtin_ctz(allowed);
+    uint32_t best_load = rq_load(best);
+    for (uint32_t m = allowed; m && best_load; m &= m - 1)
+    {
+        uint32_t cpu = __builtin_ctz(m);
+        uint32_t load = rq_load(cpu);
+        if (load < best_load)
+        {
+            best = cpu;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+// Stays on 'cpu' for a warm cache unless the mask rules it out
+static uint32_t sched_select_cpu(uint32_t mask, uint32_t cpu)
+{
+    return (mask & (1u << cpu)) ? cpu : sched_least_loaded(mask, cpu);
+}
+
+// Locks the queue a thread belongs to and the one it should be queued on next
+static uint32_t rq_lock_thread_pair(thread_t* t, uint32_t* target)
+{
+    while (true)
+    {
+        uint32_t cpu = __atomic_load_n(&t->cpu, __ATOMIC_ACQUIRE);
+        uint32_t to = sched_select_cpu(t->affinity, cpu);
+        rq_lock_pair(cpu, to);
+        if (t->cpu == cpu && (to == cpu || (t->affinity & (1u << to))))
+        {
+            *target = to;
+            return cpu;
+        }
+        rq_unlock_pair(cpu, to);
+    }
+}
+
+// An idle CPU halts until its next tick; one that was just handed a thread is woken now
+static void sched_kick(uint32_t cpu)
+{
+    if (cpu == cpu_current_id()) return;
+    cpu_local* c = smp_cpu(cpu);
+    if (c->current == c->idle) smp_send_reschedule(cpu);
+}
+
+// A CPU out of work takes the best thread it may run from the peer with the most queued
+static thread_t* rq_steal(uint32_t self)
+{
+    uint32_t victim = self;
+    uint32_t most = 0;
+    for (uint32_t m = smp_online_mask() & ~(1u << self); m; m &= m - 1)
+    {
+        uint32_t cpu = __builtin_ctz(m);
+        if (runqueues[cpu].nr_ready > most)
+        {
+            victim = cpu;
+            most = runqueues[cpu].nr_ready;
+        }
+    }
+    if (victim == self) return nullptr;
+
+    cpu_runqueue* rq = &runqueues[victim];
+    spin_lock(&rq->lock);
+    thread_t* t = rq_find_movable(rq, self);
+    if (t)
+    {
+        rq_remove(t);
+        t->cpu = self;
+        t->running = true;
+    }
+    spin_unlock(&rq->lock);
+    return t;
+}
+
+// Places a thread that has never run on the least loaded CPU its mask allows
+static void rq_enqueue_new(thread_t* t, bool held)
+{
+    t->cpu = sched_least_loaded(t->affinity, cpu_current_id());
+    if (held)
+    {
+        t->state = THREAD_BLOCKED;
+        return;
+    }
+
+    spin_lock(&runqueues[t->cpu].lock);
+    rq_enqueue_ready(t);
+    spin_unlock(&runqueues[t->cpu].lock);
+    sched_kick(t->cpu);
+}
+
+/*
+ * Called on every scheduler tick with interrupts off. Every SCHED_BALANCE_MS
+ * a CPU pulls one thread from the busiest CPU if that one carries at least
+ * SCHED_IMBALANCE more; idle CPUs also steal on their own in yield().
+ */
+void thread_balance_tick()
+{
+    if (smp_online_mask() == 1) return;
+
+    cpu_local* cpu = cpu_this();
+    cpu_runqueue* rq = &runqueues[cpu->id];
+    uint64_t now = timer_get_ticks();
+    if (!cpu->idle || now < rq->next_balance) return;
+    rq->next_balance = now + timer_ms_to_ticks(SCHED_BALANCE_MS);
+
+    uint32_t self = cpu->id;
+    uint32_t busiest = self;
+    uint32_t most = rq_load(self) + SCHED_IMBALANCE - 1;
+    for (uint32_t m = smp_online_mask() & ~(1u << self); m; m &= m - 1)
+    {
+        uint32_t peer = __builtin_ctz(m);
+        uint32_t load = rq_load(peer);
+        if (load > most && runqueues[peer].nr_ready)
+        {
+            busiest = peer;
+            most = load;
+        }
+    }
+    if (busiest == self) return;
+
+    rq_lock_pair(self, busiest);
+    thread_t* t = rq_find_movable(&runqueues[busiest], self);
+    if (t)
+    {
+        rq_remove(t);
+        t->cpu = self;
+        rq_enqueue_ready(t);
+    }
+    rq_unlock_pair(self, busiest);
+}
+
 void cleanup_zombies() 
 {
     spin_lock_irqsave((spinlock_t*)&zombie_lock);
@@ -80,98 +388,110 @@ void cleanup_zombies()
     zombie_list_head = nullptr;
     spin_unlock_irqrestore((spinlock_t*)&zombie_lock);
 
+    thread_t* joined = nullptr;
     while (curr) 
     {
         thread_t* next = curr->next;
-        if (curr->stack_start) {
-            kfree(curr->stack_start);
+
+        // Someone is still reading the exit code, or the thread is still
+        // switching away on another CPU; try again next time
+        if (__atomic_load_n(&curr->joiners, __ATOMIC_ACQUIRE) || curr->on_cpu)
+        {
+            curr->next = joined;
+            joined = curr;
+            curr = next;
+            continue;
         }
+
+        timer_cancel(&curr->sleep_timer);
+        if (curr->stack_start) kstack_free(curr->stack_start);
         
-        if (curr->is_user) 
+        // Tears down the user half: stack, image, heap and every table under them
+        if (curr->is_user)
         {
-             
-             // 1. Free User Stack (Fixed 16KB at 0x0000700000000000)
-             // Note: t->user_stack points to TOP. Base is top - 16384.
-             // But we know the fixed virtual address is 0x0000700000000000
-            uintptr_t stack_base = 0x0000700000000000;
-            for (int i = 0; i < 4; i++) 
-            {
-                uintptr_t addr = stack_base + i * 4096;
-                void* phys = paging_get_physical_address((void*)addr);
-                if (phys) 
-                {
-                    pfa_free_frame(phys);
-                    paging_unmap_page((void*)addr);
-                }
-            }
+            for (int fd = 3; fd < 16; fd++)
+                if (curr->fd_table[fd]) vfs_close(curr->fd_table[fd]);
+
+            vma_destroy_all(curr->as);
+            paging_destroy_address_space(curr->as);
+        }
 
-             // 2. Free User Code/Data (Image)
-             if (curr->user_image_end > curr->user_image_start) 
-             {
-                 for (uintptr_t addr = curr->user_image_start; addr < curr->user_image_end; addr += 4096)
-                 {
-                     void* phys = paging_get_physical_address((void*)addr);
-                     if (phys) 
-                     {
-                         pfa_free_frame(phys);
-                         paging_unmap_page((void*)addr);
-                     }
-                 }
-             }
-
-             // 3. Free User Heap (Standard start 1GB)
-             // This covers both sbrk growth and huge ELFs overlaps (safe due to checks)
-             uintptr_t heap_start = 0x40000000;
-             if (curr->user_heap_break > heap_start) 
-             {
-                 for (uintptr_t addr = heap_start; addr < curr->user_heap_break; addr += 4096)
-                 {
-                     void* phys = paging_get_physical_address((void*)addr);
-                     if (phys) 
-                     {
-                         pfa_free_frame(phys);
-                         paging_unmap_page((void*)addr);
-                     }
-                 }
-             }
-         }
-
-        kfree(curr);
+        kmem_cache_free(thread_cache, curr);
         
         curr = next;
     }
+
+    if (!joined) return;
+    spin_lock_irqsave((spinlock_t*)&zombie_lock);
+    thread_t* tail = joined;
+    while (tail->next) tail = tail->next;
+    tail->next = zombie_list_head;
+    zombie_list_head = joined;
+    spin_unlock_irqrestore((spinlock_t*)&zombie_lock);
 }
 
 void thread_init()
 {
-    current_thread = (thread_t*)kmalloc(sizeof(thread_t));
-    memset(current_thread, 0, sizeof(thread_t));
-    
-    current_thread->id = next_thread_id++;
-    current_thread->state = THREAD_READY;
-    current_thread->next = current_thread;
-    current_thread->stack_start = nullptr; 
+    thread_cache = kmem_cache_create("thread_t", sizeof(thread_t));
 
-    strcpy(current_thread->name, "kernel");
+    thread_t* boot = (thread_t*)kmem_cache_alloc(thread_cache);
+    memset(boot, 0, sizeof(thread_t));
+    
+    boot->id = next_thread_id++;
+    boot->state = THREAD_READY;
+    boot->priority = THREAD_PRIORITY_DEFAULT;
+    boot->next = boot;
+    boot->stack_start = nullptr; 
+    boot->as = paging_kernel_space();
+    boot->affinity = ~0u;
+    boot->running = true;
+    boot->on_cpu = true;
+
+    strcpy(boot->name, "kernel");
+    cpu_this()->current = boot;
     
-    idle_thread_ptr = thread_create(idle_task, "sys_idle");
-    if (idle_thread_ptr)
+    idle_thread_ptr = thread_create_idle(0);
+    cpu_this()->idle = idle_thread_ptr;
+}
+
+// Creates the idle thread of a CPU; it is on the thread list but never queued
+thread_t* thread_create_idle(uint32_t cpu)
+{
+    thread_t* t = thread_create(idle_task, "sys_idle");
+    if (!t) return nullptr;
+
+    if (cpu) 
     {
-        idle_thread_ptr->next = current_thread->next;
-        current_thread->next = idle_thread_ptr;
+        t->name[8] = '0' + cpu;
+        t->name[9] = '\0';
     }
+    t->is_idle = true;
+    t->cpu = cpu;
+    t->affinity = 1u << cpu;
+
+    spin_lock_irqsave((spinlock_t*)&thread_list_lock);
+    thread_t* self = thread_get_current();
+    t->id = next_thread_id++;
+    t->next = self->next;
+    self->next = t;
+    spin_unlock_irqrestore((spinlock_t*)&thread_list_lock);
+    return t;
 }
 
-thread_t* thread_add(void(*entry_point)(), const char* name, bool is_user)
+// A held thread is kept off every queue until thread_make_ready starts it
+thread_t* thread_add(void(*entry_point)(), const char* name, bool is_user, size_t user_stack_size, bool held)
 {
     spin_lock_irqsave((spinlock_t*)&thread_list_lock);
 
-    thread_t* t = is_user ? thread_create_user(entry_point, name) : thread_create(entry_point, name);
+    thread_t* t = is_user ? thread_create_user(entry_point, name, user_stack_size) : thread_create(entry_point, name);
     if (t)
     {
+        thread_t* self = thread_get_current();
         t->id = next_thread_id++;
-        t->next = current_thread->next;
-        current_thread->next = t;
+        t->affinity = self->affinity;
+        t->next = self->next;
+        self->next = t;
+        rq_enqueue_new(t, held);
     }
     spin_unlock_irqrestore((spinlock_t*)&thread_list_lock);
     
@@ -180,62 +500,67 @@ thread_t* thread_add(void(*entry_point)(), const char* name, bool is_user)
 
 extern "C" void yield()
 {
-    
-    if (!current_thread || !idle_thread_ptr) return;
+    if (!thread_get_current() || !cpu_this()->idle) return;
 
     asm volatile("cli");
-    
-    thread_t* prev = current_thread;
-    thread_t* next_to_run = nullptr;
-    
-    thread_t* start_node = (prev->state == THREAD_ZOMBIE) ? idle_thread_ptr : prev;
-    thread_t* scan = start_node->next;
 
-    do 
-    {
-        if (scan->state == THREAD_SLEEPING && scan->sleep_ticks == 0)
-            scan->state = THREAD_READY;
-        scan = scan->next;
-    } while (scan != start_node->next);
-    
-    scan = start_node->next;
+    // With IF clear nothing can move this thread to another CPU any more
+    cpu_local* cpu = cpu_this();
+    thread_t* prev = cpu->current;
+    uint32_t self = cpu->id;
 
-    
-    scan = start_node->next;
+    // A thread whose mask no longer allows this CPU is queued on one it allows
+    uint32_t to = self;
+    if (!prev->is_idle && !(prev->affinity & (1u << self))) to = sched_least_loaded(prev->affinity, self);
+    rq_lock_pair(self, to);
 
-    do 
+    // A thread that is still runnable goes to the back of its level, so
+    // equal priorities take turns; blocked and sleeping ones are parked already
+    bool moved = false;
+    if (prev->state == THREAD_READY)
     {
-        if (scan->state == THREAD_READY && scan != idle_thread_ptr) 
+        if (to != self && (prev->affinity & (1u << to)))
         {
-            next_to_run = scan;
-            break;
+            prev->cpu = to;
+            moved = true;
         }
-        scan = scan->next;
-    } while (scan != start_node->next);
+        rq_enqueue_ready(prev);
+    }
+
+    thread_t* next_to_run = rq_pick(&runqueues[self], prev);
+    if (next_to_run) next_to_run->running = true;
+    if (next_to_run != prev) prev->running = false;
+    rq_unlock_pair(self, to);
 
-    if (!next_to_run) 
+    if (moved) sched_kick(to);
+    if (!next_to_run) next_to_run = rq_steal(self);
+    if (!next_to_run)
     {
-        if (prev->state == THREAD_READY) next_to_run = prev;
-        else next_to_run = idle_thread_ptr;
+        next_to_run = cpu->idle;
+        next_to_run->running = true;
     }
     
     if (next_to_run != prev) 
     {
-        current_thread = next_to_run;
+        next_to_run->on_cpu = true;
+        cpu->current = next_to_run;
 
         // If it's a user thread, we must update RSP0 in TSS so that
         // interrupts in Ring 3 can correctly return to the kernel stack.
         // We also update the GS base used by 'syscall' instruction.
-        uint64_t kstack = (uint64_t)next_to_run->stack_start + 16384;
+        uint64_t kstack = (uint64_t)next_to_run->stack_start + THREAD_KERNEL_STACK_SIZE;
         
         if (next_to_run->is_user)
         {
-            kernel_tss.rsp0 = kstack;
+            cpu->tss.rsp0 = kstack;
         }
             
         syscall_set_kernel_stack(kstack);
+
+        // Threads of the same process (and all kernel threads) keep the TLB
+        if (next_to_run->as != prev->as) paging_switch_address_space(next_to_run->as);
         
-        switch_context(&(prev->rsp), next_to_run->rsp);
+        switch_context(&(prev->rsp), next_to_run->rsp, &prev->on_cpu);
     }
 
     asm volatile("sti");
@@ -243,36 +568,35 @@ extern "C" void yield()
 
 void thread_sleep(uint32_t ms)
 {
-    uint32_t ticks = ms / 10;
-    if (ticks == 0) ticks = 1;
-
-    asm volatile("cli");
-    current_thread->sleep_ticks = ticks;
-    current_thread->state = THREAD_SLEEPING;
-    asm volatile("sti");
-
-    yield();
+    timer_sleep(ms ? ms : 1);
 }
 
 thread_t* thread_create(void (*entry_point)(), const char* name) 
 {
-    thread_t* t = (thread_t*)kmalloc(sizeof(thread_t));
-    uint64_t* stack = (uint64_t*)kmalloc(16384);
+    thread_t* t = (thread_t*)kmem_cache_alloc(thread_cache);
+    uint64_t* stack = (uint64_t*)kstack_alloc();
     
-    if (!stack || !t) return nullptr;
+    if (!stack || !t) 
+    {
+        kstack_free(stack);
+        kmem_cache_free(thread_cache, t);
+        return nullptr;
+    }
     
     memset(t, 0, sizeof(thread_t));
     t->stack_start = stack;
+    t->as = paging_kernel_space();
     t->is_user = false;
     t->state = THREAD_READY;
-    t->sleep_ticks = 0;
+    t->priority = THREAD_PRIORITY_DEFAULT;
+    t->affinity = ~0u;
     t->exit_code = 0;
     t->user_heap_break = 0;
 
     if (name) strncpy(t->name, name, 15);
     else strcpy(t->name, "unk");
     
-    uint64_t* stack_ptr = (uint64_t*)((uintptr_t)stack + 16384);
+    uint64_t* stack_ptr = (uint64_t*)((uintptr_t)stack + THREAD_KERNEL_STACK_SIZE);
 
     *(--stack_ptr) = (uint64_t)thread_exit; 
     *(--stack_ptr) = (uint64_t)entry_point;
@@ -289,30 +613,49 @@ thread_t* thread_create(void (*entry_point)(), const char* name)
     return t;
 }
 
-thread_t* thread_create_user(void (*entry_point)(), const char* name) 
+thread_t* thread_create_user(void (*entry_point)(), const char* name, size_t stack_size) 
 {
-    thread_t* t = (thread_t*)kmalloc(sizeof(thread_t));
-    uint64_t* k_stack = (uint64_t*)kmalloc(16384); // Stack Kernel (Ring 0)
-    
-    // Increase user stack to 16KB (4 pages)
-    uintptr_t u_stack_virt = 0x0000700000000000;
+    thread_t* t = (thread_t*)kmem_cache_alloc(thread_cache);
+    uint64_t* k_stack = (uint64_t*)kstack_alloc(); // Stack Kernel (Ring 0)
+    if (!t || !k_stack)
+    {
+        kstack_free(k_stack);
+        kmem_cache_free(thread_cache, t);
+        return nullptr;
+    }
     
-    for (int i = 0; i < 4; i++) 
+    address_space* as = paging_create_address_space();
+    if (!as)
     {
-        void* u_stack_phys = pfa_alloc_frame();
-        if (!u_stack_phys) 
-        {
-             kfree(k_stack);
-             kfree(t);
-             return nullptr;
-        }
-        paging_map_page((void*)(u_stack_virt + i * 4096), u_stack_phys, PTE_PRESENT | PTE_RW | PTE_USER);
+        kstack_free(k_stack);
+        kmem_cache_free(thread_cache, t);
+        return nullptr;
+    }
+
+    if (stack_size == 0) stack_size = USER_STACK_DEFAULT;
+    if (stack_size > USER_STACK_MAX) stack_size = USER_STACK_MAX;
+    stack_size = (stack_size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+
+    // The stack is only reserved here; its pages are faulted in as it grows
+    // down, and the guard area below turns an overflow into a clean fault
+    uintptr_t u_stack_top = USER_STACK_TOP;
+    uintptr_t u_stack_base = u_stack_top - stack_size;
+    if (!vma_create(as, u_stack_base - PAGE_SIZE, u_stack_base, 0, VMA_GUARD) ||
+        !vma_create(as, u_stack_base, u_stack_top, VMA_READ | VMA_WRITE, VMA_STACK))
+    {
+        vma_destroy_all(as);
+        paging_destroy_address_space(as);
+        kstack_free(k_stack);
+        kmem_cache_free(thread_cache, t);
+        return nullptr;
     }
-    uintptr_t u_stack_top = u_stack_virt + 16384;
 
     memset(t, 0, sizeof(thread_t));
     t->is_user = true;
+    t->as = as;
     t->state = THREAD_READY;
+    t->priority = THREAD_PRIORITY_DEFAULT;
+    t->affinity = ~0u;
     t->stack_start = k_stack;
     t->user_stack = (uint64_t*)u_stack_top;
     t->user_heap_break = 0x600000;
@@ -320,7 +663,7 @@ thread_t* thread_create_user(void (*entry_point)(), const char* name)
     t->user_image_start = 0;
     t->user_image_end = 0;
 
-    uint64_t* sp = (uint64_t*)((uintptr_t)k_stack + 16384);
+    uint64_t* sp = (uint64_t*)((uintptr_t)k_stack + THREAD_KERNEL_STACK_SIZE);
 
     *(--sp) = 0x1B;                     // SS (User Data + RPL 3)
     *(--sp) = u_stack_top;              // RSP Utente
@@ -343,6 +686,78 @@ thread_t* thread_create_user(void (*entry_point)(), const char* name)
     return t;
 }
 
+/*
+ * Duplicates a user process from inside its own syscall. The child shares
+ * every page copy-on-write, holds its own reference on each open file and
+ * resumes from the same syscall frame, returning 0 instead of a pid.
+ */
+thread_t* thread_fork(thread_t* parent)
+{
+    if (!parent || !parent->is_user) return nullptr;
+
+    thread_t* t = (thread_t*)kmem_cache_alloc(thread_cache);
+    uint64_t* k_stack = (uint64_t*)kstack_alloc();
+    address_space* as = (t && k_stack) ? paging_fork_address_space(parent->as) : nullptr;
+    if (!as || !vma_copy(as, parent->as))
+    {
+        if (as)
+        {
+            vma_destroy_all(as);
+            paging_destroy_address_space(as);
+        }
+        kstack_free(k_stack);
+        kmem_cache_free(thread_cache, t);
+        return nullptr;
+    }
+
+    memcpy(t, parent, sizeof(thread_t));
+    t->as = as;
+    t->state = THREAD_READY;
+    t->stack_start = k_stack;
+    t->rq = nullptr;
+    t->rq_next = nullptr;
+    t->rq_prev = nullptr;
+    t->waiting = nullptr;
+    t->joiners = 0;
+    t->running = false;
+    t->on_cpu = false;
+    t->kill_pending = false;
+    t->sleep_timer.next = nullptr;
+    t->sleep_timer.link = nullptr;
+    t->exit_code = 0;
+
+    for (int fd = 3; fd < 16; fd++)
+        if (t->fd_table[fd]) t->fd_table[fd]->open();
+
+    // The parent's user registers sit at the top of its kernel stack, as
+    // pushed by syscall_entry; the child pops the same frame on its way out
+    uint64_t* parent_top = (uint64_t*)((uintptr_t)parent->stack_start + THREAD_KERNEL_STACK_SIZE);
+    uint64_t* sp = (uint64_t*)((uintptr_t)k_stack + THREAD_KERNEL_STACK_SIZE);
+    sp -= SYSCALL_FRAME_QWORDS;
+    memcpy(sp, parent_top - SYSCALL_FRAME_QWORDS, SYSCALL_FRAME_QWORDS * sizeof(uint64_t));
+
+    *(--sp) = (uint64_t)user_fork_return;
+
+    *(--sp) = 0x002; // RFLAGS: stay masked until sysret
+    *(--sp) = 0;     // R15
+    *(--sp) = 0;     // R14
+    *(--sp) = 0;     // R13
+    *(--sp) = 0;     // R12
+    *(--sp) = 0;     // RBX
+    *(--sp) = 0;     // RBP
+    t->rsp = sp;
+
+    spin_lock_irqsave((spinlock_t*)&thread_list_lock);
+    thread_t* self = thread_get_current();
+    t->id = next_thread_id++;
+    t->next = self->next;
+    self->next = t;
+    rq_enqueue_new(t, false);
+    spin_unlock_irqrestore((spinlock_t*)&thread_list_lock);
+
+    return t;
+}
+
 void user_test_thread() 
 {
     uint16_t cs;
@@ -355,22 +770,41 @@ void user_test_thread()
 
 void idle_task() 
 {
+    cpu_runqueue* rq = &runqueues[cpu_current_id()];
     while (1) 
     {
         asm volatile("cli");
         cleanup_zombies();
         asm volatile("sti");
-        asm volatile("hlt");
+
+        // Work queued while this CPU was still switching to idle got no kick
+        if (rq->nr_ready)
+        {
+            yield();
+            continue;
+        }
+
+        // Spend idle time pre-zeroing frames; only halt once the pool is full
+        if (pfa_zero_pool_refill(PFA_ZERO_POOL_BATCH) == 0)
+            asm volatile("hlt");
     }
 }
 
-thread_t* thread_get_current() { return current_thread; }
+// A single GS-relative load, so a migration cannot hand back another CPU's thread
+thread_t* thread_get_current() 
+{
+    thread_t* t;
+    asm volatile("movq %%gs:%c1, %0" : "=r"(t) : "i"(CPU_LOCAL_CURRENT));
+    return t;
+}
+
 thread_t* get_idle_thread_ptr() { return idle_thread_ptr; }
 
 uint32_t thread_get_id_by_name(const char* name)
 {
-    if (!current_thread || !name) return THREAD_NOT_FOUND;
-    thread_t* temp = current_thread;
+    thread_t* self = thread_get_current();
+    if (!self || !name) return THREAD_NOT_FOUND;
+    thread_t* temp = self;
     uint32_t found_id = THREAD_NOT_FOUND;
     int count = 0;
 
@@ -382,7 +816,7 @@ uint32_t thread_get_id_by_name(const char* name)
             count++;
         }
         temp = temp->next;
-    } while (temp != current_thread);
+    } while (temp != self);
 
     if (count > 1) return THREAD_AMBIGUOUS;
     return found_id;
@@ -390,21 +824,36 @@ uint32_t thread_get_id_by_name(const char* name)
 
 bool thread_kill(uint32_t id) 
 {
-    if (id == current_thread->id || id == idle_thread_ptr->id || id == 0) return false; 
+    thread_t* self = thread_get_current();
+    if (id == self->id || id == 0) return false; 
 
     spin_lock_irqsave((spinlock_t*)&thread_list_lock);
 
-    thread_t* prev = current_thread;
-    thread_t* curr = current_thread->next;
+    thread_t* prev = self;
+    thread_t* curr = self->next;
     bool found = false;
 
     do 
 	{
         if (curr->id == id) 
 		{
-            prev->next = curr->next;
+            if (curr->is_idle) break;
 
+            cpu_runqueue* rq = rq_lock_thread(curr);
+            if (curr->running)
+            {
+                // Running on another CPU: a user thread leaves at its next
+                // return to ring 3, a kernel thread cannot be stopped safely
+                if (curr->is_user) curr->kill_pending = found = true;
+                spin_unlock(&rq->lock);
+                break;
+            }
+            rq_remove(curr);
             curr->state = THREAD_ZOMBIE;
+            spin_unlock(&rq->lock);
+
+            prev->next = curr->next;
+            wait_queue_abort(curr);
             curr->exit_code = -1;
 
             spin_lock(&zombie_lock);
@@ -412,12 +861,13 @@ bool thread_kill(uint32_t id)
             zombie_list_head = curr;
             spin_unlock(&zombie_lock);
 
+            wait_queue_wake_all(&exit_wait);
             found = true;
             break;
         }
         prev = curr;
         curr = curr->next;
-    } while (curr != current_thread);
+    } while (curr != self);
 
     spin_unlock_irqrestore((spinlock_t*)&thread_list_lock);
     return found;
@@ -425,11 +875,12 @@ bool thread_kill(uint32_t id)
 
 void thread_print_list() 
 {
-    if (!current_thread) return;
-    printf("  ID    %-15s %-10s %s\n", "NAME", "STATE", "RSP");
-    printf("------------------------------------------------------------\n");
+    thread_t* self = thread_get_current();
+    if (!self) return;
+    printf("  ID    %-15s %-10s %-4s %-4s %s\n", "NAME", "STATE", "PRI", "CPU", "RSP");
+    printf("-----------------------------------------------------------------\n");
 
-    thread_t* t = current_thread;
+    thread_t* t = self;
     do 
 	{
         const char* state_str;
@@ -442,20 +893,21 @@ void thread_print_list()
             case THREAD_ZOMBIE:   state_str = "ZOMB "; break; 
             default:              state_str = "UNKN "; break;
         }
-        printf("  %d    %-15s %-10s 0x%lx\n", (int)t->id, t->name, state_str, (uint64_t)t->rsp);
+        char cpu[2] = { t->running ? (char)('0' + t->cpu) : '-', '\0' };
+        printf("  %d    %-15s %-10s %-4d %-4s 0x%lx\n", (int)t->id, t->name, state_str, t->priority, cpu, (uint64_t)t->rsp);
         t = t->next;
-    } while (t != current_thread);
+    } while (t != self);
 }
 
 void thread_exit(int code)
 {
     spin_lock_irqsave((spinlock_t*)&thread_list_lock);
 
-    thread_t* self = current_thread;
+    thread_t* self = thread_get_current();
     self->exit_code = code;
     self->state = THREAD_ZOMBIE;
 
-    if (self->id == 0 || self == idle_thread_ptr) 
+    if (self->id == 0 || self->is_idle) 
         panic(KernelError::K_ERR_SYSTEM_THREAD_EXIT_ATTEMPT);
 
     thread_t* prev = self;
@@ -469,23 +921,150 @@ void thread_exit(int code)
     zombie_list_head = self;
     spin_unlock(&zombie_lock);
 
+    wait_queue_wake_all(&exit_wait);
     spin_unlock_irqrestore((spinlock_t*)&thread_list_lock);
 
     yield();
     __builtin_unreachable();
 }
 
-void thread_wakeup_blocked()
+// Wakes a blocked, held or sleeping thread onto the CPU it last ran on, if
+// its mask still allows that one; anything else is left alone
+void thread_make_ready(thread_t* t)
 {
-	if (!current_thread) return;
+    uint64_t flags = local_irq_save();
+    uint32_t to;
+    uint32_t from = rq_lock_thread_pair(t, &to);
 
-	thread_t* temp = current_thread;
-	do
-	{
-		if (temp->state == THREAD_BLOCKED)
-			temp->state = THREAD_READY;
-		temp = temp->next;
-	} while (temp != current_thread);
+    bool queued = false;
+    if (t->state == THREAD_BLOCKED || t->state == THREAD_SLEEPING)
+    {
+        t->state = THREAD_READY;
+
+        // A thread woken before it got to yield() is still running; yield requeues it
+        if (!t->running)
+        {
+            t->cpu = to;
+            rq_enqueue_ready(t);
+            queued = true;
+        }
+    }
+    rq_unlock_pair(from, to);
+
+    if (queued) sched_kick(to);
+    local_irq_restore(flags);
+}
+
+// Takes the current thread off the CPU until thread_make_ready; the caller yields.
+// Blocked and sleeping threads are found through their wait queue or timer.
+void thread_park(thread_state_t state)
+{
+    uint64_t flags = local_irq_save();
+    thread_t* self = thread_get_current();
+    cpu_runqueue* rq = rq_lock_thread(self);
+    self->state = state;
+    spin_unlock(&rq->lock);
+    local_irq_restore(flags);
+}
+
+// Keeps a thread off every queue, so only thread_make_ready can start it
+void thread_hold(thread_t* t)
+{
+    uint64_t flags = local_irq_save();
+    cpu_runqueue* rq = rq_lock_thread(t);
+    rq_remove(t);
+    t->state = THREAD_BLOCKED;
+    spin_unlock(&rq->lock);
+    local_irq_restore(flags);
+}
+
+static bool thread_has_exited(void* arg)
+{
+    return ((thread_t*)arg)->state == THREAD_ZOMBIE;
+}
+
+// Waits for a thread to exit and fetches its exit code: 0, -ESRCH, -EDEADLK or -ETIMEDOUT
+int thread_join(uint32_t id, int* exit_code, uint32_t timeout_ms)
+{
+    thread_t* self = thread_get_current();
+    spin_lock_irqsave((spinlock_t*)&thread_list_lock);
+    thread_t* t = thread_get_by_id(id);
+    if (t && t != self) __atomic_add_fetch(&t->joiners, 1, __ATOMIC_ACQ_REL);
+    spin_unlock_irqrestore((spinlock_t*)&thread_list_lock);
+
+    if (!t) return -ESRCH;
+    if (t == self) return -EDEADLK;
+
+    bool exited = wait_queue_wait(&exit_wait, thread_has_exited, t, timeout_ms);
+    if (exited && exit_code) *exit_code = t->exit_code;
+    __atomic_sub_fetch(&t->joiners, 1, __ATOMIC_ACQ_REL);
+
+    return exited ? 0 : -ETIMEDOUT;
+}
+
+bool thread_set_priority(uint32_t id, int priority)
+{
+    if (priority < 0 || priority >= THREAD_PRIORITIES) return false;
+
+    spin_lock_irqsave((spinlock_t*)&thread_list_lock);
+    thread_t* t = thread_get_by_id(id);
+    if (t && !t->is_idle)
+    {
+        cpu_runqueue* rq = rq_lock_thread(t);
+        bool queued = t->rq != nullptr;
+        if (queued) rq_remove(t);
+        t->priority = priority;
+        if (queued) rq_enqueue_ready(t);
+        spin_unlock(&rq->lock);
+    }
+    spin_unlock_irqrestore((spinlock_t*)&thread_list_lock);
+
+    return t && !t->is_idle;
+}
+
+/*
+ * Limits a thread to the CPUs in 'mask'. A queued thread moves at once, a
+ * blocked one wakes on an allowed CPU and a running one moves when it next
+ * yields; a caller that just excluded its own CPU yields straight away.
+ */
+bool thread_set_affinity(uint32_t id, uint32_t mask)
+{
+    if (!(mask & smp_online_mask())) return false;
+
+    spin_lock_irqsave((spinlock_t*)&thread_list_lock);
+    thread_t* t = thread_get_by_id(id);
+    bool ok = t && !t->is_idle;
+    uint32_t to = 0;
+    bool queued = false;
+    if (ok)
+    {
+        uint32_t from;
+        while (true)
+        {
+            from = __atomic_load_n(&t->cpu, __ATOMIC_ACQUIRE);
+            to = sched_select_cpu(mask, from);
+            rq_lock_pair(from, to);
+            if (t->cpu == from) break;
+            rq_unlock_pair(from, to);
+        }
+
+        t->affinity = mask;
+        if (t->rq)
+        {
+            rq_remove(t);
+            t->cpu = to;
+            rq_enqueue_ready(t);
+            queued = true;
+        }
+        else if (!t->running) t->cpu = to;
+        rq_unlock_pair(from, to);
+    }
+    bool leave = ok && t == thread_get_current() && !(mask & (1u << cpu_current_id()));
+    spin_unlock_irqrestore((spinlock_t*)&thread_list_lock);
+
+    if (queued) sched_kick(to);
+    if (leave) yield();
+    return ok;
 }
 
 int64_t thread_kill_by_string(const char* input) 
@@ -506,15 +1085,30 @@ int64_t thread_kill_by_string(const char* input)
     return -EPERM;
 }
 
+// Calls 'fn' on every live thread with the list locked, so none can be freed meanwhile
+void thread_for_each(void (*fn)(thread_t* t, void* arg), void* arg)
+{
+    spin_lock_irqsave((spinlock_t*)&thread_list_lock);
+    thread_t* self = thread_get_current();
+    thread_t* t = self;
+    do
+    {
+        fn(t, arg);
+        t = t->next;
+    } while (t != self);
+    spin_unlock_irqrestore((spinlock_t*)&thread_list_lock);
+}
+
 thread_t* thread_get_by_id(uint32_t id)
 {
-    if (!current_thread) return nullptr;
+    thread_t* self = thread_get_current();
+    if (!self) return nullptr;
     
-    thread_t* temp = current_thread;
+    thread_t* temp = self;
     do {
         if (temp->id == id) return temp;
         temp = temp->next;
-    } while (temp != current_thread);
+    } while (temp != self);
     
     return nullptr;
 }
\ No newline at end of file
@@ -25,6 +25,8 @@
 #include <fs/vfs.h>
 #include <mm/heap.h>
 #include <mm/vmm.h>
+#include <mm/vma.h>
+#include <mm/page_cache.h>
 #include <kernel/arch/x86_64/thread.h>
 #include <kernel/arch/x86_64/paging.h>
 #include <sys/errno.h>
@@ -46,6 +48,75 @@ static bool validate_elf(Elf64_Ehdr* hdr)
     return true;
 }
 
+static bool share_segments = true;
+static kex_load_stats load_stats;
+
+/*
+ * Maps [vaddr, vaddr + mem_size) into 'as' and fills it from the file. The
+ * target space need not be the loaded one: data goes through the direct map.
+ * Returns false on allocation failure or a short read.
+ *
+ * Pages that are plain file contents map the page cache's frame instead of a
+ * copy, so every instance of a binary shares them: read-only segments as is,
+ * writable ones copy-on-write. Only bss and partial data pages are private.
+ */
+static bool load_segment(address_space* as, VFSNode* file, uintptr_t vaddr, uintptr_t mem_size,
+                         uintptr_t file_offset, uintptr_t file_size, uint32_t seg_flags)
+{
+    uintptr_t page_start = vaddr & ~0xFFFULL;
+    uintptr_t page_end = (vaddr + mem_size + 0xFFF) & ~0xFFFULL;
+    bool writable = seg_flags & PF_W;
+    uint64_t flags = PTE_PRESENT | PTE_USER | (writable ? (uint64_t)PTE_RW : 0);
+
+    // File pages line up with memory pages only if both share the same offset
+    bool shareable = share_segments && file->cache_id() && (vaddr & 0xFFF) == (file_offset & 0xFFF);
+
+    for (uintptr_t addr = page_start; addr < page_end; addr += 4096)
+    {
+        // Pages fully covered by file data are overwritten below, the
+        // rest (bss, partial edges) must come back zero-filled.
+        bool file_backed = addr >= vaddr && addr + 4096 <= vaddr + file_size;
+
+        // A read-only page may expose file bytes around the segment, as long
+        // as none of it is bss that has to read back as zero
+        bool plain_file = file_backed || (!writable && (mem_size == file_size || addr + 4096 <= vaddr + file_size));
+        if (shareable && plain_file && !paging_get_physical_address(as, (void*)addr))
+        {
+            uint32_t index = ((file_offset & ~0xFFFULL) + (addr - page_start)) / 4096;
+            void* frame = page_cache_get_frame(file, index);
+            if (frame)
+            {
+                if (!paging_map_page(as, (void*)addr, frame, PTE_PRESENT | PTE_USER | (writable ? (uint64_t)PTE_COW : 0)))
+                {
+                    pfa_put_frame(frame);
+                    return false;
+                }
+                load_stats.shared_frames++;
+                continue;
+            }
+        }
+
+        void* phys = pfa_alloc_frame(file_backed ? PFA_NO_ZERO : 0);
+        if (!phys) return false;
+
+        if (!paging_map_page(as, (void*)addr, phys, flags))
+        {
+            pfa_free_frame(phys);
+            return false;
+        }
+        load_stats.private_frames++;
+
+        uintptr_t copy_start = addr < vaddr ? vaddr : addr;
+        uintptr_t copy_end = addr + 4096 < vaddr + file_size ? addr + 4096 : vaddr + file_size;
+        if (copy_start >= copy_end) continue;
+
+        uint8_t* dst = (uint8_t*)phys_to_virt((uintptr_t)phys) + (copy_start - addr);
+        uint32_t len = copy_end - copy_start;
+        if (vfs_read(file, file_offset + (copy_start - vaddr), len, dst) != len) return false;
+    }
+    return true;
+}
+
 int kex_load(const char* path, [[maybe_unused]] int argc, [[maybe_unused]] char** argv)
 {
     VFSNode* file = vfs_open(path);
@@ -70,7 +141,7 @@ int kex_load(const char* path, [[maybe_unused]] int argc, [[maybe_unused]] char*
     // Read Program Headers
     uint32_t ph_size = hdr.e_phnum * hdr.e_phentsize;
     uint8_t* ph_buf = (uint8_t*)kmalloc(ph_size);
-    if (vfs_read(file, hdr.e_phoff, ph_size, ph_buf) != ph_size) {
+    if (!ph_buf || vfs_read(file, hdr.e_phoff, ph_size, ph_buf) != ph_size) {
         printf("Error: Cannot read Program Headers.\n");
         kfree(ph_buf);
         vfs_close(file);
@@ -79,12 +150,18 @@ int kex_load(const char* path, [[maybe_unused]] int argc, [[maybe_unused]] char*
 
     Elf64_Phdr* ph = (Elf64_Phdr*)ph_buf;
     bool kex_note_found = false;
+    size_t stack_size = 0;          // 0 selects USER_STACK_DEFAULT
 
     // First Pass: Check for KEX Note
     for (int i = 0; i < hdr.e_phnum; i++) {
         if (ph[i].p_type == PT_NOTE) {
             uint8_t* note_buf = (uint8_t*)kmalloc(ph[i].p_filesz);
-            vfs_read(file, ph[i].p_offset, ph[i].p_filesz, note_buf);
+            if (!note_buf || ph[i].p_filesz < 12 ||
+                vfs_read(file, ph[i].p_offset, ph[i].p_filesz, note_buf) != ph[i].p_filesz)
+            {
+                kfree(note_buf);
+                continue;
+            }
             
             struct Elf_Note {
                 uint32_t namesz;
@@ -99,9 +176,10 @@ int kex_load(const char* path, [[maybe_unused]] int argc, [[maybe_unused]] char*
             {
                  kex_note_found = true;
                  
-                 // Check version in desc (KEX1)
-                 // void* desc = (void*)(note_name + 8); // aligned(7)=8
-                 // We can parse KexHeader here for stack requirements
+                 // Older images only carry the "KEX1" tag, not the full header
+                 KexHeader* kh = (KexHeader*)(note_name + ((note->namesz + 3) & ~3));
+                 if (note->descsz >= sizeof(KexHeader) && memcmp(kh->verify, "KEX1", 4) == 0)
+                     stack_size = kh->stack_size;
             }
             kfree(note_buf);
         }
@@ -115,12 +193,9 @@ int kex_load(const char* path, [[maybe_unused]] int argc, [[maybe_unused]] char*
     }
 
     // Create User Thread
-    // Disable interrupts to prevent scheduler from picking up the new thread before content is loaded (Race Condition Fix)
-    // Use thread_add to ensure thread is linked to scheduler list
-    asm volatile("cli");
-    thread_t* t = thread_add((void(*)())hdr.e_entry, path, true);
-    if (t) t->state = THREAD_BLOCKED;
-    asm volatile("sti");
+    // Linked on the thread list but held off the run queues until it is
+    // loaded; no CPU may pick it up before its content is in place
+    thread_t* t = thread_add((void(*)())hdr.e_entry, path, true, stack_size, true);
 
     if (!t) 
     {
@@ -149,40 +224,15 @@ int kex_load(const char* path, [[maybe_unused]] int argc, [[maybe_unused]] char*
             if (vaddr_end > max_vaddr) max_vaddr = vaddr_end;
             if (vaddr_start < min_vaddr) min_vaddr = vaddr_start;
 
-            uintptr_t page_start = vaddr_start & ~0xFFF;
-            uintptr_t page_end = (vaddr_end + 0xFFF) & ~0xFFF;
-            
-            // Force RW to allow loading content. Security TODO: Remap RO after load if needed.
-            uint32_t flags = PTE_PRESENT | PTE_USER | PTE_RW; 
-            if (!(ph[i].p_flags & PF_X)) {} // NX bit?
-
-            // Map Pages
-            for (uintptr_t addr = page_start; addr < page_end; addr += 4096) {
-                // Check if already mapped? 
-                // We trust pfa will give fresh frames.
-                // TODO: Zero pages for security (pfa_alloc doesn't guarantee zero)
-                void* phys = pfa_alloc_frame();
-                if (!phys) 
-                {
-                    // Cleanup partial thread
-                    t->user_image_start = min_vaddr & ~0xFFF;
-                    t->user_image_end = (max_vaddr + 0xFFF) & ~0xFFF;
-                    thread_kill(t->id);
-                    
-                    kfree(ph_buf);
-                    vfs_close(file);
-                    return -1;
-                }
-                
-                paging_map_page((void*)addr, phys, flags);
-                
-                // Zero page manually
-                memset((void*)addr, 0, 4096); 
-            }
-            
-            // Read file content
-            if (file_size > 0) {
-                 vfs_read(file, file_offset, file_size, (uint8_t*)vaddr_start);
+            if (!load_segment(t->as, file, vaddr_start, ph[i].p_memsz, file_offset, file_size, ph[i].p_flags))
+            {
+                printf("Error: Failed to load segment.\n");
+
+                // Tearing down the address space releases everything mapped so far
+                thread_kill(t->id);
+                kfree(ph_buf);
+                vfs_close(file);
+                return -1;
             }
         }
     }
@@ -200,25 +250,22 @@ int kex_load(const char* path, [[maybe_unused]] int argc, [[maybe_unused]] char*
         t->user_image_start = min_vaddr & ~0xFFF;
         t->user_image_end = (max_vaddr + 0xFFF) & ~0xFFF;
         
-        uintptr_t heap_start_standard = 0x40000000;
+        uintptr_t heap_start_standard = USER_HEAP_MIN;
         if (max_vaddr < heap_start_standard) max_vaddr = heap_start_standard;
         
         t->user_heap_break = (max_vaddr + 0xFFF) & ~0xFFF;
-    }
 
-    // Flush TLB to ensure User permissions are visible in upper paging levels
-    // This fixes #PF 0x5 when switching to User Mode if upper paging directories were cached as Supervisor-only.
-    uintptr_t cr3;
-    asm volatile("mov %%cr3, %0" : "=r"(cr3));
-    asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+        // Segments are mapped eagerly; the area keeps gaps between them valid
+        vma_create(t->as, t->user_image_start, t->user_image_end, VMA_READ | VMA_WRITE | VMA_EXEC, VMA_IMAGE);
+    }
 
+    // The new space has never been loaded, so no stale translations exist for it
+    load_stats.loads++;
     kfree(ph_buf);
     vfs_close(file);
     
     // Wake up thread
-    asm volatile("cli");
-    t->state = THREAD_READY;
-    asm volatile("sti");
+    thread_make_ready(t);
     
     asm volatile("sti");
     return t->id;
@@ -258,7 +305,7 @@ uintptr_t kdl_load(const char* path, thread_t* t)
     // Read Program Headers
     uint32_t ph_size = hdr.e_phnum * hdr.e_phentsize;
     uint8_t* ph_buf = (uint8_t*)kmalloc(ph_size);
-    if (vfs_read(file, hdr.e_phoff, ph_size, ph_buf) != ph_size) 
+    if (!ph_buf || vfs_read(file, hdr.e_phoff, ph_size, ph_buf) != ph_size) 
     {
         printf("Error: Cannot read Program Headers.\n");
         kfree(ph_buf);
@@ -283,15 +330,21 @@ uintptr_t kdl_load(const char* path, thread_t* t)
     lib_size = (lib_size + 0xFFF) & ~0xFFF;
 
     // 2. Assign a base virtual address for this library
-    // We can use a high memory region for shared libraries, e.g. 0x700000000000
+    // We can use a high memory region for shared libraries, below the stack
     // For simplicity, we assign a fixed base or we can scan for free space.
     // Let's implement a simple bump allocator for dynamic libraries per thread:
     // We need to store this in thread_t. For now, we will use a fixed hardcoded
-    // region starting at 0x700000000000 and increment it by the library size.
-    // Assuming t->dyn_lib_break initialized to 0x700000000000
-    if (t->dyn_lib_break == 0) t->dyn_lib_break = 0x700000000000;
+    // region starting at USER_LIB_BASE and increment it by the library size.
+    if (t->dyn_lib_break == 0) t->dyn_lib_break = USER_LIB_BASE;
     
     uintptr_t load_base = t->dyn_lib_break;
+    if (!vma_create(t->as, load_base, load_base + lib_size, VMA_READ | VMA_WRITE | VMA_EXEC, VMA_IMAGE))
+    {
+        printf("Error: No room for library at 0x%lx.\n", load_base);
+        kfree(ph_buf);
+        vfs_close(file);
+        return 0;
+    }
     t->dyn_lib_break += lib_size;
     
 
@@ -310,46 +363,32 @@ uintptr_t kdl_load(const char* path, thread_t* t)
             
             if (vaddr_end == vaddr_start) continue;
 
-            uintptr_t page_start = vaddr_start & ~0xFFF;
-            uintptr_t page_end = (vaddr_end + 0xFFF) & ~0xFFF;
-            
-            uint32_t flags = PTE_PRESENT | PTE_USER | PTE_RW; 
-
-            // Map Pages
-            for (uintptr_t addr = page_start; addr < page_end; addr += 4096) 
+            if (!load_segment(t->as, file, vaddr_start, ph[i].p_memsz, file_offset, file_size, ph[i].p_flags))
             {
-                void* phys = pfa_alloc_frame();
-                if (!phys) 
-                {
-                    kfree(ph_buf);
-                    vfs_close(file);
-                    return 0;
-                }
-                
-                paging_map_page((void*)addr, phys, flags);
-                memset((void*)addr, 0, 4096); 
+                printf("Error: Failed to load library segment.\n");
+                kfree(ph_buf);
+                vfs_close(file);
+                return 0;
             }
-            
-            // Read file content
-            if (file_size > 0) 
-                 vfs_read(file, file_offset, file_size, (uint8_t*)vaddr_start);
         }
         else if (ph[i].p_type == PT_DYNAMIC)
             dyn_table = (Elf64_Dyn*)(load_base + ph[i].p_vaddr);
     }
 
-    // 4. Process Relocations
+    // 4. Process Relocations (through t's tables, it need not be the running space)
     if (dyn_table)
     {
-        Elf64_Rela* rela = nullptr;
+        uintptr_t rela = 0;
         size_t rela_sz = 0;
         size_t rela_ent = 0;
 
-        for (Elf64_Dyn* d = dyn_table; d->d_tag != DT_NULL; d++)
+        Elf64_Dyn d;
+        for (uintptr_t p = (uintptr_t)dyn_table; paging_copy_from(t->as, &d, p, sizeof(d)) == sizeof(d); p += sizeof(d))
         {
-            if (d->d_tag == DT_RELA) rela = (Elf64_Rela*)(load_base + d->d_un.d_ptr);
-            else if (d->d_tag == DT_RELASZ) rela_sz = d->d_un.d_val;
-            else if (d->d_tag == DT_RELAENT) rela_ent = d->d_un.d_val;
+            if (d.d_tag == DT_NULL) break;
+            if (d.d_tag == DT_RELA) rela = load_base + d.d_un.d_ptr;
+            else if (d.d_tag == DT_RELASZ) rela_sz = d.d_un.d_val;
+            else if (d.d_tag == DT_RELAENT) rela_ent = d.d_un.d_val;
         }
 
         if (rela && rela_ent > 0)
@@ -357,23 +396,32 @@ uintptr_t kdl_load(const char* path, thread_t* t)
             size_t num_relas = rela_sz / rela_ent;
             for (size_t i = 0; i < num_relas; i++)
             {
-                if (ELF64_R_TYPE(rela[i].r_info) == R_X86_64_RELATIVE)
+                Elf64_Rela r;
+                if (paging_copy_from(t->as, &r, rela + i * rela_ent, sizeof(r)) != sizeof(r)) break;
+                if (ELF64_R_TYPE(r.r_info) == R_X86_64_RELATIVE)
                 {
-                    uintptr_t target = load_base + rela[i].r_offset;
-                    uint64_t* ptr = (uint64_t*)target;
-                    *ptr = load_base + rela[i].r_addend;
+                    uint64_t value = load_base + r.r_addend;
+                    paging_copy_to(t->as, load_base + r.r_offset, &value, sizeof(value));
                 }
             }
         }
     }
 
-    // Flush TLB
-    uintptr_t cr3;
-    asm volatile("mov %%cr3, %0" : "=r"(cr3));
-    asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+    // Fresh mappings only replace non-present entries, which the TLB never caches
 
+    load_stats.loads++;
     kfree(ph_buf);
     vfs_close(file);
     
     return load_base;
 }
+
+void kex_set_segment_sharing(bool enabled)
+{
+    share_segments = enabled;
+}
+
+void kex_get_load_stats(kex_load_stats* stats)
+{
+    if (stats) *stats = load_stats;
+}
@@ -31,9 +31,11 @@
 #include <kernel/arch/x86_64/thread.h>
 #include <kernel/arch/x86_64/gdt.h>
 #include <kernel/arch/x86_64/idt.h>
+#include <kernel/arch/x86_64/smp.h>
 
 #include <mm/vmm.h>
 #include <mm/heap.h>
+#include <mm/reclaim.h>
 
 #include <fs/vfs.h>
 #include <fs/ramfs.h>
@@ -45,6 +47,7 @@
 
 #include <drivers/vga.h>
 #include <drivers/ata.h>
+#include <drivers/acpi.h>
 #include <drivers/timer.h>
 #include <drivers/serial.h>
 #include <drivers/speaker.h>
@@ -57,9 +60,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-extern "C" char _kernel_end;
-extern "C" tss_entry kernel_tss;
-
 
 void init_file_system(void* ramdisk_vaddr) 
 {
@@ -128,6 +128,7 @@ extern "C" void kernel_main([[maybe_unused]] uint64_t magic, uint64_t multiboot_
     uintptr_t rd_phys = 0;
     uint32_t rd_size = 0;
 	uint32_t mods_count = 0;
+	void* acpi_rsdp = nullptr;
 
 	multiboot_tag *tag;
     for (tag = (multiboot_tag*)(multiboot_virt_addr + 8);
@@ -150,6 +151,16 @@ extern "C" void kernel_main([[maybe_unused]] uint64_t magic, uint64_t multiboot_
 				mods_count++;
                 break;
             }
+            case MULTIBOOT_TAG_TYPE_ACPI_OLD:
+            {
+                if (!acpi_rsdp) acpi_rsdp = ((multiboot_tag_old_acpi*)tag)->rsdp;
+                break;
+            }
+            case MULTIBOOT_TAG_TYPE_ACPI_NEW:
+            {
+                acpi_rsdp = ((multiboot_tag_new_acpi*)tag)->rsdp;
+                break;
+            }
         }
     }
 
@@ -162,8 +173,7 @@ extern "C" void kernel_main([[maybe_unused]] uint64_t magic, uint64_t multiboot_
 	paging_init();	
     paging_make_kernel_user_accessible();
 
-	VMM::kernel_dynamic_break = ((uintptr_t)&_kernel_end + 0xFFF) & ~0xFFF;
-	VMM::kernel_dynamic_break += 0x10000;
+	VMM::kernel_dynamic_break = KERNEL_DYNAMIC_BASE;
 	
 	void* heap_start = (void*)VMM::kernel_dynamic_break;
     uintptr_t initial_heap_size = 4 * 1024 * 1024;
@@ -180,22 +190,16 @@ extern "C" void kernel_main([[maybe_unused]] uint64_t magic, uint64_t multiboot_
 	// 4. Subsystem Initialization
 	timer_init(100);
 	thread_init();
+	reclaim_init();
 	keyboard_init();
 
 	void* ramdisk_vaddr = nullptr;
 	if (rd_phys != 0) 
     {
         size_t rd_pages = (rd_size + 4095) / 4096;
-        ramdisk_vaddr = (void*)0xFFFFFFFFE0000000;
-
-        for(size_t i = 0; i < rd_pages; i++)
-        {
-            paging_map_page(
-                (void*)((uintptr_t)ramdisk_vaddr + (i * PAGE_SIZE)), 
-                (void*)(rd_phys + (i * PAGE_SIZE)), 
-                PTE_PRESENT | PTE_RW
-            );
-        }
+        ramdisk_vaddr = VMM::map_physical_region(rd_phys, rd_pages, PTE_PRESENT | PTE_RW);
+        if (!ramdisk_vaddr)
+            panic(KernelError::K_ERR_OUT_OF_MEMORY, "Cannot map the RAMFS module");
 
         KeonFS_Info* fs_info = (KeonFS_Info*)ramdisk_vaddr;
         if (fs_info->magic != KEONFS_MAGIC)
@@ -206,6 +210,10 @@ extern "C" void kernel_main([[maybe_unused]] uint64_t magic, uint64_t multiboot_
 
 	// Re-enable interrupts after safe hardware/memory setup
 	asm volatile("sti");
+
+	// Start the other processors now that the timer and scheduler run
+	acpi_init(acpi_rsdp);
+	smp_init();
 	
 	// 5. User Interface & Branding
     // Show the boot splash screen and provide visual/auditory feedback (beep)
@@ -253,7 +261,8 @@ extern "C" void kernel_main([[maybe_unused]] uint64_t magic, uint64_t multiboot_
         asm volatile("cli");
         cleanup_zombies();
         asm volatile("sti");
-        asm volatile("hlt");
+        if (pfa_zero_pool_refill(PFA_ZERO_POOL_BATCH) == 0)
+            asm volatile("hlt");
     }
 	
 }
@@ -20,13 +20,21 @@
 
 
 #include <kernel/arch/x86_64/paging.h>
+#include <kernel/arch/x86_64/cpu.h>
+#include <kernel/arch/x86_64/smp.h>
 #include <kernel/arch/x86_64/thread.h>
 
 #include <kernel/constants.h>
 #include <kernel/kernel.h>
 #include <kernel/shell.h>
+#include <kernel/wait_queue.h>
 
 #include <mm/heap.h>
+#include <mm/kstack.h>
+#include <mm/page_cache.h>
+#include <mm/reclaim.h>
+#include <mm/slab.h>
+#include <mm/vma.h>
 #include <mm/vmm.h>
 
 #include <fs/ramfs.h>
@@ -102,7 +110,7 @@ static int history_index = -1;
 static const char* command_list[] = 
 {
     "help", "clear", "echo", "info", "testheap", "meminfo", 
-    "reboot", "halt", "paginginfo", "testpaging", "memstat", "dump",
+    "reboot", "halt", "paginginfo", "testpaging", "benchtlb", "benchctx", "benchcache", "benchspawn", "benchscale", "testtimer", "testsched", "testwait", "testsmp", "memstat", "dump",
 	"uptime", "ps", "pkill", "ls", "cat", "cd", "mkdir", "touch", "rm",
     "sleep", "pid", "stat"
 };
@@ -156,6 +164,15 @@ static void cmd_help(const char* args)
         printf("  testheap   - Stress test the kernel heap allocator\n");
         printf("  testpaging - Verify virtual memory mapping/unmapping\n");
         printf("  paginginfo - Display physical frame and page table stats\n");
+        printf("  benchtlb   - Time random reads via 4K pages vs the direct map\n");
+        printf("  benchctx   - Time address space switches with and without PCID\n");
+        printf("  benchcache <f> - Time a cold (disk) and a warm (page cache) file read\n");
+        printf("  benchspawn <f> [n] - Spawn a KEX n times with copied and shared segments\n");
+        printf("  benchscale <f> [n] - Run 1 to n copies of a CPU-bound KEX at once\n");
+        printf("  testtimer  - Check timer wheel expiry, cascading and cancellation\n");
+        printf("  testsched  - Check priority order and yield cost with blocked threads\n");
+        printf("  testwait   - Check wait queue wakeups, timeouts and thread join\n");
+        printf("  testsmp    - List the CPUs, check threads spread, TLB shootdowns and affinity\n");
         printf("  memstat    - Detailed summary of physical and virtual memory\n");
         printf("  dump <hex> - Hexdump 64 bytes starting from memory address\n");
         printf("\n");
@@ -345,7 +362,66 @@ static void cmd_testheap()
         printf("  [+] C++ delete operator works\n");
     } 
 	else printf("  [-] C++ new operator failed!\n");
-    
+
+    void* big = kmalloc(3 * PAGE_SIZE);
+    if (big) printf("  [+] Large allocation served by the list allocator\n");
+    else printf("  [-] Large allocation failed!\n");
+    kfree(big);
+
+    static kmem_cache* test_cache = nullptr;
+    if (!test_cache) test_cache = kmem_cache_create("testheap", 200);
+    void* objs[64];
+    bool slab_ok = test_cache != nullptr;
+    for (int i = 0; slab_ok && i < 64; i++)
+    {
+        objs[i] = kmem_cache_alloc(test_cache);
+        if (!objs[i]) slab_ok = false;
+        else memset(objs[i], i, 200);
+    }
+    for (int i = 0; slab_ok && i < 64; i++)
+        if (((uint8_t*)objs[i])[199] != (uint8_t)i) slab_ok = false;
+    for (int i = 0; slab_ok && i < 64; i++)
+    {
+        if (i & 1) kfree(objs[i]);
+        else kmem_cache_free(test_cache, objs[i]);
+    }
+    if (slab_ok) printf("  [+] Named slab cache alloc/free works\n");
+    else printf("  [-] Named slab cache test failed!\n");
+
+    // Random alloc/free on the list allocator (sizes above the slab classes)
+    struct heap_stats before, after;
+    kheap_get_stats(&before);
+
+    void* slots[32] = {0};
+    uint32_t seed = 0x1234567;
+    bool stress_ok = kheap_check();
+    for (int round = 0; stress_ok && round < 2000; round++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int i = (seed >> 16) % 32;
+        if (slots[i])
+        {
+            kfree(slots[i]);
+            slots[i] = nullptr;
+        }
+        else
+        {
+            size_t size = KMEM_KMALLOC_MAX + 1 + ((seed >> 8) % (8 * PAGE_SIZE));
+            slots[i] = kmalloc(size);
+            if (!slots[i]) stress_ok = false;
+            else memset(slots[i], 0xA5, size);
+        }
+        if ((round % 100) == 0 && !kheap_check()) stress_ok = false;
+    }
+    for (int i = 0; i < 32; i++) kfree(slots[i]);
+
+    kheap_get_stats(&after);
+    if (!kheap_check() || after.used_size != before.used_size) stress_ok = false;
+
+    if (stress_ok) printf("  [+] Heap stress test consistent (%d blocks, %d free)\n",
+                          (int)after.block_count, (int)after.free_block_count);
+    else printf("  [-] Heap stress test found an inconsistency!\n");
+
     kfree(ptr1);
     kfree(ptr3);
     kfree(ptr4);
@@ -378,7 +454,16 @@ static void cmd_meminfo()
     printf("Free:       %d KB (%d%%)\n", free_kb, free_pct);
 
     printf("Blocks:     Total: %d, Free: %d\n", (int)stats.block_count, (int)stats.free_block_count);
-    
+
+    printf("\nSlab Caches: %d KB held, %d KB in use\n", (int)(stats.slab_size / 1024), (int)(stats.slab_used / 1024));
+    for (size_t i = 0; i < stats.cache_count; i++)
+    {
+        struct kmem_cache_stats* c = &stats.caches[i];
+        if (c->slab_count == 0) continue;
+        printf("  %s: %d/%d objs of %d B, %d slabs\n", c->name, (int)c->active_objects,
+               (int)c->total_objects, (int)c->object_size, (int)c->slab_count);
+    }
+
     printf("-------------------------------\n");
 }
 
@@ -584,6 +669,32 @@ static void cmd_paginginfo()
     printf("Free Frames:   %d (%d%%)\n", (int)stats.free_frames, free_pct);
 
     printf("Mapped Pages:  %d\n", (int)stats.mapped_pages);
+    printf("Huge Leaves:   %d x 2M, %d x 1G\n", (int)stats.huge_2m, (int)stats.huge_1g);
+    printf("User Huge:     %d x 2M mapped, %d split\n", (int)stats.thp_mapped, (int)stats.thp_splits);
+    printf("Demand Faults: %lu\n", vma_fault_count());
+    if (stats.pcid_enabled) printf("PCID Tags:     %d in use\n", (int)stats.pcid_used);
+    else printf("PCID Tags:     unsupported\n");
+
+    printf("Free Blocks:  ");
+    for (int order = 0; order <= PFA_MAX_ORDER; order++)
+        printf(" %d", (int)stats.free_blocks[order]);
+    printf("  (order 0..%d)\n", PFA_MAX_ORDER);
+
+    static const char* zone_names[PFA_ZONE_COUNT] = { "DMA", "DMA32", "Normal" };
+    printf("Zones:        ");
+    for (int z = 0; z < PFA_ZONE_COUNT; z++)
+        printf(" %s %d/%d", zone_names[z], (int)stats.zone_free[z], (int)stats.zone_present[z]);
+    printf("  (free/present)\n");
+
+    uint64_t pcp_total = stats.pcp_hits + stats.pcp_misses;
+    int hit_pct = (pcp_total > 0) ? (int)((stats.pcp_hits * 100) / pcp_total) : 0;
+    printf("CPU Caches:    %d frames, %d hits / %d misses (%d%% hit)\n",
+           (int)stats.pcp_cached, (int)stats.pcp_hits, (int)stats.pcp_misses, hit_pct);
+
+    uint64_t zero_total = stats.zero_pool_hits + stats.zero_pool_misses;
+    int zero_pct = (zero_total > 0) ? (int)((stats.zero_pool_hits * 100) / zero_total) : 0;
+    printf("Zeroed Pool:   %d frames, %d hits / %d misses (%d%% hit)\n",
+           (int)stats.zero_pool_frames, (int)stats.zero_pool_hits, (int)stats.zero_pool_misses, zero_pct);
     
     printf("--------------------------------\n");
 }
@@ -606,11 +717,11 @@ static void cmd_testpaging()
     
     void* test_vaddr = (void*)0xE0000000;
     printf(" [2] Mapping virtual page 0x%lx... ", (uintptr_t)test_vaddr);
-    paging_map_page(test_vaddr, frame, PTE_PRESENT | PTE_RW);
+    paging_map_page(paging_kernel_space(), test_vaddr, frame, PTE_PRESENT | PTE_RW);
     printf("OK\n");        
     
     printf(" [3] Verification: ");
-    void* phys = paging_get_physical_address(test_vaddr);
+    void* phys = paging_get_physical_address(paging_kernel_space(), test_vaddr);
     if (phys == frame) 
         printf("MATCH (0x%lx == 0x%lx)\n", (uintptr_t)phys, (uintptr_t)frame);
 
@@ -622,18 +733,814 @@ static void cmd_testpaging()
     }
     
     printf(" [4] Unmapping virtual page... ");
-    paging_unmap_page(test_vaddr);
+    paging_unmap_page(paging_kernel_space(), test_vaddr);
     printf("OK\n");
     
     printf(" [5] Freeing physical frame... ");
     pfa_free_frame(frame);
     printf("OK\n");
-    
+
+    printf(" [6] vmalloc range reuse... ");
+    void* area = vmalloc(8 * PAGE_SIZE, VM_GUARD);
+    vfree(area);
+    void* again = vmalloc(8 * PAGE_SIZE, VM_GUARD);
+    if (area && again == area) printf("OK (0x%lx)\n", (uintptr_t)area);
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED (0x%lx then 0x%lx)\n", (uintptr_t)area, (uintptr_t)again);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+    vfree(again);
+
+    printf(" [7] Private address space... ");
+    paging_stats before;
+    paging_get_stats(&before);
+    address_space* as = paging_create_address_space();
+    void* user_frame = as ? pfa_alloc_frame() : nullptr;
+    uint64_t pattern = 0x6B656F6E4F53ULL, readback = 0;
+    bool isolated = false;
+    if (user_frame)
+    {
+        paging_map_page(as, test_vaddr, user_frame, PTE_PRESENT | PTE_RW | PTE_USER);
+        paging_copy_to(as, (uintptr_t)test_vaddr, &pattern, sizeof(pattern));
+        paging_copy_from(as, &readback, (uintptr_t)test_vaddr, sizeof(readback));
+        isolated = paging_get_physical_address(paging_kernel_space(), test_vaddr) == nullptr;
+    }
+    paging_destroy_address_space(as);
+    paging_stats after;
+    paging_get_stats(&after);
+    if (isolated && readback == pattern && after.free_frames == before.free_frames) printf("OK\n");
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED (isolated %d, data %s, frames %ld)\n", isolated, readback == pattern ? "ok" : "bad",
+               (int64_t)after.free_frames - (int64_t)before.free_frames);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
+    printf(" [8] Zone placement... ");
+    paging_get_stats(&before);
+    void* dma_frame = pfa_alloc_frame_zone(PFA_ZONE_DMA);
+    void* any_frame = pfa_alloc_frames(1);
+    bool dma_ok = dma_frame && (uintptr_t)dma_frame < PFA_ZONE_DMA_END;
+    // With higher memory free, a default block must not come out of the DMA zone
+    bool high_ok = !any_frame || (uintptr_t)any_frame >= PFA_ZONE_DMA_END ||
+                   before.zone_free[PFA_ZONE_DMA32] + before.zone_free[PFA_ZONE_NORMAL] < 2;
+    if (dma_ok && high_ok) printf("OK (DMA 0x%lx, default 0x%lx)\n", (uintptr_t)dma_frame, (uintptr_t)any_frame);
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED (DMA 0x%lx, default 0x%lx)\n", (uintptr_t)dma_frame, (uintptr_t)any_frame);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+    if (dma_frame) pfa_free_frame(dma_frame);
+    if (any_frame) pfa_free_frames(any_frame, 1);
+
+    printf(" [9] Kernel stack guard... ");
+    uint8_t* kstack = (uint8_t*)kstack_alloc();
+    bool guarded = kstack && kstack_is_guard((uintptr_t)kstack - 1) &&
+                   paging_get_physical_address(paging_kernel_space(), kstack - 1) == nullptr &&
+                   paging_get_physical_address(paging_kernel_space(), kstack + THREAD_KERNEL_STACK_SIZE - 1) != nullptr;
+    kstack_free(kstack);
+    void* reused = kstack_alloc();
+    kstack_free(reused);
+    if (guarded && reused == kstack) printf("OK (0x%lx)\n", (uintptr_t)kstack);
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED (guard %d, 0x%lx then 0x%lx)\n", guarded, (uintptr_t)kstack, (uintptr_t)reused);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
     shell_setcolor(vga_color_t(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
     printf("\n[SUCCESS] Paging test completed!\n");
     shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
 }
 
+/**
+ * cmd_benchtlb: Random page-stride reads over the same 16 MiB of frames,
+ * once through 4 KiB vmalloc mappings and once through the huge-page direct map
+ */
+static void cmd_benchtlb()
+{
+    const size_t pages = 4096;
+    const int accesses = 1 << 20;
+
+    uint8_t* area = (uint8_t*)vmalloc(pages * PAGE_SIZE);
+    uint8_t** small_map = (uint8_t**)kmalloc(pages * sizeof(uint8_t*));
+    uint8_t** huge_map = (uint8_t**)kmalloc(pages * sizeof(uint8_t*));
+    if (!area || !small_map || !huge_map)
+    {
+        printf("benchtlb: out of memory\n");
+        vfree(area);
+        kfree(small_map);
+        kfree(huge_map);
+        return;
+    }
+
+    for (size_t i = 0; i < pages; i++)
+    {
+        small_map[i] = area + i * PAGE_SIZE;
+        huge_map[i] = (uint8_t*)phys_to_virt((uintptr_t)paging_get_physical_address(paging_kernel_space(), small_map[i]));
+    }
+
+    uint8_t** maps[2] = { small_map, huge_map };
+    uint64_t cycles[2];
+    volatile uint64_t sink = 0;
+
+    for (int m = 0; m < 2; m++)
+    {
+        uint32_t seed = 0xC0FFEE;
+        uint64_t start = rdtsc();
+        for (int i = 0; i < accesses; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            sink += maps[m][(seed >> 8) % pages][seed & 0xFC0];
+        }
+        cycles[m] = rdtsc() - start;
+    }
+
+    printf("\n--- TLB Benchmark (%d random reads over %d KB) ---\n", accesses, (int)(pages * 4));
+    printf("4K mappings:   %lu cycles (%lu per read)\n", cycles[0], cycles[0] / accesses);
+    printf("Direct map:    %lu cycles (%lu per read)\n", cycles[1], cycles[1] / accesses);
+
+    vfree(area);
+    kfree(small_map);
+    kfree(huge_map);
+}
+
+/**
+ * cmd_benchctx: Ping-pongs between two address spaces touching a small working
+ * set in each, once keeping the TLB across switches (PCID) and once flushing
+ */
+static void cmd_benchctx()
+{
+    const int pages = 32;
+    const int rounds = 4096;
+    const uintptr_t base = 0x10000000;
+
+    address_space* spaces[2] = { paging_create_address_space(), paging_create_address_space() };
+    bool ok = spaces[0] && spaces[1];
+    for (int s = 0; ok && s < 2; s++)
+    {
+        for (int i = 0; ok && i < pages; i++)
+        {
+            void* frame = pfa_alloc_frame();
+            if (!frame) ok = false;
+            else paging_map_page(spaces[s], (void*)(base + i * PAGE_SIZE), frame, PTE_PRESENT | PTE_RW);
+        }
+        uint64_t marker = s + 1;
+        if (ok) paging_copy_to(spaces[s], base, &marker, sizeof(marker));
+    }
+    if (!ok)
+    {
+        printf("benchctx: out of memory\n");
+        paging_destroy_address_space(spaces[0]);
+        paging_destroy_address_space(spaces[1]);
+        return;
+    }
+
+    uint64_t cycles[2];
+    int wrong = 0;
+    volatile uint64_t sink = 0;
+
+    // The shell is a kernel thread: keep the scheduler out while foreign tables are live
+    uint64_t rflags = local_irq_save();
+    for (int flush = 0; flush < 2; flush++)
+    {
+        uint64_t start = rdtsc();
+        for (int r = 0; r < rounds; r++)
+        {
+            for (int s = 0; s < 2; s++)
+            {
+                if (flush) paging_flush_address_space(spaces[s]);
+                paging_switch_address_space(spaces[s]);
+
+                if (*(volatile uint64_t*)base != (uint64_t)(s + 1)) wrong++;
+                for (int i = 0; i < pages; i++)
+                    sink += *(volatile uint64_t*)(base + i * PAGE_SIZE + 64);
+            }
+        }
+        cycles[flush] = rdtsc() - start;
+    }
+    paging_switch_address_space(paging_kernel_space());
+    local_irq_restore(rflags);
+
+    paging_stats stats;
+    paging_get_stats(&stats);
+    uint64_t switches = 2ULL * rounds;
+
+    printf("\n--- Context Switch Benchmark (%lu switches, %d pages each) ---\n", switches, pages);
+    printf("PCID:          %s\n", stats.pcid_enabled ? "enabled" : "unsupported (both runs flush)");
+    printf("Tagged TLB:    %lu cycles (%lu per switch)\n", cycles[0], cycles[0] / switches);
+    printf("Flushed TLB:   %lu cycles (%lu per switch)\n", cycles[1], cycles[1] / switches);
+    if (wrong)
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED: %d reads saw the other space's page\n", wrong);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
+    paging_destroy_address_space(spaces[0]);
+    paging_destroy_address_space(spaces[1]);
+}
+
+/**
+ * cmd_benchcache: Reads a file twice, first with its pages dropped from the
+ * page cache so they come from disk, then again from the cache
+ */
+static void cmd_benchcache(const char* args)
+{
+    char path[512];
+    if (!args || args[0] == '\0')
+    {
+        printf("Usage: benchcache <file>\n");
+        return;
+    }
+    resolve_path(path, args);
+
+    VFSNode* file = vfs_open(path);
+    if (!file || file->type != VFS_FILE || !file->cache_id() || file->size == 0)
+    {
+        printf("benchcache: %s is not a cacheable file\n", path);
+        vfs_close(file);
+        return;
+    }
+
+    uint8_t* buffer = (uint8_t*)kmalloc(PAGE_SIZE);
+    if (!buffer)
+    {
+        printf("benchcache: out of memory\n");
+        vfs_close(file);
+        return;
+    }
+
+    page_cache_flush(file);
+    page_cache_invalidate(file->cache_id(), 0, UINT32_MAX);
+
+    uint64_t cycles[2];
+    uint32_t sums[2];
+    for (int pass = 0; pass < 2; pass++)
+    {
+        sums[pass] = 0;
+        uint64_t start = rdtsc();
+        for (uint32_t offset = 0; offset < file->size; offset += PAGE_SIZE)
+        {
+            uint32_t got = vfs_read(file, offset, PAGE_SIZE, buffer);
+            for (uint32_t i = 0; i < got; i++) sums[pass] = sums[pass] * 31 + buffer[i];
+        }
+        cycles[pass] = rdtsc() - start;
+    }
+
+    printf("\n--- Page Cache Benchmark (%u KB) ---\n", file->size / 1024);
+    printf("Cold (disk):   %lu cycles\n", cycles[0]);
+    printf("Warm (cache):  %lu cycles\n", cycles[1]);
+    if (sums[0] != sums[1])
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED: cached data differs from the disk\n");
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
+    kfree(buffer);
+    vfs_close(file);
+}
+
+/**
+ * cmd_benchspawn: Launches the same program repeatedly, first copying its
+ * segments into every instance and then sharing them through the page cache,
+ * and compares launch time and the frames each instance's image costs
+ */
+static void cmd_benchspawn(const char* args)
+{
+    char path[512];
+    char name[256];
+    if (!args || args[0] == '\0')
+    {
+        printf("Usage: benchspawn <file.kex> [count]\n");
+        return;
+    }
+
+    int len = 0;
+    while (args[len] && args[len] != ' ' && len < 255) { name[len] = args[len]; len++; }
+    name[len] = '\0';
+    int count = args[len] == ' ' ? atoi(args + len + 1) : 8;
+    if (count < 1) count = 1;
+    if (count > 32) count = 32;
+    resolve_path(path, name);
+
+    char* kargv[2] = { path, nullptr };
+
+    // One untimed run brings the file into the page cache for both passes
+    int pid = kex_load(path, 1, kargv);
+    if (pid <= 0)
+    {
+        printf("benchspawn: cannot launch %s\n", path);
+        return;
+    }
+    thread_join(pid, nullptr, WAIT_FOREVER);
+
+    uint64_t cycles[2] = { 0, 0 };
+    uint64_t private_frames[2];
+    uint64_t shared_frames[2];
+    for (int share = 0; share < 2; share++)
+    {
+        kex_set_segment_sharing(share);
+        kex_load_stats before;
+        kex_get_load_stats(&before);
+
+        int pids[32];
+        for (int i = 0; i < count; i++)
+        {
+            uint64_t start = rdtsc();
+            pids[i] = kex_load(path, 1, kargv);
+            cycles[share] += rdtsc() - start;
+        }
+        for (int i = 0; i < count; i++)
+            if (pids[i] > 0) thread_join(pids[i], nullptr, WAIT_FOREVER);
+
+        kex_load_stats after;
+        kex_get_load_stats(&after);
+        uint64_t loads = after.loads - before.loads;
+        if (!loads) loads = 1;
+        private_frames[share] = (after.private_frames - before.private_frames) / loads;
+        shared_frames[share] = (after.shared_frames - before.shared_frames) / loads;
+    }
+    kex_set_segment_sharing(true);
+
+    // Shared frames are paid for once, by the page cache, however many instances run
+    uint64_t copied_kb = count * (private_frames[0] + shared_frames[0]) * 4;
+    uint64_t shared_kb = (count * private_frames[1] + shared_frames[1]) * 4;
+
+    printf("\n--- Spawn Benchmark (%s x %d) ---\n", path, count);
+    printf("Copied segments: %lu cycles per spawn, %lu private frames each\n",
+           cycles[0] / count, private_frames[0]);
+    printf("Shared segments: %lu cycles per spawn, %lu private + %lu shared frames each\n",
+           cycles[1] / count, private_frames[1], shared_frames[1]);
+    printf("Image memory for %d instances: %lu KB copied, %lu KB shared\n", count, copied_kb, shared_kb);
+}
+
+/**
+ * cmd_benchscale: Runs 1, 2, ... n copies of a CPU-bound KEX at once and
+ * compares their throughput with a single copy's; n defaults to the CPU count.
+ * The timed runs include each copy's kex_load.
+ */
+static void cmd_benchscale(const char* args)
+{
+    char path[512];
+    char name[256];
+    if (!args || args[0] == '\0')
+    {
+        printf("Usage: benchscale <file.kex> [max workers]\n");
+        return;
+    }
+
+    int len = 0;
+    while (args[len] && args[len] != ' ' && len < 255) { name[len] = args[len]; len++; }
+    name[len] = '\0';
+    int max = args[len] == ' ' ? atoi(args + len + 1) : (int)smp_cpu_count();
+    if (max < 1) max = 1;
+    if (max > 32) max = 32;
+    resolve_path(path, name);
+
+    char* kargv[2] = { path, nullptr };
+
+    // One untimed run brings the file into the page cache
+    int pid = kex_load(path, 1, kargv);
+    if (pid <= 0)
+    {
+        printf("benchscale: cannot launch %s\n", path);
+        return;
+    }
+    thread_join(pid, nullptr, WAIT_FOREVER);
+
+    printf("\n--- Scaling Benchmark (%s, %u CPUs) ---\n", path, smp_cpu_count());
+    printf("  Workers  Cycles          Speedup  Efficiency\n");
+
+    uint64_t single = 0;
+    for (int n = 1; n <= max; n++)
+    {
+        int pids[32];
+        uint64_t start = rdtsc();
+        for (int i = 0; i < n; i++) pids[i] = kex_load(path, 1, kargv);
+        for (int i = 0; i < n; i++)
+            if (pids[i] > 0) thread_join(pids[i], nullptr, WAIT_FOREVER);
+        uint64_t elapsed = rdtsc() - start;
+        if (n == 1) single = elapsed;
+
+        // n copies of the work in 'elapsed', against one copy in 'single'
+        uint64_t speedup = elapsed ? n * single * 100 / elapsed : 0;
+        printf("  %-7d  %-14lu  %lu.%02lux    %lu%%\n", n, elapsed, speedup / 100, speedup % 100, speedup / n);
+    }
+}
+
+static volatile int timer_test_fired[5];
+static volatile uint64_t timer_test_ticks[5];
+static volatile int timer_test_count;
+
+static void timer_test_callback(void* data)
+{
+    int id = (int)(uintptr_t)data;
+    timer_test_ticks[id] = timer_get_ticks();
+    if (timer_test_count < 5) timer_test_fired[timer_test_count++] = id;
+}
+
+/**
+ * cmd_testtimer: Arms timers that fire from the root wheel, after a cascade
+ * and after being cancelled, then times adding and cancelling many timers
+ */
+static void cmd_testtimer()
+{
+    static const uint64_t delays[5] = { 1, 30, 300, 20, 20000 };
+    ktimer timers[5];
+    uint64_t deadline[5];
+
+    printf("\n--- Testing Timer Wheel ---\n");
+    timer_test_count = 0;
+    uint64_t now = timer_get_ticks();
+    for (int i = 0; i < 5; i++)
+    {
+        memset(&timers[i], 0, sizeof(ktimer));
+        timers[i].callback = timer_test_callback;
+        timers[i].data = (void*)(uintptr_t)i;
+        deadline[i] = now + delays[i];
+        timer_add(&timers[i], deadline[i]);
+    }
+
+    // Timer 3 is cancelled from the root wheel and timer 4 from an outer level
+    bool cancelled = timer_cancel(&timers[3]) && timer_cancel(&timers[4]);
+    while (timer_get_ticks() < deadline[2] + 2) thread_sleep(20);
+
+    bool in_order = timer_test_count == 3 && timer_test_fired[0] == 0 &&
+                    timer_test_fired[1] == 1 && timer_test_fired[2] == 2;
+    bool on_time = in_order;
+    for (int i = 0; on_time && i < 3; i++) on_time = timer_test_ticks[i] >= deadline[i];
+
+    printf(" [1] Expiry order and deadlines... ");
+    if (in_order && on_time) printf("OK (cascaded timer fired at +%lu)\n", timer_test_ticks[2] - now);
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED (%d fired)\n", timer_test_count);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
+    printf(" [2] Cancellation... ");
+    bool fired_dequeued = !timer_cancel(&timers[0]);
+    for (int i = 0; i < 5; i++) timer_cancel(&timers[i]);
+    if (cancelled && fired_dequeued) printf("OK\n");
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED\n");
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
+    const int count = 1024;
+    ktimer* many = (ktimer*)kmalloc(count * sizeof(ktimer));
+    if (!many)
+    {
+        printf("testtimer: out of memory\n");
+        return;
+    }
+    memset(many, 0, count * sizeof(ktimer));
+
+    now = timer_get_ticks();
+    uint64_t start = rdtsc();
+    for (int i = 0; i < count; i++)
+    {
+        many[i].callback = timer_test_callback;
+        many[i].data = (void*)(uintptr_t)0;
+        timer_add(&many[i], now + 1000 + (uint64_t)i * 7919 % 1000000);
+    }
+    uint64_t add_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    int pending = 0;
+    for (int i = 0; i < count; i++) pending += timer_cancel(&many[i]);
+    uint64_t cancel_cycles = rdtsc() - start;
+    kfree(many);
+
+    printf(" [3] %d timers: %lu cycles per add, %lu per cancel (%d pending)\n",
+           count, add_cycles / count, cancel_cycles / count, pending);
+}
+
+static int sched_test_order[3];
+static volatile int sched_test_count;
+static volatile int sched_test_exited;
+static volatile bool sched_test_release;
+static wait_queue_t sched_test_queue;
+
+static void sched_test_worker()
+{
+    if (sched_test_count < 3) sched_test_order[sched_test_count++] = thread_get_current()->priority;
+}
+
+static bool sched_test_released(void*)
+{
+    return sched_test_release;
+}
+
+static void sched_test_blocker()
+{
+    wait_queue_wait(&sched_test_queue, sched_test_released, nullptr, WAIT_FOREVER);
+    __atomic_add_fetch(&sched_test_exited, 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t sched_test_yield_cycles(int rounds)
+{
+    uint64_t start = rdtsc();
+    for (int i = 0; i < rounds; i++) yield();
+    return (rdtsc() - start) / rounds;
+}
+
+/**
+ * cmd_testsched: Starts threads at three priorities and checks they run
+ * highest first, then times yield() with and without a crowd of blocked threads
+ */
+static void cmd_testsched()
+{
+    static const int prios[3] = { THREAD_PRIORITIES - 8, 8, 4 };
+
+    printf("\n--- Testing Scheduler ---\n");
+    sched_test_count = 0;
+
+    // The workers inherit the shell's mask, so only this CPU can run them,
+    // and nothing may run before its priority is set
+    uint32_t self = thread_get_current()->id;
+    thread_set_affinity(self, 1u << cpu_current_id());
+    asm volatile("cli");
+    int started = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        thread_t* t = thread_add(sched_test_worker, "sched_test");
+        if (t && thread_set_priority(t->id, prios[i])) started++;
+    }
+    asm volatile("sti");
+
+    for (int i = 0; i < 100 && sched_test_count < started; i++) thread_sleep(10);
+    thread_set_affinity(self, ~0u);
+
+    printf(" [1] Priority order... ");
+    if (started == 3 && sched_test_count == 3 && sched_test_order[0] == 4 &&
+        sched_test_order[1] == 8 && sched_test_order[2] == THREAD_PRIORITIES - 8)
+        printf("OK\n");
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED (%d of %d ran)\n", sched_test_count, started);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
+    printf(" [2] Bad priorities rejected... ");
+    if (!thread_set_priority(self, THREAD_PRIORITIES) && !thread_set_priority(self, -1) &&
+        !thread_set_priority(get_idle_thread_ptr()->id, 0))
+        printf("OK\n");
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED\n");
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
+    const int rounds = 10000;
+    const int blockers = 64;
+    uint64_t alone = sched_test_yield_cycles(rounds);
+
+    sched_test_release = false;
+    sched_test_exited = 0;
+    int parked = 0;
+    for (int i = 0; i < blockers; i++)
+        if (thread_add(sched_test_blocker, "sched_block")) parked++;
+    thread_sleep(20);
+    uint64_t crowded = sched_test_yield_cycles(rounds);
+
+    sched_test_release = true;
+    wait_queue_wake_all(&sched_test_queue);
+    for (int i = 0; i < 100 && sched_test_exited < parked; i++) thread_sleep(10);
+
+    printf(" [3] yield(): %lu cycles alone, %lu with %d blocked threads\n", alone, crowded, parked);
+}
+
+static wait_queue_t wait_test_queue;
+static volatile int wait_test_woken;
+
+static void wait_test_waiter()
+{
+    if (wait_queue_wait(&wait_test_queue, nullptr, nullptr, 1000))
+        __atomic_add_fetch(&wait_test_woken, 1, __ATOMIC_RELAXED);
+}
+
+static void wait_test_exit()
+{
+    thread_exit(42);
+}
+
+/**
+ * cmd_testwait: Checks that wake_one and wake_all wake exactly as many
+ * waiters as they say, that waits time out, and that join sees the exit code
+ */
+static void cmd_testwait()
+{
+    const int waiters = 4;
+    uint32_t ids[waiters];
+
+    printf("\n--- Testing Wait Queues ---\n");
+    wait_test_woken = 0;
+    int started = 0;
+    for (int i = 0; i < waiters; i++)
+    {
+        thread_t* t = thread_add(wait_test_waiter, "wait_test");
+        if (t) ids[started++] = t->id;
+    }
+    thread_sleep(20);
+
+    bool one = wait_queue_wake_one(&wait_test_queue);
+    thread_sleep(20);
+    int after_one = wait_test_woken;
+    int all = wait_queue_wake_all(&wait_test_queue);
+    for (int i = 0; i < started; i++) thread_join(ids[i], nullptr, WAIT_FOREVER);
+
+    printf(" [1] wake_one / wake_all... ");
+    if (started == waiters && one && after_one == 1 && all == waiters - 1 && wait_test_woken == waiters)
+        printf("OK\n");
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED (%d, then %d woken)\n", after_one, all);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
+    printf(" [2] Timeout... ");
+    uint64_t start = timer_get_ticks();
+    bool woken = wait_queue_wait(&wait_test_queue, nullptr, nullptr, 50);
+    uint64_t waited = timer_get_ticks() - start;
+    if (!woken && waited >= timer_ms_to_ticks(50)) printf("OK (%lu ticks)\n", waited);
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED\n");
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
+    printf(" [3] Join... ");
+    int code = 0;
+
+    // Below the shell's priority and on its CPU, so it can only exit once the join is waiting
+    uint32_t self = thread_get_current()->id;
+    thread_set_affinity(self, 1u << cpu_current_id());
+    asm volatile("cli");
+    thread_t* t = thread_add(wait_test_exit, "wait_exit");
+    if (t) thread_set_priority(t->id, THREAD_PRIORITY_DEFAULT + 1);
+    asm volatile("sti");
+    thread_set_affinity(self, ~0u);
+    int joined = t ? thread_join(t->id, &code, 1000) : -ESRCH;
+    if (joined == 0 && code == 42 && thread_join(THREAD_NOT_FOUND, nullptr, 0) == -ESRCH)
+        printf("OK\n");
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED (%d, exit code %d)\n", joined, code);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+}
+
+static volatile bool smp_test_stop;
+static volatile bool smp_test_remapped;
+static volatile uint32_t smp_test_mask;
+static volatile int smp_test_stale;
+static volatile uint64_t* smp_test_page;
+
+// Spins reading the test page, so its translation stays in this CPU's TLB
+static void smp_test_worker()
+{
+    while (!__atomic_load_n(&smp_test_stop, __ATOMIC_ACQUIRE))
+    {
+        __atomic_or_fetch(&smp_test_mask, 1u << cpu_current_id(), __ATOMIC_RELAXED);
+
+        bool remapped = __atomic_load_n(&smp_test_remapped, __ATOMIC_ACQUIRE);
+        if (remapped && *smp_test_page != 2) __atomic_add_fetch(&smp_test_stale, 1, __ATOMIC_RELAXED);
+        asm volatile("pause");
+    }
+}
+
+/**
+ * cmd_testsmp: Lists the CPUs, checks busy threads reach all of them and
+ * that a kernel page remapped on this CPU is seen remapped everywhere
+ */
+static void cmd_testsmp()
+{
+    uint32_t count = smp_cpu_count();
+
+    printf("\n--- Testing SMP ---\n");
+    printf(" [1] %u CPU(s), this is CPU %u\n", count, cpu_current_id());
+    for (uint32_t i = 0; i < count; i++)
+    {
+        cpu_local* cpu = smp_cpu(i);
+        thread_t* current = cpu->current;
+        printf("     CPU %u: APIC id %u, %lu timer ticks, running %s\n",
+               i, cpu->apic_id, cpu->ticks, current ? current->name : "-");
+    }
+
+    if (count == 1)
+    {
+        printf(" [2] Threads spread... SKIPPED (1 CPU)\n");
+        printf(" [3] TLB shootdown... SKIPPED (1 CPU)\n");
+        printf(" [4] Affinity... SKIPPED (1 CPU)\n");
+        return;
+    }
+
+    volatile uint64_t* page = (volatile uint64_t*)vmalloc(PAGE_SIZE);
+    void* frame = pfa_alloc_frame();
+    if (!page || !frame)
+    {
+        printf(" [2] FAILED - Out of memory\n");
+        if (page) vfree((void*)page);
+        if (frame) pfa_free_frame(frame);
+        return;
+    }
+    void* original = paging_get_physical_address(paging_kernel_space(), (void*)page);
+    *page = 1;
+    *(volatile uint64_t*)phys_to_virt((uintptr_t)frame) = 2;
+
+    smp_test_page = page;
+    smp_test_stop = false;
+    smp_test_remapped = false;
+    smp_test_mask = 0;
+    smp_test_stale = 0;
+
+    const int workers = 2 * count;
+    uint32_t ids[2 * MAX_CPUS];
+    int started = 0;
+    for (int i = 0; i < workers; i++)
+    {
+        thread_t* t = thread_add(smp_test_worker, "smp_test");
+        if (t) ids[started++] = t->id;
+    }
+    thread_sleep(50);
+
+    // Every worker CPU has read the old frame through this address by now
+    paging_map_page(paging_kernel_space(), (void*)page, frame, PTE_PRESENT | PTE_RW);
+    __atomic_store_n(&smp_test_remapped, true, __ATOMIC_RELEASE);
+    thread_sleep(50);
+
+    __atomic_store_n(&smp_test_stop, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < started; i++) thread_join(ids[i], nullptr, WAIT_FOREVER);
+
+    uint32_t expected = smp_online_mask();
+    printf(" [2] Threads spread... ");
+    if ((smp_test_mask & expected) == expected) printf("OK (mask 0x%x)\n", smp_test_mask);
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED (mask 0x%x, expected 0x%x)\n", smp_test_mask, expected);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
+    printf(" [3] TLB shootdown... ");
+    if (smp_test_stale == 0) printf("OK\n");
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED (%d stale reads)\n", smp_test_stale);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+
+    // Give the area its own frame back before freeing it
+    paging_map_page(paging_kernel_space(), (void*)page, original, PTE_PRESENT | PTE_RW);
+    vfree((void*)page);
+    pfa_free_frame(frame);
+
+    // Moves the shell to the last CPU; a thread it starts there inherits the mask
+    uint32_t last = count - 1;
+    uint32_t self = thread_get_current()->id;
+    thread_set_affinity(self, 1u << last);
+    uint32_t landed = cpu_current_id();
+
+    smp_test_stop = false;
+    smp_test_remapped = false;
+    smp_test_mask = 0;
+    thread_t* pinned = thread_add(smp_test_worker, "smp_pinned");
+    thread_set_affinity(self, ~0u);
+    if (pinned)
+    {
+        uint32_t pinned_id = pinned->id;
+        thread_sleep(50);
+        __atomic_store_n(&smp_test_stop, true, __ATOMIC_RELEASE);
+        thread_join(pinned_id, nullptr, WAIT_FOREVER);
+    }
+
+    printf(" [4] Affinity... ");
+    if (pinned && landed == last && smp_test_mask == (1u << last)) printf("OK (CPU %u)\n", last);
+    else
+    {
+        shell_setcolor(vga_color_t(VGA_COLOR_RED, VGA_COLOR_BLACK));
+        printf("FAILED (shell on CPU %u, worker mask 0x%x)\n", landed, smp_test_mask);
+        shell_setcolor(vga_color_t(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+}
+
 /**
  * cmd_memstat: Displays to the user the memory stats
  */
@@ -657,6 +1564,27 @@ static void cmd_memstat()
     kheap_get_stats(&h_stats);
     printf("    Heap Block: %d\n", h_stats.block_count);
     printf("    Heap Free Space: %u KB\n", h_stats.free_size / 1024);
+
+    struct page_cache_stats c_stats;
+    page_cache_get_stats(&c_stats);
+    printf("\nPage Cache:\n");
+    printf("    Cached: %lu KB (%lu KB dirty)\n", c_stats.pages * 4, c_stats.dirty * 4);
+    printf("    Hits: %lu, Misses: %lu\n", c_stats.hits, c_stats.misses);
+    printf("    Evictions: %lu, Write-backs: %lu\n", c_stats.evictions, c_stats.writebacks);
+
+    struct reclaim_stats r_stats;
+    reclaim_get_stats(&r_stats);
+    printf("\nReclaim:\n");
+    printf("    Watermarks: low %d KB, high %d KB\n", RECLAIM_WMARK_LOW * 4, RECLAIM_WMARK_HIGH * 4);
+    printf("    kswapd runs: %lu, Direct: %lu, Reclaimed: %lu KB\n",
+           r_stats.kswapd_runs, r_stats.direct_runs, r_stats.reclaimed * 4);
+    printf("    OOM kills: %lu\n", r_stats.oom_kills);
+
+    struct kstack_stats k_stats;
+    kstack_get_stats(&k_stats);
+    printf("\nKernel Stacks:\n");
+    printf("    In use: %lu (peak %lu), Cached: %lu, Size: %d KB + guard\n",
+           k_stats.in_use, k_stats.peak, k_stats.cached, THREAD_KERNEL_STACK_SIZE / 1024);
     printf("--------------------------------\n\n");
 }
 
@@ -1234,6 +2162,15 @@ void shell_execute(const char* command)
 #if defined(__is_libk)
     else if (!is_user_mode() && strcmp(cmd, "paginginfo") == 0) 	cmd_paginginfo();
 	else if (!is_user_mode() && strcmp(cmd, "testpaging") == 0) 	cmd_testpaging();
+    else if (!is_user_mode() && strcmp(cmd, "benchtlb") == 0)    cmd_benchtlb();
+    else if (!is_user_mode() && strcmp(cmd, "benchctx") == 0)    cmd_benchctx();
+    else if (!is_user_mode() && strcmp(cmd, "benchcache") == 0)  cmd_benchcache(clean_args);
+    else if (!is_user_mode() && strcmp(cmd, "benchspawn") == 0)  cmd_benchspawn(clean_args);
+    else if (!is_user_mode() && strcmp(cmd, "benchscale") == 0)  cmd_benchscale(clean_args);
+    else if (!is_user_mode() && strcmp(cmd, "testtimer") == 0)   cmd_testtimer();
+    else if (!is_user_mode() && strcmp(cmd, "testsched") == 0)   cmd_testsched();
+    else if (!is_user_mode() && strcmp(cmd, "testwait") == 0)    cmd_testwait();
+    else if (!is_user_mode() && strcmp(cmd, "testsmp") == 0)     cmd_testsmp();
     else if (!is_user_mode() && strcmp(cmd, "memstat") == 0)     cmd_memstat();
     else if (!is_user_mode() && strcmp(cmd, "dump") == 0)        cmd_dump(clean_args);
 #endif
@@ -1269,11 +2206,7 @@ void shell_execute(const char* command)
         if (pid > 0) 
         {
              // Wait for process
-             while (thread_get_by_id(pid) != nullptr) 
-             {
-                 thread_sleep(20);
-             }
-             // Process context switch will return here when thread is gone
+             thread_join(pid, nullptr, WAIT_FOREVER);
         }
         else 
         {
@@ -10,6 +10,12 @@
 #include <fs/vfs.h>
 #include <stdio.h>
 #include <drivers/serial.h>
+#include <kernel/wait_queue.h>
+
+static bool stdin_has_input(void*)
+{
+    return keyboard_has_input() || serial_received();
+}
 
 uint64_t sys_read(uint64_t fd, uint64_t buf, uint64_t size, uint64_t a4, uint64_t a5, uint64_t a6) 
 {
@@ -30,9 +36,9 @@ uint64_t sys_read(uint64_t fd, uint64_t buf, uint64_t size, uint64_t a4, uint64_
             {
                 if (bytes_read > 0) break; // Return what we have
                 
-                // If we have nothing, block and wait
-                thread_get_current()->state = THREAD_BLOCKED;
-                yield();
+                // If we have nothing, wait for either source
+                wait_queue_t* sources[2] = { keyboard_wait_queue(), serial_wait_queue() };
+                wait_queue_wait_any(sources, 2, stdin_has_input, nullptr, WAIT_FOREVER);
                 continue;
             }
             
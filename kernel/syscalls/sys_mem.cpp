@@ -21,6 +21,9 @@
 #include <kernel/syscalls/syscalls.h>
 #include <kernel/arch/x86_64/thread.h>
 #include <kernel/arch/x86_64/paging.h>
+#include <kernel/constants.h>
+#include <mm/vma.h>
+#include <sys/mman.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -34,28 +37,87 @@ uint64_t sys_sbrk(uint64_t increment, uint64_t a2, uint64_t a3, uint64_t a4, uin
     if (increment == 0) return old_break;
 
     uintptr_t new_break = old_break + increment;
-    
-    // Page-align calculations: we need to ensure all pages from old_break to new_break are USER accessible
-    uintptr_t start_page = old_break & ~0xFFFULL;
-    uintptr_t end_page = (new_break + 4095) & ~0xFFFULL;
 
-    for (uintptr_t addr = start_page; addr < end_page; addr += PAGE_SIZE) 
+    // Only the heap area moves: its pages are faulted in on first touch
+    vm_area* heap = vma_find_kind(current->as, VMA_HEAP);
+    if (!heap) heap = vma_create(current->as, old_break, old_break, VMA_READ | VMA_WRITE, VMA_HEAP);
+    if (!heap || new_break < heap->start) return -1;
+    if (!vma_resize(current->as, heap, new_break)) return -1;
+
+    current->user_heap_break = new_break;
+    return old_break;
+}
+
+// x86 pages cannot be write-only, so any access right implies reading
+static uint32_t prot_to_vma(uint64_t prot)
+{
+    uint32_t flags = 0;
+    if (prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) flags |= VMA_READ;
+    if (prot & PROT_WRITE) flags |= VMA_WRITE;
+    if (prot & PROT_EXEC) flags |= VMA_EXEC;
+    return flags;
+}
+
+uint64_t sys_mmap(uint64_t addr, uint64_t length, uint64_t prot, uint64_t flags, uint64_t fd, uint64_t offset)
+{
+    thread_t* current = thread_get_current();
+    if (!current || !current->is_user || length == 0) return -1;
+
+    bool shared = flags & MAP_SHARED;
+    if (shared == (bool)(flags & MAP_PRIVATE)) return -1;
+    if ((offset & (PAGE_SIZE - 1)) || offset > 0xFFFFFFFFULL) return -1;
+
+    uint32_t vma_flags = prot_to_vma(prot);
+    VFSNode* file = nullptr;
+    if (!(flags & MAP_ANONYMOUS))
     {
-        if (!paging_is_user_accessible((void*)addr)) 
+        if (fd >= 16 || !current->fd_table[fd] || current->fd_table[fd]->type != VFS_FILE) return -1;
+        file = current->fd_table[fd];
+
+        // Pages are filled from the file but never written back to it
+        if (shared)
         {
-            void* frame = paging_get_physical_address((void*)addr);
-            if (!frame) frame = pfa_alloc_frame();
-            if (!frame) return -1; 
-            
-            paging_map_page((void*)addr, frame, PTE_PRESENT | PTE_RW | PTE_USER);
+            if (prot & PROT_WRITE) return -1;
+            vma_flags |= VMA_SHARED;
         }
     }
+    else if (shared) return -1;     // fork copies every page, so nothing anonymous is shared
 
-    // Full TLB flush to be safe
-    uintptr_t cr3;
-    asm volatile("mov %%cr3, %0" : "=r"(cr3));
-    asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+    bool fixed = flags & MAP_FIXED;
+    if (!fixed) addr &= ~(uint64_t)(PAGE_SIZE - 1);
 
-    current->user_heap_break = new_break;
-    return old_break;
+    uintptr_t mapped = vma_map(current->as, addr, length, vma_flags, fixed, file, offset);
+    return mapped ? mapped : (uint64_t)-1;
+}
+
+uint64_t sys_munmap(uint64_t addr, uint64_t length, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6)
+{
+    (void)a3; (void)a4; (void)a5; (void)a6;
+    thread_t* current = thread_get_current();
+    if (!current || !current->is_user || (addr & (PAGE_SIZE - 1)) || length == 0) return -1;
+
+    return vma_unmap(current->as, addr, addr + length) ? 0 : -1;
+}
+
+uint64_t sys_mprotect(uint64_t addr, uint64_t length, uint64_t prot, uint64_t a4, uint64_t a5, uint64_t a6)
+{
+    (void)a4; (void)a5; (void)a6;
+    thread_t* current = thread_get_current();
+    if (!current || !current->is_user || (addr & (PAGE_SIZE - 1)) || length == 0) return -1;
+
+    return vma_protect(current->as, addr, addr + length, prot_to_vma(prot)) ? 0 : -1;
+}
+
+uint64_t sys_meminfo(uint64_t info, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6)
+{
+    (void)a2; (void)a3; (void)a4; (void)a5; (void)a6;
+    paging_stats stats;
+    paging_get_stats(&stats);
+
+    meminfo out;
+    out.total_frames = stats.total_frames;
+    out.free_frames = stats.free_frames;
+    out.thp_mapped = stats.thp_mapped;
+    out.thp_splits = stats.thp_splits;
+    return copy_to_user((void*)info, &out, sizeof(out)) ? 0 : -1;
 }
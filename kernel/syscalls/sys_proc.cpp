@@ -21,6 +21,7 @@
 
 #include <kernel/arch/x86_64/thread.h>
 #include <kernel/syscalls/syscalls.h>
+#include <kernel/constants.h>
 #include <kernel/arch/x86_64/paging.h>
 #include <exec/kex_loader.h>
 #include <mm/heap.h>
@@ -29,15 +30,11 @@
 #include <drivers/keyboard.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/errno.h>
 
 uint64_t sys_exit(uint64_t status, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t) 
 {
     int exit_status = (int)status;
-    thread_t* current = thread_get_current();
-
-    if (current && current->is_user) 
-        asm volatile("swapgs");
-
     thread_exit(exit_status);
     __builtin_unreachable();
     return 0;
@@ -102,6 +99,33 @@ uint64_t sys_sleep(uint64_t ms, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t
     return 0;
 }
 
+/*
+ * A process may only change its own priority (every process is a single
+ * thread), and never above the default: a spinning thread at level 0
+ * would starve the shell and kswapd under the strict-priority picker.
+ */
+uint64_t sys_setpriority(uint64_t id, uint64_t priority, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6)
+{
+    (void)a3; (void)a4; (void)a5; (void)a6;
+    if (priority >= THREAD_PRIORITIES) return (uint64_t)-EINVAL;
+    if ((uint32_t)id != thread_get_current()->id || priority < THREAD_PRIORITY_DEFAULT) return (uint64_t)-EPERM;
+    if (!thread_set_priority((uint32_t)id, (int)priority)) return (uint64_t)-ESRCH;
+
+    // Let a thread that now outranks the caller run straight away
+    yield();
+    return 0;
+}
+
+// 'mask' has one bit per CPU. Like setpriority, only the caller's own mask
+// may be changed; a mask with no online CPU is refused
+uint64_t sys_setaffinity(uint64_t id, uint64_t mask, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6)
+{
+    (void)a3; (void)a4; (void)a5; (void)a6;
+    if ((uint32_t)id != thread_get_current()->id) return (uint64_t)-EPERM;
+    if (!thread_set_affinity((uint32_t)id, (uint32_t)mask)) return (uint64_t)-EINVAL;
+    return 0;
+}
+
 uint64_t sys_load_library(uint64_t path_ptr, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6)
 {
     (void)a2; (void)a3; (void)a4; (void)a5; (void)a6;
@@ -114,4 +138,14 @@ uint64_t sys_load_library(uint64_t path_ptr, uint64_t a2, uint64_t a3, uint64_t
     if (!current) return 0;
 
     return (uint64_t)kdl_load(path, current);
-}
\ No newline at end of file
+}
+
+uint64_t sys_fork(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6)
+{
+    (void)a1; (void)a2; (void)a3; (void)a4; (void)a5; (void)a6;
+
+    // The child comes back through user_fork_return with 0 in rax
+    thread_t* child = thread_fork(thread_get_current());
+    if (!child) return (uint64_t)-1;
+    return child->id;
+}
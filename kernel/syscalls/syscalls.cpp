@@ -23,39 +23,42 @@
 #include <kernel/arch/x86_64/thread.h>
 #include <kernel/arch/x86_64/paging.h>
 #include <kernel/arch/x86_64/gdt.h>
+#include <kernel/arch/x86_64/smp.h>
+#include <kernel/arch/x86_64/cpu.h>
+#include <mm/vma.h>
 #include <kernel/panic.h>
 #include <kernel/error.h>
 #include <string.h>
 #include <stdio.h>
 
-static kernel_gs_data gs_ptr;
 syscall_fn syscall_table[256];
 
 void syscall_init() 
 {
 	syscall_table_init();
+    syscall_init_cpu();
+}
 
-    uint32_t low, high;
-    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(0xC0000080));
-    low |= 1;
-    asm volatile("wrmsr" : : "a"(low), "d"(high), "c"(0xC0000080));
+// Per-CPU half of the setup; GS already points at the CPU's cpu_local
+void syscall_init_cpu()
+{
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | 1);
 
-    gs_ptr.kernel_stack = kernel_tss.rsp0;
+    cpu_local* cpu = cpu_this();
+    cpu->kernel_stack = cpu->tss.rsp0;
 
-    uint64_t gs_base = (uintptr_t)&gs_ptr;
-    asm volatile("wrmsr" : : "a"((uint32_t)gs_base), "d"((uint32_t)(gs_base >> 32)), "c"(0xC0000102));
+    // Kernel mode runs with GS on the cpu_local; every return to ring 3 swaps it out
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
 
     uint64_t star = ((uint64_t)0x13 << 48) | ((uint64_t)0x08 << 32);
-    asm volatile("wrmsr" : : "a"((uint32_t)star), "d"((uint32_t)(star >> 32)), "c"(0xC0000081));
-
-    uint64_t lstar = (uintptr_t)syscall_entry;
-    asm volatile("wrmsr" : : "a"((uint32_t)lstar), "d"((uint32_t)(lstar >> 32)), "c"(0xC0000082));
-    asm volatile("wrmsr" : : "a"(0x200), "d"(0), "c"(0xC0000084));
+    wrmsr(0xC0000081, star);
+    wrmsr(0xC0000082, (uintptr_t)syscall_entry);
+    wrmsr(0xC0000084, 0x200);
 }
 
 void syscall_set_kernel_stack(uint64_t stack)
 {
-    gs_ptr.kernel_stack = stack;
+    cpu_this()->kernel_stack = stack;
 }
 
 void syscall_table_init() 
@@ -75,25 +78,32 @@ void syscall_table_init()
     syscall_table[10] = sys_getpid;
     syscall_table[11] = sys_sleep;
     syscall_table[12] = sys_sbrk;
+    syscall_table[13] = sys_mmap;
+    syscall_table[14] = sys_munmap;
+    syscall_table[15] = sys_mprotect;
+    syscall_table[16] = sys_meminfo;
     
     syscall_table[20] = sys_load_library;
     syscall_table[37] = sys_kill;
+    syscall_table[57] = sys_fork;
     syscall_table[60] = sys_exit;
     syscall_table[100] = sys_vga;
+    syscall_table[141] = sys_setpriority;
     syscall_table[161] = sys_reboot;
     syscall_table[200] = sys_ps;
+    syscall_table[203] = sys_setaffinity;
 }
 
 
 extern "C" uint64_t syscall_handler(uint64_t num, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6)
 {
-    if (num < 256 && syscall_table[num]) 
-    {
-        return syscall_table[num](a1, a2, a3, a4, a5, a6);
-    }
+    uint64_t ret = (uint64_t)-ENOSYS;
+    if (num < 256 && syscall_table[num]) ret = syscall_table[num](a1, a2, a3, a4, a5, a6);
+    else printf("\n[SYSCALL] Error: %llu not defined\n", num);
 
-    printf("\n[SYSCALL] Error: %llu not defined\n", num);
-	return (uint64_t)-ENOSYS;
+    // Killed while it ran on another CPU; this is the first safe point
+    if (thread_get_current()->kill_pending) thread_exit(-1);
+	return ret;
 }
 
 
@@ -114,9 +124,11 @@ void start_user_code()
 bool copy_from_user(void* dst, const void* src, size_t size)
 {
     uintptr_t u = (uintptr_t)src;
+    address_space* as = thread_get_current()->as;
     for (size_t i = 0; i < size; i++) 
     {
-        if (!paging_is_user_accessible((void*)(u + i))) 
+        // Lazily backed pages are faulted in here rather than by the MMU
+        if (!paging_is_user_accessible(as, (void*)(u + i)) && !vma_handle_fault(as, u + i, false)) 
         {
             printf("[SYSCALL] copy_from_user FAIL: 0x%lx\n", u + i);
             return false;
@@ -129,9 +141,11 @@ bool copy_from_user(void* dst, const void* src, size_t size)
 bool copy_to_user(void* dst, const void* src, size_t size)
 {
     uintptr_t u = (uintptr_t)dst;
+    address_space* as = thread_get_current()->as;
     for (size_t i = 0; i < size; i++) 
     {
-        if (!paging_is_user_accessible((void*)(u + i))) 
+        // Copy-on-write shares are broken here too, before the kernel writes
+        if (!paging_is_user_accessible(as, (void*)(u + i), true) && !vma_handle_fault(as, u + i, true)) 
         {
             printf("[SYSCALL] copy_to_user FAIL: 0x%lx\n", u + i);
             return false;
@@ -0,0 +1,208 @@
+/*
+ * keonOS - kernel/wait_queue.cpp
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+
+#include <kernel/wait_queue.h>
+#include <drivers/timer.h>
+#include <string.h>
+
+
+enum wait_wakeup
+{
+    WAIT_PENDING,
+    WAIT_WOKEN,
+    WAIT_TIMED_OUT
+};
+
+/*
+ * One pass of a thread through wait_queue_wait_any(). It lives on the
+ * waiting thread's stack and sits on every queue it waits on through one
+ * entry each; whoever claims it first, a waker or the timeout, wakes it.
+ */
+struct wait_waiter
+{
+    thread_t* thread;
+    int woken;
+    int count;
+    wait_queue_t* queues[WAIT_QUEUE_MAX_ANY];
+    wait_entry entries[WAIT_QUEUE_MAX_ANY];
+    ktimer timer;
+};
+
+static bool waiter_claim(wait_waiter* w, int how)
+{
+    int pending = WAIT_PENDING;
+    return __atomic_compare_exchange_n(&w->woken, &pending, how, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static void entry_unlink(wait_queue_t* queue, wait_entry* e)
+{
+    if (e->prev) e->prev->next = e->next;
+    else queue->head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else queue->tail = e->prev;
+
+    e->next = nullptr;
+    e->prev = nullptr;
+    e->queued = false;
+}
+
+static void entry_add(wait_queue_t* queue, wait_entry* e)
+{
+    spin_lock_irqsave(&queue->lock);
+    e->next = nullptr;
+    e->prev = queue->tail;
+    if (queue->tail) queue->tail->next = e;
+    else queue->head = e;
+    queue->tail = e;
+    e->queued = true;
+    spin_unlock_irqrestore(&queue->lock);
+}
+
+static void entry_remove(wait_queue_t* queue, wait_entry* e)
+{
+    spin_lock_irqsave(&queue->lock);
+    if (e->queued) entry_unlink(queue, e);
+    spin_unlock_irqrestore(&queue->lock);
+}
+
+static void wait_timeout(void* data)
+{
+    wait_waiter* w = (wait_waiter*)data;
+    if (waiter_claim(w, WAIT_TIMED_OUT)) thread_make_ready(w->thread);
+}
+
+void wait_queue_init(wait_queue_t* queue)
+{
+    memset(queue, 0, sizeof(wait_queue_t));
+}
+
+bool wait_queue_wait(wait_queue_t* queue, bool (*cond)(void*), void* arg, uint32_t timeout_ms)
+{
+    return wait_queue_wait_any(&queue, 1, cond, arg, timeout_ms);
+}
+
+bool wait_queue_wait_any(wait_queue_t** queues, int count, bool (*cond)(void*), void* arg, uint32_t timeout_ms)
+{
+    if (count < 1 || count > WAIT_QUEUE_MAX_ANY) return false;
+
+    thread_t* self = thread_get_current();
+    bool timed = timeout_ms != WAIT_FOREVER;
+    uint64_t deadline = timed ? timer_get_ticks() + timer_ms_to_ticks(timeout_ms) : 0;
+
+    while (true)
+    {
+        if (cond && cond(arg)) return true;
+        if (timed && timer_get_ticks() >= deadline) return false;
+
+        // Too early to sleep: no scheduler yet, so just poll
+        if (!self)
+        {
+            asm volatile("pause");
+            self = thread_get_current();
+            continue;
+        }
+
+        wait_waiter w;
+        memset(&w, 0, sizeof(wait_waiter));
+        w.thread = self;
+        w.count = count;
+
+        // Interrupts stay off until the switch, so a tick can't take the CPU
+        // away between marking the thread blocked and queueing it
+        asm volatile("cli");
+        thread_park(THREAD_BLOCKED);
+        self->waiting = &w;
+        for (int i = 0; i < count; i++)
+        {
+            w.queues[i] = queues[i];
+            w.entries[i].waiter = &w;
+            entry_add(queues[i], &w.entries[i]);
+        }
+
+        // Checked again once queued: an event from now on wakes the thread
+        if (cond && cond(arg) && waiter_claim(&w, WAIT_WOKEN))
+        {
+            thread_make_ready(self);
+            asm volatile("sti");
+        }
+        else
+        {
+            if (timed)
+            {
+                w.timer.callback = wait_timeout;
+                w.timer.data = &w;
+                timer_add(&w.timer, deadline);
+            }
+            yield();
+        }
+
+        if (timed) timer_cancel(&w.timer);
+        for (int i = 0; i < count; i++) entry_remove(w.queues[i], &w.entries[i]);
+        self->waiting = nullptr;
+
+        if (!cond) return w.woken == WAIT_WOKEN;
+    }
+}
+
+// Every entry passed over is spent: its waiter is woken now or was already
+static int wake(wait_queue_t* queue, bool all)
+{
+    int woken = 0;
+
+    spin_lock_irqsave(&queue->lock);
+    wait_entry* e = queue->head;
+    while (e)
+    {
+        wait_entry* next = e->next;
+        entry_unlink(queue, e);
+        if (waiter_claim(e->waiter, WAIT_WOKEN))
+        {
+            thread_make_ready(e->waiter->thread);
+            woken++;
+            if (!all) break;
+        }
+        e = next;
+    }
+    spin_unlock_irqrestore(&queue->lock);
+
+    return woken;
+}
+
+bool wait_queue_wake_one(wait_queue_t* queue)
+{
+    return wake(queue, false) != 0;
+}
+
+int wait_queue_wake_all(wait_queue_t* queue)
+{
+    return wake(queue, true);
+}
+
+void wait_queue_abort(thread_t* t)
+{
+    wait_waiter* w = t->waiting;
+    if (!w) return;
+
+    waiter_claim(w, WAIT_TIMED_OUT);
+    timer_cancel(&w->timer);
+    for (int i = 0; i < w->count; i++) entry_remove(w->queues[i], &w->entries[i]);
+    t->waiting = nullptr;
+}
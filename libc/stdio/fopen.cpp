@@ -22,6 +22,9 @@
 #include <stdlib.h>
 #include <fs/vfs.h>
 #include <mm/heap.h>
+#include <mm/slab.h>
+
+static kmem_cache* file_cache = nullptr;
 
 
 extern "C" FILE* fopen(const char* filename, [[maybe_unused]] const char* mode)
@@ -29,7 +32,8 @@ extern "C" FILE* fopen(const char* filename, [[maybe_unused]] const char* mode)
     VFSNode* node = vfs_open(filename);
     if (!node) return NULL;
 	
-    FILE* stream = (FILE*)kmalloc(sizeof(FILE));
+    if (!file_cache) file_cache = kmem_cache_create("FILE", sizeof(FILE));
+    FILE* stream = (FILE*)kmem_cache_alloc(file_cache);
     if (!stream) {
         vfs_close(node);
         return NULL;
@@ -22,107 +22,286 @@
 #include <kernel/arch/x86_64/thread.h>
 #include <kernel/constants.h>
 #include <mm/heap.h>
+#include <mm/slab.h>
 #include <mm/vmm.h>
 #include <string.h>
 
 static spinlock_t heap_lock = {0, 0};
-static struct heap_block* heap_start = NULL;
+
+/*
+ * General-purpose heap for requests the slab caches do not serve.
+ *
+ * Blocks carry a header and a footer (boundary tags) so both neighbours of a
+ * freed block are found and coalesced in O(1). Free blocks sit in
+ * segregated lists indexed TLSF-style: the first level is the power of two
+ * of the size, the second level splits it into 2^HEAP_SL_BITS ranges, and a
+ * two-level bitmap finds a non-empty list without scanning.
+ *
+ * Each sbrk'd arena is bounded by fenceposts (an allocated prologue footer
+ * and a zero-sized allocated epilogue header), so coalescing never crosses
+ * arena edges.
+ */
+#define HEAP_BLOCK_MAGIC	0x4B484250
+#define HEAP_FOOTER_FREE	0x1
+#define HEAP_HEADER_SIZE	16
+#define HEAP_FOOTER_SIZE	sizeof(size_t)
+#define HEAP_MIN_BLOCK		48
+#define HEAP_SL_COUNT		(1 << HEAP_SL_BITS)
+#define HEAP_SMALL_BLOCK	256
+#define HEAP_FL_SHIFT		8		// log2(HEAP_SMALL_BLOCK)
+
+struct heap_arena
+{
+    struct heap_arena* next;
+    size_t size;
+};
+
+#define HEAP_ARENA_OVERHEAD	(32 + HEAP_HEADER_SIZE)		// Arena header, prologue, epilogue
+
+static struct heap_arena* arena_list = NULL;
+static struct heap_arena** arena_tail = &arena_list;
+static struct heap_block* free_lists[HEAP_FL_COUNT][HEAP_SL_COUNT];
+static uint32_t fl_bitmap = 0;
+static uint32_t sl_bitmap[HEAP_FL_COUNT];
+
 static size_t heap_total_size = 0;
+static size_t heap_arena_count = 0;
+static size_t heap_free_size = 0;
+static size_t heap_block_count = 0;
+static size_t heap_free_block_count = 0;
+
+
+static inline size_t* block_footer(struct heap_block* block)
+{
+    return (size_t*)((uint8_t*)block + block->size - HEAP_FOOTER_SIZE);
+}
+
+static inline struct heap_block* block_right(struct heap_block* block)
+{
+    return (struct heap_block*)((uint8_t*)block + block->size);
+}
+
+static inline void block_set(struct heap_block* block, size_t size, bool free)
+{
+    block->size = size;
+    block->magic = HEAP_BLOCK_MAGIC;
+    block->free = free;
+    *block_footer(block) = size | (free ? HEAP_FOOTER_FREE : 0);
+}
+
+static inline int fls64(size_t value)
+{
+    return 63 - __builtin_clzll(value);
+}
+
+static bool mapping_insert(size_t size, int* fl, int* sl)
+{
+    if (size < HEAP_SMALL_BLOCK)
+    {
+        *fl = 0;
+        *sl = (int)(size / (HEAP_SMALL_BLOCK / HEAP_SL_COUNT));
+        return true;
+    }
+
+    int bit = fls64(size);
+    *sl = (int)((size >> (bit - HEAP_SL_BITS)) ^ HEAP_SL_COUNT);
+    *fl = bit - HEAP_FL_SHIFT + 1;
+    return *fl < HEAP_FL_COUNT;
+}
+
+// Rounds up to the next list boundary so any block found there is large enough
+static size_t mapping_round(size_t size)
+{
+    if (size >= HEAP_SMALL_BLOCK)
+        size += ((size_t)1 << (fls64(size) - HEAP_SL_BITS)) - 1;
+    return size;
+}
+
+static bool mapping_search(size_t size, int* fl, int* sl)
+{
+    return mapping_insert(mapping_round(size), fl, sl);
+}
+
+static void free_list_insert(struct heap_block* block)
+{
+    int fl, sl;
+    if (!mapping_insert(block->size, &fl, &sl)) return;
+
+    block->prev_free = NULL;
+    block->next_free = free_lists[fl][sl];
+    if (block->next_free) block->next_free->prev_free = block;
+    free_lists[fl][sl] = block;
+
+    fl_bitmap |= 1U << fl;
+    sl_bitmap[fl] |= 1U << sl;
+    heap_free_size += block->size;
+    heap_free_block_count++;
+}
+
+static void free_list_remove(struct heap_block* block)
+{
+    int fl, sl;
+    if (!mapping_insert(block->size, &fl, &sl)) return;
+
+    if (block->prev_free) block->prev_free->next_free = block->next_free;
+    else free_lists[fl][sl] = block->next_free;
+    if (block->next_free) block->next_free->prev_free = block->prev_free;
+
+    if (!free_lists[fl][sl])
+    {
+        sl_bitmap[fl] &= ~(1U << sl);
+        if (!sl_bitmap[fl]) fl_bitmap &= ~(1U << fl);
+    }
+    heap_free_size -= block->size;
+    heap_free_block_count--;
+}
+
+static struct heap_block* free_list_find(size_t size)
+{
+    int fl, sl;
+    if (!mapping_search(size, &fl, &sl)) return NULL;
+
+    uint32_t sl_map = sl_bitmap[fl] & (~0U << sl);
+    if (!sl_map)
+    {
+        uint32_t fl_map = (fl + 1 < HEAP_FL_COUNT) ? (fl_bitmap & (~0U << (fl + 1))) : 0;
+        if (!fl_map) return NULL;
+        fl = __builtin_ctz(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+    return free_lists[fl][sl];
+}
+
+static struct heap_block* arena_first_block(struct heap_arena* arena)
+{
+    return (struct heap_block*)((uint8_t*)arena + 32);
+}
+
+// Formats [start, start + size) as an arena holding one free block
+static bool heap_add_arena(void* start, size_t size)
+{
+    if (size < HEAP_ARENA_OVERHEAD + HEAP_MIN_BLOCK) return false;
+
+    struct heap_arena* arena = (struct heap_arena*)start;
+    arena->next = NULL;
+    arena->size = size & ~(size_t)15;
+
+    *(size_t*)((uint8_t*)arena + 32 - HEAP_FOOTER_SIZE) = 0;		// Prologue
+
+    struct heap_block* epilogue = (struct heap_block*)((uint8_t*)arena + arena->size - HEAP_HEADER_SIZE);
+    epilogue->size = 0;
+    epilogue->magic = HEAP_BLOCK_MAGIC;
+    epilogue->free = false;
+
+    struct heap_block* block = arena_first_block(arena);
+    block_set(block, arena->size - HEAP_ARENA_OVERHEAD, true);
+
+    *arena_tail = arena;
+    arena_tail = &arena->next;
+    heap_total_size += arena->size;
+    heap_arena_count++;
+    heap_block_count++;
+    free_list_insert(block);
+    return true;
+}
 
 bool kheap_init(void* start_addr, size_t size) 
 {
-    if (start_addr == NULL || size < sizeof(struct heap_block) * 2)
+    if (start_addr == NULL || !heap_add_arena(start_addr, size))
         return false;
-    
-    heap_start = reinterpret_cast<struct heap_block*>(start_addr);
-    heap_start->size = size - sizeof(struct heap_block);
-    heap_start->free = true;
-    heap_start->next = NULL;
-    heap_total_size = size;    
+
+    kmem_init();
     return true;
 }
 
 
 void* kmalloc(size_t size) 
 {   
-    if (!heap_start) return NULL;
+    if (size <= KMEM_KMALLOC_MAX)
+    {
+        void* obj = kmem_alloc(size);
+        if (obj) return obj;
+    }
+
+    if (!arena_list) return NULL;
+
+    size_t needed = (size + HEAP_HEADER_SIZE + HEAP_FOOTER_SIZE + 15) & ~(size_t)15;
+    if (needed < HEAP_MIN_BLOCK) needed = HEAP_MIN_BLOCK;
+    if (needed < size) return NULL;
 
-    size = (size + 15) & ~15;
     spin_lock_irqsave(&heap_lock);
 
-    struct heap_block* current = heap_start;
-    struct heap_block* last = NULL;
-    
-    while (current) 
-	{
-        if (current->free && current->size >= size) 
-		{   
-            if (current->size > size + sizeof(struct heap_block) + 16) 
-			{   
-                struct heap_block* new_block = (struct heap_block*)((uint8_t*)current + sizeof(struct heap_block) + size);
-                new_block->size = current->size - size - sizeof(struct heap_block);
-                new_block->free = true;
-                new_block->next = current->next;
-                
-                current->size = size;
-                current->next = new_block;
-            }
-            
-            current->free = false;
+    struct heap_block* block = free_list_find(needed);
+    if (!block)
+    {
+        size_t grow = mapping_round(needed) + HEAP_ARENA_OVERHEAD;
+        if (grow < HEAP_GROW_MIN) grow = HEAP_GROW_MIN;
+        grow = (grow + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+
+        void* region = VMM::sbrk(grow);
+        if (region == (void*)-1 || region == NULL || !heap_add_arena(region, grow))
+        {
+            spin_unlock_irqrestore(&heap_lock);
+            return NULL;
+        }
+        block = free_list_find(needed);
+        if (!block)
+        {
             spin_unlock_irqrestore(&heap_lock);
-            return (void*)((uint8_t*)current + sizeof(struct heap_block));
+            return NULL;
         }
-        last = current;
-        current = current->next;
     }
-    
-    size_t total_needed = size + sizeof(struct heap_block);
-    struct heap_block* new_region = (struct heap_block*)VMM::sbrk(total_needed);
 
-    if (new_region == (void*)-1 || new_region == NULL)
+    free_list_remove(block);
+
+    if (block->size >= needed + HEAP_MIN_BLOCK)
     {
-        spin_unlock_irqrestore(&heap_lock);
-        return NULL;
+        struct heap_block* rest = (struct heap_block*)((uint8_t*)block + needed);
+        block_set(rest, block->size - needed, true);
+        free_list_insert(rest);
+        heap_block_count++;
+        block_set(block, needed, false);
     }
-
-    size_t actual_size = ((total_needed + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
-
-    new_region->size = actual_size - sizeof(struct heap_block);
-    new_region->free = false;
-    new_region->next = NULL;
-
-    if (last) last->next = new_region;
-    else heap_start = new_region;
+    else block_set(block, block->size, false);
 
     spin_unlock_irqrestore(&heap_lock);
-    return (void*)((uint8_t*)new_region + sizeof(struct heap_block));
+    return (void*)((uint8_t*)block + HEAP_HEADER_SIZE);
 }
 
 void kfree(void* ptr) 
 {
     if (!ptr) return;
+    if (kmem_free(ptr)) return;
+
+    struct heap_block* block = (struct heap_block*)((uint8_t*)ptr - HEAP_HEADER_SIZE);
+    if (block->magic != HEAP_BLOCK_MAGIC || block->free) return;
+
     spin_lock_irqsave(&heap_lock);
 
-    struct heap_block* block = (struct heap_block*)((uint8_t*)ptr - sizeof(struct heap_block));
-    block->free = true;
-    
-    
-    if (block->next && block->next->free) 
+    size_t size = block->size;
+
+    struct heap_block* right = block_right(block);
+    if (right->free)
     {
-        block->size += sizeof(struct heap_block) + block->next->size;
-        block->next = block->next->next;
+        free_list_remove(right);
+        size += right->size;
+        heap_block_count--;
     }
-    
-    struct heap_block* curr = heap_start;
-    while (curr && curr->next) {
-        if (curr->free && curr->next->free) 
-        {
-            curr->size += sizeof(struct heap_block) + curr->next->size;
-            curr->next = curr->next->next;
-            continue; 
-        }
-        curr = curr->next;
+
+    size_t left_tag = *(size_t*)((uint8_t*)block - HEAP_FOOTER_SIZE);
+    if (left_tag & HEAP_FOOTER_FREE)
+    {
+        struct heap_block* left = (struct heap_block*)((uint8_t*)block - (left_tag & ~(size_t)15));
+        free_list_remove(left);
+        size += left->size;
+        block->magic = 0;
+        block = left;
+        heap_block_count--;
     }
+
+    block_set(block, size, true);
+    free_list_insert(block);
     spin_unlock_irqrestore(&heap_lock);
 }
 
@@ -131,34 +310,91 @@ void kheap_get_stats(struct heap_stats* stats)
 {
     if (!stats) return;
     
+    spin_lock_irqsave(&heap_lock);
     stats->total_size = heap_total_size;
-    stats->used_size = 0;
-    stats->free_size = 0;
-    stats->block_count = 0;
-    stats->free_block_count = 0;
-    
-    struct heap_block* current = heap_start;
-    while (current != NULL) 
-	{
-        stats->block_count++;
-        if (current->free) 
-		{
-            stats->free_size += current->size;
-            stats->free_block_count++;
+    stats->free_size = heap_free_size;
+    stats->used_size = heap_total_size - heap_free_size - heap_arena_count * HEAP_ARENA_OVERHEAD;
+    stats->block_count = heap_block_count;
+    stats->free_block_count = heap_free_block_count;
+    spin_unlock_irqrestore(&heap_lock);
+
+    stats->cache_count = kmem_get_stats(stats->caches, KMEM_MAX_CACHES);
+    stats->slab_size = 0;
+    stats->slab_used = 0;
+    for (size_t i = 0; i < stats->cache_count; i++)
+    {
+        stats->slab_size += stats->caches[i].slab_bytes;
+        stats->slab_used += stats->caches[i].active_objects * stats->caches[i].object_size;
+    }
+}
+
+/*
+ * Walks every arena and free list and checks them against the running
+ * counters kept by kmalloc/kfree. Returns false on the first inconsistency.
+ */
+bool kheap_check()
+{
+    bool ok = true;
+    size_t total = 0, free_bytes = 0, blocks = 0, free_blocks = 0;
+
+    spin_lock_irqsave(&heap_lock);
+
+    for (struct heap_arena* arena = arena_list; arena && ok; arena = arena->next)
+    {
+        total += arena->size;
+        struct heap_block* end = (struct heap_block*)((uint8_t*)arena + arena->size - HEAP_HEADER_SIZE);
+        bool prev_free = false;
+
+        struct heap_block* block = arena_first_block(arena);
+        while (block < end)
+        {
+            if (block->magic != HEAP_BLOCK_MAGIC || block->size < HEAP_MIN_BLOCK || (block->size & 15) ||
+                *block_footer(block) != (block->size | (block->free ? HEAP_FOOTER_FREE : 0)) ||
+                (prev_free && block->free))
+            {
+                ok = false;
+                break;
+            }
+
+            blocks++;
+            if (block->free)
+            {
+                free_blocks++;
+                free_bytes += block->size;
+            }
+            prev_free = block->free;
+            block = block_right(block);
         }
-		else stats->used_size += current->size;
-        current = current->next;
+        if (block != end || end->size != 0 || end->free) ok = false;
     }
-    
-    size_t overhead = stats->block_count * sizeof(struct heap_block);
-    stats->used_size += overhead;
-    if (stats->used_size > stats->total_size) stats->used_size = stats->total_size;
-    stats->free_size = stats->total_size - stats->used_size;
+
+    size_t listed = 0;
+    for (int fl = 0; fl < HEAP_FL_COUNT && ok; fl++)
+    {
+        for (int sl = 0; sl < HEAP_SL_COUNT; sl++)
+        {
+            bool has = free_lists[fl][sl] != NULL;
+            if (has != (bool)(sl_bitmap[fl] & (1U << sl))) ok = false;
+            for (struct heap_block* b = free_lists[fl][sl]; b; b = b->next_free)
+            {
+                if (!b->free) ok = false;
+                listed++;
+            }
+        }
+        if ((sl_bitmap[fl] != 0) != (bool)(fl_bitmap & (1U << fl))) ok = false;
+    }
+
+    if (total != heap_total_size || free_bytes != heap_free_size || blocks != heap_block_count ||
+        free_blocks != heap_free_block_count || listed != free_blocks)
+        ok = false;
+
+    spin_unlock_irqrestore(&heap_lock);
+    return ok;
 }
 
 heap_block* get_kheap_start()
 {
-    return heap_start;
+    return arena_list ? arena_first_block(arena_list) : NULL;
 }
 
 void* operator new(size_t size) {
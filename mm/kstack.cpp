@@ -0,0 +1,157 @@
+/*
+ * keonOS - mm/kstack.cpp
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#include <kernel/arch/x86_64/paging.h>
+#include <kernel/arch/x86_64/thread.h>
+#include <kernel/constants.h>
+#include <mm/kstack.h>
+
+#define KSTACK_PAGES	(THREAD_KERNEL_STACK_SIZE / PAGE_SIZE)
+
+static_assert(KSTACK_SLOTS <= 65536, "slot numbers are kept in 16 bits");
+
+/*
+ * Slots are handed out from three places, cheapest first: the cache of
+ * recently freed stacks that are still mapped, the list of freed slots whose
+ * frames were given back, and the never-used tail of the region. All three
+ * are O(1), and none of them touches the general-purpose heap.
+ */
+static uint16_t cached_slots[KSTACK_CACHE_SIZE];
+static uint32_t cached_count = 0;
+static uint16_t empty_slots[KSTACK_SLOTS];
+static uint32_t empty_count = 0;
+static uint32_t next_unused = 0;
+static uint64_t in_use = 0;
+static uint64_t peak = 0;
+static spinlock_t kstack_lock = {0, 0};
+
+
+static inline uintptr_t slot_stack(uint32_t slot)
+{
+	return KERNEL_KSTACK_BASE + (uintptr_t)slot * KSTACK_SLOT_SIZE + KSTACK_SLOT_SIZE - THREAD_KERNEL_STACK_SIZE;
+}
+
+static void unmap_stack(uintptr_t stack, uint32_t pages)
+{
+	for (uint32_t i = 0; i < pages; i++)
+	{
+		void* virt = (void*)(stack + i * PAGE_SIZE);
+		void* phys = paging_get_physical_address(paging_kernel_space(), virt);
+		paging_unmap_page(paging_kernel_space(), virt);
+		if (phys) pfa_free_frame(phys);
+	}
+}
+
+static bool map_stack(uintptr_t stack)
+{
+	for (uint32_t i = 0; i < KSTACK_PAGES; i++)
+	{
+		void* phys = pfa_alloc_frame(PFA_NO_ZERO);
+		if (!phys || !paging_map_page(paging_kernel_space(), (void*)(stack + i * PAGE_SIZE), phys, PTE_PRESENT | PTE_RW))
+		{
+			if (phys) pfa_free_frame(phys);
+			unmap_stack(stack, i);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Returns the lowest address of a mapped THREAD_KERNEL_STACK_SIZE stack
+void* kstack_alloc()
+{
+	bool mapped = true;
+	uint32_t slot;
+
+	spin_lock_irqsave(&kstack_lock);
+	if (cached_count > 0) slot = cached_slots[--cached_count];
+	else if (empty_count > 0)
+	{
+		slot = empty_slots[--empty_count];
+		mapped = false;
+	}
+	else if (next_unused < KSTACK_SLOTS)
+	{
+		slot = next_unused++;
+		mapped = false;
+	}
+	else
+	{
+		spin_unlock_irqrestore(&kstack_lock);
+		return nullptr;
+	}
+	if (++in_use > peak) peak = in_use;
+	spin_unlock_irqrestore(&kstack_lock);
+
+	// Frames are mapped outside the lock: the allocation may have to reclaim
+	uintptr_t stack = slot_stack(slot);
+	if (!mapped && !map_stack(stack))
+	{
+		spin_lock_irqsave(&kstack_lock);
+		empty_slots[empty_count++] = (uint16_t)slot;
+		in_use--;
+		spin_unlock_irqrestore(&kstack_lock);
+		return nullptr;
+	}
+	return (void*)stack;
+}
+
+void kstack_free(void* stack)
+{
+	uintptr_t addr = (uintptr_t)stack;
+	if (addr < KERNEL_KSTACK_BASE || addr >= KERNEL_KSTACK_END) return;
+
+	uint32_t slot = (uint32_t)((addr - KERNEL_KSTACK_BASE) / KSTACK_SLOT_SIZE);
+	if (addr != slot_stack(slot)) return;
+
+	spin_lock_irqsave(&kstack_lock);
+	in_use--;
+	if (cached_count < KSTACK_CACHE_SIZE)
+	{
+		cached_slots[cached_count++] = (uint16_t)slot;
+		spin_unlock_irqrestore(&kstack_lock);
+		return;
+	}
+	spin_unlock_irqrestore(&kstack_lock);
+
+	// The slot is not listed anywhere yet, so nobody can hand it out while it is torn down
+	unmap_stack(addr, KSTACK_PAGES);
+
+	spin_lock_irqsave(&kstack_lock);
+	empty_slots[empty_count++] = (uint16_t)slot;
+	spin_unlock_irqrestore(&kstack_lock);
+}
+
+// True if addr lies in the unmapped part of a stack slot
+bool kstack_is_guard(uintptr_t addr)
+{
+	if (addr < KERNEL_KSTACK_BASE || addr >= KERNEL_KSTACK_END) return false;
+	return (addr - KERNEL_KSTACK_BASE) % KSTACK_SLOT_SIZE < KSTACK_SLOT_SIZE - THREAD_KERNEL_STACK_SIZE;
+}
+
+void kstack_get_stats(struct kstack_stats* stats)
+{
+	if (!stats) return;
+	spin_lock_irqsave(&kstack_lock);
+	stats->in_use = in_use;
+	stats->cached = cached_count;
+	stats->peak = peak;
+	spin_unlock_irqrestore(&kstack_lock);
+}
@@ -0,0 +1,411 @@
+/*
+ * keonOS - mm/page_cache.cpp
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#include <kernel/arch/x86_64/paging.h>
+#include <kernel/arch/x86_64/thread.h>
+#include <kernel/constants.h>
+#include <fs/vfs_node.h>
+#include <mm/page_cache.h>
+#include <mm/reclaim.h>
+#include <mm/slab.h>
+#include <string.h>
+
+struct pc_page
+{
+	uint64_t file;				// VFSNode::cache_id of the owner
+	uint32_t index;				// Page number within the file
+	bool dirty;
+	VFSNode* owner;				// Node that dirtied it, written back through
+	void* frame;				// The cache holds one reference on it
+	pc_page* hash_next;
+	pc_page* lru_prev;			// Towards the most recently used end
+	pc_page* lru_next;
+	pc_page* dirty_next;		// Towards the most recently dirtied end
+};
+
+static kmem_cache* pc_cache = nullptr;
+static spinlock_t pc_lock = {0, 0};
+static pc_page* pc_buckets[1 << PAGE_CACHE_HASH_BITS];
+static pc_page* lru_head = nullptr;			// Most recently used
+static pc_page* lru_tail = nullptr;
+static pc_page* dirty_list = nullptr;		// Dirtied longest ago
+static pc_page* dirty_tail = nullptr;
+static page_cache_stats pc_stats = {};
+
+static uint64_t pc_shrink_count();
+static uint64_t pc_shrink_scan(uint64_t nr);
+static shrinker pc_shrinker = { "page_cache", pc_shrink_count, pc_shrink_scan, nullptr };
+
+
+static inline uint32_t bucket_of(uint64_t file, uint32_t index)
+{
+	uint64_t key = (file << 24) ^ index;
+	return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - PAGE_CACHE_HASH_BITS));
+}
+
+// The helpers below are called with pc_lock held
+static pc_page* lookup_locked(uint64_t file, uint32_t index)
+{
+	for (pc_page* page = pc_buckets[bucket_of(file, index)]; page; page = page->hash_next)
+		if (page->file == file && page->index == index) return page;
+	return nullptr;
+}
+
+static void lru_unlink(pc_page* page)
+{
+	if (page->lru_prev) page->lru_prev->lru_next = page->lru_next;
+	else lru_head = page->lru_next;
+	if (page->lru_next) page->lru_next->lru_prev = page->lru_prev;
+	else lru_tail = page->lru_prev;
+}
+
+static void lru_push(pc_page* page)
+{
+	page->lru_prev = nullptr;
+	page->lru_next = lru_head;
+	if (lru_head) lru_head->lru_prev = page;
+	else lru_tail = page;
+	lru_head = page;
+}
+
+static void mark_dirty_locked(pc_page* page, VFSNode* node)
+{
+	if (page->dirty) return;
+	page->dirty = true;
+	page->owner = node;
+	page->dirty_next = nullptr;
+	if (dirty_tail) dirty_tail->dirty_next = page;
+	else dirty_list = page;
+	dirty_tail = page;
+	pc_stats.dirty++;
+}
+
+static void clear_dirty_locked(pc_page* page)
+{
+	if (!page->dirty) return;
+	pc_page* prev = nullptr;
+	for (pc_page* cur = dirty_list; cur; prev = cur, cur = cur->dirty_next)
+	{
+		if (cur == page)
+		{
+			if (prev) prev->dirty_next = page->dirty_next;
+			else dirty_list = page->dirty_next;
+			if (dirty_tail == page) dirty_tail = prev;
+			break;
+		}
+	}
+	page->dirty = false;
+	page->owner = nullptr;
+	pc_stats.dirty--;
+}
+
+static void remove_locked(pc_page* page)
+{
+	for (pc_page** link = &pc_buckets[bucket_of(page->file, page->index)]; *link; link = &(*link)->hash_next)
+	{
+		if (*link == page)
+		{
+			*link = page->hash_next;
+			break;
+		}
+	}
+	lru_unlink(page);
+	clear_dirty_locked(page);
+
+	// Processes that mapped the frame keep it alive through their own reference
+	pfa_put_frame(page->frame);
+	kmem_cache_free(pc_cache, page);
+	pc_stats.pages--;
+}
+
+// A frame holding page 'index' of the node, read from it when 'read' is set
+static void* fill_frame(VFSNode* node, uint32_t index, bool read)
+{
+	void* frame = pfa_alloc_frame(PFA_NO_ZERO);
+	if (!frame) return nullptr;
+
+	uint8_t* data = (uint8_t*)phys_to_virt((uintptr_t)frame);
+	uint64_t start = (uint64_t)index * PAGE_SIZE;
+	uint32_t got = (read && start < node->size) ? node->read((uint32_t)start, PAGE_SIZE, data) : 0;
+	if (got < PAGE_SIZE) memset(data + got, 0, PAGE_SIZE - got);
+	return frame;
+}
+
+/*
+ * Finds or creates the page; the disk is only touched with pc_lock dropped.
+ * Always returns with pc_lock held, nullptr when memory ran out.
+ */
+static pc_page* get_locked(VFSNode* node, uint64_t file, uint32_t index, bool read)
+{
+	spin_lock_irqsave(&pc_lock);
+	pc_page* page = lookup_locked(file, index);
+	if (page)
+	{
+		pc_stats.hits++;
+		lru_unlink(page);
+		lru_push(page);
+		return page;
+	}
+	pc_stats.misses++;
+	spin_unlock_irqrestore(&pc_lock);
+
+	void* frame = fill_frame(node, index, read);
+
+	spin_lock_irqsave(&pc_lock);
+	if (!frame) return nullptr;
+
+	// Someone else may have brought the page in meanwhile
+	page = lookup_locked(file, index);
+	if (page)
+	{
+		pfa_free_frame(frame);
+		return page;
+	}
+
+	if (!pc_cache)
+	{
+		pc_cache = kmem_cache_create("page_cache", sizeof(pc_page));
+		if (pc_cache) register_shrinker(&pc_shrinker);
+	}
+	page = pc_cache ? (pc_page*)kmem_cache_alloc(pc_cache) : nullptr;
+	if (!page)
+	{
+		pfa_free_frame(frame);
+		return nullptr;
+	}
+
+	page->file = file;
+	page->index = index;
+	page->dirty = false;
+	page->owner = nullptr;
+	page->frame = frame;
+	page->dirty_next = nullptr;
+	uint32_t bucket = bucket_of(file, index);
+	page->hash_next = pc_buckets[bucket];
+	pc_buckets[bucket] = page;
+	lru_push(page);
+	pc_stats.pages++;
+	return page;
+}
+
+uint32_t page_cache_read(VFSNode* node, uint32_t offset, uint32_t size, uint8_t* buffer)
+{
+	uint64_t file = node ? node->cache_id() : 0;
+	if (!file || offset >= node->size) return 0;
+	if (size > node->size - offset) size = node->size - offset;
+
+	uint32_t done = 0;
+	while (done < size)
+	{
+		uint32_t pos = offset + done;
+		uint32_t in_page = pos % PAGE_SIZE;
+		uint32_t chunk = PAGE_SIZE - in_page;
+		if (chunk > size - done) chunk = size - done;
+
+		pc_page* page = get_locked(node, file, pos / PAGE_SIZE, true);
+		if (page) memcpy(buffer + done, (uint8_t*)phys_to_virt((uintptr_t)page->frame) + in_page, chunk);
+		spin_unlock_irqrestore(&pc_lock);
+		if (!page) break;
+		done += chunk;
+	}
+	return done;
+}
+
+/*
+ * Writes back whole files, the one dirtied longest ago first, until the
+ * dirty count is under the limit again. A node is closed only after its
+ * pages were flushed, so a dirty page's owner is still alive; the extra
+ * reference keeps it so while pc_lock is dropped.
+ */
+static void writeback_oldest()
+{
+	while (true)
+	{
+		spin_lock_irqsave(&pc_lock);
+		if (pc_stats.dirty <= PAGE_CACHE_DIRTY_MAX || !dirty_list)
+		{
+			spin_unlock_irqrestore(&pc_lock);
+			return;
+		}
+		VFSNode* owner = dirty_list->owner;
+		owner->open();
+		spin_unlock_irqrestore(&pc_lock);
+
+		page_cache_flush(owner);
+		owner->close();
+	}
+}
+
+uint32_t page_cache_write(VFSNode* node, uint32_t offset, uint32_t size, const uint8_t* buffer)
+{
+	uint64_t file = node ? node->cache_id() : 0;
+	if (!file) return 0;
+
+	uint32_t old_size = node->size;
+	uint32_t done = 0;
+	while (done < size)
+	{
+		uint32_t pos = offset + done;
+		uint32_t in_page = pos % PAGE_SIZE;
+		uint32_t chunk = PAGE_SIZE - in_page;
+		if (chunk > size - done) chunk = size - done;
+
+		// Only a partly overwritten page that already had data needs reading
+		uint32_t index = pos / PAGE_SIZE;
+		bool read = chunk < PAGE_SIZE && (uint64_t)index * PAGE_SIZE < old_size;
+
+		pc_page* page = get_locked(node, file, index, read);
+		if (page)
+		{
+			memcpy((uint8_t*)phys_to_virt((uintptr_t)page->frame) + in_page, buffer + done, chunk);
+			mark_dirty_locked(page, node);
+		}
+		spin_unlock_irqrestore(&pc_lock);
+		if (!page) break;
+		done += chunk;
+	}
+
+	if (offset + done > node->size) node->size = offset + done;
+	if (pc_stats.dirty > PAGE_CACHE_DIRTY_MAX) writeback_oldest();
+	return done;
+}
+
+// Returns the frame caching page 'index' with a reference for the caller, for mmap
+void* page_cache_get_frame(VFSNode* node, uint32_t index)
+{
+	uint64_t file = node ? node->cache_id() : 0;
+	if (!file) return nullptr;
+
+	pc_page* page = get_locked(node, file, index, true);
+	void* frame = page ? page->frame : nullptr;
+	if (frame) pfa_ref_frame(frame);
+	spin_unlock_irqrestore(&pc_lock);
+	return frame;
+}
+
+/*
+ * Writes the node's dirty pages back through it, lowest offset first so a
+ * file only ever grows at its end.
+ */
+void page_cache_flush(VFSNode* node)
+{
+	uint64_t file = node ? node->cache_id() : 0;
+	if (!file) return;
+
+	while (true)
+	{
+		spin_lock_irqsave(&pc_lock);
+		pc_page* next = nullptr;
+		for (pc_page* page = dirty_list; page; page = page->dirty_next)
+			if (page->file == file && (!next || page->index < next->index)) next = page;
+
+		if (!next)
+		{
+			spin_unlock_irqrestore(&pc_lock);
+			return;
+		}
+
+		// The page is clean from here on and may be evicted while it is written
+		clear_dirty_locked(next);
+		void* frame = next->frame;
+		uint64_t start = (uint64_t)next->index * PAGE_SIZE;
+		pfa_ref_frame(frame);
+		pc_stats.writebacks++;
+		spin_unlock_irqrestore(&pc_lock);
+
+		if (start < node->size)
+		{
+			uint32_t len = node->size - (uint32_t)start;
+			if (len > PAGE_SIZE) len = PAGE_SIZE;
+			node->write((uint32_t)start, len, (uint8_t*)phys_to_virt((uintptr_t)frame));
+		}
+		pfa_put_frame(frame);
+	}
+}
+
+// Drops pages [first, last] of a file, dirty or not (deleted file, disk rewritten underneath)
+void page_cache_invalidate(uint64_t file, uint32_t first, uint32_t last)
+{
+	spin_lock_irqsave(&pc_lock);
+	if (last - first < PAGE_CACHE_LOOKUP_MAX)
+	{
+		// Short ranges (a few sectors) are cheaper to look up one by one
+		for (uint32_t index = first; index <= last; index++)
+		{
+			pc_page* page = lookup_locked(file, index);
+			if (page) remove_locked(page);
+		}
+	}
+	else
+	{
+		pc_page* page = lru_head;
+		while (page)
+		{
+			pc_page* next = page->lru_next;
+			if (page->file == file && page->index >= first && page->index <= last) remove_locked(page);
+			page = next;
+		}
+	}
+	spin_unlock_irqrestore(&pc_lock);
+}
+
+/*
+ * Releases up to max_pages clean, unmapped pages, least recently used first.
+ * Reclaim may run inside an allocation made under pc_lock, so a busy lock
+ * means nothing is evicted rather than a deadlock.
+ */
+uint32_t page_cache_evict(uint32_t max_pages)
+{
+	uint32_t evicted = 0;
+	if (!spin_trylock_irqsave(&pc_lock)) return 0;
+	pc_page* page = lru_tail;
+	while (page && evicted < max_pages)
+	{
+		pc_page* prev = page->lru_prev;
+		// A page still mapped somewhere frees nothing and would only stop being shared
+		if (!page->dirty && pfa_frame_shares(page->frame) == 0)
+		{
+			remove_locked(page);
+			evicted++;
+		}
+		page = prev;
+	}
+	pc_stats.evictions += evicted;
+	spin_unlock_irqrestore(&pc_lock);
+	return evicted;
+}
+
+static uint64_t pc_shrink_count()
+{
+	return pc_stats.pages - pc_stats.dirty;
+}
+
+static uint64_t pc_shrink_scan(uint64_t nr)
+{
+	return page_cache_evict(nr > UINT32_MAX ? UINT32_MAX : (uint32_t)nr);
+}
+
+void page_cache_get_stats(struct page_cache_stats* stats)
+{
+	if (!stats) return;
+	spin_lock_irqsave(&pc_lock);
+	*stats = pc_stats;
+	spin_unlock_irqrestore(&pc_lock);
+}
@@ -0,0 +1,165 @@
+/*
+ * keonOS - mm/reclaim.cpp
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#include <kernel/arch/x86_64/paging.h>
+#include <kernel/arch/x86_64/thread.h>
+#include <kernel/arch/x86_64/cpu.h>
+#include <kernel/constants.h>
+#include <mm/reclaim.h>
+#include <stdio.h>
+#include <string.h>
+
+static shrinker* shrinkers = nullptr;
+static spinlock_t shrinker_lock = {0, 0};
+static bool in_direct_reclaim[MAX_CPUS];
+static reclaim_stats stats = {};
+
+
+// The list only ever grows and a new entry is complete before it is published
+void register_shrinker(shrinker* s)
+{
+	spin_lock_irqsave(&shrinker_lock);
+	s->next = shrinkers;
+	__atomic_store_n(&shrinkers, s, __ATOMIC_RELEASE);
+	spin_unlock_irqrestore(&shrinker_lock);
+}
+
+// Asks the shrinkers, in registration order, for up to 'target' frames
+uint64_t reclaim_pages(uint64_t target)
+{
+	uint64_t freed = 0;
+	for (shrinker* s = __atomic_load_n(&shrinkers, __ATOMIC_ACQUIRE); s && freed < target; s = s->next)
+	{
+		uint64_t available = s->count();
+		if (available == 0) continue;
+		freed += s->scan(available < target - freed ? available : target - freed);
+	}
+	__atomic_add_fetch(&stats.reclaimed, freed, __ATOMIC_RELAXED);
+	return freed;
+}
+
+// Reclaim on behalf of a failing allocation; one level deep per CPU
+uint64_t reclaim_direct(uint64_t target)
+{
+	uint64_t rflags = local_irq_save();
+	uint32_t cpu = cpu_current_id();
+	uint64_t freed = 0;
+
+	if (!in_direct_reclaim[cpu])
+	{
+		in_direct_reclaim[cpu] = true;
+		stats.direct_runs++;
+		freed = reclaim_pages(target < RECLAIM_BATCH ? RECLAIM_BATCH : target);
+		in_direct_reclaim[cpu] = false;
+	}
+
+	local_irq_restore(rflags);
+	return freed;
+}
+
+struct oom_choice
+{
+	uint32_t id;
+	uint64_t pages;
+	char name[16];
+};
+
+// Called with the thread list locked. Threads already on their way out are
+// passed over, so a victim still running elsewhere is not picked twice.
+static void oom_consider(thread_t* t, void* arg)
+{
+	oom_choice* c = (oom_choice*)arg;
+	if (!t->is_user || t->state == THREAD_ZOMBIE || t->kill_pending) return;
+
+	uint64_t pages = paging_resident_pages(t->as);
+	if (c->id == THREAD_NOT_FOUND || pages > c->pages || (pages == c->pages && t->id > c->id))
+	{
+		c->id = t->id;
+		c->pages = pages;
+		memcpy(c->name, t->name, sizeof(c->name));
+	}
+}
+
+/*
+ * Called when a legal user access found no frame. Tries reclaim once more,
+ * then kills the user process with the most resident pages (ties go to the
+ * newest), waits for it to exit and reaps it. Returns true only once frames
+ * have actually come free, and false when the victim is 'faulting' itself
+ * or nothing could be freed in time; the caller must then terminate.
+ */
+bool oom_kill(thread_t* faulting)
+{
+	if (reclaim_direct(RECLAIM_BATCH)) return true;
+
+	oom_choice choice = { THREAD_NOT_FOUND, 0, {0} };
+	thread_for_each(oom_consider, &choice);
+	if (choice.id == THREAD_NOT_FOUND) return false;
+
+	printf("\nOut of memory: killed %s (pid %u, %lu KB resident)\n",
+	       choice.name, choice.id, choice.pages * (PAGE_SIZE / 1024));
+	if (choice.id == faulting->id)
+	{
+		__atomic_add_fetch(&stats.oom_kills, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	// A victim that exited on its own since the scan has freed its memory already
+	uint64_t free_before = pfa_free_frame_count();
+	if (!thread_kill(choice.id)) return pfa_free_frame_count() > free_before;
+	__atomic_add_fetch(&stats.oom_kills, 1, __ATOMIC_RELAXED);
+
+	// A victim running on another CPU only leaves on its next return to ring 3
+	thread_join(choice.id, nullptr, OOM_KILL_WAIT_MS);
+
+	// The zombie is reaped once its CPU has switched away from it
+	for (uint32_t waited = 0; waited < OOM_KILL_WAIT_MS; waited += 10)
+	{
+		cleanup_zombies();
+		if (pfa_free_frame_count() > free_before) return true;
+		thread_sleep(10);
+	}
+	return false;
+}
+
+// Sleeps until free memory drops below the low watermark, then refills it
+static void kswapd_main()
+{
+	while (true)
+	{
+		if (pfa_free_frame_count() < RECLAIM_WMARK_LOW)
+		{
+			stats.kswapd_runs++;
+			while (pfa_free_frame_count() < RECLAIM_WMARK_HIGH)
+				if (reclaim_pages(RECLAIM_BATCH) == 0) break;
+		}
+		thread_sleep(KSWAPD_INTERVAL_MS);
+	}
+}
+
+void reclaim_init()
+{
+	if (!thread_add(kswapd_main, "kswapd", false))
+		printf("reclaim: cannot start kswapd, relying on direct reclaim\n");
+}
+
+void reclaim_get_stats(struct reclaim_stats* out)
+{
+	if (out) *out = stats;
+}
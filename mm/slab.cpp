@@ -0,0 +1,377 @@
+/*
+ * keonOS - mm/slab.cpp
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+
+#include <kernel/arch/x86_64/thread.h>
+#include <kernel/arch/x86_64/paging.h>
+#include <kernel/constants.h>
+#include <mm/reclaim.h>
+#include <mm/slab.h>
+#include <string.h>
+
+#define KMEM_SLAB_MAGIC 0x534C4142		// "SLAB"
+
+/*
+ * A slab is one buddy block split into equal objects. Free objects are
+ * chained through their first word. Small caches keep the slab header at
+ * the start of the block; caches of large objects keep it off-slab so the
+ * block is filled by whole objects. Every frame of a slab is tagged with
+ * its header through pfa_set_owner, so kfree finds the cache in O(1).
+ */
+struct kmem_slab
+{
+	uint32_t magic;
+	uint32_t in_use;
+	struct kmem_cache* cache;
+	void* free_list;
+	uint8_t* mem;
+	struct kmem_slab* next;
+	struct kmem_slab* prev;
+};
+
+struct kmem_cache
+{
+	char name[KMEM_CACHE_NAME_LEN];
+	size_t object_size;
+	size_t first_offset;
+	uint32_t order;
+	uint32_t objects_per_slab;
+	bool off_slab;
+
+	struct kmem_slab* partial;
+	struct kmem_slab* full;
+	struct kmem_slab* empty;		// At most one fully free slab is kept around
+
+	size_t slab_count;
+	size_t active_objects;
+	spinlock_t lock;
+	struct kmem_cache* next;
+};
+
+struct kmalloc_class
+{
+	size_t size;
+	const char* name;
+};
+
+static const kmalloc_class kmalloc_classes[] =
+{
+	{16, "kmalloc-16"}, {32, "kmalloc-32"}, {64, "kmalloc-64"},
+	{96, "kmalloc-96"}, {128, "kmalloc-128"}, {192, "kmalloc-192"},
+	{256, "kmalloc-256"}, {512, "kmalloc-512"}, {1024, "kmalloc-1024"},
+	{2048, "kmalloc-2048"}, {4096, "kmalloc-4096"},
+};
+
+#define KMALLOC_CLASS_COUNT (sizeof(kmalloc_classes) / sizeof(kmalloc_classes[0]))
+
+static kmem_cache cache_cache;		// Backs kmem_cache descriptors
+static kmem_cache slab_cache;		// Backs off-slab headers
+static kmem_cache* kmalloc_caches[KMALLOC_CLASS_COUNT];
+
+static kmem_cache* cache_list = nullptr;
+static kmem_cache** cache_list_tail = &cache_list;
+static spinlock_t cache_list_lock = {0, 0};
+static bool kmem_ready = false;
+
+static uint64_t slab_shrink_count();
+static uint64_t slab_shrink_scan(uint64_t nr);
+static shrinker slab_shrinker = { "slab", slab_shrink_count, slab_shrink_scan, nullptr };
+
+
+static void slab_list_add(kmem_slab** head, kmem_slab* slab)
+{
+	slab->prev = nullptr;
+	slab->next = *head;
+	if (*head) (*head)->prev = slab;
+	*head = slab;
+}
+
+static void slab_list_remove(kmem_slab** head, kmem_slab* slab)
+{
+	if (slab->prev) slab->prev->next = slab->next;
+	else *head = slab->next;
+	if (slab->next) slab->next->prev = slab->prev;
+	slab->next = slab->prev = nullptr;
+}
+
+static kmem_slab* slab_of(void* ptr)
+{
+	uintptr_t addr = (uintptr_t)ptr;
+	if (addr < KERNEL_VIRT_OFFSET || addr >= KERNEL_VIRT_OFFSET + KERNEL_DIRECT_MAP_SIZE) return nullptr;
+
+	kmem_slab* slab = (kmem_slab*)pfa_get_owner((void*)virt_to_phys(ptr));
+	if (!slab || slab->magic != KMEM_SLAB_MAGIC) return nullptr;
+	return slab;
+}
+
+// Picks the smallest slab order that wastes at most 1/8 of the block
+static bool cache_setup(kmem_cache* cache, const char* name, size_t size, size_t align)
+{
+	if (align < KMEM_MIN_ALIGN) align = KMEM_MIN_ALIGN;
+	if (align & (align - 1)) return false;
+
+	memset(cache, 0, sizeof(kmem_cache));
+	strncpy(cache->name, name, KMEM_CACHE_NAME_LEN - 1);
+
+	size = (size + align - 1) & ~(align - 1);
+	cache->object_size = size;
+	cache->off_slab = size >= PAGE_SIZE / 8;
+	cache->first_offset = cache->off_slab ? 0 : ((sizeof(kmem_slab) + align - 1) & ~(align - 1));
+
+	uint32_t order = 0;
+	while (order < KMEM_MAX_SLAB_ORDER)
+	{
+		size_t bytes = (size_t)PAGE_SIZE << order;
+		if (bytes >= cache->first_offset + size && ((bytes - cache->first_offset) % size) * 8 <= bytes) break;
+		order++;
+	}
+
+	cache->order = order;
+	cache->objects_per_slab = (uint32_t)((((size_t)PAGE_SIZE << order) - cache->first_offset) / size);
+	return cache->objects_per_slab > 0;
+}
+
+static void cache_register(kmem_cache* cache)
+{
+	spin_lock_irqsave(&cache_list_lock);
+	cache->next = nullptr;
+	*cache_list_tail = cache;
+	cache_list_tail = &cache->next;
+	spin_unlock_irqrestore(&cache_list_lock);
+}
+
+// Called with cache->lock held
+static kmem_slab* cache_grow(kmem_cache* cache)
+{
+	void* phys = pfa_alloc_frames(cache->order, PFA_NO_ZERO);
+	if (!phys) return nullptr;
+
+	uint8_t* mem = (uint8_t*)phys_to_virt((uintptr_t)phys);
+	kmem_slab* slab = cache->off_slab ? (kmem_slab*)kmem_cache_alloc(&slab_cache) : (kmem_slab*)mem;
+	if (!slab)
+	{
+		pfa_free_frames(phys, cache->order);
+		return nullptr;
+	}
+
+	slab->magic = KMEM_SLAB_MAGIC;
+	slab->in_use = 0;
+	slab->cache = cache;
+	slab->mem = mem;
+	slab->free_list = nullptr;
+	slab->next = slab->prev = nullptr;
+
+	for (uint32_t i = cache->objects_per_slab; i-- > 0;)
+	{
+		void** obj = (void**)(mem + cache->first_offset + i * cache->object_size);
+		*obj = slab->free_list;
+		slab->free_list = obj;
+	}
+
+	pfa_set_owner(phys, cache->order, slab);
+	cache->slab_count++;
+	return slab;
+}
+
+// Called with cache->lock held
+static void cache_release(kmem_cache* cache, kmem_slab* slab)
+{
+	void* phys = (void*)virt_to_phys(slab->mem);
+	pfa_set_owner(phys, cache->order, nullptr);
+	slab->magic = 0;
+	cache->slab_count--;
+
+	if (cache->off_slab) kmem_cache_free(&slab_cache, slab);
+	pfa_free_frames(phys, cache->order);
+}
+
+
+void kmem_init()
+{
+	if (kmem_ready) return;
+
+	cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache), 0);
+	cache_register(&cache_cache);
+	cache_setup(&slab_cache, "kmem_slab", sizeof(kmem_slab), 0);
+	cache_register(&slab_cache);
+
+	for (size_t i = 0; i < KMALLOC_CLASS_COUNT; i++)
+		kmalloc_caches[i] = kmem_cache_create(kmalloc_classes[i].name, kmalloc_classes[i].size);
+
+	register_shrinker(&slab_shrinker);
+	kmem_ready = true;
+}
+
+kmem_cache* kmem_cache_create(const char* name, size_t object_size, size_t align)
+{
+	if (!name || object_size == 0) return nullptr;
+
+	kmem_cache* cache = (kmem_cache*)kmem_cache_alloc(&cache_cache);
+	if (!cache) return nullptr;
+
+	if (!cache_setup(cache, name, object_size, align))
+	{
+		kmem_cache_free(&cache_cache, cache);
+		return nullptr;
+	}
+
+	cache_register(cache);
+	return cache;
+}
+
+void* kmem_cache_alloc(kmem_cache* cache)
+{
+	if (!cache) return nullptr;
+	spin_lock_irqsave(&cache->lock);
+
+	kmem_slab* slab = cache->partial;
+	if (!slab)
+	{
+		slab = cache->empty;
+		if (slab) slab_list_remove(&cache->empty, slab);
+		else slab = cache_grow(cache);
+
+		if (!slab)
+		{
+			spin_unlock_irqrestore(&cache->lock);
+			return nullptr;
+		}
+		slab_list_add(&cache->partial, slab);
+	}
+
+	void** obj = (void**)slab->free_list;
+	slab->free_list = *obj;
+	slab->in_use++;
+	cache->active_objects++;
+
+	if (slab->in_use == cache->objects_per_slab)
+	{
+		slab_list_remove(&cache->partial, slab);
+		slab_list_add(&cache->full, slab);
+	}
+
+	spin_unlock_irqrestore(&cache->lock);
+	return obj;
+}
+
+void kmem_cache_free(kmem_cache* cache, void* obj)
+{
+	if (!obj) return;
+
+	kmem_slab* slab = slab_of(obj);
+	if (!slab || slab->cache != cache) return;
+
+	spin_lock_irqsave(&cache->lock);
+
+	kmem_slab** list = (slab->in_use == cache->objects_per_slab) ? &cache->full : &cache->partial;
+	slab_list_remove(list, slab);
+
+	*(void**)obj = slab->free_list;
+	slab->free_list = obj;
+	slab->in_use--;
+	cache->active_objects--;
+
+	if (slab->in_use > 0) slab_list_add(&cache->partial, slab);
+	else if (!cache->empty) slab_list_add(&cache->empty, slab);
+	else cache_release(cache, slab);
+
+	spin_unlock_irqrestore(&cache->lock);
+}
+
+// Size-class allocation for kmalloc; nullptr means "use the list allocator"
+void* kmem_alloc(size_t size)
+{
+	if (!kmem_ready || size > KMEM_KMALLOC_MAX) return nullptr;
+
+	for (size_t i = 0; i < KMALLOC_CLASS_COUNT; i++)
+		if (size <= kmalloc_classes[i].size) return kmem_cache_alloc(kmalloc_caches[i]);
+
+	return nullptr;
+}
+
+// Returns false when ptr does not belong to any slab
+bool kmem_free(void* ptr)
+{
+	kmem_slab* slab = slab_of(ptr);
+	if (!slab) return false;
+
+	kmem_cache_free(slab->cache, ptr);
+	return true;
+}
+
+static uint64_t slab_shrink_count()
+{
+	uint64_t frames = 0;
+	for (kmem_cache* cache = cache_list; cache; cache = cache->next)
+		if (cache->empty) frames += 1ULL << cache->order;
+	return frames;
+}
+
+// Frees the spare empty slab each cache keeps; caches whose lock is busy are skipped
+static uint64_t slab_shrink_scan(uint64_t nr)
+{
+	uint64_t freed = 0;
+	if (!spin_trylock_irqsave(&cache_list_lock)) return 0;
+
+	for (kmem_cache* cache = cache_list; cache && freed < nr; cache = cache->next)
+	{
+		if (!cache->empty) continue;
+
+		// Off-slab headers go back to slab_cache, whose lock this CPU may hold
+		if (cache->off_slab)
+		{
+			if (!spin_trylock_irqsave(&slab_cache.lock)) continue;
+			spin_unlock_irqrestore(&slab_cache.lock);
+		}
+		if (!spin_trylock_irqsave(&cache->lock)) continue;
+
+		kmem_slab* slab = cache->empty;
+		if (slab)
+		{
+			slab_list_remove(&cache->empty, slab);
+			cache_release(cache, slab);
+			freed += 1ULL << cache->order;
+		}
+		spin_unlock_irqrestore(&cache->lock);
+	}
+
+	spin_unlock_irqrestore(&cache_list_lock);
+	return freed;
+}
+
+size_t kmem_get_stats(struct kmem_cache_stats* out, size_t max)
+{
+	size_t count = 0;
+	spin_lock_irqsave(&cache_list_lock);
+
+	for (kmem_cache* cache = cache_list; cache && count < max; cache = cache->next)
+	{
+		kmem_cache_stats* s = &out[count++];
+		memcpy(s->name, cache->name, KMEM_CACHE_NAME_LEN);
+		s->object_size = cache->object_size;
+		s->active_objects = cache->active_objects;
+		s->total_objects = cache->slab_count * cache->objects_per_slab;
+		s->slab_count = cache->slab_count;
+		s->slab_bytes = cache->slab_count * ((size_t)PAGE_SIZE << cache->order);
+	}
+
+	spin_unlock_irqrestore(&cache_list_lock);
+	return count;
+}
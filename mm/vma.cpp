@@ -0,0 +1,474 @@
+/*
+ * keonOS - mm/vma.cpp
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#include <kernel/arch/x86_64/paging.h>
+#include <kernel/arch/x86_64/thread.h>
+#include <kernel/constants.h>
+#include <fs/vfs.h>
+#include <mm/page_cache.h>
+#include <mm/slab.h>
+#include <mm/vma.h>
+#include <string.h>
+
+static kmem_cache* vma_cache = nullptr;
+static spinlock_t vma_cache_lock = {0, 0};	// Each address space has its own vma_lock
+static uint64_t vma_faults = 0;
+
+
+// Called with as->vma_lock held
+static vm_area* find_locked(address_space* as, uintptr_t addr)
+{
+	for (vm_area* vma = as->vmas; vma && vma->start <= addr; vma = vma->next)
+		if (addr < vma->end) return vma;
+	return nullptr;
+}
+
+// Drops and frees every page mapped in [start, end); huge pages only partly inside are split
+static void unmap_range(address_space* as, uintptr_t start, uintptr_t end)
+{
+	for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE)
+	{
+		if (!(addr & (PAGE_SIZE_2M - 1)) && addr + PAGE_SIZE_2M <= end)
+		{
+			void* block = paging_unmap_huge_page(as, (void*)addr);
+			if (block)
+			{
+				pfa_free_frames(block, 9);
+				addr += PAGE_SIZE_2M - PAGE_SIZE;
+				continue;
+			}
+		}
+
+		void* phys = paging_get_physical_address(as, (void*)addr);
+		if (phys && paging_unmap_page(as, (void*)addr)) pfa_put_frame(phys);
+	}
+}
+
+/*
+ * Backs the whole 2 MiB window around addr with one huge page, if the window
+ * lies inside an anonymous heap or mmap area, nothing in it is mapped yet and
+ * the buddy allocator has an order-9 block to spare. Called with as->vma_lock held.
+ */
+static bool fault_huge_locked(address_space* as, vm_area* vma, uintptr_t addr)
+{
+	uintptr_t base = addr & ~(uintptr_t)(PAGE_SIZE_2M - 1);
+	if (vma->file || (vma->kind != VMA_HEAP && vma->kind != VMA_MMAP)) return false;
+	if (base < vma->start || base + PAGE_SIZE_2M > vma->end) return false;
+	if (!paging_can_map_huge(as, (void*)base)) return false;
+
+	// Only opportunistic: never shrink caches just to get a huge page
+	void* block = pfa_alloc_frames(9, PFA_NO_RECLAIM);
+	if (!block) return false;
+
+	uint64_t flags = PTE_PRESENT | PTE_USER | ((vma->flags & VMA_WRITE) ? (uint64_t)PTE_RW : 0ULL);
+	if (paging_map_huge_page(as, (void*)base, block, flags)) return true;
+	pfa_free_frames(block, 9);
+	return false;
+}
+
+// Drops a removed area's pages and queues it on 'dead' for free_released()
+static void release_locked(address_space* as, vm_area* vma, vm_area** dead)
+{
+	unmap_range(as, vma->start, vma->end);
+	vma->next = *dead;
+	*dead = vma;
+}
+
+/*
+ * Frees areas taken off a list, with as->vma_lock dropped: closing the last
+ * hold on a file writes its dirty pages back and may delete the node.
+ */
+static void free_released(vm_area* dead)
+{
+	while (dead)
+	{
+		vm_area* next = dead->next;
+		if (dead->file) vfs_close(dead->file);
+		kmem_cache_free(vma_cache, dead);
+		dead = next;
+	}
+}
+
+// Splits the area holding addr so that an area starts exactly at addr
+static bool split_locked(address_space* as, uintptr_t addr)
+{
+	vm_area* vma = find_locked(as, addr);
+	if (!vma || vma->start == addr) return true;
+
+	vm_area* tail = (vm_area*)kmem_cache_alloc(vma_cache);
+	if (!tail) return false;
+	*tail = *vma;
+	tail->start = addr;
+	if (tail->file)
+	{
+		tail->file_offset += addr - vma->start;
+		tail->file->open();
+	}
+	vma->end = addr;
+	vma->next = tail;
+	return true;
+}
+
+// Lowest 'align'-aligned gap of 'size' bytes in [lo, hi), or 0
+static uintptr_t find_gap_locked(address_space* as, size_t size, uintptr_t lo, uintptr_t hi,
+								 uintptr_t align = PAGE_SIZE)
+{
+	uintptr_t candidate = (lo + align - 1) & ~(align - 1);
+	for (vm_area* vma = as->vmas; vma; vma = vma->next)
+	{
+		if (vma->end <= candidate) continue;
+		if (vma->start >= candidate + size) break;
+		candidate = (vma->end + align - 1) & ~(align - 1);
+	}
+	return (candidate + size <= hi) ? candidate : 0;
+}
+
+// Called with as->vma_lock held; fails on overlap
+static vm_area* insert_locked(address_space* as, uintptr_t start, uintptr_t end, uint32_t flags, vma_kind kind)
+{
+	if (!vma_cache)
+	{
+		spin_lock(&vma_cache_lock);
+		if (!vma_cache) vma_cache = kmem_cache_create("vm_area", sizeof(vm_area));
+		spin_unlock(&vma_cache_lock);
+	}
+
+	vm_area* prev = nullptr;
+	vm_area* curr = as->vmas;
+	while (curr && curr->start < start)
+	{
+		prev = curr;
+		curr = curr->next;
+	}
+
+	// Empty areas (a fresh heap) may sit right at a neighbour's edge
+	bool overlaps = (prev && prev->end > start) || (curr && curr->start < end);
+	vm_area* vma = (!overlaps && vma_cache) ? (vm_area*)kmem_cache_alloc(vma_cache) : nullptr;
+	if (vma)
+	{
+		vma->start = start;
+		vma->end = end;
+		vma->flags = flags;
+		vma->kind = kind;
+		vma->file = nullptr;
+		vma->file_offset = 0;
+		vma->next = curr;
+		if (prev) prev->next = vma;
+		else as->vmas = vma;
+	}
+	return vma;
+}
+
+vm_area* vma_create(address_space* as, uintptr_t start, uintptr_t end, uint32_t flags, vma_kind kind)
+{
+	start &= ~(uintptr_t)(PAGE_SIZE - 1);
+	end = (end + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+	if (!as || end < start || end > USER_SPACE_END) return nullptr;
+
+	spin_lock_irqsave(&as->vma_lock);
+	vm_area* vma = insert_locked(as, start, end, flags, kind);
+	spin_unlock_irqrestore(&as->vma_lock);
+	return vma;
+}
+
+vm_area* vma_find(address_space* as, uintptr_t addr)
+{
+	if (!as) return nullptr;
+	spin_lock_irqsave(&as->vma_lock);
+	vm_area* vma = find_locked(as, addr);
+	spin_unlock_irqrestore(&as->vma_lock);
+	return vma;
+}
+
+vm_area* vma_find_kind(address_space* as, vma_kind kind)
+{
+	if (!as) return nullptr;
+	spin_lock_irqsave(&as->vma_lock);
+	vm_area* vma = as->vmas;
+	while (vma && vma->kind != kind) vma = vma->next;
+	spin_unlock_irqrestore(&as->vma_lock);
+	return vma;
+}
+
+// Moves the end of an area; pages that fall outside are released at once
+bool vma_resize(address_space* as, vm_area* vma, uintptr_t new_end)
+{
+	new_end = (new_end + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+	if (!as || !vma || new_end < vma->start || new_end > USER_SPACE_END) return false;
+
+	spin_lock_irqsave(&as->vma_lock);
+	if (vma->next && new_end > vma->next->start)
+	{
+		spin_unlock_irqrestore(&as->vma_lock);
+		return false;
+	}
+
+	uintptr_t old_end = vma->end;
+	vma->end = new_end;
+	if (new_end < old_end) unmap_range(as, new_end, old_end);
+	spin_unlock_irqrestore(&as->vma_lock);
+	return true;
+}
+
+// Gives 'dst' the same areas as 'src' (fork); the pages are shared separately
+bool vma_copy(address_space* dst, address_space* src)
+{
+	if (!dst || !src) return false;
+
+	spin_lock_irqsave(&src->vma_lock);
+	vm_area** tail = &dst->vmas;
+	bool ok = true;
+	for (vm_area* vma = src->vmas; vma; vma = vma->next)
+	{
+		vm_area* copy = (vm_area*)kmem_cache_alloc(vma_cache);
+		if (!copy)
+		{
+			ok = false;
+			break;
+		}
+		*copy = *vma;
+		copy->next = nullptr;
+		if (copy->file) copy->file->open();
+		*tail = copy;
+		tail = &copy->next;
+	}
+	spin_unlock_irqrestore(&src->vma_lock);
+	return ok;
+}
+
+/*
+ * Backend of mmap: places a page-rounded area at addr (replacing whatever
+ * was there when fixed), at the hint if it is free, or in the lowest gap
+ * of the mmap window. Pages fault in later, from 'file' when it is set.
+ */
+uintptr_t vma_map(address_space* as, uintptr_t addr, size_t length, uint32_t flags, bool fixed,
+				  VFSNode* file, uint64_t offset)
+{
+	size_t size = (length + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+	if (!as || size == 0 || size > USER_SPACE_END || (addr & (PAGE_SIZE - 1))) return 0;
+	if (fixed && (addr < PAGE_SIZE || addr > USER_SPACE_END - size)) return 0;
+
+	vm_area* dead = nullptr;
+	spin_lock_irqsave(&as->vma_lock);
+	if (fixed)
+	{
+		// MAP_FIXED silently replaces any overlapping mapping
+		if (!split_locked(as, addr) || !split_locked(as, addr + size))
+		{
+			spin_unlock_irqrestore(&as->vma_lock);
+			return 0;
+		}
+		vm_area** link = &as->vmas;
+		while (*link)
+		{
+			vm_area* vma = *link;
+			if (vma->start >= addr && vma->end <= addr + size)
+			{
+				*link = vma->next;
+				release_locked(as, vma, &dead);
+			}
+			else link = &vma->next;
+		}
+	}
+	else
+	{
+		bool hint_free = addr >= PAGE_SIZE && addr <= USER_SPACE_END - size &&
+						 find_gap_locked(as, size, addr, addr + size) == addr;
+		// Large anonymous areas start on a 2 MiB boundary so they can fault in huge pages
+		uintptr_t align = (!file && size >= PAGE_SIZE_2M) ? PAGE_SIZE_2M : PAGE_SIZE;
+		if (!hint_free) addr = find_gap_locked(as, size, USER_MMAP_BASE, USER_MMAP_END, align);
+	}
+
+	vm_area* vma = addr ? insert_locked(as, addr, addr + size, flags, VMA_MMAP) : nullptr;
+	if (vma && file)
+	{
+		file->open();
+		vma->file = file;
+		vma->file_offset = offset;
+	}
+	spin_unlock_irqrestore(&as->vma_lock);
+	free_released(dead);
+	return vma ? addr : 0;
+}
+
+// Removes every area inside [start, end), splitting the ones that straddle it
+bool vma_unmap(address_space* as, uintptr_t start, uintptr_t end)
+{
+	start &= ~(uintptr_t)(PAGE_SIZE - 1);
+	end = (end + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+	if (!as || end <= start || end > USER_SPACE_END) return false;
+
+	vm_area* dead = nullptr;
+	spin_lock_irqsave(&as->vma_lock);
+	bool ok = split_locked(as, start) && split_locked(as, end);
+	if (ok)
+	{
+		vm_area** link = &as->vmas;
+		while (*link)
+		{
+			vm_area* vma = *link;
+			if (vma->start >= start && vma->end <= end)
+			{
+				*link = vma->next;
+				release_locked(as, vma, &dead);
+			}
+			else link = &vma->next;
+		}
+	}
+	spin_unlock_irqrestore(&as->vma_lock);
+	free_released(dead);
+	return ok;
+}
+
+/*
+ * Changes the access rights of [start, end), which must be fully covered by
+ * areas. Pages already mapped are updated in place.
+ */
+bool vma_protect(address_space* as, uintptr_t start, uintptr_t end, uint32_t flags)
+{
+	start &= ~(uintptr_t)(PAGE_SIZE - 1);
+	end = (end + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+	if (!as || end <= start || end > USER_SPACE_END) return false;
+
+	spin_lock_irqsave(&as->vma_lock);
+	uintptr_t covered = start;
+	for (vm_area* vma = find_locked(as, start); vma && vma->start <= covered && covered < end; vma = vma->next)
+	{
+		// Guard pages and shared file pages cannot be opened up
+		if (vma->kind == VMA_GUARD || ((vma->flags & VMA_SHARED) && (flags & VMA_WRITE))) break;
+		covered = vma->end;
+	}
+
+	bool ok = covered >= end && split_locked(as, start) && split_locked(as, end);
+	if (ok)
+	{
+		for (vm_area* vma = find_locked(as, start); vma && vma->start < end; vma = vma->next)
+			vma->flags = (vma->flags & VMA_SHARED) | (flags & ~(uint32_t)VMA_SHARED);
+
+		paging_protect_range(as, start, end, flags & VMA_READ, flags & VMA_WRITE);
+	}
+	spin_unlock_irqrestore(&as->vma_lock);
+	return ok;
+}
+
+// Forgets the areas only; the frames go away with the page tables
+void vma_destroy_all(address_space* as)
+{
+	if (!as) return;
+
+	spin_lock_irqsave(&as->vma_lock);
+	vm_area* dead = as->vmas;
+	as->vmas = nullptr;
+	spin_unlock_irqrestore(&as->vma_lock);
+	free_released(dead);
+}
+
+/*
+ * Backs the page holding addr with a zeroed frame (or a whole huge page),
+ * or one filled from the area's file, if the area allows the access; or
+ * breaks copy-on-write sharing for a write. Returns false when the address
+ * is outside every area, inside a guard area, or the area forbids writing:
+ * the fault is a real violation. It also returns false,
+ * setting *out_of_memory, when no frame could be had for a legal access.
+ */
+bool vma_handle_fault(address_space* as, uintptr_t addr, bool write, bool* out_of_memory)
+{
+	if (!as || addr >= USER_SPACE_END) return false;
+
+	spin_lock_irqsave(&as->vma_lock);
+	vm_area* vma = find_locked(as, addr);
+	if (!vma || !(vma->flags & VMA_READ) || (write && !(vma->flags & VMA_WRITE)))
+	{
+		spin_unlock_irqrestore(&as->vma_lock);
+		return false;
+	}
+
+	// A present page can only fault here on a write to a copy-on-write share
+	void* page = (void*)(addr & ~(uintptr_t)(PAGE_SIZE - 1));
+	bool resolved = paging_get_physical_address(as, page) != nullptr;
+	if (resolved)
+	{
+		if (write) resolved = paging_handle_cow(as, page, out_of_memory);
+		spin_unlock_irqrestore(&as->vma_lock);
+		return resolved;
+	}
+
+	void* frame = nullptr;
+	bool cache_frame = false;
+	if (vma->file)
+	{
+		// The file is read with the lock dropped; hold it so munmap cannot close it
+		VFSNode* file = vma->file;
+		uint64_t offset = vma->file_offset + ((uintptr_t)page - vma->start);
+		file->open();
+		spin_unlock_irqrestore(&as->vma_lock);
+
+		// A read maps the page cache's own frame; only a write makes a private copy
+		void* cached = page_cache_get_frame(file, (uint32_t)(offset / PAGE_SIZE));
+		if (cached && !write)
+		{
+			frame = cached;
+			cache_frame = true;
+		}
+		else
+		{
+			frame = pfa_alloc_frame(cached ? PFA_NO_ZERO : 0);
+			if (frame && cached) memcpy(phys_to_virt((uintptr_t)frame), phys_to_virt((uintptr_t)cached), PAGE_SIZE);
+			else if (frame) vfs_read(file, (uint32_t)offset, PAGE_SIZE, (uint8_t*)phys_to_virt((uintptr_t)frame));
+			if (cached) pfa_put_frame(cached);
+		}
+		vfs_close(file);
+
+		// The area may have changed meanwhile: only map what is still wanted
+		spin_lock_irqsave(&as->vma_lock);
+		vma = find_locked(as, addr);
+		if (!vma || vma->file != file || paging_get_physical_address(as, page))
+		{
+			spin_unlock_irqrestore(&as->vma_lock);
+			if (frame) pfa_put_frame(frame);
+			return vma != nullptr;
+		}
+	}
+	else if (fault_huge_locked(as, vma, addr))
+	{
+		__atomic_add_fetch(&vma_faults, 1, __ATOMIC_RELAXED);
+		spin_unlock_irqrestore(&as->vma_lock);
+		return true;
+	}
+	else frame = pfa_alloc_frame();
+
+	if (frame)
+	{
+		// Writes through a private mapping never reach a frame the cache shares
+		uint64_t flags = PTE_PRESENT | PTE_USER;
+		if (vma->flags & VMA_WRITE) flags |= cache_frame ? (uint64_t)PTE_COW : (uint64_t)PTE_RW;
+		resolved = paging_map_page(as, page, frame, flags);
+		if (resolved) __atomic_add_fetch(&vma_faults, 1, __ATOMIC_RELAXED);
+		else pfa_put_frame(frame);
+	}
+	spin_unlock_irqrestore(&as->vma_lock);
+	if (!resolved && out_of_memory) *out_of_memory = true;
+	return resolved;
+}
+
+uint64_t vma_fault_count()
+{
+	return vma_faults;
+}
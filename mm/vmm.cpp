@@ -19,41 +19,399 @@
  */
 
 #include <kernel/arch/x86_64/paging.h>
+#include <kernel/arch/x86_64/thread.h>
 #include <kernel/constants.h>
+#include <mm/slab.h>
 #include <mm/vmm.h>
 
 uintptr_t VMM::kernel_dynamic_break = 0;
 static size_t vmm_allocated_bytes = 0;
 
-void* VMM::allocate(size_t pages, uint32_t flags)
+/*
+ * Range allocator for [KERNEL_VMALLOC_BASE, KERNEL_VMALLOC_END).
+ * Free and busy ranges live in two AVL trees keyed by start address. Each
+ * node also records the largest free range below it, so first-fit finds
+ * the lowest hole big enough in O(log n) however fragmented the region
+ * gets. Released ranges are merged with their free neighbours, so virtual
+ * space handed back by vfree/iounmap is reused.
+ */
+struct vm_range
 {
-	if (kernel_dynamic_break == 0) return nullptr;
+	uintptr_t start;
+	size_t size;				// Bytes, including the guard page if any
+	uint32_t flags;
+	int height;
+	size_t max_size;			// Largest 'size' in this subtree
+	struct vm_range* left;
+	struct vm_range* right;
+};
 
-	void* start_addr = (void*)kernel_dynamic_break;
+static vm_range* free_ranges = nullptr;
+static vm_range* busy_ranges = nullptr;
+static kmem_cache* vm_range_cache = nullptr;
+static spinlock_t vm_lock = {0, 0};
 
-	for (size_t i = 0; i < pages; i++)
+
+static inline int range_height(vm_range* node) { return node ? node->height : 0; }
+static inline size_t range_max(vm_range* node) { return node ? node->max_size : 0; }
+
+static void range_update(vm_range* node)
+{
+	int lh = range_height(node->left), rh = range_height(node->right);
+	node->height = 1 + (lh > rh ? lh : rh);
+
+	size_t max = node->size;
+	if (range_max(node->left) > max) max = range_max(node->left);
+	if (range_max(node->right) > max) max = range_max(node->right);
+	node->max_size = max;
+}
+
+static vm_range* range_rotate_right(vm_range* node)
+{
+	vm_range* top = node->left;
+	node->left = top->right;
+	top->right = node;
+	range_update(node);
+	range_update(top);
+	return top;
+}
+
+static vm_range* range_rotate_left(vm_range* node)
+{
+	vm_range* top = node->right;
+	node->right = top->left;
+	top->left = node;
+	range_update(node);
+	range_update(top);
+	return top;
+}
+
+// Restores the AVL invariant at 'node' after one of its subtrees changed
+static vm_range* range_balance(vm_range* node)
+{
+	range_update(node);
+	int balance = range_height(node->left) - range_height(node->right);
+	if (balance > 1)
 	{
-		void* phys_frame = pfa_alloc_frame();
-		if (!phys_frame) return nullptr;
-		paging_map_page((void*)(kernel_dynamic_break + (i * PAGE_SIZE)), phys_frame, (uint64_t)flags);
+		if (range_height(node->left->left) < range_height(node->left->right))
+			node->left = range_rotate_left(node->left);
+		return range_rotate_right(node);
 	}
-	kernel_dynamic_break += (pages * PAGE_SIZE);
-	return start_addr;
+	if (balance < -1)
+	{
+		if (range_height(node->right->right) < range_height(node->right->left))
+			node->right = range_rotate_right(node->right);
+		return range_rotate_left(node);
+	}
+	return node;
 }
 
-void VMM::free(void* virt_addr, size_t pages)
+static vm_range* range_insert(vm_range* root, vm_range* range)
+{
+	if (!root)
+	{
+		range->left = range->right = nullptr;
+		range_update(range);
+		return range;
+	}
+	if (range->start < root->start) root->left = range_insert(root->left, range);
+	else root->right = range_insert(root->right, range);
+	return range_balance(root);
+}
+
+static vm_range* range_remove_min(vm_range* root)
+{
+	if (!root->left) return root->right;
+	root->left = range_remove_min(root->left);
+	return range_balance(root);
+}
+
+// 'range' must be in the tree
+static vm_range* range_remove(vm_range* root, vm_range* range)
+{
+	if (range->start < root->start) root->left = range_remove(root->left, range);
+	else if (range->start > root->start) root->right = range_remove(root->right, range);
+	else
+	{
+		if (!root->left) return root->right;
+		if (!root->right) return root->left;
+
+		vm_range* successor = root->right;
+		while (successor->left) successor = successor->left;
+		successor->right = range_remove_min(root->right);
+		successor->left = root->left;
+		root = successor;
+	}
+	return range_balance(root);
+}
+
+static vm_range* range_find(vm_range* root, uintptr_t start)
+{
+	while (root && root->start != start) root = (start < root->start) ? root->left : root->right;
+	return root;
+}
+
+// Lowest-addressed range of at least 'bytes'
+static vm_range* range_first_fit(vm_range* root, size_t bytes)
+{
+	while (root)
+	{
+		if (range_max(root->left) >= bytes) root = root->left;
+		else if (root->size >= bytes) return root;
+		else if (range_max(root->right) >= bytes) root = root->right;
+		else return nullptr;
+	}
+	return nullptr;
+}
+
+// Nearest range starting below / above 'addr'
+static vm_range* range_below(vm_range* root, uintptr_t addr)
 {
-	uintptr_t addr = (uintptr_t)virt_addr;
+	vm_range* best = nullptr;
+	while (root)
+	{
+		if (root->start < addr)
+		{
+			best = root;
+			root = root->right;
+		}
+		else root = root->left;
+	}
+	return best;
+}
+
+static vm_range* range_above(vm_range* root, uintptr_t addr)
+{
+	vm_range* best = nullptr;
+	while (root)
+	{
+		if (root->start > addr)
+		{
+			best = root;
+			root = root->left;
+		}
+		else root = root->right;
+	}
+	return best;
+}
+
+// Called with vm_lock held
+static bool vm_init_locked()
+{
+	if (vm_range_cache) return true;
+
+	vm_range_cache = kmem_cache_create("vm_range", sizeof(vm_range));
+	if (!vm_range_cache) return false;
+
+	vm_range* all = (vm_range*)kmem_cache_alloc(vm_range_cache);
+	if (!all) return false;
 
+	all->start = KERNEL_VMALLOC_BASE;
+	all->size = KERNEL_VMALLOC_END - KERNEL_VMALLOC_BASE;
+	all->flags = 0;
+	free_ranges = range_insert(nullptr, all);
+	return true;
+}
+
+// Reserves a range for 'pages' mapped pages (plus a guard page if asked)
+static vm_range* vm_reserve(size_t pages, uint32_t vm_flags)
+{
+	size_t bytes = (pages + ((vm_flags & VM_GUARD) ? 1 : 0)) * PAGE_SIZE;
+	if (pages == 0) return nullptr;
+
+	spin_lock_irqsave(&vm_lock);
+	if (!vm_init_locked())
+	{
+		spin_unlock_irqrestore(&vm_lock);
+		return nullptr;
+	}
+
+	vm_range* hole = range_first_fit(free_ranges, bytes);
+	vm_range* range = nullptr;
+	if (hole && hole->size == bytes)
+	{
+		free_ranges = range_remove(free_ranges, hole);
+		range = hole;
+	}
+	else if (hole && (range = (vm_range*)kmem_cache_alloc(vm_range_cache)))
+	{
+		// The hole keeps its place in the order, but its size changes the subtree maxima
+		free_ranges = range_remove(free_ranges, hole);
+		range->start = hole->start;
+		range->size = bytes;
+		hole->start += bytes;
+		hole->size -= bytes;
+		free_ranges = range_insert(free_ranges, hole);
+	}
+
+	if (range)
+	{
+		range->flags = vm_flags;
+		busy_ranges = range_insert(busy_ranges, range);
+	}
+
+	spin_unlock_irqrestore(&vm_lock);
+	return range;
+}
+
+static vm_range* vm_take(uintptr_t start)
+{
+	spin_lock_irqsave(&vm_lock);
+
+	vm_range* range = range_find(busy_ranges, start);
+	if (range) busy_ranges = range_remove(busy_ranges, range);
+
+	spin_unlock_irqrestore(&vm_lock);
+	return range;
+}
+
+static void vm_release(vm_range* range)
+{
+	spin_lock_irqsave(&vm_lock);
+
+	vm_range* prev = range_below(free_ranges, range->start);
+	if (prev && prev->start + prev->size == range->start)
+	{
+		free_ranges = range_remove(free_ranges, prev);
+		range->start = prev->start;
+		range->size += prev->size;
+		kmem_cache_free(vm_range_cache, prev);
+	}
+
+	vm_range* next = range_above(free_ranges, range->start);
+	if (next && range->start + range->size == next->start)
+	{
+		free_ranges = range_remove(free_ranges, next);
+		range->size += next->size;
+		kmem_cache_free(vm_range_cache, next);
+	}
+
+	free_ranges = range_insert(free_ranges, range);
+	spin_unlock_irqrestore(&vm_lock);
+}
+
+static inline size_t vm_mapped_pages(vm_range* range)
+{
+	return range->size / PAGE_SIZE - ((range->flags & VM_GUARD) ? 1 : 0);
+}
+
+static void vm_unmap(uintptr_t start, size_t pages, bool free_frames)
+{
 	for (size_t i = 0; i < pages; i++)
 	{
-		uintptr_t current_virt = addr + (i * PAGE_SIZE);
-		void* phys_frame = paging_get_physical_address((void*)current_virt);
-		if (phys_frame) pfa_free_frame(phys_frame);
-		paging_unmap_page((void*)current_virt);
+		void* virt = (void*)(start + (i * PAGE_SIZE));
+		void* phys_frame = paging_get_physical_address(paging_kernel_space(), virt);
+		if (phys_frame && free_frames) pfa_free_frame(phys_frame);
+		paging_unmap_page(paging_kernel_space(), virt);
 	}
 }
 
+// Backs [start, start + pages) with the largest physically contiguous runs the
+// buddy allocator can hand out, falling back to smaller blocks when fragmented.
+static bool vm_map_frames(uintptr_t start, size_t pages, uint64_t flags)
+{
+	size_t mapped = 0;
+
+	while (mapped < pages)
+	{
+		uint32_t order = 0;
+		while (order < PFA_MAX_ORDER && (2ULL << order) <= pages - mapped) order++;
+
+		void* phys_block = nullptr;
+		while (!(phys_block = pfa_alloc_frames(order)) && order > 0) order--;
+		if (!phys_block)
+		{
+			vm_unmap(start, mapped, true);
+			return false;
+		}
+
+		for (size_t i = 0; i < (1ULL << order); i++)
+			paging_map_page(paging_kernel_space(), (void*)(start + ((mapped + i) * PAGE_SIZE)),
+							(void*)((uintptr_t)phys_block + (i * PAGE_SIZE)), flags);
+		mapped += (1ULL << order);
+	}
+	return true;
+}
+
+static void* vm_alloc(size_t pages, uint64_t flags, uint32_t vm_flags)
+{
+	vm_range* range = vm_reserve(pages, vm_flags & ~VM_IOREMAP);
+	if (!range) return nullptr;
+
+	if (!vm_map_frames(range->start, pages, flags))
+	{
+		vm_take(range->start);
+		vm_release(range);
+		return nullptr;
+	}
+
+	__sync_fetch_and_add(&vmm_allocated_bytes, pages * PAGE_SIZE);
+	return (void*)range->start;
+}
+
+static void* vm_map_phys(uintptr_t phys_addr, size_t pages, uint64_t flags, uint32_t vm_flags)
+{
+	vm_range* range = vm_reserve(pages, vm_flags | VM_IOREMAP);
+	if (!range) return nullptr;
+
+	for (size_t i = 0; i < pages; i++)
+		paging_map_page(paging_kernel_space(), (void*)(range->start + (i * PAGE_SIZE)), (void*)(phys_addr + (i * PAGE_SIZE)), flags);
+	return (void*)range->start;
+}
+
+static bool vm_free(uintptr_t start)
+{
+	vm_range* range = vm_take(start);
+	if (!range) return false;
+
+	size_t pages = vm_mapped_pages(range);
+	bool owns_frames = !(range->flags & VM_IOREMAP);
+	vm_unmap(range->start, pages, owns_frames);
+	if (owns_frames) __sync_fetch_and_sub(&vmm_allocated_bytes, pages * PAGE_SIZE);
+
+	vm_release(range);
+	return true;
+}
+
+
+void* vmalloc(size_t size, uint32_t vm_flags)
+{
+	return vm_alloc((size + PAGE_SIZE - 1) / PAGE_SIZE, PTE_PRESENT | PTE_RW, vm_flags);
+}
+
+void vfree(void* addr)
+{
+	if (addr) vm_free((uintptr_t)addr);
+}
+
+// Uncached mapping of a device region; the result keeps phys_addr's page offset
+void* ioremap(uintptr_t phys_addr, size_t size, uint32_t vm_flags)
+{
+	uintptr_t offset = phys_addr & (PAGE_SIZE - 1);
+	size_t pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	uint8_t* base = (uint8_t*)vm_map_phys(phys_addr - offset, pages, PTE_PRESENT | PTE_RW | PTE_PCD | PTE_PWT, vm_flags);
+	return base ? base + offset : nullptr;
+}
+
+void iounmap(void* addr)
+{
+	if (addr) vm_free((uintptr_t)addr & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+
+void* VMM::allocate(size_t pages, uint32_t flags)
+{
+	if (kernel_dynamic_break == 0) return nullptr;
+	return vm_alloc(pages, flags, 0);
+}
+
+void VMM::free(void* virt_addr, size_t pages)
+{
+	if (vm_free((uintptr_t)virt_addr)) return;
+	vm_unmap((uintptr_t)virt_addr, pages, true);
+}
+
 void* VMM::sbrk(size_t increment_bytes)
 {
 	if (kernel_dynamic_break == 0) return (void*)-1;
@@ -62,16 +420,23 @@ void* VMM::sbrk(size_t increment_bytes)
 	if (increment_bytes == 0) return (void*)old_break;
 
 	size_t pages_needed = (increment_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
-	vmm_allocated_bytes += (pages_needed * PAGE_SIZE);
+	if (old_break + pages_needed * PAGE_SIZE > KERNEL_DYNAMIC_BASE + KERNEL_HEAP_AREA_SIZE) return (void*)-1;
 
 	for (size_t i = 0; i < pages_needed; i++)
 	{
+		void* virt = (void*)(old_break + (i * PAGE_SIZE));
 		void* phys_frame = pfa_alloc_frame();
-		if (!phys_frame) return (void*)-1;
-
-		paging_map_page((void*)kernel_dynamic_break, phys_frame, (uint64_t)(PTE_PRESENT | PTE_RW));
-		kernel_dynamic_break += PAGE_SIZE;
+		if (!phys_frame || !paging_map_page(paging_kernel_space(), virt, phys_frame, (uint64_t)(PTE_PRESENT | PTE_RW)))
+		{
+			// The heap treats a failure as nothing having changed
+			if (phys_frame) pfa_free_frame(phys_frame);
+			vm_unmap(old_break, i, true);
+			return (void*)-1;
+		}
 	}
+
+	kernel_dynamic_break = old_break + (pages_needed * PAGE_SIZE);
+	__sync_fetch_and_add(&vmm_allocated_bytes, pages_needed * PAGE_SIZE);
 	return (void*)old_break;
 }
 
@@ -82,13 +447,6 @@ size_t VMM::get_total_allocated()
 
 void* VMM::map_physical_region(uintptr_t phys_addr, size_t pages, uint32_t flags)
 {
-    void* start_addr = (void*)kernel_dynamic_break;
-
-    for (size_t i = 0; i < pages; i++)
-    {
-        paging_map_page((void*)(kernel_dynamic_break), (void*)(phys_addr + (i * PAGE_SIZE)), (uint64_t)flags);
-        kernel_dynamic_break += PAGE_SIZE;
-    }
-
-    return start_addr;
-}
\ No newline at end of file
+	if (kernel_dynamic_break == 0) return nullptr;
+	return vm_map_phys(phys_addr, pages, flags, 0);
+}
@@ -25,11 +25,15 @@ extern exit
 
 section .note.kex
     dd 7                ; namesz
-    dd 4                ; descsz
+    dd 20               ; descsz (struct KexHeader)
     dd 0x1001           ; type (NT_KEX_VERSION)
     db "KeonOS", 0      ; name (padded to 8 bytes, but 7+1=8)
     db 0                ; padding
-    db "KEX1"           ; desc
+    db "KEX1"           ; desc: verify
+    dd 0                ; flags
+    dd 0                ; stack_size (0 = default 1MB)
+    dd 0                ; heap_size
+    dd 0                ; capabilities
 
 section .text
 _start:
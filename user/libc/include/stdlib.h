@@ -25,6 +25,8 @@
 
 void exit(int status);
 void* malloc(size_t size);
+void* calloc(size_t count, size_t size);
+void* realloc(void* ptr, size_t size);
 void free(void* ptr);
 
 char* itoa(unsigned long long value, char* str, int base);
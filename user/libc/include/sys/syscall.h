@@ -10,10 +10,17 @@
 #define SYS_UNLINK  6
 #define SYS_READDIR 7
 #define SYS_SBRK    12
+#define SYS_MMAP    13
+#define SYS_MUNMAP  14
+#define SYS_MPROTECT 15
+#define SYS_MEMINFO 16
 #define SYS_KILL    37
+#define SYS_FORK    57
 #define SYS_EXIT    60
 #define SYS_VGA     100
+#define SYS_SETPRIORITY 141
 #define SYS_REBOOT  161
 #define SYS_PS      200
+#define SYS_SETAFFINITY 203
 
 #endif
@@ -13,5 +13,11 @@ int open(const char* pathname, int flags);
 int close(int fd);
 int mkdir(const char* pathname, uint32_t mode);
 int unlink(const char* pathname);
+void* sbrk(long increment);
+int fork(void);
+unsigned int sleep(unsigned int seconds);
+int setpriority(int pid, int priority);
+int setaffinity(int pid, unsigned int mask);
+int kill(int pid, int sig);
 
 #endif
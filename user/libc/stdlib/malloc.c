@@ -1,4 +1,6 @@
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/syscall.h>
 
 extern long syscall1(long n, long a1);
@@ -7,14 +9,273 @@ void* sbrk(long increment) {
     return (void*)syscall1(SYS_SBRK, increment);
 }
 
+/*
+ * Heap allocator on top of sbrk.
+ *
+ * Every block starts with a 16-byte header holding its size and two flags:
+ * USED, and PREV_USED for the block just below it. A free block's size is
+ * also stored in the next block's prev_size, so frees can merge with both
+ * neighbours. The highest free block is the "top" chunk, which grows by at
+ * least SBRK_CHUNK per sbrk and is given back once it gets large.
+ *
+ * Blocks of up to SMALL_MAX bytes are recycled through exact size-class
+ * lists and never merged: they keep USED set while listed, so freeing and
+ * reusing them is a list push and pop. Larger free blocks are merged and
+ * kept in power-of-two bins searched first fit.
+ */
+
+#define ALIGN           16
+#define HDR             16
+#define MIN_BLOCK       32
+#define SMALL_MAX       528
+#define SMALL_CLASSES   ((SMALL_MAX - MIN_BLOCK) / ALIGN + 1)
+#define LARGE_BINS      16
+#define SBRK_CHUNK      (64 * 1024)
+#define TRIM_THRESHOLD  (256 * 1024)
+
+#define USED        1UL
+#define PREV_USED   2UL
+#define FLAGS       (USED | PREV_USED)
+
+struct block {
+    size_t prev_size;       /* valid only while the block below is free */
+    size_t size;            /* whole block including the header, plus flags */
+    struct block* next;     /* free list links, inside the payload */
+    struct block* prev;
+};
+
+static struct block* small_free[SMALL_CLASSES];
+static struct block* large_free[LARGE_BINS];
+static struct block* top;
+static char* arena_end;
+
+static inline size_t block_size(struct block* b) {
+    return b->size & ~FLAGS;
+}
+
+static inline struct block* block_at(void* base, long offset) {
+    return (struct block*)((char*)base + offset);
+}
+
+static inline struct block* next_block(struct block* b) {
+    return block_at(b, block_size(b));
+}
+
+static inline void* payload(struct block* b) {
+    return (char*)b + HDR;
+}
+
+static int large_bin(size_t size) {
+    int bin = 0;
+    for (size >>= 10; size && bin < LARGE_BINS - 1; size >>= 1) bin++;
+    return bin;
+}
+
+static void insert_free(struct block* b) {
+    struct block** head = &large_free[large_bin(block_size(b))];
+    b->prev = NULL;
+    b->next = *head;
+    if (*head) (*head)->prev = b;
+    *head = b;
+}
+
+static void remove_free(struct block* b) {
+    if (b->prev) b->prev->next = b->next;
+    else large_free[large_bin(block_size(b))] = b->next;
+    if (b->next) b->next->prev = b->prev;
+}
+
+/* Hands everything above a trim threshold back, if nobody moved the break since */
+static void trim_top(void) {
+    size_t size = block_size(top);
+    if (size <= TRIM_THRESHOLD || (char*)sbrk(0) != arena_end) return;
+
+    size_t release = (size - SBRK_CHUNK) & ~(size_t)4095;
+    if ((long)sbrk(-(long)release) == -1) return;
+    top->size -= release;
+    arena_end -= release;
+}
+
+/* Frees a block that is not in any list, merging it with free neighbours */
+static void release(struct block* b) {
+    size_t size = block_size(b);
+    if (!(b->size & PREV_USED)) {
+        struct block* prev = block_at(b, -(long)b->prev_size);
+        remove_free(prev);
+        size += block_size(prev);
+        b = prev;
+    }
+
+    struct block* next = block_at(b, size);
+    if (next == top) {
+        b->size = (size + block_size(top)) | (b->size & PREV_USED);
+        top = b;
+        trim_top();
+        return;
+    }
+    if (!(next->size & USED)) {
+        remove_free(next);
+        size += block_size(next);
+        next = block_at(b, size);
+    }
+
+    b->size = size | (b->size & PREV_USED);
+    next->prev_size = size;
+    next->size &= ~PREV_USED;
+    insert_free(b);
+}
+
+/* Shrinks a used block to 'need' bytes, freeing the tail if it can hold a block */
+static void carve(struct block* b, size_t need) {
+    size_t size = block_size(b);
+    if (size - need < MIN_BLOCK) return;
+
+    b->size = need | (b->size & FLAGS);
+    struct block* rest = block_at(b, need);
+    rest->size = (size - need) | PREV_USED;
+    release(rest);
+}
+
+/*
+ * Fences off a top chunk that can no longer grow in place (someone else
+ * moved the break) and keeps what is left of it as an ordinary free block.
+ */
+static void retire_top(void) {
+    size_t size = block_size(top);
+    if (size < MIN_BLOCK + HDR) {
+        top->size |= USED;
+        return;
+    }
+
+    struct block* fence = block_at(top, size - HDR);
+    fence->prev_size = size - HDR;
+    fence->size = HDR | USED;
+    top->size = (size - HDR) | (top->size & PREV_USED);
+    insert_free(top);
+}
+
+static int grow(size_t min) {
+    size_t len = (min + ALIGN + SBRK_CHUNK - 1) & ~(size_t)(SBRK_CHUNK - 1);
+    char* p = (char*)sbrk((long)len);
+    if (p == (char*)-1) return 0;
+
+    if (top && p == arena_end) {
+        top->size += len;
+        arena_end += len;
+        return 1;
+    }
+
+    if (top) retire_top();
+    char* start = (char*)(((uintptr_t)p + ALIGN - 1) & ~(uintptr_t)(ALIGN - 1));
+    arena_end = (char*)((uintptr_t)(p + len) & ~(uintptr_t)(ALIGN - 1));
+    top = (struct block*)start;
+    top->size = (size_t)(arena_end - start) | PREV_USED;
+    return 1;
+}
+
+/* Splits 'need' bytes off the bottom of the top chunk, which keeps at least a header */
+static struct block* take_top(size_t need) {
+    if ((!top || block_size(top) < need + MIN_BLOCK) && !grow(need + MIN_BLOCK)) return NULL;
+
+    struct block* b = top;
+    size_t rest = block_size(top) - need;
+    top = block_at(b, need);
+    top->size = rest | PREV_USED;
+    b->size = need | USED | (b->size & PREV_USED);
+    return b;
+}
+
+static struct block* take_free(size_t need) {
+    for (int bin = large_bin(need); bin < LARGE_BINS; bin++) {
+        for (struct block* b = large_free[bin]; b; b = b->next) {
+            if (block_size(b) < need) continue;
+
+            remove_free(b);
+            b->size |= USED;
+            next_block(b)->size |= PREV_USED;
+            carve(b, need);
+            return b;
+        }
+    }
+    return NULL;
+}
+
+static size_t block_for(size_t size) {
+    size_t need = (size + HDR + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+    return need < MIN_BLOCK ? MIN_BLOCK : need;
+}
+
 void* malloc(size_t size) {
-    if (size == 0) return NULL;
-    // Simple bump allocator: just get memory from kernel
-    void* ptr = sbrk(size);
-    if ((long)ptr == -1) return NULL;
-    return ptr;
+    if (size == 0 || size > ((size_t)-1 >> 2)) return NULL;
+    size_t need = block_for(size);
+
+    struct block* b = NULL;
+    if (need <= SMALL_MAX) {
+        struct block** list = &small_free[(need - MIN_BLOCK) / ALIGN];
+        b = *list;
+        if (b) *list = b->next;
+    }
+    if (!b) b = take_free(need);
+    if (!b) b = take_top(need);
+    return b ? payload(b) : NULL;
 }
 
 void free(void* ptr) {
-    (void)ptr; // No-op for now
+    if (!ptr) return;
+    struct block* b = block_at(ptr, -HDR);
+    size_t size = block_size(b);
+
+    if (size <= SMALL_MAX) {
+        struct block** list = &small_free[(size - MIN_BLOCK) / ALIGN];
+        b->next = *list;
+        *list = b;
+        return;
+    }
+    release(b);
+}
+
+void* calloc(size_t count, size_t size) {
+    if (size && count > ((size_t)-1 >> 2) / size) return NULL;
+    void* ptr = malloc(count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (!ptr) return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (size > ((size_t)-1 >> 2)) return NULL;
+
+    struct block* b = block_at(ptr, -HDR);
+    size_t have = block_size(b);
+    size_t need = block_for(size);
+    if (need <= have) return ptr;
+
+    /* Large blocks grow in place when the space above them is free */
+    if (have > SMALL_MAX) {
+        struct block* next = next_block(b);
+        if (next == top && block_size(top) >= need - have + MIN_BLOCK) {
+            size_t rest = block_size(top) - (need - have);
+            top = block_at(b, need);
+            top->size = rest | PREV_USED;
+            b->size = need | (b->size & FLAGS);
+            return ptr;
+        }
+        if (next != top && !(next->size & USED) && have + block_size(next) >= need) {
+            remove_free(next);
+            b->size = (have + block_size(next)) | (b->size & FLAGS);
+            next_block(b)->size |= PREV_USED;
+            carve(b, need);
+            return ptr;
+        }
+    }
+
+    void* fresh = malloc(size);
+    if (!fresh) return NULL;
+    memcpy(fresh, ptr, have - HDR);
+    free(ptr);
+    return fresh;
 }
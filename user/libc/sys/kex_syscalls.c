@@ -19,6 +19,7 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -33,6 +34,10 @@ extern int64_t syscall2(uint64_t num, uint64_t a1, uint64_t a2);
 #define SYS_GETPID  10
 #define SYS_SLEEP   11
 #define SYS_LOAD_LIBRARY 20
+#define SYS_KILL    37
+#define SYS_FORK    57
+#define SYS_SETPRIORITY 141
+#define SYS_SETAFFINITY 203
 
 int stat(const char *path, struct stat *buf) {
     return (int)syscall2(SYS_STAT, (uint64_t)path, (uint64_t)buf);
@@ -56,6 +61,29 @@ void msleep(unsigned int ms) {
     syscall1(SYS_SLEEP, (uint64_t)ms);
 }
 
+// Custom KeonOS extension: 0 is the highest of the 32 priorities, 16 the default.
+// A process may only lower its own priority (16 to 31); anything else is -EPERM.
+int setpriority(int pid, int priority) {
+    return (int)syscall2(SYS_SETPRIORITY, (uint64_t)pid, (uint64_t)priority);
+}
+
+// Custom KeonOS extension: bit n of the mask allows CPU n; only the caller's own mask
+int setaffinity(int pid, unsigned int mask) {
+    return (int)syscall2(SYS_SETAFFINITY, (uint64_t)pid, (uint64_t)mask);
+}
+
+// KeonOS has no signals: any 'sig' terminates the process. Fails once it is gone.
+int kill(int pid, int sig) {
+    (void)sig;
+    char id[64];            // The kernel copies 64 bytes of the id string
+    itoa((unsigned long long)pid, id, 10);
+    return (int)syscall1(SYS_KILL, (uint64_t)id);
+}
+
+int fork() {
+    return (int)syscall0(SYS_FORK);
+}
+
 void* load_library(const char* path) {
     return (void*)syscall1(SYS_LOAD_LIBRARY, (uint64_t)path);
 }
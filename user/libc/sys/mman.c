@@ -0,0 +1,45 @@
+/*
+ * keonOS - user/libc/sys/mman.c
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+extern int64_t syscall1(uint64_t num, uint64_t a1);
+extern int64_t syscall2(uint64_t num, uint64_t a1, uint64_t a2);
+extern int64_t syscall3(uint64_t num, uint64_t a1, uint64_t a2, uint64_t a3);
+extern int64_t syscall6(uint64_t num, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
+
+void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    int64_t ret = syscall6(SYS_MMAP, (uint64_t)addr, length, (uint64_t)prot, (uint64_t)flags, (uint64_t)fd, (uint64_t)offset);
+    return (ret < 0) ? MAP_FAILED : (void*)ret;
+}
+
+int munmap(void* addr, size_t length) {
+    return (int)syscall2(SYS_MUNMAP, (uint64_t)addr, length);
+}
+
+int mprotect(void* addr, size_t length, int prot) {
+    return (int)syscall3(SYS_MPROTECT, (uint64_t)addr, length, (uint64_t)prot);
+}
+
+int meminfo(struct meminfo* info) {
+    return (int)syscall1(SYS_MEMINFO, (uint64_t)info);
+}
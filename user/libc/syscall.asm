@@ -6,6 +6,7 @@ global syscall2
 global syscall3
 global syscall4
 global syscall5
+global syscall6
 
 section .text
 
@@ -59,3 +60,15 @@ syscall5:
     mov r8, r9
     syscall
     ret
+
+; syscall6(num, arg1, arg2, arg3, arg4, arg5, arg6)
+syscall6:
+    mov rax, rdi
+    mov rdi, rsi
+    mov rsi, rdx
+    mov rdx, rcx
+    mov r10, r8
+    mov r8, r9
+    mov r9, [rsp + 8]
+    syscall
+    ret
@@ -0,0 +1,81 @@
+/*
+ * keonOS - user/tests/test_fork.c
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int shared_global = 42;
+
+int main(int argc, char** argv) {
+    printf("=== TEST_FORK: Copy-on-write fork Test ===\n");
+
+    char* heap = (char*)malloc(8192);
+    if (!heap) {
+        printf("FAIL: malloc failed\n");
+        return 1;
+    }
+    heap[0] = 'P';
+    heap[8191] = 'P';
+    volatile int on_stack = 7;
+
+    int pid = fork();
+    if (pid < 0) {
+        printf("FAIL: fork() returned %d\n", pid);
+        return 1;
+    }
+
+    if (pid == 0) {
+        // The child starts with the parent's values, then diverges
+        if (shared_global == 42 && heap[0] == 'P' && heap[8191] == 'P' && on_stack == 7)
+            printf("PASS: child sees the parent's memory.\n");
+        else
+            printf("FAIL: child memory differs before writing.\n");
+
+        shared_global = 1;
+        heap[0] = 'C';
+        heap[8191] = 'C';
+        on_stack = 1;
+
+        if (shared_global == 1 && heap[0] == 'C' && heap[8191] == 'C' && on_stack == 1)
+            printf("PASS: child writes landed in its own copy.\n");
+        else
+            printf("FAIL: child writes were lost.\n");
+        exit(0);
+    }
+
+    printf("Forked child %d, waiting for it to write...\n", pid);
+    sleep(1);
+
+    if (shared_global == 42 && heap[0] == 'P' && heap[8191] == 'P' && on_stack == 7)
+        printf("PASS: parent memory untouched by the child.\n");
+    else
+        printf("FAIL: child writes leaked into the parent.\n");
+
+    heap[0] = 'Q';
+    if (heap[0] == 'Q') printf("PASS: parent can still write its pages.\n");
+    else printf("FAIL: parent write lost.\n");
+
+    free(heap);
+    printf("=== TEST_FORK Completed ===\n");
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * keonOS - user/tests/test_malloc.c
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ROUNDS 100000
+#define LIVE 256
+
+static inline unsigned long rdtsc(void) {
+    unsigned int lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long)hi << 32) | lo;
+}
+
+static unsigned int seed = 12345;
+static unsigned int next_rand(void) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+int main(int argc, char** argv) {
+    printf("=== TEST_MALLOC: Allocator Test ===\n");
+
+    // 1. Freed small blocks are reused by the next request of their size class
+    char* a = (char*)malloc(40);
+    free(a);
+    char* b = (char*)malloc(40);
+    if (a == b) printf("PASS: small block reused after free.\n");
+    else printf("FAIL: small block not reused (%p, %p)\n", a, b);
+    if (((unsigned long)b & 15) == 0) printf("PASS: blocks are 16-byte aligned.\n");
+    else printf("FAIL: misaligned block %p\n", b);
+    free(b);
+
+    // 2. Neighbouring large blocks merge when freed
+    char* x = (char*)malloc(8000);
+    char* y = (char*)malloc(8000);
+    char* guard = (char*)malloc(8000);
+    free(x);
+    free(y);
+    char* z = (char*)malloc(15000);
+    if (z == x) printf("PASS: adjacent free blocks coalesced.\n");
+    else printf("FAIL: coalesced block not reused (%p, %p)\n", x, z);
+    free(z);
+    free(guard);
+
+    // 3. calloc zeroes, realloc keeps the contents
+    int* zeros = (int*)calloc(1000, sizeof(int));
+    int zeroed = zeros != NULL;
+    for (int i = 0; zeroed && i < 1000; i++) if (zeros[i]) zeroed = 0;
+    if (zeroed) printf("PASS: calloc memory is zeroed.\n");
+    else printf("FAIL: calloc memory not zeroed.\n");
+
+    for (int i = 0; i < 1000; i++) zeros[i] = i;
+    int* grown = (int*)realloc(zeros, 50000 * sizeof(int));
+    int kept = grown != NULL;
+    for (int i = 0; kept && i < 1000; i++) if (grown[i] != i) kept = 0;
+    if (kept) printf("PASS: realloc preserved the contents.\n");
+    else printf("FAIL: realloc lost the contents.\n");
+    free(grown);
+
+    // 4. A malloc/free loop must not grow the heap (klbtool's pattern)
+    char* brk_before = (char*)sbrk(0);
+    for (int i = 0; i < 10000; i++) {
+        char* tmp = (char*)malloc(1000 + (i % 5000));
+        tmp[0] = 1;
+        free(tmp);
+    }
+    long growth = (char*)sbrk(0) - brk_before;
+    if (growth <= 64 * 1024) printf("PASS: heap grew %ld bytes over 10000 malloc/free pairs.\n", growth);
+    else printf("FAIL: heap grew %ld bytes over 10000 malloc/free pairs.\n", growth);
+
+    // 5. Microbenchmark: the old allocator issued one sbrk per malloc
+    printf("\n--- Malloc Benchmark (%d operations) ---\n", ROUNDS);
+    char* base = (char*)sbrk(0);
+    unsigned long start = rdtsc();
+    for (int i = 0; i < ROUNDS; i++) sbrk(32);
+    unsigned long sbrk_cycles = rdtsc() - start;
+    sbrk(-(long)ROUNDS * 32);
+    if ((char*)sbrk(0) != base) printf("FAIL: sbrk did not shrink back\n");
+
+    start = rdtsc();
+    for (int i = 0; i < ROUNDS; i++) free(malloc(32));
+    unsigned long small_cycles = rdtsc() - start;
+
+    // Mixed sizes with a working set of LIVE blocks, mostly small, some large
+    char* live[LIVE];
+    memset(live, 0, sizeof(live));
+    brk_before = (char*)sbrk(0);
+    start = rdtsc();
+    for (int i = 0; i < ROUNDS; i++) {
+        unsigned int slot = next_rand() % LIVE;
+        free(live[slot]);
+        size_t size = (next_rand() % 8) ? 16 + next_rand() % 500 : 1024 + next_rand() % 16384;
+        live[slot] = (char*)malloc(size);
+        if (live[slot]) live[slot][0] = (char)i;
+    }
+    unsigned long mixed_cycles = rdtsc() - start;
+    growth = (char*)sbrk(0) - brk_before;
+    for (int i = 0; i < LIVE; i++) free(live[i]);
+
+    printf("sbrk per allocation (old): %lu cycles per op\n", sbrk_cycles / ROUNDS);
+    printf("malloc+free, 32 bytes:     %lu cycles per op\n", small_cycles / ROUNDS);
+    printf("mixed working set:         %lu cycles per op, heap grew %ld KB\n", mixed_cycles / ROUNDS, growth / 1024);
+
+    printf("=== TEST_MALLOC Completed ===\n");
+    return 0;
+}
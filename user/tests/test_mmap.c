@@ -0,0 +1,112 @@
+/*
+ * keonOS - user/tests/test_mmap.c
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define PAGE 4096
+
+int main(int argc, char** argv) {
+    printf("=== TEST_MMAP: mmap/munmap/mprotect Test ===\n");
+
+    // 1. Anonymous mappings are zero-filled and private
+    size_t len = 16 * PAGE;
+    char* anon = (char*)mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (anon == MAP_FAILED) {
+        printf("FAIL: anonymous mmap failed\n");
+        return 1;
+    }
+    int zeroed = 1;
+    for (size_t i = 0; i < len; i += PAGE / 2) if (anon[i]) zeroed = 0;
+    if (zeroed) printf("PASS: anonymous pages read as zero.\n");
+    else printf("FAIL: anonymous pages not zeroed.\n");
+
+    anon[0] = 'A';
+    anon[len - 1] = 'Z';
+    if (anon[0] == 'A' && anon[len - 1] == 'Z') printf("PASS: anonymous pages are writable.\n");
+    else printf("FAIL: anonymous write lost.\n");
+
+    // 2. mprotect round trip, then punch a hole and refill it with MAP_FIXED
+    if (mprotect(anon, len, PROT_READ) == 0 && anon[0] == 'A' &&
+        mprotect(anon, len, PROT_READ | PROT_WRITE) == 0) {
+        anon[1] = 'B';
+        printf("PASS: mprotect read-only and back.\n");
+    } else {
+        printf("FAIL: mprotect round trip failed\n");
+    }
+
+    if (munmap(anon + 4 * PAGE, 4 * PAGE) != 0) printf("FAIL: munmap of a middle range failed\n");
+    char* again = (char*)mmap(anon + 4 * PAGE, 4 * PAGE, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (again == anon + 4 * PAGE && again[0] == 0 && anon[0] == 'A' && anon[len - 1] == 'Z')
+        printf("PASS: munmap split the mapping, MAP_FIXED refilled the hole.\n");
+    else
+        printf("FAIL: hole refill returned %p\n", again);
+    munmap(anon, len);
+
+    // 3. File mappings fault their pages in from the file
+    const char* filename = "/test_mmap.txt";
+    int fd = open(filename, O_CREAT | O_WRONLY);
+    if (fd < 0) {
+        printf("FAIL: open(O_CREAT) failed\n");
+        return 1;
+    }
+    static char data[PAGE + 64];
+    for (int i = 0; i < (int)sizeof(data); i++) data[i] = 'a' + (i % 26);
+    write(fd, data, sizeof(data));
+    close(fd);
+
+    fd = open(filename, O_RDONLY);
+    char* view = (char*)mmap(0, sizeof(data), PROT_READ, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED) {
+        printf("FAIL: file mmap failed\n");
+        close(fd);
+        return 1;
+    }
+    if (strncmp(view, data, sizeof(data)) == 0 && view[sizeof(data)] == 0)
+        printf("PASS: file contents visible through the mapping.\n");
+    else
+        printf("FAIL: mapped file contents differ.\n");
+
+    // A private writable view keeps its changes to itself
+    char* priv = (char*)mmap(0, sizeof(data), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (priv != MAP_FAILED) {
+        priv[0] = '#';
+        if (view[0] == 'a' && priv[0] == '#' && priv[PAGE] == data[PAGE])
+            printf("PASS: private file mapping is copy-on-write.\n");
+        else
+            printf("FAIL: private file mapping leaked or lost data.\n");
+        munmap(priv, sizeof(data));
+    } else {
+        printf("FAIL: private file mmap failed\n");
+    }
+
+    munmap(view, sizeof(data));
+    close(fd);
+    unlink(filename);
+
+    printf("=== TEST_MMAP Completed ===\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * keonOS - user/tests/test_oom.c
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PAGE 4096
+#define STEP (1024 * 1024)
+
+int main(int argc, char** argv) {
+    printf("=== TEST_OOM: Memory exhaustion Test ===\n");
+
+    // A bystander that holds almost no memory and must outlive the OOM kill
+    int small = fork();
+    if (small < 0) {
+        printf("FAIL: fork() returned %d\n", small);
+        return 1;
+    }
+    if (small == 0) {
+        for (;;) sleep(1);
+    }
+
+    int pid = fork();
+    if (pid < 0) {
+        printf("FAIL: fork() returned %d\n", pid);
+        kill(small, 9);
+        return 1;
+    }
+
+    if (pid == 0) {
+        // Touch heap pages until the OOM killer steps in; it must pick this
+        // process, the largest one, and nothing else
+        long touched = 0;
+        for (;;) {
+            char* chunk = (char*)sbrk(STEP);
+            if ((long)chunk == -1) {
+                printf("FAIL: sbrk refused after %ld MB instead of an OOM kill\n", touched / STEP);
+                exit(1);
+            }
+            for (long i = 0; i < STEP; i += PAGE) chunk[i] = 1;
+            touched += STEP;
+            if (touched % (64 * STEP) == 0) printf("Child holds %ld MB...\n", touched / STEP);
+        }
+    }
+
+    printf("Forked child %d to exhaust memory next to idle child %d, waiting...\n", pid, small);
+    sleep(5);
+
+    // kill() only succeeds on a process that still exists
+    if (kill(pid, 9) != 0) printf("PASS: the large child was the OOM victim.\n");
+    else printf("FAIL: the large child was still alive after 5 seconds.\n");
+    if (kill(small, 9) == 0) printf("PASS: the small child survived the OOM kill.\n");
+    else printf("FAIL: the small child was killed instead of, or as well as, the large one.\n");
+
+    // The killed child's memory must be usable again
+    char* buf = (char*)malloc(4 * STEP);
+    if (!buf) {
+        printf("FAIL: malloc after the OOM kill failed\n");
+        return 1;
+    }
+    for (long i = 0; i < 4 * STEP; i += PAGE) buf[i] = 'X';
+    if (buf[0] == 'X' && buf[4 * STEP - PAGE] == 'X') printf("PASS: parent survived and can allocate again.\n");
+    else printf("FAIL: parent memory corrupted.\n");
+    free(buf);
+
+    printf("=== TEST_OOM Completed ===\n");
+    return 0;
+}
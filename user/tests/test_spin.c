@@ -0,0 +1,45 @@
+/*
+ * keonOS - user/tests/test_spin.c
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+
+#include <stdlib.h>
+
+#define DEFAULT_MILLIONS 50
+
+/*
+ * CPU-bound worker for the benchscale shell command: a fixed amount of
+ * register-only work with no syscalls or memory traffic, so copies running
+ * at once only compete for CPUs. argv[1] sets the work in millions of rounds.
+ */
+static volatile unsigned long sink;
+
+int main(int argc, char** argv) {
+    long millions = argc > 1 ? strtol(argv[1], 0, 10) : DEFAULT_MILLIONS;
+    if (millions <= 0) millions = DEFAULT_MILLIONS;
+
+    unsigned long x = 88172645463325252UL;
+    for (long i = 0; i < millions * 1000000L; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    sink = x;
+    return 0;
+}
@@ -23,6 +23,15 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+// Each level keeps a 4 KiB frame live so the stack really grows
+static int recurse(int depth) {
+    volatile char frame[4096];
+    frame[0] = (char)depth;
+    frame[sizeof(frame) - 1] = (char)depth;
+    if (depth == 0) return frame[0];
+    return recurse(depth - 1) + frame[sizeof(frame) - 1] - (char)depth;
+}
+
 int main(int argc, char** argv) {
     printf("=== TEST_SYS: System Calls Test ===\n");
 
@@ -60,6 +69,31 @@ int main(int argc, char** argv) {
         printf("PASS: freed memory.\n");
     }
 
+    // 4. Large sbrk reservation: only touched pages get frames
+    long reserve = 256L * 1024 * 1024;
+    printf("Testing sbrk(%ld MB) with sparse touches...\n", reserve / (1024 * 1024));
+    char* base = (char*)sbrk(reserve);
+    if ((long)base == -1) {
+        printf("FAIL: sbrk reservation failed\n");
+    } else {
+        base[0] = 'L';
+        base[reserve / 2] = 'A';
+        base[reserve - 1] = 'Z';
+        if (base[0] == 'L' && base[reserve / 2] == 'A' && base[reserve - 1] == 'Z')
+            printf("PASS: Sparse pages faulted in on demand.\n");
+        else
+            printf("FAIL: Sparse page content corruption.\n");
+
+        sbrk(-reserve);
+        if ((char*)sbrk(0) == base) printf("PASS: sbrk shrink restored the break.\n");
+        else printf("FAIL: break did not return to %p\n", base);
+    }
+
+    // 5. Deep recursion: ~512 KiB of the default 1 MiB stack, faulted in on demand
+    printf("Testing 128 levels of 4 KiB stack frames...\n");
+    if (recurse(128) == 0) printf("PASS: Stack grew on demand.\n");
+    else printf("FAIL: Stack frame corruption.\n");
+
     printf("=== TEST_SYS Completed ===\n");
     return 0;
 }
@@ -0,0 +1,152 @@
+/*
+ * keonOS - user/tests/test_thp.c
+ * Copyright (C) 2025-2026 fmdxp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ADDITIONAL TERMS (Per Section 7 of the GNU GPLv3):
+ * - Original author attributions must be preserved in all copies.
+ * - Modified versions must be marked as different from the original.
+ * - The name "keonOS" or "fmdxp" cannot be used for publicity without permission.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PAGE 4096
+#define HUGE (2 * 1024 * 1024)
+#define AREA (8 * 1024 * 1024)
+#define SMALL_MAP (64 * 1024)
+
+static inline unsigned long rdtsc(void) {
+    unsigned int lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long)hi << 32) | lo;
+}
+
+static char pattern(long offset) {
+    return (char)('a' + (offset / PAGE) % 26);
+}
+
+static int check_pages(char* base, long from, long to, long skip_from, long skip_to) {
+    for (long off = from; off < to; off += PAGE) {
+        if (off >= skip_from && off < skip_to) continue;
+        if (base[off] != pattern(off)) return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    printf("=== TEST_THP: Transparent huge page Test ===\n");
+
+    // 1. A large anonymous mapping is 2 MiB aligned and faults in whole huge pages
+    char* area = (char*)mmap(0, AREA, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) {
+        printf("FAIL: mmap of %d MB failed\n", AREA >> 20);
+        return 1;
+    }
+    if (((unsigned long)area & (HUGE - 1)) == 0) printf("PASS: large mapping is 2 MiB aligned.\n");
+    else printf("FAIL: large mapping at %p is not 2 MiB aligned\n", area);
+
+    struct meminfo before, after;
+    if (meminfo(&before) != 0) {
+        printf("FAIL: meminfo() failed\n");
+        return 1;
+    }
+
+    unsigned long start = rdtsc();
+    for (long off = 0; off < AREA; off += PAGE) area[off] = pattern(off);
+    unsigned long huge_cycles = rdtsc() - start;
+
+    // Every 2 MiB of the area must have been faulted in as one huge page
+    meminfo(&after);
+    long gained = (long)(after.thp_mapped - before.thp_mapped);
+    if (gained >= AREA / HUGE) printf("PASS: %ld huge pages mapped by the faults.\n", gained);
+    else printf("FAIL: only %ld of %d huge pages mapped by the faults\n", gained, AREA / HUGE);
+
+    if (check_pages(area, 0, AREA, 0, 0)) printf("PASS: huge-page backed memory holds its data.\n");
+    else printf("FAIL: data lost in the huge-page area.\n");
+
+    // The same amount of memory spread over areas too small for a huge page
+    int maps = AREA / SMALL_MAP;
+    char** small = (char**)malloc(maps * sizeof(char*));
+    int ok = small != NULL;
+    for (int i = 0; ok && i < maps; i++) {
+        small[i] = (char*)mmap(0, SMALL_MAP, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (small[i] == MAP_FAILED) ok = 0;
+    }
+    if (ok) {
+        start = rdtsc();
+        for (int i = 0; i < maps; i++)
+            for (long off = 0; off < SMALL_MAP; off += PAGE) small[i][off] = 1;
+        unsigned long small_cycles = rdtsc() - start;
+        for (int i = 0; i < maps; i++) munmap(small[i], SMALL_MAP);
+
+        printf("First touch of %d MB: %lu cycles/MB with 4 KiB faults, %lu cycles/MB in huge areas\n",
+               AREA >> 20, small_cycles / (AREA >> 20), huge_cycles / (AREA >> 20));
+    } else {
+        printf("FAIL: could not set up the 4 KiB comparison areas\n");
+    }
+    free(small);
+
+    // 2. Partial munmap splits the huge page and keeps its neighbours
+    long hole = HUGE + 16 * PAGE;
+    meminfo(&before);
+    if (munmap(area + hole, PAGE) == 0 && check_pages(area, 0, AREA, hole, hole + PAGE)) {
+        meminfo(&after);
+        if (after.thp_splits > before.thp_splits && after.thp_mapped < before.thp_mapped)
+            printf("PASS: unmapping one page split the huge page, neighbours intact.\n");
+        else
+            printf("FAIL: partial munmap left the huge page unsplit\n");
+    } else {
+        printf("FAIL: partial munmap of a huge page\n");
+    }
+
+    // 3. Partial mprotect does the same
+    long ro = 2 * HUGE + 8 * PAGE;
+    if (mprotect(area + ro, PAGE, PROT_READ) == 0 && area[ro] == pattern(ro)) {
+        area[ro + PAGE] = pattern(ro + PAGE);
+        area[ro - PAGE] = pattern(ro - PAGE);
+        if (mprotect(area + ro, PAGE, PROT_READ | PROT_WRITE) == 0 && check_pages(area, 0, AREA, hole, hole + PAGE)) {
+            area[ro] = pattern(ro);
+            printf("PASS: read-only page inside a huge page, neighbours writable.\n");
+        } else {
+            printf("FAIL: mprotect back to read-write\n");
+        }
+    } else {
+        printf("FAIL: partial mprotect of a huge page\n");
+    }
+
+    // 4. A child sees the parent's huge pages and its writes stay private
+    int pid = fork();
+    if (pid < 0) {
+        printf("FAIL: fork() returned %d\n", pid);
+    } else if (pid == 0) {
+        int same = check_pages(area, 3 * HUGE, AREA, 0, 0);
+        for (long off = 3 * HUGE; off < AREA; off += PAGE) area[off] = '#';
+        printf("%s: child reads the parent's huge pages.\n", same ? "PASS" : "FAIL");
+        exit(0);
+    } else {
+        sleep(1);
+        if (check_pages(area, 3 * HUGE, AREA, 0, 0)) printf("PASS: child writes did not reach the parent.\n");
+        else printf("FAIL: child writes leaked into the parent.\n");
+    }
+
+    // 5. Releasing whole huge pages
+    if (munmap(area, AREA) == 0) printf("PASS: huge-page area unmapped.\n");
+    else printf("FAIL: munmap of the whole area\n");
+
+    printf("=== TEST_THP Completed ===\n");
+    return 0;
+}